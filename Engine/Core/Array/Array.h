@@ -1,5 +1,6 @@
 #pragma once
 #include <cassert>
+#include <cstring>
 #include <vector>
 #include <cuda_runtime.h>
 #include <memory>
@@ -19,6 +20,8 @@ namespace Physika {
 		Array(const std::shared_ptr<MemoryManager<deviceType>> alloc = std::make_shared<DefaultMemoryManager<deviceType>>())
 			: m_data(NULL)
 			, m_totalNum(0)
+			, m_capacity(0)
+			, m_external(false)
 			, m_alloc(alloc)
 		{
 		};
@@ -26,6 +29,8 @@ namespace Physika {
 		Array(int num, const std::shared_ptr<MemoryManager<deviceType>> alloc = std::make_shared<DefaultMemoryManager<deviceType>>())
 			: m_data(NULL)
 			, m_totalNum(num)
+			, m_capacity(0)
+			, m_external(false)
 			, m_alloc(alloc)
 		{
 			allocMemory();
@@ -38,6 +43,18 @@ namespace Physika {
 
 		void resize(int n);
 
+		/*!
+		*	\brief	Change the number of elements while keeping the first ones, appended elements are cleared to zero.
+		*			Memory is only reallocated, with some headroom, when n exceeds the capacity.
+		*/
+		void setSize(int n);
+
+		/*!
+		*	\brief	Refer to n elements of memory owned elsewhere, e.g., a sub-range of a larger array.
+		*			The memory is never released by this array, and any later resizing moves the data to memory of its own.
+		*/
+		void setExternalData(T* data, int n);
+
 		/*!
 		*	\brief	Clear all data to zero.
 		*/
@@ -54,12 +71,20 @@ namespace Physika {
 
 		void Swap(Array<T, deviceType>& arr)
 		{
-			assert(m_totalNum == arr.Size());
+			assert(m_totalNum == arr.size());
 // 			T* tp = arr.GetDataPtr();
 // 			arr.SetDataPtr(m_data);
 			T* tp = arr.m_data;
 			arr.m_data = m_data;
 			m_data = tp;
+
+			bool ext = arr.m_external;
+			arr.m_external = m_external;
+			m_external = ext;
+
+			int cap = arr.m_capacity;
+			arr.m_capacity = m_capacity;
+			m_capacity = cap;
 		}
 
 		COMM_FUNC inline T& operator [] (unsigned int id)
@@ -73,9 +98,11 @@ namespace Physika {
 		}
 
 		COMM_FUNC inline int size() { return m_totalNum; }
+		COMM_FUNC inline int capacity() { return m_capacity; }
 		COMM_FUNC inline bool isCPU() { return deviceType == DeviceType::CPU; }
 		COMM_FUNC inline bool isGPU() { return deviceType == DeviceType::GPU; }
 		COMM_FUNC inline bool isEmpty() { return m_data == NULL; }
+		COMM_FUNC inline bool isExternal() { return m_external; }
 
 	protected:
 		void allocMemory();
@@ -83,6 +110,8 @@ namespace Physika {
 	private:
 		T* m_data;
 		int m_totalNum;
+		int m_capacity;
+		bool m_external;
 		std::shared_ptr<MemoryManager<deviceType>> m_alloc;
 	};
 
@@ -95,6 +124,51 @@ namespace Physika {
 		allocMemory();
 	}
 
+	template<typename T, DeviceType deviceType>
+	void Array<T, deviceType>::setSize(const int n)
+	{
+		assert(n >= 0);
+		if (n > m_capacity || m_external)
+		{
+			int capacity = n > 2 * m_capacity ? n : 2 * m_capacity;
+			int kept = n < m_totalNum ? n : m_totalNum;
+
+			T* data = NULL;
+			m_alloc->allocMemory1D((void**)&data, capacity, sizeof(T));
+			if (m_data != NULL)
+			{
+				if (deviceType == DeviceType::GPU)
+					cudaMemcpy(data, m_data, kept * sizeof(T), cudaMemcpyDeviceToDevice);
+				else
+					memcpy(data, m_data, kept * sizeof(T));
+
+				if (!m_external)
+					m_alloc->releaseMemory((void**)&m_data);
+			}
+
+			m_data = data;
+			m_capacity = capacity;
+			m_external = false;
+		}
+
+		if (n > m_totalNum)
+		{
+			m_alloc->initMemory((void*)(m_data + m_totalNum), 0, (n - m_totalNum) * sizeof(T));
+		}
+		m_totalNum = n;
+	}
+
+	template<typename T, DeviceType deviceType>
+	void Array<T, deviceType>::setExternalData(T* data, int n)
+	{
+		release();
+
+		m_data = data;
+		m_totalNum = n;
+		m_capacity = n;
+		m_external = true;
+	}
+
 	template<typename T, DeviceType deviceType>
 	void Array<T, deviceType>::release()
 	{
@@ -112,13 +186,15 @@ namespace Physika {
 // 				break;
 // 			}
 // 		}
-		if (m_data != NULL)
+		if (m_data != NULL && !m_external)
 		{
 			m_alloc->releaseMemory((void**)&m_data);
 		}
 		
 		m_data = NULL;
 		m_totalNum = 0;
+		m_capacity = 0;
+		m_external = false;
 	}
 
 	template<typename T, DeviceType deviceType>
@@ -137,6 +213,7 @@ namespace Physika {
 // 		}
 
 		m_alloc->allocMemory1D((void**)&m_data, m_totalNum, sizeof(T));
+		m_capacity = m_totalNum;
 
 		reset();
 	}
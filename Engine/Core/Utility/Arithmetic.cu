@@ -4,16 +4,16 @@
 
 namespace Physika {
 
-	template<typename T>
-	Arithmetic<T>::Arithmetic(int n)
+	template<typename T, typename Acc>
+	Arithmetic<T, Acc>::Arithmetic(int n)
 		: m_reduce(NULL)
 	{
-		m_reduce = Reduction<T>::Create(n);
+		m_reduce = Reduction<T, Acc>::Create(n);
 		m_buf.resize(n);
 	}
 
-	template<typename T>
-	Arithmetic<T>::~Arithmetic()
+	template<typename T, typename Acc>
+	Arithmetic<T, Acc>::~Arithmetic()
 	{
 		if (m_reduce != NULL)
 		{
@@ -23,14 +23,14 @@ namespace Physika {
 	}
 
 
-	template<typename T>
-	Arithmetic<T>* Arithmetic<T>::Create(int n)
+	template<typename T, typename Acc>
+	Arithmetic<T, Acc>* Arithmetic<T, Acc>::Create(int n)
 	{
-		return new Arithmetic<T>(n);
+		return new Arithmetic<T, Acc>(n);
 	}
 
-	template<typename T>
-	T Arithmetic<T>::Dot(DeviceArray<T>& xArr, DeviceArray<T>& yArr)
+	template<typename T, typename Acc>
+	Acc Arithmetic<T, Acc>::Dot(DeviceArray<T>& xArr, DeviceArray<T>& yArr)
 	{
 		Function2Pt::multiply(m_buf, xArr, yArr);
 		return m_reduce->Accumulate(m_buf.getDataPtr(), m_buf.size());
@@ -4,7 +4,11 @@
 
 namespace Physika {
 
-	template<typename T>
+	/*!
+	*	\class	Arithmetic
+	*	\brief	Array arithmetic with results accumulated in Acc, see Reduction.
+	*/
+	template<typename T, typename Acc = T>
 	class Arithmetic
 	{
 	public:
@@ -15,17 +19,18 @@ namespace Physika {
 		
 
 		//
-		T Dot(DeviceArray<T>& xArr, DeviceArray<T>& yArr);
+		Acc Dot(DeviceArray<T>& xArr, DeviceArray<T>& yArr);
 		
 		~Arithmetic();
 	private:
 		Arithmetic(int n);
 
-		Reduction<T>* m_reduce;
+		Reduction<T, Acc>* m_reduce;
 		DeviceArray<T> m_buf;
 	};
 
 	template class Arithmetic<int>;
 	template class Arithmetic<float>;
 	template class Arithmetic<double>;
+	template class Arithmetic<float, double>;
 }
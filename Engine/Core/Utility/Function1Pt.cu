@@ -22,5 +22,39 @@ namespace Physika
 		}
 
 		template void Length(DeviceArray<float>&, DeviceArray<float3>&);
+
+		/*!
+		*	\brief	One thread per word of the result, so consecutive threads copy consecutive words of an element.
+		*/
+		template<typename Word>
+		__global__ void KerGather(Word* dst, Word* src, int* index, int num, int words)
+		{
+			int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+			if (tId >= num*words) return;
+
+			int i = tId / words;
+			int w = tId - i*words;
+
+			dst[tId] = src[index[i] * words + w];
+		}
+
+		void gather(void* dst, void* src, int* index, int num, size_t elemSize)
+		{
+			if (num <= 0) return;
+
+			if (elemSize % sizeof(int) == 0)
+			{
+				int words = elemSize / sizeof(int);
+				unsigned pDim = cudaGridSize(num*words, BLOCK_SIZE);
+				KerGather << <pDim, BLOCK_SIZE >> > ((int*)dst, (int*)src, index, num, words);
+			}
+			else
+			{
+				int words = elemSize;
+				unsigned pDim = cudaGridSize(num*words, BLOCK_SIZE);
+				KerGather << <pDim, BLOCK_SIZE >> > ((char*)dst, (char*)src, index, num, words);
+			}
+			cuSynchronize();
+		}
 	}
 }
\ No newline at end of file
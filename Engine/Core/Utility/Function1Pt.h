@@ -63,6 +63,19 @@ namespace Physika
 		template<typename T1, typename T2>
 		void Length(DeviceArray<T1>& lhs, DeviceArray<T2>& rhs);
 
+		/*!
+		*	\brief	dst[i] = src[index[i]] for the first num entries of index, on device memory with elements of elemSize bytes.
+		*			It is untyped so that fields can call it from headers compiled by the host compiler.
+		*/
+		void gather(void* dst, void* src, int* index, int num, size_t elemSize);
+
+		template<typename T>
+		void gather(DeviceArray<T>& dst, DeviceArray<T>& src, DeviceArray<int>& index, int num)
+		{
+			assert(dst.size() >= num && index.size() >= num);
+			gather((void*)dst.getDataPtr(), (void*)src.getDataPtr(), index.getDataPtr(), num, sizeof(T));
+		}
+
 
 	}
 }
@@ -14,6 +14,8 @@ namespace Physika {
 
 	GTimer::~GTimer()
 	{
+		cudaEventDestroy(m_start);
+		cudaEventDestroy(m_stop);
 	}
 
 	void GTimer::start()
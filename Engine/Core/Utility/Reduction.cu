@@ -8,25 +8,25 @@
 
 namespace Physika {
 
-	template<typename T>
-	Reduction<T>::Reduction(unsigned num)
+	template<typename T, typename Acc>
+	Reduction<T, Acc>::Reduction(unsigned num)
 		: m_num(num)
 		, m_aux(NULL)
 	{
 		m_auxNum = GetAuxiliaryArraySize(num);
-		cudaMalloc((void**)&m_aux, m_auxNum * sizeof(T));
+		cudaMalloc((void**)&m_aux, m_auxNum * sizeof(Acc));
 	}
 
-	template<typename T>
-	Reduction<T>::~Reduction()
+	template<typename T, typename Acc>
+	Reduction<T, Acc>::~Reduction()
 	{
 		cudaFree(m_aux);
 	}
 
-	template<typename T>
-	Reduction<T>* Reduction<T>::Create(int n)
+	template<typename T, typename Acc>
+	Reduction<T, Acc>* Reduction<T, Acc>::Create(int n)
 	{
-		return new Reduction<T>(n);
+		return new Reduction<T, Acc>(n);
 	}
 
 	/*!
@@ -49,81 +49,88 @@ namespace Physika {
 	*	\brief	Accumulates the sum of n values of array pData[], 
 	*	storing the result in the beginning of res[].
 	*	(Many positions of res[] are used as blocks, storing the final result in res[0]).
+	*	The values are converted to the accumulation type Acc when loaded.
 	*/
 	template <typename T, 
+			  typename Acc,
 			  unsigned blockSize,
 			  typename Function>
-	__global__ void KerReduce(const T *pData, unsigned n, T *pAux, Function func, T val)
+	__global__ void KerReduce(const T *pData, unsigned n, Acc *pAux, Function func, Acc val)
 	{
 		//extern __shared__ T sharedMem[];
 
-		SharedMemory<T> smem;
-		T* sharedMem = smem.getPointer();
+		SharedMemory<Acc> smem;
+		Acc* sharedMem = smem.getPointer();
 
 		unsigned tid = threadIdx.x;
 		unsigned id = blockIdx.x*blockDim.x + threadIdx.x;
-		sharedMem[tid] = (id < n ? pData[id] : val);
+		sharedMem[tid] = (id < n ? Acc(pData[id]) : val);
 		__syncthreads();
 		if (blockSize >= 512) { if (tid < 256)sharedMem[tid] = func(sharedMem[tid], sharedMem[tid + 256]);  __syncthreads(); }
 		if (blockSize >= 256) { if (tid < 128)sharedMem[tid] = func(sharedMem[tid], sharedMem[tid + 128]);  __syncthreads(); }
 		if (blockSize >= 128) { if (tid < 64) sharedMem[tid] = func(sharedMem[tid], sharedMem[tid + 64]);   __syncthreads(); }
-		if (tid < 32)KerReduceWarp<T, blockSize>(sharedMem, tid, func);
+		if (tid < 32)KerReduceWarp<Acc, blockSize>(sharedMem, tid, func);
 		if (tid == 0)pAux[blockIdx.x] = sharedMem[0];
 	}
 
-	template<typename T, typename Function>
-	T Reduce(T* pData, unsigned num, T* pAux, Function func, T v0)
+	template<typename T, typename Acc, typename Function>
+	Acc Reduce(T* pData, unsigned num, Acc* pAux, Function func, Acc v0)
 	{
+		if (num == 0)
+			return v0;
+
 		unsigned n = num;
-		unsigned sharedMemSize = REDUCTION_BLOCK * sizeof(T);
+		unsigned sharedMemSize = REDUCTION_BLOCK * sizeof(Acc);
 		unsigned blockNum = cudaGridSize(num, REDUCTION_BLOCK);
-		T* subData = pData;
-		T* aux1 = pAux;
-		T* aux2 = pAux + blockNum;
-		T* subAux = aux1;
+		Acc* aux1 = pAux;
+		Acc* aux2 = pAux + blockNum;
+
+		//The first pass reads the input, later passes reduce the partial results in Acc
+		KerReduce<T, Acc, REDUCTION_BLOCK, Function> << <blockNum, REDUCTION_BLOCK, sharedMemSize >> > (pData, n, aux1, func, v0);
+		n = blockNum;
+		blockNum = cudaGridSize(n, REDUCTION_BLOCK);
+
+		Acc* subData = aux1;
+		Acc* subAux = aux2;
 		while (n > 1) {
-			KerReduce<T, REDUCTION_BLOCK, Function> << <blockNum, REDUCTION_BLOCK, sharedMemSize >> > (subData, n, subAux, func, v0);
+			KerReduce<Acc, Acc, REDUCTION_BLOCK, Function> << <blockNum, REDUCTION_BLOCK, sharedMemSize >> > (subData, n, subAux, func, v0);
 			n = blockNum; 
 			blockNum = cudaGridSize(n, REDUCTION_BLOCK);
-			if (n > 1) {
-				subData = subAux; subAux = (subData == aux1 ? aux2 : aux1);
-			}
+
+			Acc* tmp = subData; subData = subAux; subAux = tmp;
 		}
 
-		T val;
-		if (num > 1)
-			cudaMemcpy(&val, subAux, sizeof(T), cudaMemcpyDeviceToHost);
-		else 
-			cudaMemcpy(&val, pData, sizeof(T), cudaMemcpyDeviceToHost);
+		Acc val;
+		cudaMemcpy(&val, subData, sizeof(Acc), cudaMemcpyDeviceToHost);
 
 		return val;
 	}
 
-	template<typename T>
-	T Physika::Reduction<T>::Accumulate(T* val, int num)
+	template<typename T, typename Acc>
+	Acc Physika::Reduction<T, Acc>::Accumulate(T* val, int num)
 	{
 		assert(num == m_num);
-		return Reduce(val, num, m_aux, PlusFunc<T>(), (T)0);
+		return Reduce(val, num, m_aux, PlusFunc<Acc>(), (Acc)0);
 	}
 
-	template<typename T>
-	T Physika::Reduction<T>::Maximum(T* val, int num)
+	template<typename T, typename Acc>
+	Acc Physika::Reduction<T, Acc>::Maximum(T* val, int num)
 	{
 		assert(num == m_num);
-		return Reduce(val, num, m_aux, MaximumFunc<T>(), (T)-FLT_MAX);
+		return Reduce(val, num, m_aux, MaximumFunc<Acc>(), (Acc)-FLT_MAX);
 	}
 
-	template<typename T>
-	T Physika::Reduction<T>::Minimum(T* val, int num)
+	template<typename T, typename Acc>
+	Acc Physika::Reduction<T, Acc>::Minimum(T* val, int num)
 	{
 		assert(num == m_num);
-		return Reduce(val, num, m_aux, MinimumFunc<T>(), (T)FLT_MAX);
+		return Reduce(val, num, m_aux, MinimumFunc<Acc>(), (Acc)FLT_MAX);
 	}
 
-	template<typename T>
-	T Physika::Reduction<T>::Average(T* val, int num)
+	template<typename T, typename Acc>
+	Acc Physika::Reduction<T, Acc>::Average(T* val, int num)
 	{
 		assert(num == m_num);
-		return Reduce(val, num, m_aux, PlusFunc<T>(), (T)0) / num;
+		return Reduce(val, num, m_aux, PlusFunc<Acc>(), (Acc)0) / num;
 	}
 }
\ No newline at end of file
@@ -3,20 +3,28 @@ namespace Physika {
 
 #define REDUCTION_BLOCK 128
 
-	template<typename T>
+	/*!
+	*	\class	Reduction
+	*	\brief	Device reductions over arrays of T. Partial results are kept in Acc, e.g., Reduction<float, double>
+	*			sums float data with double accumulation.
+	*
+	*	Values are combined along a fixed tree of REDUCTION_BLOCK wide blocks without atomics,
+	*	so the result for the same input is the same on every run.
+	*/
+	template<typename T, typename Acc = T>
 	class Reduction
 	{
 	public:
 		static Reduction* Create(int n);
 		~Reduction();
 
-		T Accumulate(T * val, int num);
+		Acc Accumulate(T * val, int num);
 
-		T Maximum(T* val, int num);
+		Acc Maximum(T* val, int num);
 
-		T Minimum(T* val, int num);
+		Acc Minimum(T* val, int num);
 
-		T Average(T* val, int num);
+		Acc Average(T* val, int num);
 
 	private:
 		Reduction(unsigned num);
@@ -25,11 +33,12 @@ namespace Physika {
 		
 		unsigned m_num;
 		
-		T* m_aux;
+		Acc* m_aux;
 		int m_auxNum;
 	};
 
 	template class Reduction<int>;
 	template class Reduction<float>;
 	template class Reduction<double>;
+	template class Reduction<float, double>;
 }
@@ -0,0 +1,153 @@
+#pragma once
+#include <cuda_runtime.h>
+#include "Core/Platform.h"
+#include "Core/Array/Array.h"
+#include "Core/Utility/Reduction.h"
+
+/*
+*  This file implements a device-side maximum (and sum) that update kernels can fold their residual into,
+*  so no separate reduction pass over the particle arrays is needed. Include from .cu files only.
+*/
+namespace Physika
+{
+	/*!
+	*	\brief	Atomic maximum on the bit patterns, valid since only non-negative values are folded in
+	*			and the initial value is negative.
+	*/
+	__device__ inline void RS_AtomicMax(float* address, float val)
+	{
+		atomicMax((int*)address, __float_as_int(val));
+	}
+
+	__device__ inline void RS_AtomicMax(double* address, double val)
+	{
+#if __CUDA_ARCH__ >= 350
+		atomicMax((long long int*)address, __double_as_longlong(val));
+#else
+		//64-bit atomicMax is not available before sm_35
+		unsigned long long int* ptr = (unsigned long long int*)address;
+		unsigned long long int old = *ptr;
+		unsigned long long int assumed;
+		do
+		{
+			assumed = old;
+			if (__longlong_as_double(assumed) >= val)
+				break;
+			old = atomicCAS(ptr, assumed, __double_as_longlong(val));
+		} while (assumed != old);
+#endif
+	}
+
+	__device__ inline void RS_AtomicAdd(float* address, float val)
+	{
+		atomicAdd(address, val);
+	}
+
+	__device__ inline void RS_AtomicAdd(double* address, double val)
+	{
+#if __CUDA_ARCH__ >= 600
+		atomicAdd(address, val);
+#else
+		//double atomicAdd is not available before sm_60
+		unsigned long long int* ptr = (unsigned long long int*)address;
+		unsigned long long int old = *ptr;
+		unsigned long long int assumed;
+		do
+		{
+			assumed = old;
+			old = atomicCAS(ptr, assumed, __double_as_longlong(val + __longlong_as_double(assumed)));
+		} while (assumed != old);
+#endif
+	}
+
+	/*!
+	*	\brief	Fold a non-negative value into the residual. Must be reached by all threads of a warp,
+	*			i.e., kernels calling it should not return early for out-of-range threads.
+	*/
+	template<typename Real>
+	__device__ inline void RS_WarpMax(Real* residual, Real val)
+	{
+		for (int offset = 16; offset > 0; offset >>= 1)
+		{
+			Real other = __shfl_down_sync(0xffffffff, val, offset);
+			val = other > val ? other : val;
+		}
+
+		if ((threadIdx.x & 31) == 0)
+			RS_AtomicMax(residual, val);
+	}
+
+	/*!
+	*	\brief	Fold a value into a device sum, with the same requirement on the warp as RS_WarpMax.
+	*/
+	template<typename Real>
+	__device__ inline void RS_WarpSum(Real* sum, Real val)
+	{
+		for (int offset = 16; offset > 0; offset >>= 1)
+		{
+			val += __shfl_down_sync(0xffffffff, val, offset);
+		}
+
+		if ((threadIdx.x & 31) == 0)
+			RS_AtomicAdd(sum, val);
+	}
+
+	/*!
+	*	\brief	Same as above, but stores the value of thread pId in terms instead when terms is not empty,
+	*			to be summed in a fixed order by RS_SumTerms(), see SceneGraph::isDeterministic().
+	*/
+	template<typename Real>
+	__device__ inline void RS_WarpSum(Real* sum, DeviceArray<Real>& terms, int pId, Real val)
+	{
+		if (terms.size() > 0)
+		{
+			if (pId < terms.size())
+				terms[pId] = val;
+		}
+		else
+		{
+			RS_WarpSum(sum, val);
+		}
+	}
+
+	/*!
+	*	\brief	Write the sum of the terms stored by RS_WarpSum() to the device value sum, reduce must be created for terms.size().
+	*/
+	template<typename Real>
+	inline void RS_SumTerms(Real* sum, DeviceArray<Real>& terms, Reduction<Real>* reduce)
+	{
+		Real val = reduce->Accumulate(terms.getDataPtr(), terms.size());
+		cudaMemcpy(sum, &val, sizeof(Real), cudaMemcpyHostToDevice);
+	}
+
+	/*!
+	*	\class	ResidualMax
+	*	\brief	A single device value holding the maximum residual of an iteration, read back with one 4/8-byte copy.
+	*			A negative value means no kernel has reported a residual since the last reset.
+	*/
+	template<typename Real>
+	class ResidualMax
+	{
+	public:
+		ResidualMax() { m_value.resize(1); reset(); }
+		~ResidualMax() { m_value.release(); }
+
+		void reset()
+		{
+			Real init = Real(-1);
+			cudaMemcpy(m_value.getDataPtr(), &init, sizeof(Real), cudaMemcpyHostToDevice);
+		}
+
+		Real getValue()
+		{
+			Real val;
+			cudaMemcpy(&val, m_value.getDataPtr(), sizeof(Real), cudaMemcpyDeviceToHost);
+			return val;
+		}
+
+		Real* getDataPtr() { return m_value.getDataPtr(); }
+
+	private:
+		DeviceArray<Real> m_value;
+	};
+}
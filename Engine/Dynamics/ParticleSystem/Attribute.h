@@ -17,11 +17,14 @@ namespace Physika
 		{
 			MATERIAL_MASK = 0xC0000000,
 			MATERIAL_FLUID = 0x00000000,
-			MATERIAL_RIGID = 0xA0000000,
-			MATERIAL_ELASTIC = 0xB0000000,
+			MATERIAL_RIGID = 0x40000000,
+			MATERIAL_ELASTIC = 0x80000000,
 			MATERIAL_PLASTIC = 0xC0000000
 		};
 
+		/// Number of materials, the material index of a tag is its two most significant bits
+		enum { MATERIAL_NUM = 4 };
+
 		enum KinematicType
 		{
 			KINEMATIC_MASK = 0x30000000,
@@ -41,7 +44,8 @@ namespace Physika
 
 		COMM_FUNC inline MaterialType GetMaterialType() { return (MaterialType)(m_tag&MATERIAL_MASK); }
 		COMM_FUNC inline KinematicType GetKinematicType() { return (KinematicType)(m_tag&KINEMATIC_MASK); }
-		COMM_FUNC inline unsigned GetObjectId() { (unsigned)(m_tag&OBJECTID_MASK); }
+		COMM_FUNC inline unsigned GetObjectId() { return (unsigned)(m_tag&OBJECTID_MASK); }
+		COMM_FUNC inline unsigned GetMaterialIndex() { return (m_tag&MATERIAL_MASK) >> 30; }
 
 		COMM_FUNC inline bool IsFluid() { return MaterialType::MATERIAL_FLUID == GetMaterialType(); }
 		COMM_FUNC inline bool IsRigid() { return MaterialType::MATERIAL_RIGID == GetMaterialType(); }
@@ -84,6 +84,10 @@ namespace Physika
 	template<typename TDataType>
 	bool BoundaryConstraint<TDataType>::constrain(DeviceArray<Coord>& position, DeviceArray<Coord>& velocity, Real dt)
 	{
+		//Sinks may have drained all particles
+		if (position.size() == 0)
+			return true;
+
 		cuint pDim = cudaGridSize(position.size(), BLOCK_SIZE);
 		K_ConstrainSDF << <pDim, BLOCK_SIZE >> > (
 			position,
@@ -0,0 +1,273 @@
+#include <cuda_runtime.h>
+#include <cmath>
+#include <algorithm>
+#include "BoundaryParticles.h"
+#include "Kernel.h"
+#include "Core/Utility.h"
+
+namespace Physika
+{
+	IMPLEMENT_CLASS_1(BoundaryParticles, TDataType)
+
+	/*!
+	*	\brief	The volume of a sample is the inverse of its number density among the samples, itself included.
+	*/
+	template<typename Real, typename Coord, typename TKernel>
+	__global__ void BP_ComputeVolume(
+		DeviceArray<Real> volume,
+		DeviceArray<Coord> posArr,
+		NeighborList<int> neighbors,
+		TKernel kern)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		Coord pos_i = posArr[pId];
+
+		Real sum = Real(0);
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			sum += kern.Weight((pos_i - posArr[j]).norm());
+		}
+
+		volume[pId] = sum > EPSILON ? Real(1) / sum : Real(0);
+	}
+
+	template<typename TDataType>
+	BoundaryParticles<TDataType>::BoundaryParticles(std::string name)
+		: Module(name)
+		, m_samplingDistance(Real(0.005))
+		, m_smoothingLength(Real(0.0125))
+	{
+	}
+
+	template<typename TDataType>
+	BoundaryParticles<TDataType>::~BoundaryParticles()
+	{
+		m_position.release();
+		m_volume.release();
+		m_neighbors.release();
+	}
+
+	template<typename TDataType>
+	void BoundaryParticles<TDataType>::sampleBox(Coord lo, Coord hi)
+	{
+		Real d = m_samplingDistance;
+
+		int n[3] = { 1, 1, 1 };
+		int total = 1;
+		for (int k = 0; k < Coord::dims(); k++)
+		{
+			n[k] = std::max(2, (int)std::round((hi[k] - lo[k]) / d) + 1);
+			total *= n[k];
+		}
+
+		//Only the grid points on the faces are kept
+		for (int id = 0; id < total; id++)
+		{
+			int rest = id;
+			bool onFace = false;
+			Coord p = lo;
+			for (int k = 0; k < Coord::dims(); k++)
+			{
+				int i = rest % n[k];
+				rest /= n[k];
+
+				p[k] = lo[k] + i*(hi[k] - lo[k]) / (n[k] - 1);
+				onFace = onFace || i == 0 || i == n[k] - 1;
+			}
+
+			if (onFace)
+			{
+				m_samples.push_back(p);
+			}
+		}
+	}
+
+	template<typename TDataType>
+	void BoundaryParticles<TDataType>::sampleSphere(Coord center, Real r)
+	{
+		Real d = m_samplingDistance;
+
+		int n[3] = { 1, 1, 1 };
+		int total = 1;
+		for (int k = 0; k < Coord::dims(); k++)
+		{
+			n[k] = (int)std::ceil(2 * (r + d) / d) + 1;
+			total *= n[k];
+		}
+
+		//A shell of grid points one sampling distance thick, the volumes make up for the uneven spacing
+		for (int id = 0; id < total; id++)
+		{
+			int rest = id;
+			Coord p = center;
+			for (int k = 0; k < Coord::dims(); k++)
+			{
+				p[k] = center[k] - r - d + (rest % n[k])*d;
+				rest /= n[k];
+			}
+
+			if (std::abs((p - center).norm() - r) < Real(0.5)*d)
+			{
+				m_samples.push_back(p);
+			}
+		}
+	}
+
+	template<typename TDataType>
+	void BoundaryParticles<TDataType>::addSamples(std::vector<Coord>& pos)
+	{
+		m_samples.insert(m_samples.end(), pos.begin(), pos.end());
+	}
+
+	template<typename TDataType>
+	bool BoundaryParticles<TDataType>::initializeImpl()
+	{
+		int num = m_samples.size();
+		if (num <= 0)
+		{
+			std::cout << "Exception: " << std::string("BoundaryParticles has no samples!") << "\n";
+			return false;
+		}
+
+		m_position.resize(num);
+		Function1Pt::copy(m_position, m_samples);
+
+		m_volume.resize(num);
+
+		//A tree loaded by read() comes with its volumes
+		if (m_tree.size() == num && m_loadedVolume.size() == num)
+		{
+			Function1Pt::copy(m_volume, m_loadedVolume);
+			m_loadedVolume.clear();
+			return true;
+		}
+
+		m_tree.construct(m_samples);
+
+		NeighborList<int> selfNeighbors;
+		m_tree.queryRadius(selfNeighbors, m_position, m_smoothingLength);
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+		BP_ComputeVolume <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+			m_volume,
+			m_position,
+			selfNeighbors,
+			SpikyKernel<Real>(m_smoothingLength));
+		cuSynchronize();
+
+		selfNeighbors.release();
+
+		return true;
+	}
+
+	template<typename TDataType>
+	void BoundaryParticles<TDataType>::updatePositions(DeviceArray<Coord>& pos)
+	{
+		if (!this->isInitialized() || pos.size() != getSampleNumber())
+			return;
+
+		Function1Pt::copy(m_position, pos);
+		m_tree.construct(m_position);
+	}
+
+	template<typename TDataType>
+	void BoundaryParticles<TDataType>::queryNeighbors(DeviceArray<Coord>& pos)
+	{
+		if (!this->initialize())
+			return;
+
+		m_tree.queryRadius(m_neighbors, pos, m_smoothingLength);
+	}
+
+	template<typename TDataType>
+	BoundaryContribution<typename TDataType::Real, typename TDataType::Coord> BoundaryParticles<TDataType>::getContribution(Real restDensity, Real mass)
+	{
+		BoundaryContribution<Real, Coord> contribution;
+		contribution.valid = this->isInitialized() && m_neighbors.size() > 0;
+		contribution.restDensity = restDensity;
+		contribution.invMass = mass > EPSILON ? Real(1) / mass : Real(0);
+
+		if (contribution.valid)
+		{
+			contribution.neighbors = m_neighbors;
+			contribution.position = m_position;
+			contribution.volume = m_volume;
+		}
+
+		return contribution;
+	}
+
+	template<typename TDataType>
+	DeviceArray<typename TDataType::Coord>& BoundaryParticles<TDataType>::getPositions()
+	{
+		return m_position;
+	}
+
+	template<typename TDataType>
+	int BoundaryParticles<TDataType>::getSampleNumber()
+	{
+		return m_position.size();
+	}
+
+	template<typename TDataType>
+	bool BoundaryParticles<TDataType>::write(std::ostream& out)
+	{
+		if (!this->isInitialized())
+			return false;
+
+		int num = m_position.size();
+		std::vector<Coord> hPos(num);
+		std::vector<Real> hVolume(num);
+		cudaMemcpy(hPos.data(), m_position.getDataPtr(), num * sizeof(Coord), cudaMemcpyDeviceToHost);
+		cudaMemcpy(hVolume.data(), m_volume.getDataPtr(), num * sizeof(Real), cudaMemcpyDeviceToHost);
+
+		Real h = m_smoothingLength;
+		out.write((const char*)&num, sizeof(int));
+		out.write((const char*)&h, sizeof(Real));
+		out.write((const char*)hPos.data(), num * sizeof(Coord));
+		out.write((const char*)hVolume.data(), num * sizeof(Real));
+
+		return out.good() && m_tree.write(out);
+	}
+
+	template<typename TDataType>
+	bool BoundaryParticles<TDataType>::read(std::istream& in)
+	{
+		if (this->isInitialized())
+		{
+			std::cout << "Exception: " << std::string("BoundaryParticles: samples can only be read before initialization!") << "\n";
+			return false;
+		}
+
+		int num = 0;
+		Real h = 0;
+		in.read((char*)&num, sizeof(int));
+		in.read((char*)&h, sizeof(Real));
+		if (!in.good() || num <= 0)
+		{
+			std::cout << "Exception: " << std::string("BoundaryParticles: invalid sample data!") << "\n";
+			return false;
+		}
+
+		std::vector<Coord> samples(num);
+		std::vector<Real> volume(num);
+		in.read((char*)samples.data(), num * sizeof(Coord));
+		in.read((char*)volume.data(), num * sizeof(Real));
+		if (!in.good() || !m_tree.read(in) || m_tree.size() != num)
+		{
+			std::cout << "Exception: " << std::string("BoundaryParticles: truncated sample data!") << "\n";
+			m_tree.release();
+			return false;
+		}
+
+		m_samples = samples;
+		m_loadedVolume = volume;
+		m_smoothingLength = h;
+
+		return true;
+	}
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <vector>
+#include <iostream>
+#include "Framework/Framework/Module.h"
+#include "Framework/Topology/NeighborList.h"
+#include "Framework/Topology/StaticKdTree.h"
+#include "Core/Array/Array.h"
+
+namespace Physika
+{
+
+	/*!
+	*	\struct	BoundaryContribution
+	*	\brief	Read-only view of the boundary particles near each fluid particle, passed by value to the CUDA kernels.
+	*
+	*	A boundary particle b contributes psi_b = rho_0 * V_b to the density of its fluid neighbors, see Akinci et al.,
+	*	"Versatile Rigid-Fluid Coupling for Incompressible SPH". Gradients are divided by the fluid particle mass so that
+	*	they are comparable to the mass-free gradients of the fluid neighbors in the position-based solvers.
+	*/
+	template<typename Real, typename Coord>
+	struct BoundaryContribution
+	{
+		NeighborList<int> neighbors;
+		DeviceArray<Coord> position;
+		DeviceArray<Real> volume;
+		Real restDensity;
+		Real invMass;
+		bool valid;
+
+		/*!
+		*	\brief	Add the density contributed by the boundary neighbors of particle i to rho,
+		*			and the gradient of its density with respect to pos_i to grad.
+		*/
+		template<typename TKernel>
+		GPU_FUNC void accumulate(int i, Coord pos_i, TKernel& kern, Real& rho, Coord& grad)
+		{
+			if (!valid) return;
+
+			int nbSize = neighbors.getNeighborSize(i);
+			for (int ne = 0; ne < nbSize; ne++)
+			{
+				int b = neighbors.getElement(i, ne);
+				Coord x_ib = pos_i - position[b];
+				Real r = x_ib.norm();
+				Real psi = restDensity*volume[b];
+
+				rho += psi*kern.Weight(r);
+				if (r > EPSILON)
+				{
+					grad += psi*invMass*kern.Gradient(r)*x_ib*(Real(1) / r);
+				}
+			}
+		}
+	};
+
+	/*!
+	*	\class	BoundaryParticles
+	*	\brief	Samples walls and rigid geometry with particles of precomputed volumes, read as neighbors by the density solvers.
+	*
+	*	The volume of each sample is the inverse of the kernel sum over the other samples, so unevenly sampled geometry
+	*	still contributes the density of a uniformly filled boundary. The samples are put into a static kd-tree once on initialization,
+	*	afterwards only the fluid particles are queried against this tree each step. Densely sampled geometry can be
+	*	saved with write() and loaded with read() before initialization to skip both the tree construction and the volumes.
+	*/
+	template<typename TDataType>
+	class BoundaryParticles : public Module
+	{
+		DECLARE_CLASS_1(BoundaryParticles, TDataType)
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+
+		BoundaryParticles(std::string name = "boundary_particles");
+		~BoundaryParticles() override;
+
+		void setSamplingDistance(Real d) { m_samplingDistance = d; }
+		void setSmoothingLength(Real h) { m_smoothingLength = h; }
+
+		/// Sample the faces of a box, both for a container and an obstacle
+		void sampleBox(Coord lo, Coord hi);
+		void sampleSphere(Coord center, Real r);
+		/// Add samples of arbitrary geometry, e.g., the surface points of a rigid body
+		void addSamples(std::vector<Coord>& pos);
+
+		/*!
+		*	\brief	Move the samples of a rigid geometry to new positions, the volumes are kept.
+		*
+		*	The kd-tree is rebuilt on the host, which suits geometry that is repositioned occasionally rather than every step.
+		*/
+		void updatePositions(DeviceArray<Coord>& pos);
+
+		/*!
+		*	\brief	Find the boundary neighbors of the given particles, needs to be called whenever they have moved.
+		*/
+		void queryNeighbors(DeviceArray<Coord>& pos);
+
+		/*!
+		*	\brief	The contribution to particles of the given rest density and mass, based on the last queryNeighbors().
+		*/
+		BoundaryContribution<Real, Coord> getContribution(Real restDensity, Real mass);
+
+		DeviceArray<Coord>& getPositions();
+		DeviceArray<Real>& getVolumes() { return m_volume; }
+		NeighborList<int>& getNeighbors() { return m_neighbors; }
+
+		int getSampleNumber();
+
+		/*!
+		*	\brief	Binary serialization of the samples, their volumes and the kd-tree, only valid after initialization.
+		*/
+		bool write(std::ostream& out);
+		/*!
+		*	\brief	Replace the samples by the ones written by write(), must be called before initialization.
+		*/
+		bool read(std::istream& in);
+
+	protected:
+		bool initializeImpl() override;
+
+	private:
+		Real m_samplingDistance;
+		Real m_smoothingLength;
+
+		std::vector<Coord> m_samples;
+
+		/// Volumes loaded by read(), uploaded on initialization instead of being computed
+		std::vector<Real> m_loadedVolume;
+
+		DeviceArray<Coord> m_position;
+		DeviceArray<Real> m_volume;
+
+		/// Boundary neighbors of the particles passed to the last queryNeighbors()
+		NeighborList<int> m_neighbors;
+
+		StaticKdTree<TDataType> m_tree;
+	};
+
+#ifdef PRECISION_FLOAT
+	template class BoundaryParticles<DataType3f>;
+#else
+	template class BoundaryParticles<DataType3d>;
+#endif
+}
@@ -7,112 +7,149 @@
 #include "Kernel.h"
 #include "DensitySummation.h"
 #include "Framework/Topology/FieldNeighbor.h"
+#include "Framework/Topology/GraphColoring.h"
+#include "Framework/Topology/NeighborScatter.h"
+#include "Framework/Framework/SceneGraph.h"
+#include "Core/Utility/ResidualMax.h"
+#include "BoundaryParticles.h"
 
 namespace Physika
 {
 	IMPLEMENT_CLASS_1(DensityPBD, TDataType)
 
-	template <typename Real, typename Coord>
+	/*!
+	*	\brief	Also folds the maximum relative compression into residual when it is not null.
+	*/
+	template <typename Real, typename Coord, typename TKernel>
 	__global__ void K_ComputeLambdas(
 		DeviceArray<Real> lambdaArr,
 		DeviceArray<Real> rhoArr,
 		DeviceArray<Coord> posArr,
 		NeighborList<int> neighbors,
-		Real smoothingLength)
+		BoundaryContribution<Real, Coord> boundary,
+		TKernel kern,
+		Real restDensity,
+		Real* residual,
+		int offset,
+		int num)
 	{
-		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= posArr.size()) return;
-
-		Coord pos_i = posArr[pId];
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
 
-		SpikyKernel<Real> kern;
-
-		Real lamda_i = Real(0);
-		Coord grad_ci(0);
-
-		int nbSize = neighbors.getNeighborSize(pId);
-		for (int ne = 0; ne < nbSize; ne++)
+		Real err_i = Real(0);
+		if (pId < offset + num)
 		{
-			int j = neighbors.getElement(pId, ne);
-			Real r = (pos_i - posArr[j]).norm();
+			Coord pos_i = posArr[pId];
 
-			if (r > EPSILON)
+			Real lamda_i = Real(0);
+			Coord grad_ci(0);
+
+			int nbSize = neighbors.getNeighborSize(pId);
+			for (int ne = 0; ne < nbSize; ne++)
 			{
-				Coord g = kern.Gradient(r, smoothingLength)*(pos_i - posArr[j]) * (1.0f / r);
-				grad_ci += g;
-				lamda_i += g.dot(g);
+				int j = neighbors.getElement(pId, ne);
+				Real r = (pos_i - posArr[j]).norm();
+
+				if (r > EPSILON)
+				{
+					Coord g = kern.Gradient(r)*(pos_i - posArr[j]) * (1.0f / r);
+					grad_ci += g;
+					lamda_i += g.dot(g);
+				}
 			}
-		}
 
-		lamda_i += grad_ci.dot(grad_ci);
+			//The density already includes the boundary, only its gradient is needed here
+			Real rho_b = Real(0);
+			boundary.accumulate(pId, pos_i, kern, rho_b, grad_ci);
+
+			lamda_i += grad_ci.dot(grad_ci);
+
+			Real rho_i = rhoArr[pId];
+
+			lamda_i = -(rho_i - restDensity) / (lamda_i + 0.1f);
 
-		Real rho_i = rhoArr[pId];
+			lambdaArr[pId] = lamda_i > 0.0f ? 0.0f : lamda_i;
 
-		lamda_i = -(rho_i - 1000.0f) / (lamda_i + 0.1f);
+			err_i = rho_i > restDensity ? (rho_i - restDensity) / restDensity : Real(0);
+		}
 
-		lambdaArr[pId] = lamda_i > 0.0f ? 0.0f : lamda_i;
+		if (residual != nullptr)
+			RS_WarpMax(residual, err_i);
 	}
 
-	template <typename Real, typename Coord>
+	template <typename Real, typename Coord, typename TKernel>
 	__global__ void K_ComputeLambdas(
 		DeviceArray<Real> lambdaArr,
 		DeviceArray<Real> rhoArr,
 		DeviceArray<Coord> posArr,
 		DeviceArray<Real> massInvArr,
 		NeighborList<int> neighbors,
-		Real smoothingLength)
+		BoundaryContribution<Real, Coord> boundary,
+		TKernel kern,
+		Real restDensity,
+		Real* residual,
+		int offset,
+		int num)
 	{
-		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= posArr.size()) return;
-
-		Coord pos_i = posArr[pId];
-
-		SpikyKernel<Real> kern;
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
 
-		Real lamda_i = Real(0);
-		Coord grad_ci(0);
-
-		int nbSize = neighbors.getNeighborSize(pId);
-		for (int ne = 0; ne < nbSize; ne++)
+		Real err_i = Real(0);
+		if (pId < offset + num)
 		{
-			int j = neighbors.getElement(pId, ne);
-			Real r = (pos_i - posArr[j]).norm();
+			Coord pos_i = posArr[pId];
 
-			if (r > EPSILON)
+			Real lamda_i = Real(0);
+			Coord grad_ci(0);
+
+			int nbSize = neighbors.getNeighborSize(pId);
+			for (int ne = 0; ne < nbSize; ne++)
 			{
-				Coord g = kern.Gradient(r, smoothingLength)*(pos_i - posArr[j]) * (1.0f / r);
-				grad_ci += g;
-				lamda_i += g.dot(g) * massInvArr[j];
+				int j = neighbors.getElement(pId, ne);
+				Real r = (pos_i - posArr[j]).norm();
+
+				if (r > EPSILON)
+				{
+					Coord g = kern.Gradient(r)*(pos_i - posArr[j]) * (1.0f / r);
+					grad_ci += g;
+					lamda_i += g.dot(g) * massInvArr[j];
+				}
 			}
-		}
 
-		lamda_i += grad_ci.dot(grad_ci) * massInvArr[pId];
+			Real rho_b = Real(0);
+			boundary.accumulate(pId, pos_i, kern, rho_b, grad_ci);
+
+			lamda_i += grad_ci.dot(grad_ci) * massInvArr[pId];
 
-		Real rho_i = rhoArr[pId];
+			Real rho_i = rhoArr[pId];
 
-		lamda_i = -(rho_i - 1000.0f) / (lamda_i + 0.1f);
+			lamda_i = -(rho_i - restDensity) / (lamda_i + 0.1f);
 
-		lambdaArr[pId] = lamda_i > 0.0f ? 0.0f : lamda_i;
+			lambdaArr[pId] = lamda_i > 0.0f ? 0.0f : lamda_i;
+
+			err_i = rho_i > restDensity ? (rho_i - restDensity) / restDensity : Real(0);
+		}
+
+		if (residual != nullptr)
+			RS_WarpMax(residual, err_i);
 	}
 
 
-	template <typename Real, typename Coord>
+	template <typename Real, typename Coord, typename TKernel>
 	__global__ void K_ComputeDisplacement(
 		DeviceArray<Coord> dPos, 
 		DeviceArray<Real> lambdas, 
 		DeviceArray<Coord> posArr, 
 		NeighborList<int> neighbors, 
-		Real smoothingLength,
-		Real dt)
+		TKernel kern,
+		Real dt,
+		int offset,
+		int num)
 	{
-		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= posArr.size()) return;
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= offset + num) return;
 
 		Coord pos_i = posArr[pId];
 		Real lamda_i = lambdas[pId];
 
-		SpikyKernel<Real> kern;
-
 		Coord dP_i(0);
 		int nbSize = neighbors.getNeighborSize(pId);
 		for (int ne = 0; ne < nbSize; ne++)
@@ -121,7 +158,7 @@ namespace Physika
 			Real r = (pos_i - posArr[j]).norm();
 			if (r > EPSILON)
 			{
-				Coord dp_ij = 1.0f*(pos_i - posArr[j])*(lamda_i + lambdas[j])*kern.Gradient(r, smoothingLength)* (1.0 / r);
+				Coord dp_ij = 1.0f*(pos_i - posArr[j])*(lamda_i + lambdas[j])*kern.Gradient(r)* (1.0 / r);
 				dP_i += dp_ij;
 				
 				atomicAdd(&dPos[pId][0], dp_ij[0]);
@@ -144,24 +181,24 @@ namespace Physika
 //		dPos[pId] = dP_i;
 	}
 
-	template <typename Real, typename Coord>
+	template <typename Real, typename Coord, typename TKernel>
 	__global__ void K_ComputeDisplacement(
 		DeviceArray<Coord> dPos,
 		DeviceArray<Real> lambdas,
 		DeviceArray<Coord> posArr,
 		DeviceArray<Real> massInvArr,
 		NeighborList<int> neighbors,
-		Real smoothingLength,
-		Real dt)
+		TKernel kern,
+		Real dt,
+		int offset,
+		int num)
 	{
-		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= posArr.size()) return;
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= offset + num) return;
 
 		Coord pos_i = posArr[pId];
 		Real lamda_i = lambdas[pId];
 
-		SpikyKernel<Real> kern;
-
 		int nbSize = neighbors.getNeighborSize(pId);
 		for (int ne = 0; ne < nbSize; ne++)
 		{
@@ -169,7 +206,7 @@ namespace Physika
 			Real r = (pos_i - posArr[j]).norm();
 			if (r > EPSILON)
 			{
-				Coord dp_ij = 1.0f*(pos_i - posArr[j])*(lamda_i + lambdas[j])*kern.Gradient(r, smoothingLength)* (1.0 / r);
+				Coord dp_ij = 1.0f*(pos_i - posArr[j])*(lamda_i + lambdas[j])*kern.Gradient(r)* (1.0 / r);
 				Coord dp_ji = -dp_ij * massInvArr[j];
 				dp_ij = dp_ij * massInvArr[pId];
 				atomicAdd(&dPos[pId][0], dp_ij[0]);
@@ -190,39 +227,451 @@ namespace Physika
 		}
 	}
 
+	/*!
+	*	\brief	Deterministic variant of K_ComputeDisplacement, the share of neighbor j is stored in the entry of j
+	*			and added by a NeighborScatter afterwards.
+	*/
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void DP_ComputeOrderedDisplacement(
+		DeviceArray<Coord> dPos,
+		DeviceArray<Coord> entries,
+		DeviceArray<Real> lambdas,
+		DeviceArray<Coord> posArr,
+		DeviceArray<Real> massInvArr,
+		NeighborList<int> neighbors,
+		TKernel kern,
+		bool hasMassInv,
+		int offset,
+		int num)
+	{
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= offset + num) return;
+
+		Coord pos_i = posArr[pId];
+		Real lamda_i = lambdas[pId];
+		Real mInv_i = hasMassInv ? massInvArr[pId] : Real(1);
+
+		Coord dP_i(0);
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			Real r = (pos_i - posArr[j]).norm();
+
+			Coord dp_ji(0);
+			if (r > EPSILON)
+			{
+				Coord dp_ij = 1.0f*(pos_i - posArr[j])*(lamda_i + lambdas[j])*kern.Gradient(r)* (1.0 / r);
+				dP_i += mInv_i*dp_ij;
+				dp_ji = -dp_ij*(hasMassInv ? massInvArr[j] : Real(1));
+			}
+			entries[neighbors.getElementIndex(pId, ne)] = dp_ji;
+		}
+
+		dPos[pId] = dP_i;
+	}
+
+	/*!
+	*	\brief	Atomic-free variant of K_ComputeDisplacement, relies on the neighbor list being symmetric.
+	*			Pair (i, j) contributes dp_ij to i from both i's and j's neighbor loops of the scatter version,
+	*			so each particle gathers twice the sum over its own neighbors.
+	*/
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void K_GatherDisplacement(
+		DeviceArray<Coord> dPos,
+		DeviceArray<Real> lambdas,
+		DeviceArray<Coord> posArr,
+		NeighborList<int> neighbors,
+		TKernel kern,
+		int offset,
+		int num)
+	{
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= offset + num) return;
+
+		Coord pos_i = posArr[pId];
+		Real lamda_i = lambdas[pId];
+
+		Coord dP_i(0);
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			Real r = (pos_i - posArr[j]).norm();
+			if (r > EPSILON)
+			{
+				dP_i += (pos_i - posArr[j])*(lamda_i + lambdas[j])*kern.Gradient(r)* (1.0 / r);
+			}
+		}
+
+		dPos[pId] = Real(2)*dP_i;
+	}
+
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void K_GatherDisplacement(
+		DeviceArray<Coord> dPos,
+		DeviceArray<Real> lambdas,
+		DeviceArray<Coord> posArr,
+		DeviceArray<Real> massInvArr,
+		NeighborList<int> neighbors,
+		TKernel kern,
+		int offset,
+		int num)
+	{
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= offset + num) return;
+
+		Coord pos_i = posArr[pId];
+		Real lamda_i = lambdas[pId];
+
+		Coord dP_i(0);
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			Real r = (pos_i - posArr[j]).norm();
+			if (r > EPSILON)
+			{
+				dP_i += (pos_i - posArr[j])*(lamda_i + lambdas[j])*kern.Gradient(r)* (1.0 / r);
+			}
+		}
+
+		dPos[pId] = Real(2)*massInvArr[pId]*dP_i;
+	}
+
+	/*!
+	*	\brief	Density summation and multiplier computation in a single traversal of the neighbor list.
+	*/
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void DP_ComputeDensityLambdas(
+		DeviceArray<Real> lambdaArr,
+		DeviceArray<Real> rhoArr,
+		DeviceArray<Coord> posArr,
+		DeviceArray<Real> massInvArr,
+		NeighborList<int> neighbors,
+		BoundaryContribution<Real, Coord> boundary,
+		TKernel kern,
+		Real mass,
+		Real restDensity,
+		bool hasMassInv,
+		Real* residual,
+		int offset,
+		int num)
+	{
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+
+		Real err_i = Real(0);
+		if (pId < offset + num)
+		{
+			Coord pos_i = posArr[pId];
+
+			Real rho_i = Real(0);
+			Real lamda_i = Real(0);
+			Coord grad_ci(0);
+
+			int nbSize = neighbors.getNeighborSize(pId);
+			for (int ne = 0; ne < nbSize; ne++)
+			{
+				int j = neighbors.getElement(pId, ne);
+				Coord x_ij = pos_i - posArr[j];
+				Real r = x_ij.norm();
+
+				rho_i += mass*kern.Weight(r);
+				if (r > EPSILON)
+				{
+					Coord g = kern.Gradient(r)*x_ij * (1.0f / r);
+					grad_ci += g;
+					lamda_i += g.dot(g) * (hasMassInv ? massInvArr[j] : Real(1));
+				}
+			}
+
+			//Boundary particles do not move, they only add to the gradient of particle i
+			boundary.accumulate(pId, pos_i, kern, rho_i, grad_ci);
+
+			lamda_i += grad_ci.dot(grad_ci) * (hasMassInv ? massInvArr[pId] : Real(1));
+			lamda_i = -(rho_i - restDensity) / (lamda_i + 0.1f);
+
+			rhoArr[pId] = rho_i;
+			lambdaArr[pId] = lamda_i > 0.0f ? 0.0f : lamda_i;
+
+			err_i = rho_i > restDensity ? (rho_i - restDensity) / restDensity : Real(0);
+		}
+
+		if (residual != nullptr)
+			RS_WarpMax(residual, err_i);
+	}
+
+	/*!
+	*	\brief	Project the density constraints of one color, particles of the same color are never neighbors
+	*			so each thread may update its own position and multiplier in place.
+	*/
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void DP_ProjectColor(
+		DeviceArray<Coord> posArr,
+		DeviceArray<Real> lambdas,
+		DeviceArray<Real> massInvArr,
+		DeviceArray<int> order,
+		NeighborList<int> neighbors,
+		BoundaryContribution<Real, Coord> boundary,
+		int offset,
+		int count,
+		TKernel kern,
+		Real mass,
+		Real restDensity,
+		bool hasMassInv,
+		Real* residual)
+	{
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+
+		Real err_i = Real(0);
+		if (tId < count)
+		{
+			int pId = order[offset + tId];
+			Coord pos_i = posArr[pId];
+			Real mInv_i = hasMassInv ? massInvArr[pId] : Real(1);
+
+			Real rho_i = Real(0);
+			Real lamda_i = Real(0);
+			Coord grad_ci(0);
+
+			int nbSize = neighbors.getNeighborSize(pId);
+			for (int ne = 0; ne < nbSize; ne++)
+			{
+				int j = neighbors.getElement(pId, ne);
+				Real r = (pos_i - posArr[j]).norm();
+
+				rho_i += mass*kern.Weight(r);
+				if (r > EPSILON)
+				{
+					Coord g = kern.Gradient(r)*(pos_i - posArr[j]) * (1.0f / r);
+					grad_ci += g;
+					lamda_i += g.dot(g) * (hasMassInv ? massInvArr[j] : Real(1));
+				}
+			}
+
+			Coord grad_b(0);
+			boundary.accumulate(pId, pos_i, kern, rho_i, grad_b);
+			grad_ci += grad_b;
+
+			lamda_i += grad_ci.dot(grad_ci) * mInv_i;
+			lamda_i = -(rho_i - restDensity) / (lamda_i + 0.1f);
+			lamda_i = lamda_i > 0.0f ? 0.0f : lamda_i;
+			lambdas[pId] = lamda_i;
+
+			Coord dP_i = lamda_i*grad_b;
+			for (int ne = 0; ne < nbSize; ne++)
+			{
+				int j = neighbors.getElement(pId, ne);
+				Real r = (pos_i - posArr[j]).norm();
+				if (r > EPSILON)
+				{
+					dP_i += (pos_i - posArr[j])*(lamda_i + lambdas[j])*kern.Gradient(r)* (1.0 / r);
+				}
+			}
+
+			posArr[pId] = pos_i + Real(2)*mInv_i*dP_i;
+
+			err_i = rho_i > restDensity ? (rho_i - restDensity) / restDensity : Real(0);
+		}
+
+		if (residual != nullptr)
+			RS_WarpMax(residual, err_i);
+	}
+
+	/*!
+	*	\brief	Push particles away from the boundary with their own multiplier, scaled like the pairs of fluid particles.
+	*/
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void DP_AddBoundaryDisplacement(
+		DeviceArray<Coord> dPos,
+		DeviceArray<Real> lambdas,
+		DeviceArray<Coord> posArr,
+		DeviceArray<Real> massInvArr,
+		BoundaryContribution<Real, Coord> boundary,
+		TKernel kern,
+		bool hasMassInv,
+		int offset,
+		int num)
+	{
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= offset + num) return;
+
+		Real rho_b = Real(0);
+		Coord grad_b(0);
+		boundary.accumulate(pId, posArr[pId], kern, rho_b, grad_b);
+
+		Real mInv_i = hasMassInv ? massInvArr[pId] : Real(1);
+		dPos[pId] += Real(2)*mInv_i*lambdas[pId]*grad_b;
+	}
+
+	/*!
+	*	\brief	Multipliers of particles of varying mass and support radius. The gradient of C_i with respect to a neighbor
+	*			is scaled by the neighbor's relative mass and weighted by its inverse in the denominator.
+	*/
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void DP_ComputeAdaptiveLambdas(
+		DeviceArray<Real> lambdaArr,
+		DeviceArray<Real> rhoArr,
+		DeviceArray<Coord> posArr,
+		DeviceArray<Real> massArr,
+		DeviceArray<Real> radiusArr,
+		NeighborList<int> neighbors,
+		BoundaryContribution<Real, Coord> boundary,
+		TKernel kern,
+		Real restDensity,
+		Real* residual,
+		int offset,
+		int num)
+	{
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+
+		Real err_i = Real(0);
+		if (pId < offset + num)
+		{
+			Coord pos_i = posArr[pId];
+			Real h_i = radiusArr[pId];
+
+			Real lamda_i = Real(0);
+			Coord grad_ci(0);
+
+			int nbSize = neighbors.getNeighborSize(pId);
+			for (int ne = 0; ne < nbSize; ne++)
+			{
+				int j = neighbors.getElement(pId, ne);
+				Real r = (pos_i - posArr[j]).norm();
+
+				if (r > EPSILON)
+				{
+					Real m_j = massArr[j];
+					Real h_ij = Real(0.5)*(h_i + radiusArr[j]);
+					Coord g = m_j*kern.Gradient(r, h_ij)*(pos_i - posArr[j]) * (1.0f / r);
+					grad_ci += g;
+					lamda_i += g.dot(g) / m_j;
+				}
+			}
+
+			Real rho_b = Real(0);
+			boundary.accumulate(pId, pos_i, kern, rho_b, grad_ci);
+
+			lamda_i += grad_ci.dot(grad_ci) / massArr[pId];
+
+			Real rho_i = rhoArr[pId];
+
+			lamda_i = -(rho_i - restDensity) / (lamda_i + 0.1f);
+
+			lambdaArr[pId] = lamda_i > 0.0f ? 0.0f : lamda_i;
+
+			err_i = rho_i > restDensity ? (rho_i - restDensity) / restDensity : Real(0);
+		}
+
+		if (residual != nullptr)
+			RS_WarpMax(residual, err_i);
+	}
+
+	/*!
+	*	\brief	Gathered corrections of particles of varying mass, pair (i, j) moves i by (lambda_i m_j + lambda_j m_i) grad W_ij / m_i.
+	*			The boundary term is added here as well since it is also divided by the relative mass.
+	*/
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void DP_GatherAdaptiveDisplacement(
+		DeviceArray<Coord> dPos,
+		DeviceArray<Real> lambdas,
+		DeviceArray<Coord> posArr,
+		DeviceArray<Real> massArr,
+		DeviceArray<Real> radiusArr,
+		NeighborList<int> neighbors,
+		BoundaryContribution<Real, Coord> boundary,
+		TKernel kern,
+		int offset,
+		int num)
+	{
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= offset + num) return;
+
+		Coord pos_i = posArr[pId];
+		Real lamda_i = lambdas[pId];
+		Real m_i = massArr[pId];
+		Real h_i = radiusArr[pId];
+
+		Coord dP_i(0);
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			Real r = (pos_i - posArr[j]).norm();
+			if (r > EPSILON)
+			{
+				Real h_ij = Real(0.5)*(h_i + radiusArr[j]);
+				dP_i += (pos_i - posArr[j])*(lamda_i*massArr[j] + lambdas[j]*m_i)*kern.Gradient(r, h_ij)* (1.0 / r);
+			}
+		}
+
+		Real rho_b = Real(0);
+		Coord grad_b(0);
+		boundary.accumulate(pId, pos_i, kern, rho_b, grad_b);
+		dP_i += lamda_i*grad_b;
+
+		dPos[pId] = Real(2)*dP_i / m_i;
+	}
+
 	template <typename Real, typename Coord>
 	__global__ void K_UpdatePosition(
 		DeviceArray<Coord> posArr, 
 		DeviceArray<Coord> velArr, 
 		DeviceArray<Coord> dPos, 
-		Real dt)
+		Real dt,
+		int offset,
+		int num)
 	{
-		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= posArr.size()) return;
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= offset + num) return;
 
 		posArr[pId] += dPos[pId];
 	}
 
 
+	template <typename Real>
+	__global__ void DP_AccumulateLambda(
+		DeviceArray<Real> accLambda,
+		DeviceArray<Real> lambdas,
+		Real scale)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= lambdas.size()) return;
+
+		accLambda[pId] += scale*lambdas[pId];
+	}
+
 	template<typename TDataType>
 	DensityPBD<TDataType>::DensityPBD()
 		: ConstraintModule()
-		, m_maxIteration(3)
+		, m_gatherDisplacement(true)
+		, m_gaussSeidel(false)
+		, m_fusedDensity(true)
+		, m_warmStart(false)
+		, m_warmStartFactor(Real(0.8))
+		, m_hash(nullptr)
 	{
+		m_iterationPolicy.setMaxIteration(3);
+
 		m_restDensity.setValue(Real(1000));
 		m_smoothingLength.setValue(Real(0.011));
+		m_mass.setValue(Real(1));
 
 		attachField(&m_restDensity, "rest_density", "Reference density", false);
+		attachField(&m_mass, "mass", "particle mass", false);
 		attachField(&m_smoothingLength, "smoothing_length", "The smoothing length in SPH!", false);
 		attachField(&m_position, "position", "Storing the particle positions!", false);
 		attachField(&m_velocity, "velocity", "Storing the particle velocities!", false);
 		attachField(&m_density, "density", "Storing the particle densities!", false);
 		attachField(&m_neighborhood, "neighborhood", "Storing neighboring particles' ids!", false);
+		attachField(&m_accLambda, "lambda", "Storing the multipliers accumulated over the last time step!", false);
 	}
 
 	template<typename TDataType>
 	DensityPBD<TDataType>::~DensityPBD()
 	{
+		m_entryDelta.release();
 		m_lamda.release();
 		m_deltaPos.release();
 		m_position_old.release();
@@ -236,6 +685,12 @@ namespace Physika
 			m_density.setElementCount(m_position.getElementCount());
 		}
 
+		if (!m_position.isEmpty() && m_accLambda.isEmpty())
+		{
+			m_accLambda.setElementCount(m_position.getElementCount());
+			m_accLambda.getValue().reset();
+		}
+
 		if (!isAllFieldsReady())
 		{
 			std::cout << "Exception: " << std::string("DensityPBD's fields are not fully initialized!") << std::endl;
@@ -245,12 +700,17 @@ namespace Physika
 		m_densitySum = std::make_shared<DensitySummation<TDataType>>();
 
 		m_restDensity.connect(m_densitySum->m_restDensity);
+		m_mass.connect(m_densitySum->m_mass);
 		m_smoothingLength.connect(m_densitySum->m_smoothingLength);
 		m_position.connect(m_densitySum->m_position);
 		m_density.connect(m_densitySum->m_density);
 		m_neighborhood.connect(m_densitySum->m_neighborhood);
+		m_particleMass.connect(m_densitySum->m_particleMass);
+		m_particleRadius.connect(m_densitySum->m_particleRadius);
 
 		m_densitySum->initialize();
+		m_densitySum->setBoundaryParticles(m_boundary);
+		m_densitySum->setGridHash(m_hash);
 
 
 		int num = m_position.getElementCount();
@@ -268,14 +728,113 @@ namespace Physika
 	template<typename TDataType>
 	bool DensityPBD<TDataType>::constrain()
 	{
+		//Particles were emitted or removed since the last step
+		int num = m_position.getElementCount();
+		if (m_position_old.size() != num)
+		{
+			m_position_old.setSize(num);
+			m_lamda.setSize(num);
+			m_deltaPos.setSize(num);
+		}
+		if (m_density.getElementCount() != num)
+		{
+			m_density.setElementCount(num);
+		}
+
 		Function1Pt::copy(m_position_old, m_position.getValue());
 
+		//The boundary neighbors are kept over the iterations like the fluid neighbors
+		if (m_boundary != nullptr)
+		{
+			if (!m_boundary->isInitialized())
+				m_boundary->setSmoothingLength(m_smoothingLength.getValue());
+			m_boundary->queryNeighbors(m_position.getValue());
+		}
+
+		//Scattered corrections are added in the order of the neighbor list, which is kept over the iterations
+		if (!isGathered() && SceneGraph::getInstance().isDeterministic())
+		{
+			if (m_scatter == nullptr)
+			{
+				m_scatter = std::make_shared<NeighborScatter>();
+			}
+			m_scatter->update(m_neighborhood.getValue());
+			m_entryDelta.setSize(m_scatter->getEntryNum());
+		}
+
+		//Multipliers outside the range are kept zero, the particles may have been reordered since the last step
+		if (m_rangeCount >= 0)
+		{
+			m_lamda.reset();
+		}
+
+		if (m_warmStart)
+		{
+			warmStart();
+		}
+
+		//Colors cover all particles, so a restricted range falls back to Jacobi iterations
+		if (m_gaussSeidel && m_rangeCount < 0 && !isAdaptive())
+		{
+			if (m_coloring == nullptr)
+			{
+				m_coloring = std::make_shared<GraphColoring>();
+			}
+			m_coloring->recolor(m_neighborhood.getValue());
+
+			//Multipliers of not yet visited colors are taken from a Jacobi pass at the beginning of each step
+			int num = m_position.getElementCount();
+			uint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+			m_densitySum->compute();
+			if (m_massInv.isEmpty())
+			{
+				K_ComputeLambdas <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+					m_lamda,
+					m_density.getValue(),
+					m_position.getValue(),
+					m_neighborhood.getValue(),
+					getBoundaryContribution(),
+					SpikyKernel<Real>(m_smoothingLength.getValue()),
+					m_restDensity.getValue(),
+					nullptr,
+					0,
+					num);
+			}
+			else
+			{
+				K_ComputeLambdas <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+					m_lamda,
+					m_density.getValue(),
+					m_position.getValue(),
+					m_massInv.getValue(),
+					m_neighborhood.getValue(),
+					getBoundaryContribution(),
+					SpikyKernel<Real>(m_smoothingLength.getValue()),
+					m_restDensity.getValue(),
+					nullptr,
+					0,
+					num);
+			}
+		}
+
+		if (m_residual == nullptr)
+		{
+			m_residual = std::make_shared<ResidualMax<Real>>();
+		}
+
+		//The residual reported by an iteration is the maximum relative compression it has just corrected
 		int it = 0;
-		while (it < m_maxIteration)
+		float residual = std::numeric_limits<float>::max();
+		while (m_iterationPolicy.proceed(it, residual))
 		{
+			if (m_iterationPolicy.hasTarget())
+				m_residual->reset();
+
 			takeOneIteration();
 
 			it++;
+			residual = m_iterationPolicy.hasTarget() ? m_residual->getValue() : -1.0f;
 		}
 
 		updateVelocity();
@@ -285,57 +844,382 @@ namespace Physika
 
 
 	template<typename TDataType>
-	void DensityPBD<TDataType>::takeOneIteration()
+	void DensityPBD<TDataType>::setBoundaryParticles(std::shared_ptr<BoundaryParticles<TDataType>> boundary)
 	{
-		Real dt = this->getParent()->getDt();
+		m_boundary = boundary;
+		if (m_densitySum != nullptr)
+		{
+			m_densitySum->setBoundaryParticles(boundary);
+		}
+	}
+
+	template<typename TDataType>
+	void DensityPBD<TDataType>::setGridHash(GridHash<TDataType>* hash)
+	{
+		m_hash = hash;
+		if (m_densitySum != nullptr)
+		{
+			m_densitySum->setGridHash(hash);
+		}
+	}
+
+	template<typename TDataType>
+	BoundaryContribution<typename TDataType::Real, typename TDataType::Coord> DensityPBD<TDataType>::getBoundaryContribution()
+	{
+		if (m_boundary == nullptr || m_boundary->getNeighbors().size() != m_position.getElementCount())
+		{
+			BoundaryContribution<Real, Coord> none;
+			none.valid = false;
+			return none;
+		}
+
+		Real mass = m_densitySum->m_mass.getValue()*m_densitySum->getCorrection();
+		return m_boundary->getContribution(m_restDensity.getValue(), mass);
+	}
+
+	template<typename TDataType>
+	bool DensityPBD<TDataType>::isGathered()
+	{
+		//A limited list may hold j as a neighbor of i but not i as one of j
+		return m_gatherDisplacement && !m_neighborhood.getValue().isLimited();
+	}
+
+	template<typename TDataType>
+	bool DensityPBD<TDataType>::isAdaptive()
+	{
+		int num = m_position.getElementCount();
+		return !m_particleMass.isEmpty() && !m_particleRadius.isEmpty()
+			&& m_particleMass.getElementCount() == num
+			&& m_particleRadius.getElementCount() == num;
+	}
 
+	template<typename TDataType>
+	void DensityPBD<TDataType>::resetWarmStart()
+	{
+		if (!m_accLambda.isEmpty())
+		{
+			m_accLambda.getValue().reset();
+		}
+	}
+
+	template<typename TDataType>
+	void DensityPBD<TDataType>::warmStart()
+	{
 		int num = m_position.getElementCount();
 		uint pDims = cudaGridSize(num, BLOCK_SIZE);
 
-		m_deltaPos.reset();
-		m_densitySum->compute();
+		DeviceArray<Real>& accLambda = m_accLambda.getValue();
+		if (accLambda.size() != num)
+		{
+			//Only happens if the multipliers were not carried along with the particles, e.g., outside a ParticleSystem
+			accLambda.resize(num);
+			accLambda.reset();
+			return;
+		}
 
+		m_lamda.reset();
+		DP_AccumulateLambda <Real> << <pDims, BLOCK_SIZE >> > (
+			m_lamda,
+			accLambda,
+			m_warmStartFactor);
+		Function1Pt::copy(accLambda, m_lamda);
 
-		if (m_massInv.isEmpty())
+		applyMultipliers(m_lamda);
+		cuSynchronize();
+	}
+
+	template<typename TDataType>
+	void DensityPBD<TDataType>::takeOneIteration()
+	{
+		if (m_gaussSeidel && m_coloring != nullptr && m_rangeCount < 0 && !isAdaptive())
 		{
-			K_ComputeLambdas <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+			takeOneColoredIteration();
+		}
+		else
+		{
+			int start, count;
+			this->getParticleRange(m_position.getElementCount(), start, count);
+			uint pDims = cudaGridSize(count, BLOCK_SIZE);
+
+			Real* residual = m_iterationPolicy.hasTarget() && m_residual != nullptr ? m_residual->getDataPtr() : nullptr;
+
+			if (isAdaptive())
+			{
+				m_densitySum->compute();
+				DP_ComputeAdaptiveLambdas <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+					m_lamda,
+					m_density.getValue(),
+					m_position.getValue(),
+					m_particleMass.getValue(),
+					m_particleRadius.getValue(),
+					m_neighborhood.getValue(),
+					getBoundaryContribution(),
+					SpikyKernel<Real>(m_smoothingLength.getValue()),
+					m_restDensity.getValue(),
+					residual,
+					start,
+					count);
+			}
+			else if (m_fusedDensity)
+			{
+				DeviceArray<Real> massInv;
+				bool hasMassInv = !m_massInv.isEmpty();
+				if (hasMassInv)
+					massInv = m_massInv.getValue();
+
+				DP_ComputeDensityLambdas <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+					m_lamda,
+					m_density.getValue(),
+					m_position.getValue(),
+					massInv,
+					m_neighborhood.getValue(),
+					getBoundaryContribution(),
+					SpikyKernel<Real>(m_smoothingLength.getValue()),
+					m_densitySum->m_mass.getValue()*m_densitySum->getCorrection(),
+					m_restDensity.getValue(),
+					hasMassInv,
+					residual,
+					start,
+					count);
+			}
+			else if (m_massInv.isEmpty())
+			{
+				m_densitySum->compute();
+				K_ComputeLambdas <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+					m_lamda,
+					m_density.getValue(),
+					m_position.getValue(),
+					m_neighborhood.getValue(),
+					getBoundaryContribution(),
+					SpikyKernel<Real>(m_smoothingLength.getValue()),
+					m_restDensity.getValue(),
+					residual,
+					start,
+					count);
+			}
+			else
+			{
+				m_densitySum->compute();
+				K_ComputeLambdas <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+					m_lamda,
+					m_density.getValue(),
+					m_position.getValue(),
+					m_massInv.getValue(),
+					m_neighborhood.getValue(),
+					getBoundaryContribution(),
+					SpikyKernel<Real>(m_smoothingLength.getValue()),
+					m_restDensity.getValue(),
+					residual,
+					start,
+					count);
+			}
+
+			applyMultipliers(m_lamda);
+		}
+
+		if (m_warmStart)
+		{
+			int num = m_position.getElementCount();
+			uint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+			DP_AccumulateLambda <Real> << <pDims, BLOCK_SIZE >> > (
+				m_accLambda.getValue(),
 				m_lamda,
-				m_density.getValue(),
+				Real(1));
+		}
+	}
+
+	template<typename TDataType>
+	void DensityPBD<TDataType>::applyMultipliers(DeviceArray<Real>& lambdas)
+	{
+		Real dt = this->getParent()->getDt();
+
+		int start, count;
+		this->getParticleRange(m_position.getElementCount(), start, count);
+		uint pDims = cudaGridSize(count, BLOCK_SIZE);
+
+		if (isAdaptive())
+		{
+			//Only gathered, the boundary term is included
+			DP_GatherAdaptiveDisplacement <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+				m_deltaPos,
+				lambdas,
 				m_position.getValue(),
+				m_particleMass.getValue(),
+				m_particleRadius.getValue(),
 				m_neighborhood.getValue(),
-				m_smoothingLength.getValue());
-			K_ComputeDisplacement <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+				getBoundaryContribution(),
+				SpikyKernel<Real>(m_smoothingLength.getValue()),
+				start,
+				count);
+
+			K_UpdatePosition <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+				m_position.getValue(),
+				m_velocity.getValue(),
 				m_deltaPos,
-				m_lamda,
+				dt,
+				start,
+				count);
+			return;
+		}
+
+		bool gather = isGathered();
+		if (!gather)
+			m_deltaPos.reset();
+
+		if (!gather && SceneGraph::getInstance().isDeterministic() && m_scatter != nullptr)
+		{
+			DeviceArray<Real> massInv;
+			bool hasMassInv = !m_massInv.isEmpty();
+			if (hasMassInv)
+				massInv = m_massInv.getValue();
+
+			//Entries of particles outside the range are not written
+			m_entryDelta.reset();
+			DP_ComputeOrderedDisplacement <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+				m_deltaPos,
+				m_entryDelta,
+				lambdas,
 				m_position.getValue(),
+				massInv,
 				m_neighborhood.getValue(),
-				m_smoothingLength.getValue(),
-				dt);
+				SpikyKernel<Real>(m_smoothingLength.getValue()),
+				hasMassInv,
+				start,
+				count);
+			m_scatter->add(m_deltaPos, m_entryDelta);
+		}
+		else if (m_massInv.isEmpty())
+		{
+			if (gather)
+			{
+				K_GatherDisplacement <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+					m_deltaPos,
+					lambdas,
+					m_position.getValue(),
+					m_neighborhood.getValue(),
+					SpikyKernel<Real>(m_smoothingLength.getValue()),
+					start,
+					count);
+			}
+			else
+			{
+				K_ComputeDisplacement <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+					m_deltaPos,
+					lambdas,
+					m_position.getValue(),
+					m_neighborhood.getValue(),
+					SpikyKernel<Real>(m_smoothingLength.getValue()),
+					dt,
+					start,
+					count);
+			}
 		}
 		else
 		{
-			K_ComputeLambdas <Real, Coord> << <pDims, BLOCK_SIZE >> > (
-				m_lamda,
-				m_density.getValue(),
-				m_position.getValue(),
-				m_massInv.getValue(),
-				m_neighborhood.getValue(),
-				m_smoothingLength.getValue());
-			K_ComputeDisplacement <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+			if (gather)
+			{
+				K_GatherDisplacement <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+					m_deltaPos,
+					lambdas,
+					m_position.getValue(),
+					m_massInv.getValue(),
+					m_neighborhood.getValue(),
+					SpikyKernel<Real>(m_smoothingLength.getValue()),
+					start,
+					count);
+			}
+			else
+			{
+				K_ComputeDisplacement <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+					m_deltaPos,
+					lambdas,
+					m_position.getValue(),
+					m_massInv.getValue(),
+					m_neighborhood.getValue(),
+					SpikyKernel<Real>(m_smoothingLength.getValue()),
+					dt,
+					start,
+					count);
+			}
+		}
+
+		BoundaryContribution<Real, Coord> boundary = getBoundaryContribution();
+		if (boundary.valid)
+		{
+			DeviceArray<Real> massInv;
+			bool hasMassInv = !m_massInv.isEmpty();
+			if (hasMassInv)
+				massInv = m_massInv.getValue();
+
+			DP_AddBoundaryDisplacement <Real, Coord> << <pDims, BLOCK_SIZE >> > (
 				m_deltaPos,
-				m_lamda,
+				lambdas,
 				m_position.getValue(),
-				m_massInv.getValue(),
-				m_neighborhood.getValue(),
-				m_smoothingLength.getValue(),
-				dt);
+				massInv,
+				boundary,
+				SpikyKernel<Real>(m_smoothingLength.getValue()),
+				hasMassInv,
+				start,
+				count);
 		}
 		
 		K_UpdatePosition <Real, Coord> << <pDims, BLOCK_SIZE >> > (
 			m_position.getValue(),
 			m_velocity.getValue(),
 			m_deltaPos,
-			dt);
+			dt,
+			start,
+			count);
+	}
+
+	template<typename TDataType>
+	void DensityPBD<TDataType>::takeOneColoredIteration()
+	{
+		DeviceArray<Real> massInv;
+		bool hasMassInv = !m_massInv.isEmpty();
+		if (hasMassInv)
+			massInv = m_massInv.getValue();
+
+		Real mass = m_densitySum->m_mass.getValue()*m_densitySum->getCorrection();
+		Real* residual = m_iterationPolicy.hasTarget() && m_residual != nullptr ? m_residual->getDataPtr() : nullptr;
+		BoundaryContribution<Real, Coord> boundary = getBoundaryContribution();
+
+		for (int c = 0; c < m_coloring->getColorNum(); c++)
+		{
+			int count = m_coloring->getColorSize(c);
+			if (count <= 0) continue;
+
+			uint cDims = cudaGridSize(count, BLOCK_SIZE);
+			DP_ProjectColor <Real, Coord> << <cDims, BLOCK_SIZE >> > (
+				m_position.getValue(),
+				m_lamda,
+				massInv,
+				m_coloring->getOrder(),
+				m_neighborhood.getValue(),
+				boundary,
+				m_coloring->getColorOffset(c),
+				count,
+				SpikyKernel<Real>(m_smoothingLength.getValue()),
+				mass,
+				m_restDensity.getValue(),
+				hasMassInv,
+				residual);
+		}
+		cuSynchronize();
+	}
+
+	template<typename TDataType>
+	typename DensityPBD<TDataType>::Real DensityPBD<TDataType>::computeDensityError()
+	{
+		m_densitySum->compute();
+
+		DeviceArray<Real>& rho = m_density.getValue();
+		Reduction<Real>* pReduce = Reduction<Real>::Create(rho.size());
+		Real maxRho = pReduce->Maximum(rho.getDataPtr(), rho.size());
+		delete pReduce;
+
+		return maxRho / m_restDensity.getValue() - Real(1);
 	}
 
 	template <typename Real, typename Coord>
@@ -343,10 +1227,12 @@ namespace Physika
 		DeviceArray<Coord> velArr,
 		DeviceArray<Coord> prePos,
 		DeviceArray<Coord> curPos,
-		Real dt)
+		Real dt,
+		int offset,
+		int num)
 	{
-		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= velArr.size()) return;
+		int pId = offset + threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= offset + num) return;
 
 		velArr[pId] += (curPos[pId] - prePos[pId]) / dt;
 	}
@@ -354,8 +1240,9 @@ namespace Physika
 	template<typename TDataType>
 	void DensityPBD<TDataType>::updateVelocity()
 	{
-		int num = m_position.getElementCount();
-		uint pDims = cudaGridSize(num, BLOCK_SIZE);
+		int start, count;
+		this->getParticleRange(m_position.getElementCount(), start, count);
+		uint pDims = cudaGridSize(count, BLOCK_SIZE);
 
 		Real dt = this->getParent()->getDt();
 
@@ -363,7 +1250,9 @@ namespace Physika
 			m_velocity.getValue(),
 			m_position_old,
 			m_position.getValue(),
-			dt);
+			dt,
+			start,
+			count);
 		cuSynchronize();
 	}
 
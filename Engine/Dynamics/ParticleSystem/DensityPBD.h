@@ -4,10 +4,15 @@
 #include "Framework/Framework/FieldVar.h"
 #include "Framework/Framework/FieldArray.h"
 #include "Framework/Topology/FieldNeighbor.h"
+#include "BoundaryParticles.h"
 
 namespace Physika {
 
 	template<typename TDataType> class DensitySummation;
+	template<typename TDataType> class GridHash;
+	class GraphColoring;
+	class NeighborScatter;
+	template<typename Real> class ResidualMax;
 
 	/*!
 	*	\class	DensityPBD
@@ -26,36 +31,122 @@ namespace Physika {
 
 		bool constrain() override;
 
+		/// Gauss-Seidel iterations fall back to Jacobi ones while a range is set
+		bool supportsParticleRange() override { return true; }
+
 		void takeOneIteration();
 
 		void updateVelocity();
 
-		void setIterationNumber(int n) { m_maxIteration = n; }
+		void setIterationNumber(int n) { m_iterationPolicy.setMaxIteration(n); }
+
+		/*!
+		*	\brief	Accumulate position corrections by gathering over each particle's own neighbors (default),
+		*			or by scattering with atomics. Gathering requires a symmetric neighbor list and gives the same result on every run,
+		*			corrections are scattered instead while the neighbor list has a size limit. Scattering is ordered as well
+		*			in deterministic mode, see SceneGraph::setDeterministic().
+		*/
+		void setGatherDisplacement(bool gather) { m_gatherDisplacement = gather; }
+
+		/*!
+		*	\brief	Replace Jacobi iterations with colored Gauss-Seidel sweeps. Particles are colored such that no two neighbors
+		*			share a color, and each color projects its own density constraints with the latest positions and multipliers
+		*			of all other colors.
+		*/
+		void setGaussSeidel(bool gs) { m_gaussSeidel = gs; }
+
+		/*!
+		*	\brief	Compute densities and multipliers of a Jacobi iteration in one neighbor traversal (default),
+		*			instead of running DensitySummation first and traversing the neighbors again for the multipliers.
+		*/
+		void setFusedDensity(bool fused) { m_fusedDensity = fused; }
+
+		/*!
+		*	\brief	Sum densities cell-blocked over the given hash, see DensitySummation::setGridHash().
+		*			Only used for iterations that do not fuse densities and multipliers.
+		*/
+		void setGridHash(GridHash<TDataType>* hash);
+
+		/*!
+		*	\brief	Start each step by applying the multipliers accumulated over the previous step, scaled by factor,
+		*			so that the iterations only need to resolve the change in compression. The multipliers are stored per particle
+		*			in m_accLambda, the module field "lambda", which ParticleSystem compacts, grows and reorders together with the
+		*			particle attributes. Emitted particles start from zero.
+		*/
+		void setWarmStart(bool warm, Real factor = Real(0.8)) { m_warmStart = warm; m_warmStartFactor = factor; }
+
+		/// Forget the stored multipliers, e.g., after particles changed their masses by splitting or merging
+		void resetWarmStart();
+
+		/*!
+		*	\brief	Read the boundary particles as neighbors that contribute density but are never moved,
+		*			replacing the under-sampled density near walls that is otherwise only fixed by projection afterwards.
+		*/
+		void setBoundaryParticles(std::shared_ptr<BoundaryParticles<TDataType>> boundary);
+
+		/*!
+		*	\brief	Recompute densities at the current positions and return the maximum relative compression.
+		*/
+		Real computeDensityError();
 
 		DeviceArray<Real>& getDensity() { return m_density.getValue(); }
 
 	protected:
 		bool initializeImpl() override;
 
+	private:
+		void takeOneColoredIteration();
+		void warmStart();
+		void applyMultipliers(DeviceArray<Real>& lambdas);
+		BoundaryContribution<Real, Coord> getBoundaryContribution();
+		bool isAdaptive();
+		bool isGathered();
+
 	public:
 		VarField<Real> m_restDensity;
 		VarField<Real> m_smoothingLength;
+		/// Mass of the reference particle, forwarded to the density summation
+		VarField<Real> m_mass;
 
 		DeviceArrayField<Coord> m_position;
 		DeviceArrayField<Coord> m_velocity;
 		DeviceArrayField<Real> m_massInv; // mass^-1 as described in unified particle physics
 
+		/*!
+		*	\brief	Optional relative mass and support radius of each particle for adaptive resolution. When both are set,
+		*			iterations are Jacobi ones with gathered corrections, and m_massInv as well as the Gauss-Seidel
+		*			and fused options are ignored.
+		*/
+		DeviceArrayField<Real> m_particleMass;
+		DeviceArrayField<Real> m_particleRadius;
+
 		NeighborField<int> m_neighborhood;
 
 		DeviceArrayField<Real> m_density;
+
+		/*!
+		*	\brief	Multipliers accumulated over the last time step, only updated when warm starting is enabled.
+		*/
+		DeviceArrayField<Real> m_accLambda;
 	private:
-		int m_maxIteration;
+		bool m_gatherDisplacement;
+		bool m_gaussSeidel;
+		bool m_fusedDensity;
+		bool m_warmStart;
+		Real m_warmStartFactor;
+
+		GridHash<TDataType>* m_hash;
 
 		DeviceArray<Real> m_lamda;
 		DeviceArray<Coord> m_deltaPos;
 		DeviceArray<Coord> m_position_old;
+		DeviceArray<Coord> m_entryDelta;
 
 		std::shared_ptr<DensitySummation<TDataType>> m_densitySum;
+		std::shared_ptr<GraphColoring> m_coloring;
+		std::shared_ptr<NeighborScatter> m_scatter;
+		std::shared_ptr<ResidualMax<Real>> m_residual;
+		std::shared_ptr<BoundaryParticles<TDataType>> m_boundary;
 	};
 
 
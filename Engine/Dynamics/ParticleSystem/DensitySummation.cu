@@ -3,25 +3,26 @@
 #include "Framework/Framework/MechanicalState.h"
 #include "Framework/Framework/Node.h"
 #include "Core/Utility.h"
+#include "Framework/Topology/CellBlock.h"
 #include "Kernel.h"
+#include "BoundaryParticles.h"
 
 namespace Physika
 {
 	IMPLEMENT_CLASS_1(DensitySummation, TDataType)
 
-	template<typename Real, typename Coord>
+	template<typename Real, typename Coord, typename TKernel>
 	__global__ void K_ComputeDensity(
 		DeviceArray<Real> rhoArr,
 		DeviceArray<Coord> posArr,
 		NeighborList<int> neighbors,
-		Real smoothingLength,
+		TKernel kern,
 		Real mass
 	)
 	{
 		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
 		if (pId >= posArr.size()) return;
 
-		SpikyKernel<Real> kern;
 		Real r;
 		Real rho_i = Real(0);
 		Coord pos_i = posArr[pId];
@@ -30,15 +31,82 @@ namespace Physika
 		{
 			int j = neighbors.getElement(pId, ne);
 			r = (pos_i - posArr[j]).norm();
-			rho_i += mass*kern.Weight(r, smoothingLength);
+			rho_i += mass*kern.Weight(r);
+		}
+		rhoArr[pId] = rho_i;
+	}
+
+	/*!
+	*	\brief	Density of particles of varying mass and support radius, pairs are evaluated with the mean support radius.
+	*/
+	template<typename Real, typename Coord, typename TKernel>
+	__global__ void DS_ComputeAdaptiveDensity(
+		DeviceArray<Real> rhoArr,
+		DeviceArray<Coord> posArr,
+		DeviceArray<Real> massArr,
+		DeviceArray<Real> radiusArr,
+		NeighborList<int> neighbors,
+		TKernel kern,
+		Real mass)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		Real rho_i = Real(0);
+		Coord pos_i = posArr[pId];
+		Real h_i = radiusArr[pId];
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			Real r = (pos_i - posArr[j]).norm();
+			Real h_ij = Real(0.5)*(h_i + radiusArr[j]);
+			rho_i += mass*massArr[j]*kern.Weight(r, h_ij);
 		}
 		rhoArr[pId] = rho_i;
 	}
 
+	template<typename Real, typename Coord, typename TKernel>
+	__global__ void DS_AddBoundaryDensity(
+		DeviceArray<Real> rhoArr,
+		DeviceArray<Coord> posArr,
+		BoundaryContribution<Real, Coord> boundary,
+		TKernel kern)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		Real rho_b = Real(0);
+		Coord grad_b(0);
+		boundary.accumulate(pId, posArr[pId], kern, rho_b, grad_b);
+
+		rhoArr[pId] += rho_b;
+	}
+
+	template<typename Real, typename Coord>
+	struct DS_DensityGather
+	{
+		typedef Real AccType;
+
+		DeviceArray<Real> rhoArr;
+		SpikyKernel<Real> kern;
+		Real mass;
+
+		COMM_FUNC AccType init(int i) { return Real(0); }
+
+		COMM_FUNC void accumulate(AccType& rho_i, int i, int j, Coord x_ij, Real r)
+		{
+			rho_i += mass*kern.Weight(r);
+		}
+
+		COMM_FUNC void write(int i, AccType& rho_i) { rhoArr[i] = rho_i; }
+	};
+
 	template<typename TDataType>
 	DensitySummation<TDataType>::DensitySummation()
 		: ComputeModule()
 		, m_factor(Real(1))
+		, m_hash(nullptr)
 	{
 		m_mass.setValue(Real(1));
 		m_restDensity.setValue(Real(1000));
@@ -56,6 +124,11 @@ namespace Physika
 	template<typename TDataType>
 	void DensitySummation<TDataType>::compute()
 	{
+		if (m_density.getElementCount() != m_position.getElementCount())
+		{
+			m_density.setElementCount(m_position.getElementCount());
+		}
+
 		compute(
 			m_density.getValue(),
 			m_position.getValue(),
@@ -84,8 +157,84 @@ namespace Physika
 		Real smoothingLength,
 		Real mass)
 	{
+		//The stencil of the hash only covers the support if its cells are at least as large
+		if (m_hash != nullptr && !isAdaptive(pos.size()) && m_hash->ds >= smoothingLength)
+		{
+			//Particles have moved since the hash was built, e.g., by the integrator and by earlier solver iterations
+			m_hash->construct(pos);
+			if (m_hash->particle_num == pos.size())
+			{
+				compute(rho, pos, *m_hash, smoothingLength, mass);
+				return;
+			}
+		}
+
 		cuint pDims = cudaGridSize(rho.size(), BLOCK_SIZE);
-		K_ComputeDensity <Real, Coord> << <pDims, BLOCK_SIZE >> > (rho, pos, neighbors, smoothingLength, m_factor*mass);
+		if (isAdaptive(pos.size()))
+		{
+			DS_ComputeAdaptiveDensity <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+				rho,
+				pos,
+				m_particleMass.getValue(),
+				m_particleRadius.getValue(),
+				neighbors,
+				SpikyKernel<Real>(smoothingLength),
+				m_factor*mass);
+		}
+		else
+		{
+			K_ComputeDensity <Real, Coord> << <pDims, BLOCK_SIZE >> > (rho, pos, neighbors, SpikyKernel<Real>(smoothingLength), m_factor*mass);
+		}
+
+		addBoundaryDensity(rho, pos, smoothingLength, mass);
+	}
+
+	template<typename TDataType>
+	void DensitySummation<TDataType>::compute(
+		DeviceArray<Real>& rho,
+		DeviceArray<Coord>& pos,
+		GridHash<TDataType>& hash,
+		Real smoothingLength,
+		Real mass)
+	{
+		if (m_cellBlock == nullptr)
+		{
+			m_cellBlock = std::make_shared<CellBlock<TDataType>>();
+		}
+		m_cellBlock->update(hash);
+
+		DS_DensityGather<Real, Coord> func;
+		func.rhoArr = rho;
+		func.kern = SpikyKernel<Real>(smoothingLength);
+		func.mass = m_factor*mass;
+
+		//particles outside the hash are not visited
+		rho.reset();
+		m_cellBlock->gather(hash, pos, func, smoothingLength);
+
+		addBoundaryDensity(rho, pos, smoothingLength, mass);
+	}
+
+	template<typename TDataType>
+	bool DensitySummation<TDataType>::isAdaptive(int num)
+	{
+		return !m_particleMass.isEmpty() && !m_particleRadius.isEmpty()
+			&& m_particleMass.getElementCount() == num
+			&& m_particleRadius.getElementCount() == num;
+	}
+
+	template<typename TDataType>
+	void DensitySummation<TDataType>::addBoundaryDensity(DeviceArray<Real>& rho, DeviceArray<Coord>& pos, Real smoothingLength, Real mass)
+	{
+		if (m_boundary == nullptr || m_boundary->getNeighbors().size() != pos.size())
+			return;
+
+		cuint pDims = cudaGridSize(pos.size(), BLOCK_SIZE);
+		DS_AddBoundaryDensity <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+			rho,
+			pos,
+			m_boundary->getContribution(m_restDensity.getValue(), m_factor*mass),
+			SpikyKernel<Real>(smoothingLength));
 	}
 
 	template<typename TDataType>
@@ -7,6 +7,9 @@
 namespace Physika {
 
 	template<typename TDataType> class NeighborList;
+	template<typename TDataType> class GridHash;
+	template<typename TDataType> class CellBlock;
+	template<typename TDataType> class BoundaryParticles;
 
 	template<typename TDataType>
 	class DensitySummation : public ComputeModule
@@ -31,8 +34,32 @@ namespace Physika {
 			Real smoothingLength,
 			Real mass);
 
+		/*!
+		*	\brief	Cell-blocked variant, particles of each cell are evaluated against a shared tile of their neighboring cells.
+		*			The hash must have been constructed from pos.
+		*/
+		void compute(
+			DeviceArray<Real>& rho,
+			DeviceArray<Coord>& pos,
+			GridHash<TDataType>& hash,
+			Real smoothingLength,
+			Real mass);
+
 		void setCorrection(Real factor) { m_factor = factor; }
+		Real getCorrection() { return m_factor; }
 		void setSmoothingLength(Real length) { m_smoothingLength.setValue(length); }
+
+		/*!
+		*	\brief	Sum densities cell-blocked over the hash of a NeighborQuery instead of traversing the neighbor list.
+		*			The cells of the hash are reassigned from the current positions before each summation. The neighbor list
+		*			is still used for adaptive particles, or when particles have left the hashed domain.
+		*/
+		void setGridHash(GridHash<TDataType>* hash) { m_hash = hash; }
+
+		/*!
+		*	\brief	Add the density of the boundary particles, their neighbors must have been queried for the current positions.
+		*/
+		void setBoundaryParticles(std::shared_ptr<BoundaryParticles<TDataType>> boundary) { m_boundary = boundary; }
 	
 	protected:
 		bool initializeImpl() override;
@@ -47,8 +74,22 @@ namespace Physika {
 
 		NeighborField<int> m_neighborhood;
 
+		/*!
+		*	\brief	Optional mass of each particle relative to m_mass and its support radius, used by the neighbor list variant
+		*			when both are set for all particles. They are not attached so that uniform particles need not provide them.
+		*/
+		DeviceArrayField<Real> m_particleMass;
+		DeviceArrayField<Real> m_particleRadius;
+
 	private:
+		bool isAdaptive(int num);
+		void addBoundaryDensity(DeviceArray<Real>& rho, DeviceArray<Coord>& pos, Real smoothingLength, Real mass);
+
 		Real m_factor;
+
+		GridHash<TDataType>* m_hash;
+		std::shared_ptr<CellBlock<TDataType>> m_cellBlock;
+		std::shared_ptr<BoundaryParticles<TDataType>> m_boundary;
 	};
 
 #ifdef PRECISION_FLOAT
@@ -0,0 +1,386 @@
+#include <cuda_runtime.h>
+#include "Core/Utility.h"
+#include "DivergenceFreeSPH.h"
+#include "Framework/Framework/Node.h"
+#include "Kernel.h"
+#include "DensitySummation.h"
+#include "Framework/Topology/FieldNeighbor.h"
+#include "Core/Utility/ResidualMax.h"
+
+namespace Physika
+{
+	IMPLEMENT_CLASS_1(DivergenceFreeSPH, TDataType)
+
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void DF_ComputeAlpha(
+		DeviceArray<Real> alpha,
+		DeviceArray<Coord> posArr,
+		NeighborList<int> neighbors,
+		BoundaryContribution<Real, Coord> boundary,
+		TKernel kern,
+		Real mass)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		Coord pos_i = posArr[pId];
+
+		//Boundary particles do not move, so they only add to the gradient of the particle itself
+		Real rho_b = Real(0);
+		Coord grad_b(0);
+		boundary.accumulate(pId, pos_i, kern, rho_b, grad_b);
+
+		Coord grad_ci = mass*grad_b;
+		Real sum_sq = Real(0);
+
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			Coord x_ij = pos_i - posArr[j];
+			Real r = x_ij.norm();
+
+			if (r > EPSILON)
+			{
+				Coord g = mass*kern.Gradient(r)*x_ij * (1.0f / r);
+				grad_ci += g;
+				sum_sq += g.dot(g);
+			}
+		}
+
+		Real denom = grad_ci.dot(grad_ci) + sum_sq;
+
+		alpha[pId] = denom > Real(1e-6) ? Real(1) / denom : Real(0);
+	}
+
+	/*!
+	*	\brief	Stiffness of each particle from its predicted density error. For the density solve, the error is the density
+	*			at the predicted positions plus the change caused by the velocity corrections so far, for the divergence solve
+	*			it is the density change over one time step caused by the current velocities. Only compression is corrected.
+	*/
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void DF_ComputeStiffness(
+		DeviceArray<Real> stiffness,
+		DeviceArray<Real> alpha,
+		DeviceArray<Real> rhoArr,
+		DeviceArray<Coord> posArr,
+		DeviceArray<Coord> velArr,
+		DeviceArray<Coord> velOld,
+		NeighborList<int> neighbors,
+		BoundaryContribution<Real, Coord> boundary,
+		TKernel kern,
+		Real mass,
+		Real restDensity,
+		Real dt,
+		bool densitySolve,
+		Real* residual)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+
+		Real err_i = Real(0);
+		if (pId < posArr.size())
+		{
+			Coord pos_i = posArr[pId];
+			Coord u_i = densitySolve ? velArr[pId] - velOld[pId] : velArr[pId];
+
+
+			//Boundary particles are at rest
+			Real rho_b = Real(0);
+			Coord grad_b(0);
+			boundary.accumulate(pId, pos_i, kern, rho_b, grad_b);
+
+			Real div_i = mass*u_i.dot(grad_b);
+			int nbSize = neighbors.getNeighborSize(pId);
+			for (int ne = 0; ne < nbSize; ne++)
+			{
+				int j = neighbors.getElement(pId, ne);
+				Coord x_ij = pos_i - posArr[j];
+				Real r = x_ij.norm();
+
+				if (r > EPSILON)
+				{
+					Coord u_j = densitySolve ? velArr[j] - velOld[j] : velArr[j];
+					div_i += mass*(u_i - u_j).dot(kern.Gradient(r)*x_ij * (1.0f / r));
+				}
+			}
+
+			Real drho_i = (densitySolve ? rhoArr[pId] - restDensity : Real(0)) + dt*div_i;
+			drho_i = drho_i > Real(0) ? drho_i : Real(0);
+
+			stiffness[pId] = drho_i*alpha[pId] / (dt*dt);
+
+			err_i = drho_i / restDensity;
+		}
+
+		if (residual != nullptr)
+			RS_WarpMax(residual, err_i);
+	}
+
+	template <typename Real, typename Coord, typename TKernel>
+	__global__ void DF_UpdateVelocity(
+		DeviceArray<Coord> velArr,
+		DeviceArray<Real> stiffness,
+		DeviceArray<Coord> posArr,
+		NeighborList<int> neighbors,
+		BoundaryContribution<Real, Coord> boundary,
+		TKernel kern,
+		Real mass,
+		Real dt)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		Coord pos_i = posArr[pId];
+		Real k_i = stiffness[pId];
+
+		Real rho_b = Real(0);
+		Coord grad_b(0);
+		boundary.accumulate(pId, pos_i, kern, rho_b, grad_b);
+
+		Coord dv_i = mass*k_i*grad_b;
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			Coord x_ij = pos_i - posArr[j];
+			Real r = x_ij.norm();
+
+			if (r > EPSILON)
+			{
+				dv_i += mass*(k_i + stiffness[j])*kern.Gradient(r)*x_ij * (1.0f / r);
+			}
+		}
+
+		velArr[pId] -= dt*dv_i;
+	}
+
+	template <typename Real, typename Coord>
+	__global__ void DF_UpdatePosition(
+		DeviceArray<Coord> posArr,
+		DeviceArray<Coord> velArr,
+		DeviceArray<Coord> velOld,
+		Real dt)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		posArr[pId] += dt*(velArr[pId] - velOld[pId]);
+	}
+
+
+	template<typename TDataType>
+	DivergenceFreeSPH<TDataType>::DivergenceFreeSPH()
+		: ConstraintModule()
+		, m_divergenceSolve(true)
+	{
+		m_iterationPolicy.setIterationBounds(2, 100);
+		m_iterationPolicy.setTargetResidual(0.01f);
+
+		m_divergencePolicy.setIterationBounds(1, 100);
+		m_divergencePolicy.setTargetResidual(0.01f);
+
+		m_restDensity.setValue(Real(1000));
+		m_smoothingLength.setValue(Real(0.011));
+
+		attachField(&m_restDensity, "rest_density", "Reference density", false);
+		attachField(&m_smoothingLength, "smoothing_length", "The smoothing length in SPH!", false);
+		attachField(&m_position, "position", "Storing the particle positions!", false);
+		attachField(&m_velocity, "velocity", "Storing the particle velocities!", false);
+		attachField(&m_density, "density", "Storing the particle densities!", false);
+		attachField(&m_neighborhood, "neighborhood", "Storing neighboring particles' ids!", false);
+	}
+
+	template<typename TDataType>
+	DivergenceFreeSPH<TDataType>::~DivergenceFreeSPH()
+	{
+		m_alpha.release();
+		m_stiffness.release();
+		m_velocity_old.release();
+	}
+
+	template<typename TDataType>
+	bool DivergenceFreeSPH<TDataType>::initializeImpl()
+	{
+		if (!m_position.isEmpty() && m_density.isEmpty())
+		{
+			m_density.setElementCount(m_position.getElementCount());
+		}
+
+		if (!isAllFieldsReady())
+		{
+			std::cout << "Exception: " << std::string("DivergenceFreeSPH's fields are not fully initialized!") << std::endl;
+			return false;
+		}
+
+		m_densitySum = std::make_shared<DensitySummation<TDataType>>();
+
+		m_restDensity.connect(m_densitySum->m_restDensity);
+		m_smoothingLength.connect(m_densitySum->m_smoothingLength);
+		m_position.connect(m_densitySum->m_position);
+		m_density.connect(m_densitySum->m_density);
+		m_neighborhood.connect(m_densitySum->m_neighborhood);
+
+		m_densitySum->initialize();
+		m_densitySum->setBoundaryParticles(m_boundary);
+
+		int num = m_position.getElementCount();
+
+		m_alpha.resize(num);
+		m_stiffness.resize(num);
+		m_velocity_old.resize(num);
+
+		m_residual = std::make_shared<ResidualMax<Real>>();
+
+		return true;
+	}
+
+	template<typename TDataType>
+	void DivergenceFreeSPH<TDataType>::computeAlpha()
+	{
+		int num = m_position.getElementCount();
+		uint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+		DF_ComputeAlpha <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+			m_alpha,
+			m_position.getValue(),
+			m_neighborhood.getValue(),
+			getBoundaryContribution(),
+			SpikyKernel<Real>(m_smoothingLength.getValue()),
+			m_densitySum->m_mass.getValue()*m_densitySum->getCorrection());
+		cuSynchronize();
+	}
+
+	template<typename TDataType>
+	void DivergenceFreeSPH<TDataType>::solve(IterationPolicy& policy, bool densitySolve)
+	{
+		int num = m_position.getElementCount();
+		uint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+		Real dt = this->getParent()->getDt();
+		Real mass = m_densitySum->m_mass.getValue()*m_densitySum->getCorrection();
+		bool hasTarget = policy.hasTarget();
+		BoundaryContribution<Real, Coord> boundary = getBoundaryContribution();
+
+		int it = 0;
+		float residual = std::numeric_limits<float>::max();
+		while (policy.proceed(it, residual))
+		{
+			if (hasTarget)
+				m_residual->reset();
+
+			DF_ComputeStiffness <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+				m_stiffness,
+				m_alpha,
+				m_density.getValue(),
+				m_position.getValue(),
+				m_velocity.getValue(),
+				m_velocity_old,
+				m_neighborhood.getValue(),
+				boundary,
+				SpikyKernel<Real>(m_smoothingLength.getValue()),
+				mass,
+				m_restDensity.getValue(),
+				dt,
+				densitySolve,
+				hasTarget ? m_residual->getDataPtr() : nullptr);
+
+			DF_UpdateVelocity <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+				m_velocity.getValue(),
+				m_stiffness,
+				m_position.getValue(),
+				m_neighborhood.getValue(),
+				boundary,
+				SpikyKernel<Real>(m_smoothingLength.getValue()),
+				mass,
+				dt);
+
+			it++;
+			residual = hasTarget ? m_residual->getValue() : -1.0f;
+		}
+		cuSynchronize();
+	}
+
+	template<typename TDataType>
+	bool DivergenceFreeSPH<TDataType>::constrain()
+	{
+		int num = m_position.getElementCount();
+		uint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+		//Particles were emitted or removed since the last step
+		if (m_alpha.size() != num)
+		{
+			m_alpha.setSize(num);
+			m_stiffness.setSize(num);
+			m_velocity_old.setSize(num);
+		}
+
+		Real dt = this->getParent()->getDt();
+
+		//Density solve on the positions predicted by the integrator
+		Function1Pt::copy(m_velocity_old, m_velocity.getValue());
+
+		queryBoundary();
+		m_densitySum->compute();
+		computeAlpha();
+		solve(m_iterationPolicy, true);
+
+		DF_UpdatePosition <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+			m_position.getValue(),
+			m_velocity.getValue(),
+			m_velocity_old,
+			dt);
+		cuSynchronize();
+
+		//Divergence solve on the corrected positions
+		if (m_divergenceSolve)
+		{
+			queryBoundary();
+			m_densitySum->compute();
+			computeAlpha();
+			solve(m_divergencePolicy, false);
+		}
+
+		return true;
+	}
+
+	template<typename TDataType>
+	void DivergenceFreeSPH<TDataType>::setBoundaryParticles(std::shared_ptr<BoundaryParticles<TDataType>> boundary)
+	{
+		m_boundary = boundary;
+		if (m_densitySum != nullptr)
+		{
+			m_densitySum->setBoundaryParticles(boundary);
+		}
+	}
+
+	template<typename TDataType>
+	void DivergenceFreeSPH<TDataType>::queryBoundary()
+	{
+		if (m_boundary == nullptr)
+			return;
+
+		if (!m_boundary->isInitialized())
+			m_boundary->setSmoothingLength(m_smoothingLength.getValue());
+		m_boundary->queryNeighbors(m_position.getValue());
+	}
+
+	template<typename TDataType>
+	BoundaryContribution<typename TDataType::Real, typename TDataType::Coord> DivergenceFreeSPH<TDataType>::getBoundaryContribution()
+	{
+		if (m_boundary == nullptr || m_boundary->getNeighbors().size() != m_position.getElementCount())
+		{
+			BoundaryContribution<Real, Coord> none;
+			none.valid = false;
+			return none;
+		}
+
+		Real mass = m_densitySum->m_mass.getValue()*m_densitySum->getCorrection();
+		return m_boundary->getContribution(m_restDensity.getValue(), mass);
+	}
+
+#ifdef PRECISION_FLOAT
+	template class DivergenceFreeSPH<DataType3f>;
+#else
+	template class DivergenceFreeSPH<DataType3d>;
+#endif
+}
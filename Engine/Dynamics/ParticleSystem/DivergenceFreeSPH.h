@@ -0,0 +1,84 @@
+#pragma once
+#include "Core/Array/Array.h"
+#include "Framework/Framework/ModuleConstraint.h"
+#include "Framework/Framework/FieldVar.h"
+#include "Framework/Framework/FieldArray.h"
+#include "Framework/Topology/FieldNeighbor.h"
+#include "BoundaryParticles.h"
+
+namespace Physika {
+
+	template<typename TDataType> class DensitySummation;
+	template<typename Real> class ResidualMax;
+
+	/*!
+	*	\class	DivergenceFreeSPH
+	*	\brief	This class implements the divergence-free SPH solver for incompressibility.
+	*
+	*	Refer to Bender and Koschier's "Divergence-Free Smoothed Particle Hydrodynamics" for details.
+	*	The module runs after the particle integrator and corrects the predicted velocities in two solves:
+	*	the density solve removes compression of the predicted positions and moves the particles accordingly,
+	*	the divergence solve then removes the compressive part of the velocity divergence at the corrected positions.
+	*	Both solves share the per-particle factors alpha, which only depend on the particle configuration.
+	*
+	*	The density solve is controlled by the iteration policy of the module, the divergence solve by getDivergencePolicy().
+	*	Residuals are the maximum relative density error, and the maximum relative density change over one time step respectively.
+	*/
+	template<typename TDataType>
+	class DivergenceFreeSPH : public ConstraintModule
+	{
+		DECLARE_CLASS_1(DivergenceFreeSPH, TDataType)
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+
+		DivergenceFreeSPH();
+		~DivergenceFreeSPH() override;
+
+		bool constrain() override;
+
+		void setDivergenceSolve(bool enabled) { m_divergenceSolve = enabled; }
+
+		IterationPolicy& getDivergencePolicy() { return m_divergencePolicy; }
+
+		DeviceArray<Real>& getDensity() { return m_density.getValue(); }
+
+		/*!
+		*	\brief	Read the boundary particles as static neighbors, they contribute to the densities, the factors alpha and
+		*			the divergence of each particle, and are pushed against by the stiffness of the particle alone.
+		*/
+		void setBoundaryParticles(std::shared_ptr<BoundaryParticles<TDataType>> boundary);
+
+	protected:
+		bool initializeImpl() override;
+
+	private:
+		void computeAlpha();
+		void solve(IterationPolicy& policy, bool densitySolve);
+		void queryBoundary();
+		BoundaryContribution<Real, Coord> getBoundaryContribution();
+
+	public:
+		VarField<Real> m_restDensity;
+		VarField<Real> m_smoothingLength;
+
+		DeviceArrayField<Coord> m_position;
+		DeviceArrayField<Coord> m_velocity;
+
+		NeighborField<int> m_neighborhood;
+
+		DeviceArrayField<Real> m_density;
+
+	private:
+		bool m_divergenceSolve;
+		IterationPolicy m_divergencePolicy;
+
+		DeviceArray<Real> m_alpha;
+		DeviceArray<Real> m_stiffness;
+		DeviceArray<Coord> m_velocity_old;
+
+		std::shared_ptr<DensitySummation<TDataType>> m_densitySum;
+		std::shared_ptr<ResidualMax<Real>> m_residual;
+		std::shared_ptr<BoundaryParticles<TDataType>> m_boundary;
+	};
+}
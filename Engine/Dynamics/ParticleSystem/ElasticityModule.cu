@@ -4,7 +4,9 @@
 #include "Core/Algorithm/MatrixFunc.h"
 #include "Core/Utility.h"
 #include "Kernel.h"
-
+#include "Core/Utility/ResidualMax.h"
+#include "ParticleSleeping.h"
+
 namespace Physika
 {
 	template<typename Real>
@@ -118,7 +120,11 @@ namespace Physika
 		return 10.0f;
 	}
 
-	template <typename Real, typename Coord, typename Matrix, typename NPair>
+	/*!
+	*	\brief	The weight kernel is either a CorrectedKernel bound to the horizon or its tabulated form.
+	*			Threads map to the first activeNum entries of activeIndex, or directly to the particles if it is null.
+	*/
+	template <typename Real, typename Coord, typename Matrix, typename NPair, typename TKernel>
 	__global__ void EM_EnforceElasticity(
 		DeviceArray<Coord> delta_position,
 		DeviceArray<Real> weights,
@@ -126,16 +132,19 @@ namespace Physika
 		DeviceArray<Matrix> invK,
 		DeviceArray<Coord> position,
 		NeighborList<NPair> restShapes,
+		TKernel g_weightKernel,
 		Real horizon,
 		Real distance,
 		Real mu,
-		Real lambda)
+		Real lambda,
+		int* activeIndex,
+		int activeNum)
 	{
 
-		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= position.size()) return;
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (tId >= activeNum) return;
 
-		CorrectedKernel<Real> g_weightKernel;
+		int pId = activeIndex == nullptr ? tId : activeIndex[tId];
 
 		NPair np_i = restShapes.getElement(pId, 0);
 		Coord rest_i = np_i.pos;
@@ -160,8 +169,8 @@ namespace Physika
 
 			if (r > EPSILON)
 			{
-				Real weight = g_weightKernel.Weight(r, horizon);
-
+				Real weight = g_weightKernel.Weight(r);
+
 				Coord p = (position[j] - position[pId]) / horizon;
 				Coord q = (rest_j - rest_i) / horizon*weight;
 
@@ -202,7 +211,7 @@ namespace Physika
 
 			if (r > 0.01f*horizon)
 			{
-				Real weight = g_weightKernel.WeightRR(r, horizon);
+				Real weight = g_weightKernel.WeightRR(r);
 
 				Coord rest_dir_ij = deform_i*(rest_i - rest_j);
 				Coord cur_dir_ij = cur_pos_i - cur_pos_j;
@@ -210,11 +219,11 @@ namespace Physika
 				cur_dir_ij = cur_dir_ij.norm() > EPSILON ? cur_dir_ij.normalize() : Coord(0);
 				rest_dir_ij = rest_dir_ij.norm() > EPSILON ? rest_dir_ij.normalize() : Coord(0, 0, 0);
 
-				Real mu_ij = mu*bulk_i* g_weightKernel.WeightRR(r, horizon);
+				Real mu_ij = mu*bulk_i* g_weightKernel.WeightRR(r);
 				Coord mu_pos_ij = position[j] + r*rest_dir_ij;
 				Coord mu_pos_ji = position[pId] - r*rest_dir_ij;
 
-				Real lambda_ij = lambda*bulk_i*g_weightKernel.WeightRR(r, horizon);
+				Real lambda_ij = lambda*bulk_i*g_weightKernel.WeightRR(r);
 				Coord lambda_pos_ij = position[j] + r*cur_dir_ij;
 				Coord lambda_pos_ji = position[pId] - r*cur_dir_ij;
 
@@ -273,18 +282,35 @@ namespace Physika
 //		position[pId] += delta_pos_i;		position[pId] += delta_position[pId];
 	}
 
+	/*!
+	*	\brief	Also folds the maximum position change of this iteration into residual when it is not null.
+	*			Particles outside the active set keep their positions.
+	*/
 	template <typename Real, typename Coord>
 	__global__ void K_UpdatePosition(
 		DeviceArray<Coord> position,
 		DeviceArray<Coord> old_position,
 		DeviceArray<Coord> delta_position,
-		DeviceArray<Real> delta_weights)
+		DeviceArray<Real> delta_weights,
+		int* activeIndex,
+		int activeNum,
+		Real* residual)
 	{
-		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= position.size()) return;
-		position[pId] = (old_position[pId] + delta_position[pId]) / (1.0+delta_weights[pId]);
-	}
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
 
+		Real err_i = Real(0);
+		if (tId < activeNum)
+		{
+			int pId = activeIndex == nullptr ? tId : activeIndex[tId];
+			Coord new_pos_i = (old_position[pId] + delta_position[pId]) / (1.0 + delta_weights[pId]);
+			err_i = (new_pos_i - position[pId]).norm();
+			position[pId] = new_pos_i;
+		}
+
+		if (residual != nullptr)
+			RS_WarpMax(residual, err_i);
+	}
+
 
 	template <typename Real, typename Coord>
 	__global__ void K_UpdateVelocity(
@@ -302,7 +328,10 @@ namespace Physika
 	template<typename TDataType>
 	ElasticityModule<TDataType>::ElasticityModule()
 		: ConstraintModule()
+		, m_tableHorizon(0)
 	{
+		m_iterationPolicy.setMaxIteration(3);
+
 		this->attachField(&m_horizon, "horizon", "Supporting radius!", false);
 		this->attachField(&m_distance, "distance", "The sampling distance!", false);
 		this->attachField(&m_mu, "mu", "Material stiffness!", false);
@@ -327,35 +356,99 @@ namespace Physika
 		m_invK.release();
 		m_F.release();
 		m_position_old.release();
+
+		if (m_kernelTable != nullptr)
+		{
+			m_kernelTable->release();
+		}
+	}
+
+	template<typename TDataType>
+	void ElasticityModule<TDataType>::setTabulatedKernel(bool enabled)
+	{
+		if (!enabled && m_kernelTable != nullptr)
+		{
+			m_kernelTable->release();
+			m_kernelTable = nullptr;
+		}
+		else if (enabled && m_kernelTable == nullptr)
+		{
+			m_kernelTable = std::make_shared<TabulatedKernel<Real>>();
+		}
 	}
 
 	template<typename TDataType>
 	void ElasticityModule<TDataType>::enforceElasticity()
-	{
-		int num = m_position.getElementCount();
+	{
+		int num = m_position.getElementCount();
+
+		//Sleeping particles act as fixed anchors for their awake neighbors
+		int* activeIndex = nullptr;
+		if (m_sleeping != nullptr)
+		{
+			num = m_sleeping->getActiveNumber();
+			activeIndex = m_sleeping->getActiveIndex().getDataPtr();
+		}
+		if (num <= 0) return;
+
 		uint pDims = cudaGridSize(num, BLOCK_SIZE);
 
 		m_displacement.reset();
 		m_weights.reset();
 
-		EM_EnforceElasticity << <pDims, BLOCK_SIZE >> > (
-			m_displacement,
-			m_weights,
-			m_bulkCoefs,
-			m_invK,
-			m_position.getValue(),
-			m_restShape.getValue(),
-			m_horizon.getValue(),
-			m_distance.getValue(),
-			m_mu.getValue(),
-			m_lambda.getValue());
-		cuSynchronize();
+		Real horizon = m_horizon.getValue();
+		if (m_kernelTable != nullptr)
+		{
+			//Rebuild the table once the horizon changes
+			if (m_kernelTable->isEmpty() || m_tableHorizon != horizon)
+			{
+				m_kernelTable->release();
+				m_kernelTable->build(CorrectedKernel<Real>(horizon));
+				m_tableHorizon = horizon;
+			}
 
+			EM_EnforceElasticity << <pDims, BLOCK_SIZE >> > (
+				m_displacement,
+				m_weights,
+				m_bulkCoefs,
+				m_invK,
+				m_position.getValue(),
+				m_restShape.getValue(),
+				*m_kernelTable,
+				horizon,
+				m_distance.getValue(),
+				m_mu.getValue(),
+				m_lambda.getValue(),
+				activeIndex,
+				num);
+		}
+		else
+		{
+			EM_EnforceElasticity << <pDims, BLOCK_SIZE >> > (
+				m_displacement,
+				m_weights,
+				m_bulkCoefs,
+				m_invK,
+				m_position.getValue(),
+				m_restShape.getValue(),
+				CorrectedKernel<Real>(horizon),
+				horizon,
+				m_distance.getValue(),
+				m_mu.getValue(),
+				m_lambda.getValue(),
+				activeIndex,
+				num);
+		}
+		cuSynchronize();
+
 		K_UpdatePosition << <pDims, BLOCK_SIZE >> > (
 			m_position.getValue(),
 			m_position_old,
 			m_displacement,
-			m_weights);
+			m_weights,
+			activeIndex,
+			num,
+			m_iterationPolicy.hasTarget() && m_residual != nullptr ? m_residual->getDataPtr() : nullptr);
 		cuSynchronize();
 	}
 
@@ -400,14 +493,25 @@ namespace Physika
 
 		this->computeInverseK();
 
+		if (m_residual == nullptr)
+		{
+			m_residual = std::make_shared<ResidualMax<Real>>();
+		}
+		bool hasTarget = m_iterationPolicy.hasTarget();
+
 		int itor = 0;
-		while (itor < m_iterNum)
+		float residual = std::numeric_limits<float>::max();
+		while (m_iterationPolicy.proceed(itor, residual))
 		{
+			if (hasTarget)
+				m_residual->reset();
+
 			this->enforceElasticity();
 
 			itor++;
+			residual = hasTarget ? m_residual->getValue() : -1.0f;
 		}
-
+
 		this->updateVelocity();
 	}
 
@@ -6,6 +6,9 @@
 #include "NeighborData.h"
 
 namespace Physika {
+	template<typename Real> class ResidualMax;
+	template<typename Real> class TabulatedKernel;
+	template<typename TDataType> class ParticleSleeping;
 
 	template<typename TDataType>
 	class ElasticityModule : public ConstraintModule
@@ -27,8 +30,18 @@ namespace Physika {
 		void setLambda(Real lambda) { m_lambda.setValue(lambda); }
 
 		void setHorizon(Real len) { m_horizon.setValue(len); }
-		void setIterationNumber(int num) { m_iterNum = num; }
-		int getIterationNumber() { return m_iterNum; }
+		void setIterationNumber(int num) { m_iterationPolicy.setMaxIteration(num); }
+		int getIterationNumber() { return m_iterationPolicy.getMaxIteration(); }
+
+		/**
+		 * @brief Evaluate the weight kernel from a lookup table on (r/h)^2 instead of analytically
+		 */
+		void setTabulatedKernel(bool enabled);
+
+		/**
+		 * @brief Only correct the particles in the active set of the given module, the sleeping ones keep their positions
+		 */
+		void setSleeping(std::shared_ptr<ParticleSleeping<TDataType>> sleeping) { m_sleeping = sleeping; }
 
 		void resetRestShape();
 
@@ -87,11 +100,19 @@ namespace Physika {
 		DeviceArray<Real> m_weights;
 		DeviceArray<Coord> m_displacement;
 		DeviceArray<Matrix> m_invK;
-	private:
-		int m_iterNum = 3;
 
+		/**
+		* @brief Maximum position change of the last iteration, only filled when the iteration policy has a target
+		*/
+		std::shared_ptr<ResidualMax<Real>> m_residual;
+
+		std::shared_ptr<ParticleSleeping<TDataType>> m_sleeping;
+	private:
 		DeviceArray<Real> m_stiffness;
 		DeviceArray<Matrix> m_F;
+
+		Real m_tableHorizon;
+		std::shared_ptr<TabulatedKernel<Real>> m_kernelTable;
 	};
 
 #ifdef PRECISION_FLOAT
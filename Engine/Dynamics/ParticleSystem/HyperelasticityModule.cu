@@ -10,10 +10,15 @@ namespace Physika
 	HyperelasticityModule<TDataType>::HyperelasticityModule()
 		: ElasticityModule<TDataType>()
 		, m_energyType(Linear)
+		, m_doubleAccumulation(false)
 	{
 	}
 
-	template <typename Real, typename Coord, typename Matrix, typename NPair, typename Function>
+	/*!
+	*	\brief	Per-particle sums (the first invariant, the deformation tensor and the projection weights) are accumulated in Acc,
+	*			positions and the scattered displacements stay in the storage precision Real.
+	*/
+	template <typename Real, typename Coord, typename Matrix, typename NPair, typename Function, typename Acc>
 	__global__ void HM_EnforceElasticity(
 		DeviceArray<Coord> delta_position,
 		DeviceArray<Real> weights,
@@ -39,13 +44,13 @@ namespace Physika
 
 		Coord cur_pos_i = position[pId];
 
-		Coord accPos = Coord(0);
-		Real accA = Real(0);
+		Acc accPos[3] = { Acc(0), Acc(0), Acc(0) };
+		Acc accA = Acc(0);
 		Real bulk_i = bulkCoefs[pId];
 		
 		//compute the first invariant
-		Real I1_i = Real(0);
-		Real total_weight = Real(0);
+		Acc I1_i = Acc(0);
+		Acc total_weight = Acc(0);
 		for (int ne = 1; ne < size_i; ne++)
 		{
 			NPair np_j = restShapes.getElement(pId, ne);
@@ -65,10 +70,10 @@ namespace Physika
 			}
 		}
 
-		I1_i = total_weight > EPSILON ? I1_i /= total_weight : Real(1);
+		I1_i = total_weight > EPSILON ? I1_i /= total_weight : Acc(1);
 
 		//compute the deformation tensor
-		Matrix deform_i = Matrix(0.0f);
+		Acc deform_acc[3][3] = { { Acc(0) } };
 		for (int ne = 0; ne < size_i; ne++)
 		{
 			NPair np_j = restShapes.getElement(pId, ne);
@@ -84,17 +89,20 @@ namespace Physika
 				Coord p = (position[j] - position[pId]) / horizon;
 				Coord q = (rest_j - rest_i) / horizon*weight;
 
-				deform_i(0, 0) += p[0] * q[0]; deform_i(0, 1) += p[0] * q[1]; deform_i(0, 2) += p[0] * q[2];
-				deform_i(1, 0) += p[1] * q[0]; deform_i(1, 1) += p[1] * q[1]; deform_i(1, 2) += p[1] * q[2];
-				deform_i(2, 0) += p[2] * q[0]; deform_i(2, 1) += p[2] * q[1]; deform_i(2, 2) += p[2] * q[2];
+				for (int k = 0; k < 3; k++)
+					for (int l = 0; l < 3; l++)
+						deform_acc[k][l] += Acc(p[k]) * Acc(q[l]);
 				total_weight += weight;
 			}
 		}
 
 
+		Matrix deform_i = Matrix(0.0f);
 		if (total_weight > EPSILON)
 		{
-			deform_i *= (1.0f / total_weight);
+			for (int k = 0; k < 3; k++)
+				for (int l = 0; l < 3; l++)
+					deform_i(k, l) = Real(deform_acc[k][l] / total_weight);
 			deform_i = deform_i * invK[pId];
 		}
 		else
@@ -136,7 +144,7 @@ namespace Physika
 				Coord mu_pos_ij = position[j] + r*rest_dir_ij;
 				Coord mu_pos_ji = position[pId] - r*rest_dir_ij;
 
-				Real lambda_ij = lambda*bulk_i*func(I1_i)*g_weightKernel.WeightRR(r, horizon);
+				Real lambda_ij = lambda*bulk_i*func(Real(I1_i))*g_weightKernel.WeightRR(r, horizon);
 				Coord lambda_pos_ij = position[j] + r*cur_dir_ij;
 				Coord lambda_pos_ji = position[pId] - r*cur_dir_ij;
 
@@ -146,8 +154,10 @@ namespace Physika
 				Coord delta_pos_ji = mu_ij*mu_pos_ji + lambda_ij*lambda_pos_ji;
 
 				accA += delta_weight_ij;
-				accPos += delta_pos_ij;
-
+				accPos[0] += delta_pos_ij[0];
+				accPos[1] += delta_pos_ij[1];
+				accPos[2] += delta_pos_ij[2];
+
 
 				atomicAdd(&weights[j], delta_weight_ij);
 				atomicAdd(&delta_position[j][0], delta_pos_ji[0]);
@@ -156,10 +166,10 @@ namespace Physika
 			}
 		}
 
-		atomicAdd(&weights[pId], accA);
-		atomicAdd(&delta_position[pId][0], accPos[0]);
-		atomicAdd(&delta_position[pId][1], accPos[1]);
-		atomicAdd(&delta_position[pId][2], accPos[2]);
+		atomicAdd(&weights[pId], Real(accA));
+		atomicAdd(&delta_position[pId][0], Real(accPos[0]));
+		atomicAdd(&delta_position[pId][1], Real(accPos[1]));
+		atomicAdd(&delta_position[pId][2], Real(accPos[2]));
 	}
 
 	template <typename Real, typename Coord>
@@ -175,6 +185,28 @@ namespace Physika
 		position[pId] = (old_position[pId] + delta_position[pId]) / (1.0 + delta_weights[pId]);
 	}
 
+	template<typename TDataType>
+	template<typename Acc, typename Function>
+	void HyperelasticityModule<TDataType>::enforceElasticity(Function func)
+	{
+		int num = this->m_position.getElementCount();
+		uint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+		HM_EnforceElasticity <Real, Coord, Matrix, NPair, Function, Acc> << <pDims, BLOCK_SIZE >> > (
+			this->m_displacement,
+			this->m_weights,
+			this->m_bulkCoefs,
+			this->m_invK,
+			this->m_position.getValue(),
+			this->m_restShape.getValue(),
+			this->m_horizon.getValue(),
+			this->m_distance.getValue(),
+			this->m_mu.getValue(),
+			this->m_lambda.getValue(),
+			func);
+		cuSynchronize();
+	}
+
 	template<typename TDataType>
 	void HyperelasticityModule<TDataType>::enforceElasticity()
 	{
@@ -187,35 +219,17 @@ namespace Physika
 		switch (m_energyType)
 		{
 		case Linear:
-			HM_EnforceElasticity << <pDims, BLOCK_SIZE >> > (
-				this->m_displacement,
-				this->m_weights,
-				this->m_bulkCoefs,
-				this->m_invK,
-				this->m_position.getValue(),
-				this->m_restShape.getValue(),
-				this->m_horizon.getValue(),
-				this->m_distance.getValue(),
-				this->m_mu.getValue(),
-				this->m_lambda.getValue(),
-				ConstantFunc<Real>());
-			cuSynchronize();
+			if (m_doubleAccumulation)
+				enforceElasticity<double>(ConstantFunc<Real>());
+			else
+				enforceElasticity<Real>(ConstantFunc<Real>());
 			break;
 
 		case Quadratic:
-			HM_EnforceElasticity << <pDims, BLOCK_SIZE >> > (
-				this->m_displacement,
-				this->m_weights,
-				this->m_bulkCoefs,
-				this->m_invK,
-				this->m_position.getValue(),
-				this->m_restShape.getValue(),
-				this->m_horizon.getValue(),
-				this->m_distance.getValue(),
-				this->m_mu.getValue(),
-				this->m_lambda.getValue(),
-				QuadraticFunc<Real>());
-			cuSynchronize();
+			if (m_doubleAccumulation)
+				enforceElasticity<double>(QuadraticFunc<Real>());
+			else
+				enforceElasticity<Real>(QuadraticFunc<Real>());
 			break;
 
 		default:
@@ -72,6 +72,11 @@ namespace Physika {
 	class HyperelasticityModule : public ElasticityModule<TDataType>
 	{
 	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+		typedef typename TDataType::Matrix Matrix;
+		typedef TPair<TDataType> NPair;
+
 		HyperelasticityModule();
 		~HyperelasticityModule() override {};
 		
@@ -83,11 +88,20 @@ namespace Physika {
 
 		void setEnergyFunction(EnergyType type) { m_energyType = type; }
 
+		/**
+		 * @brief Accumulate the per-particle sums in double while positions are stored in Real
+		 */
+		void setDoubleAccumulation(bool enabled) { m_doubleAccumulation = enabled; }
+
 	protected:
 		void enforceElasticity() override;
 
 	private:
+		template<typename Acc, typename Function>
+		void enforceElasticity(Function func);
+
 		EnergyType m_energyType;
+		bool m_doubleAccumulation;
 	};
 
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include "Core/Utility.h"
 #include "Framework/Framework/Node.h"
 #include "Framework/Topology/FieldNeighbor.h"
+#include "Core/Utility/ResidualMax.h"
+#include "Framework/Framework/SceneGraph.h"
 
 namespace Physika
 {
@@ -17,67 +19,211 @@ namespace Physika
 		}
 	}
 
+	/*!
+	*	\brief	Sum of the viscosity weights over the neighbors, i.e., the diagonal of the weight matrix.
+	*/
 	template<typename Real, typename Coord>
-	__global__ void K_ApplyViscosity(
-		DeviceArray<Coord> velNew,
+	__global__ void VB_ComputeWeightSum(
+		DeviceArray<Real> weightSum,
 		DeviceArray<Coord> posArr,
 		NeighborList<int> neighbors,
-		DeviceArray<Coord> velOld,
-		DeviceArray<Coord> velArr,
-		Real viscosity,
-		Real smoothingLength,
-		Real dt)
+		Real smoothingLength)
 	{
 		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
 		if (pId >= posArr.size()) return;
 
-		Real r;
-		Coord dv_i(0);
 		Coord pos_i = posArr[pId];
-		Coord vel_i = velArr[pId];
 		Real totalWeight = 0.0f;
 		int nbSize = neighbors.getNeighborSize(pId);
 		for (int ne = 0; ne < nbSize; ne++)
 		{
 			int j = neighbors.getElement(pId, ne);
-			r = (pos_i - posArr[j]).norm();
+			Real r = (pos_i - posArr[j]).norm();
 
 			if (r > EPSILON)
 			{
-				Real weight = VB_VisWeight(r, smoothingLength);
-				totalWeight += weight;
-				dv_i += weight * velArr[j];
+				totalWeight += VB_VisWeight(r, smoothingLength);
 			}
 		}
 
-		Real b = dt*viscosity / smoothingLength;
+		weightSum[pId] = totalWeight;
+	}
 
-		b = totalWeight < EPSILON ? 0.0f : b;
+	/*!
+	*	\brief	Matrix-free product with the viscosity system (1+b)W_i v_i - b sum_j w_ij v_j = W_i v_old_i, b = dt*mu/h.
+	*			Rows are scaled by W_i so that the matrix is symmetric, particles without neighbors keep their velocities.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void VB_ComputeAx(
+		DeviceArray<Coord> Ax,
+		DeviceArray<Coord> xArr,
+		DeviceArray<Coord> posArr,
+		NeighborList<int> neighbors,
+		DeviceArray<Real> weightSum,
+		Real b,
+		Real smoothingLength)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
 
-		totalWeight = totalWeight < EPSILON ? 1.0f : totalWeight;
+		Real w_i = weightSum[pId];
+		if (w_i < EPSILON)
+		{
+			Ax[pId] = xArr[pId];
+			return;
+		}
 
-		dv_i /= totalWeight;
+		Coord pos_i = posArr[pId];
+		Coord sum_i(0);
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			Real r = (pos_i - posArr[j]).norm();
 
-		velNew[pId] = velOld[pId] / (1.0f + b) + dv_i*b / (1.0f + b);
+			if (r > EPSILON)
+			{
+				sum_i += VB_VisWeight(r, smoothingLength) * xArr[j];
+			}
+		}
+
+		Ax[pId] = (1.0f + b)*w_i*xArr[pId] - b*sum_i;
+	}
+
+	/*!
+	*	\brief	Initial residual for the current velocities as the initial guess, which are also the right-hand side velocities,
+	*			so the old velocities need not be kept.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void VB_ComputeResidual(
+		DeviceArray<Coord> rArr,
+		DeviceArray<Coord> velArr,
+		DeviceArray<Coord> posArr,
+		NeighborList<int> neighbors,
+		DeviceArray<Real> weightSum,
+		Real b,
+		Real smoothingLength)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		Real w_i = weightSum[pId];
+		if (w_i < EPSILON)
+		{
+			rArr[pId] = Coord(0);
+			return;
+		}
+
+		Coord pos_i = posArr[pId];
+		Coord sum_i(0);
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			Real r = (pos_i - posArr[j]).norm();
+
+			if (r > EPSILON)
+			{
+				sum_i += VB_VisWeight(r, smoothingLength) * velArr[j];
+			}
+		}
+
+		rArr[pId] = b*(sum_i - w_i*velArr[pId]);
+	}
+
+	/*!
+	*	\brief	Jacobi preconditioner, folds r.z and z.z into the device scalars, or stores them in the terms in order.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void VB_Precondition(
+		DeviceArray<Coord> zArr,
+		DeviceArray<Coord> rArr,
+		DeviceArray<Real> weightSum,
+		Real b,
+		Real* rz,
+		Real* zz,
+		DeviceArray<Real> rzTerms,
+		DeviceArray<Real> zzTerms)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+
+		Real rz_i = Real(0);
+		Real zz_i = Real(0);
+		if (pId < rArr.size())
+		{
+			Real w_i = weightSum[pId];
+			Real diag = w_i < EPSILON ? Real(1) : (1.0f + b)*w_i;
+
+			Coord r_i = rArr[pId];
+			Coord z_i = r_i / diag;
+			zArr[pId] = z_i;
+
+			rz_i = r_i.dot(z_i);
+			zz_i = z_i.dot(z_i);
+		}
+
+		RS_WarpSum(rz, rzTerms, pId, rz_i);
+		RS_WarpSum(zz, zzTerms, pId, zz_i);
+	}
+
+	template<typename Real, typename Coord>
+	__global__ void VB_Dot(
+		Real* sum,
+		DeviceArray<Real> terms,
+		DeviceArray<Coord> xArr,
+		DeviceArray<Coord> yArr)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+
+		Real xy = pId < xArr.size() ? xArr[pId].dot(yArr[pId]) : Real(0);
+		RS_WarpSum(sum, terms, pId, xy);
 	}
 
 	template<typename Real, typename Coord>
 	__global__ void VB_UpdateVelocity(
-		DeviceArray<Coord> velArr, 
-		DeviceArray<Coord> dVel)
+		DeviceArray<Coord> velArr,
+		DeviceArray<Coord> rArr,
+		DeviceArray<Coord> pArr,
+		DeviceArray<Coord> ApArr,
+		Real* rz,
+		Real* pAp)
 	{
 		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
 		if (pId >= velArr.size()) return;
 
-		velArr[pId] = dVel[pId];
+		Real alpha = abs(*pAp) > EPSILON ? *rz / *pAp : Real(0);
+
+		velArr[pId] += alpha*pArr[pId];
+		rArr[pId] -= alpha*ApArr[pId];
+	}
+
+	template<typename Real, typename Coord>
+	__global__ void VB_UpdateDirection(
+		DeviceArray<Coord> pArr,
+		DeviceArray<Coord> zArr,
+		Real* scalars,
+		int rzSlot,
+		int rzNewSlot)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= pArr.size()) return;
+
+		Real rz = scalars[rzSlot];
+		Real beta = abs(rz) > EPSILON ? scalars[rzNewSlot] / rz : Real(0);
+
+		pArr[pId] = zArr[pId] + beta*pArr[pId];
 	}
 
 	template<typename TDataType>
 	ImplicitViscosity<TDataType>::ImplicitViscosity()
 		:ConstraintModule()
 		, m_smoothingLength(0.0125)
-		, m_maxInteration(5)
+		, m_reduce(NULL)
+		, m_checkInterval(4)
 	{
+		m_iterationPolicy.setIterationBounds(1, 50);
+		m_iterationPolicy.setTargetResidual(1e-4f);
+
 		m_viscosity.setValue(Real(0.05));
 		m_smoothingLength.setValue(Real(0.011));
 
@@ -91,8 +237,19 @@ namespace Physika
 	template<typename TDataType>
 	ImplicitViscosity<TDataType>::~ImplicitViscosity()
 	{
-		m_velOld.release();
-		m_velBuf.release();
+		m_weightSum.release();
+		m_r.release();
+		m_z.release();
+		m_p.release();
+		m_Ap.release();
+		m_scalars.release();
+		m_dotTerms.release();
+		m_normTerms.release();
+
+		if (m_reduce)
+		{
+			delete m_reduce;
+		}
 	}
 
 	template<typename TDataType>
@@ -101,21 +258,93 @@ namespace Physika
 		int num = m_position.getElementCount();
 		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
 
-		Real vis = m_viscosity.getValue();
-		Real dt = getParent()->getDt();
-		Function1Pt::copy(m_velOld, m_velocity.getValue());
-		for (int t = 0; t < m_maxInteration; t++)
+		//Particles were emitted or removed since the last step
+		if (m_weightSum.size() != num)
+		{
+			m_weightSum.setSize(num);
+			m_r.setSize(num);
+			m_z.setSize(num);
+			m_p.setSize(num);
+			m_Ap.setSize(num);
+		}
+
+		Real h = m_smoothingLength.getValue();
+		Real b = getParent()->getDt()*m_viscosity.getValue() / h;
+		Real* scalars = m_scalars.getDataPtr();
+
+		DeviceArray<Coord>& vel = m_velocity.getValue();
+		DeviceArray<Coord>& pos = m_position.getValue();
+		NeighborList<int>& nbrs = m_neighborhood.getValue();
+
+		//In the deterministic mode the dot products are stored per particle and summed along the fixed tree of m_reduce
+		bool ordered = SceneGraph::getInstance().isDeterministic();
+		if (ordered && m_dotTerms.size() != num)
 		{
-			Function1Pt::copy(m_velBuf, m_velocity.getValue());
-			K_ApplyViscosity << < pDims, BLOCK_SIZE >> > (
-				m_velocity.getValue(),
-				m_position.getValue(),
-				m_neighborhood.getValue(),
-				m_velOld, 
-				m_velBuf, 
-				vis,
-				m_smoothingLength.getValue(), 
-				dt);
+			m_dotTerms.resize(num);
+			m_normTerms.resize(num);
+
+			if (m_reduce)
+			{
+				delete m_reduce;
+			}
+			m_reduce = Reduction<Real>::Create(num);
+		}
+		DeviceArray<Real> dotTerms = ordered ? m_dotTerms : DeviceArray<Real>();
+		DeviceArray<Real> normTerms = ordered ? m_normTerms : DeviceArray<Real>();
+
+		VB_ComputeWeightSum << < pDims, BLOCK_SIZE >> > (m_weightSum, pos, nbrs, h);
+		VB_ComputeResidual << < pDims, BLOCK_SIZE >> > (m_r, vel, pos, nbrs, m_weightSum, b, h);
+
+		//The first search direction is the preconditioned residual itself
+		int rzSlot = 0;
+		m_scalars.reset();
+		VB_Precondition << < pDims, BLOCK_SIZE >> > (m_p, m_r, m_weightSum, b, scalars + rzSlot, scalars + SCALAR_ZZ, dotTerms, normTerms);
+		if (ordered)
+		{
+			RS_SumTerms(scalars + rzSlot, m_dotTerms, m_reduce);
+			RS_SumTerms(scalars + SCALAR_ZZ, m_normTerms, m_reduce);
+		}
+
+		//The residual is only read back when the iteration policy has a target to check it against
+		Real zz;
+		float residual = std::numeric_limits<float>::max();
+		if (m_iterationPolicy.hasTarget())
+		{
+			cudaMemcpy(&zz, scalars + SCALAR_ZZ, sizeof(Real), cudaMemcpyDeviceToHost);
+			residual = sqrt(zz / num);
+		}
+
+		//The velocities are updated in place and the residual recursively, no velocity buffer is copied per iteration
+		int t = 0;
+		while (m_iterationPolicy.proceed(t, residual))
+		{
+			int rzNewSlot = 1 - rzSlot;
+			cudaMemset(scalars + rzNewSlot, 0, sizeof(Real));
+			cudaMemset(scalars + SCALAR_PAP, 0, 2 * sizeof(Real));
+
+			VB_ComputeAx << < pDims, BLOCK_SIZE >> > (m_Ap, m_p, pos, nbrs, m_weightSum, b, h);
+			VB_Dot << < pDims, BLOCK_SIZE >> > (scalars + SCALAR_PAP, dotTerms, m_p, m_Ap);
+			if (ordered) RS_SumTerms(scalars + SCALAR_PAP, m_dotTerms, m_reduce);
+
+			VB_UpdateVelocity << < pDims, BLOCK_SIZE >> > (vel, m_r, m_p, m_Ap, scalars + rzSlot, scalars + SCALAR_PAP);
+
+			VB_Precondition << < pDims, BLOCK_SIZE >> > (m_z, m_r, m_weightSum, b, scalars + rzNewSlot, scalars + SCALAR_ZZ, dotTerms, normTerms);
+			if (ordered)
+			{
+				RS_SumTerms(scalars + rzNewSlot, m_dotTerms, m_reduce);
+				RS_SumTerms(scalars + SCALAR_ZZ, m_normTerms, m_reduce);
+			}
+			VB_UpdateDirection << < pDims, BLOCK_SIZE >> > (m_p, m_z, scalars, rzSlot, rzNewSlot);
+
+			rzSlot = rzNewSlot;
+			t++;
+
+			//In between two checks the last residual read back is kept, which is still above the target
+			if (m_iterationPolicy.hasTarget() && t % m_checkInterval == 0)
+			{
+				cudaMemcpy(&zz, scalars + SCALAR_ZZ, sizeof(Real), cudaMemcpyDeviceToHost);
+				residual = sqrt(zz / num);
+			}
 		}
 
 		return true;
@@ -132,14 +361,12 @@ namespace Physika
 
 		int num = m_position.getElementCount();
 
-		if (m_velOld.size() != num)
-		{
-			m_velOld.resize(num);
-		}
-		if (m_velBuf.size() != num)
-		{
-			m_velBuf.resize(num);
-		}
+		m_weightSum.resize(num);
+		m_r.resize(num);
+		m_z.resize(num);
+		m_p.resize(num);
+		m_Ap.resize(num);
+		m_scalars.resize(4);
 
 		return true;
 	}
@@ -147,7 +374,7 @@ namespace Physika
 	template<typename TDataType>
 	void ImplicitViscosity<TDataType>::setIterationNumber(int n)
 	{
-		m_maxInteration = n;
+		m_iterationPolicy.setMaxIteration(n);
 	}
 
 	template<typename TDataType>
@@ -3,8 +3,19 @@
 #include "Framework/Framework/FieldVar.h"
 #include "Framework/Framework/FieldArray.h"
 #include "Framework/Topology/FieldNeighbor.h"
+#include "Core/Utility.h"
 
 namespace Physika {
+	/*!
+	*	\class	ImplicitViscosity
+	*	\brief	Implicit XSPH-like viscosity, solved matrix-free with a Jacobi-preconditioned conjugate gradient.
+	*
+	*	The system is scaled by the weight sums to be symmetric, which holds for symmetric neighbor lists.
+	*	The residual checked against the iteration policy is the RMS of the preconditioned residual, i.e., in units of velocity.
+	*	By default the solve stops once the residual drops below 1e-4, or after 50 iterations for very viscous materials.
+	*	The residual is only read back every k iterations, see setResidualCheckInterval(), so up to k - 1 iterations may be
+	*	taken after the target has been reached. Without a target on getIterationPolicy() it is never read back.
+	*/
 	template<typename TDataType>
 	class ImplicitViscosity : public ConstraintModule
 	{
@@ -21,6 +32,9 @@ namespace Physika {
 
 		void setViscosity(Real mu);
 
+		/// Read the residual back every k iterations only, each readback synchronizes with the device
+		void setResidualCheckInterval(int k) { m_checkInterval = k > 0 ? k : 1; }
+
 
 	protected:
 		bool initializeImpl() override;
@@ -35,12 +49,24 @@ namespace Physika {
 		NeighborField<int> m_neighborhood;
 
 	private:
-		int m_maxInteration;
+		//Slots of the device scalars, 0 and 1 alternate between the old and the new r.z
+		static const int SCALAR_PAP = 2;
+		static const int SCALAR_ZZ = 3;
 
-		DeviceArray<Coord> m_velOld;
-		DeviceArray<Coord> m_velBuf;
+		DeviceArray<Real> m_weightSum;
 
-		
+		DeviceArray<Coord> m_r;
+		DeviceArray<Coord> m_z;
+		DeviceArray<Coord> m_p;
+		DeviceArray<Coord> m_Ap;
+
+		DeviceArray<Real> m_scalars;
+		DeviceArray<Real> m_dotTerms;
+		DeviceArray<Real> m_normTerms;
+
+		Reduction<Real>* m_reduce;
+
+		int m_checkInterval;
 	};
 
 
@@ -1,25 +1,42 @@
 #pragma once
 #include "Core/Platform.h"
 #include "Core/Utility.h"
+#include "Core/Array/Array.h"
+#include <vector>
 
 namespace Physika {
 
+	/*!
+	*	\class	Kernel
+	*	\brief	Base of the SPH kernels. Weight and Gradient are not virtual, the kernel type is a template parameter of
+	*			the CUDA kernels using it so calls are resolved at compile time.
+	*
+	*	Kernels constructed with a smoothing length precompute their normalization constants once on the host,
+	*	are passed to the CUDA kernels by value and evaluated with Weight(r)/Gradient(r).
+	*/
 	template<typename Real>
 	class Kernel
 	{
 	public:
-		COMM_FUNC Kernel() {};
+		COMM_FUNC Kernel() : m_h(0), m_invH(0) {};
+		COMM_FUNC Kernel(const Real h) : m_h(h), m_invH(Real(1) / h) {};
 		COMM_FUNC ~Kernel() {};
 
-		COMM_FUNC inline virtual Real Weight(const Real r, const Real h)
+		COMM_FUNC inline Real Weight(const Real r, const Real h)
 		{
 			return Real(0);
 		}
 
-		COMM_FUNC inline virtual Real Gradient(const Real r, const Real h)
+		COMM_FUNC inline Real Gradient(const Real r, const Real h)
 		{
 			return Real(0);
 		}
+
+		COMM_FUNC inline Real getSmoothingLength() const { return m_h; }
+
+	protected:
+		Real m_h;
+		Real m_invH;
 	};
 
 	//spiky kernel
@@ -28,9 +45,13 @@ namespace Physika {
 	{
 	public:
 		COMM_FUNC SpikyKernel() : Kernel<Real>() {};
+		COMM_FUNC SpikyKernel(const Real h)
+			: Kernel<Real>(h)
+			, m_weightCoef(15.0f / ((Real)M_PI * h * h * h))
+			, m_gradientCoef(-45.0f / ((Real)M_PI * h * h * h)) {};
 		COMM_FUNC ~SpikyKernel() {};
 
-		COMM_FUNC inline Real Weight(const Real r, const Real h) override
+		COMM_FUNC inline Real Weight(const Real r, const Real h)
 		{
 			const Real q = r / h;
 			if (q > 1.0f) return 0.0f;
@@ -41,7 +62,7 @@ namespace Physika {
 			}
 		}
 
-		COMM_FUNC inline Real Gradient(const Real r, const Real h) override
+		COMM_FUNC inline Real Gradient(const Real r, const Real h)
 		{
 			const Real q = r / h;
 			if (q > 1.0f) return 0.0;
@@ -52,6 +73,26 @@ namespace Physika {
 				return -45.0f / ((Real)M_PI * hh*h) *d*d;
 			}
 		}
+
+		COMM_FUNC inline Real Weight(const Real r) const
+		{
+			const Real q = r * this->m_invH;
+			if (q > 1.0f) return 0.0f;
+			const Real d = 1.0f - q;
+			return m_weightCoef * d * d * d;
+		}
+
+		COMM_FUNC inline Real Gradient(const Real r) const
+		{
+			const Real q = r * this->m_invH;
+			if (q > 1.0f) return 0.0f;
+			const Real d = 1.0f - q;
+			return m_gradientCoef * d * d;
+		}
+
+	private:
+		Real m_weightCoef = 0;
+		Real m_gradientCoef = 0;
 	};
 
 
@@ -60,9 +101,10 @@ namespace Physika {
 	{
 	public:
 		COMM_FUNC SmoothKernel() : Kernel<Real>() {};
+		COMM_FUNC SmoothKernel(const Real h) : Kernel<Real>(h) {};
 		COMM_FUNC ~SmoothKernel() {};
 
-		COMM_FUNC inline Real Weight(const Real r, const Real h) override
+		COMM_FUNC inline Real Weight(const Real r, const Real h)
 		{
 			const Real q = r / h;
 			if (q > 1.0f) return 0.0f;
@@ -71,7 +113,7 @@ namespace Physika {
 			}
 		}
 
-		COMM_FUNC inline Real Gradient(const Real r, const Real h) override
+		COMM_FUNC inline Real Gradient(const Real r, const Real h)
 		{
 			const Real q = r / h;
 			if (q > 1.0f) return 0.0f;
@@ -82,6 +124,18 @@ namespace Physika {
 				return -alpha * dd;
 			}
 		}
+
+		COMM_FUNC inline Real Weight(const Real r) const
+		{
+			const Real q = r * this->m_invH;
+			return q > 1.0f ? 0.0f : 1.0f - q*q;
+		}
+
+		COMM_FUNC inline Real Gradient(const Real r) const
+		{
+			const Real q = r * this->m_invH;
+			return q > 1.0f ? 0.0f : q*q - 1.0f;
+		}
 	};
 
 
@@ -91,9 +145,10 @@ namespace Physika {
 	{
 	public:
 		COMM_FUNC CorrectedKernel() : Kernel<Real>() {};
+		COMM_FUNC CorrectedKernel(const Real h) : Kernel<Real>(h) {};
 		COMM_FUNC ~CorrectedKernel() {};
 
-		COMM_FUNC inline Real Weight(const Real r, const Real h) override
+		COMM_FUNC inline Real Weight(const Real r, const Real h)
 		{
 			const Real q = r / h;
 			SmoothKernel<Real> kernSmooth;
@@ -137,6 +192,24 @@ namespace Physika {
 // 			}
 // 			return w / r / r;
 		}
+
+		COMM_FUNC inline Real Weight(const Real r) const
+		{
+			const Real q = r * this->m_invH;
+			return q > 1.0f ? 0.0f : q*q*q*(1.0f - q*q);
+		}
+
+		COMM_FUNC inline Real WeightR(const Real r) const
+		{
+			const Real q = r * this->m_invH;
+			return q > 1.0f ? 0.0f : q*q*(1.0f - q*q)*this->m_invH;
+		}
+
+		COMM_FUNC inline Real WeightRR(const Real r) const
+		{
+			const Real q = r * this->m_invH;
+			return q > 1.0f ? 0.0f : q*(1.0f - q*q)*this->m_invH*this->m_invH;
+		}
 	};
 
 	//cubic kernel
@@ -145,9 +218,12 @@ namespace Physika {
 	{
 	public:
 		COMM_FUNC CubicKernel() : Kernel<Real>() {};
+		COMM_FUNC CubicKernel(const Real h)
+			: Kernel<Real>(h)
+			, m_alpha(3.0f / (2.0f * (Real)M_PI * h * h * h)) {};
 		COMM_FUNC ~CubicKernel() {};
 
-		COMM_FUNC inline Real Weight(const Real r, const Real h) override
+		COMM_FUNC inline Real Weight(const Real r, const Real h)
 		{
 			const Real hh = h*h;
 			const Real q = 2.0f*r / h;
@@ -170,7 +246,7 @@ namespace Physika {
 			}
 		}
 
-		COMM_FUNC inline Real Gradient(const Real r, const Real h) override
+		COMM_FUNC inline Real Gradient(const Real r, const Real h)
 		{
 			const Real hh = h*h;
 			const Real q = 2.0f*r / h;
@@ -192,6 +268,34 @@ namespace Physika {
 				//return alpha*(-0.5);
 			}
 		}
+
+		COMM_FUNC inline Real Weight(const Real r) const
+		{
+			const Real q = 2.0f*r*this->m_invH;
+			if (q > 2.0f) return 0.0f;
+			else if (q >= 1.0f)
+			{
+				const Real d = 2.0f - q;
+				return m_alpha / 6.0f*d*d*d;
+			}
+			const Real qq = q*q;
+			return m_alpha*(2.0f / 3.0f - qq + 0.5f*qq*q);
+		}
+
+		COMM_FUNC inline Real Gradient(const Real r) const
+		{
+			const Real q = 2.0f*r*this->m_invH;
+			if (q > 2.0f) return 0.0f;
+			else if (q >= 1.0f)
+			{
+				const Real d = 2.0f - q;
+				return -0.5f*m_alpha*d*d;
+			}
+			return m_alpha*(-2.0f*q + 1.5f*q*q);
+		}
+
+	private:
+		Real m_alpha = 0;
 	};
 
 	template<typename Real>
@@ -201,7 +305,7 @@ namespace Physika {
 		COMM_FUNC QuarticKernel() : Kernel<Real>() {};
 		COMM_FUNC ~QuarticKernel() {};
 
-		COMM_FUNC inline Real Weight(const Real r, const Real h) override
+		COMM_FUNC inline Real Weight(const Real r, const Real h)
 		{
 			const Real hh = h*h;
 			const Real q = 2.5f*r / h;
@@ -232,7 +336,7 @@ namespace Physika {
 			}
 		}
 
-		COMM_FUNC inline Real Gradient(const Real r, const Real h) override
+		COMM_FUNC inline Real Gradient(const Real r, const Real h)
 		{
 			const Real hh = h*h;
 			const Real q = 2.5f*r / h;
@@ -258,4 +362,67 @@ namespace Physika {
 			}
 		}
 	};
+
+	/*!
+	*	\class	TabulatedKernel
+	*	\brief	Lookup table of a kernel providing Weight, WeightR and WeightRR for a fixed smoothing length, e.g., CorrectedKernel.
+	*
+	*	The functions are sampled uniformly in q^2 = (r/h)^2 on [0, 1] and linearly interpolated, which also allows
+	*	evaluating them from squared distances without a square root. Build the table on the host, pass the object
+	*	to CUDA kernels by value and release it explicitly, like DeviceArray.
+	*/
+	template<typename Real>
+	class TabulatedKernel
+	{
+	public:
+		TabulatedKernel() : m_size(0), m_invHH(0) {};
+		~TabulatedKernel() {};
+
+		template<typename TKernel>
+		void build(TKernel kern, int samples = 1024)
+		{
+			Real h = kern.getSmoothingLength();
+			m_size = samples < 2 ? 2 : samples;
+			m_invHH = Real(1) / (h*h);
+
+			std::vector<Real> hTable(3 * m_size);
+			for (int i = 0; i < m_size; i++)
+			{
+				Real r = h*sqrt(Real(i) / (m_size - 1));
+				hTable[3 * i] = kern.Weight(r);
+				hTable[3 * i + 1] = kern.WeightR(r);
+				hTable[3 * i + 2] = kern.WeightRR(r);
+			}
+
+			m_table.resize(3 * m_size);
+			cudaMemcpy(m_table.getDataPtr(), hTable.data(), 3 * m_size * sizeof(Real), cudaMemcpyHostToDevice);
+		}
+
+		void release() { m_table.release(); }
+
+		bool isEmpty() { return m_size == 0; }
+
+		COMM_FUNC inline Real Weight(const Real r) { return lookup(r*r*m_invHH, 0); }
+		COMM_FUNC inline Real WeightR(const Real r) { return lookup(r*r*m_invHH, 1); }
+		COMM_FUNC inline Real WeightRR(const Real r) { return lookup(r*r*m_invHH, 2); }
+
+		COMM_FUNC inline Real WeightSq(const Real rr) { return lookup(rr*m_invHH, 0); }
+
+	private:
+		COMM_FUNC inline Real lookup(const Real qq, const int channel)
+		{
+			if (qq >= Real(1)) return Real(0);
+
+			Real x = qq*(m_size - 1);
+			int i = (int)x;
+			i = i > m_size - 2 ? m_size - 2 : i;
+			Real t = x - i;
+
+			return (1 - t)*m_table[3 * i + channel] + t*m_table[3 * i + 3 + channel];
+		}
+
+		DeviceArray<Real> m_table;
+		int m_size;
+		Real m_invHH;
+	};
 }
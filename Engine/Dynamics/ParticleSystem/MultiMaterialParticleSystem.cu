@@ -0,0 +1,241 @@
+#include <cuda_runtime.h>
+#include <thrust/sort.h>
+#include <thrust/sequence.h>
+#include <thrust/binary_search.h>
+#include <thrust/execution_policy.h>
+#include <thrust/iterator/counting_iterator.h>
+#include "MultiMaterialParticleSystem.h"
+#include "ParticleIntegrator.h"
+
+#include "Framework/Framework/ModuleConstraint.h"
+#include "Framework/Topology/NeighborQuery.h"
+#include "Framework/Topology/PointSet.h"
+#include "Core/Utility.h"
+
+namespace Physika
+{
+	IMPLEMENT_CLASS_1(MultiMaterialParticleSystem, TDataType)
+
+	/*!
+	*	\brief	Position of a material in the sorted order, the materials advanced by the integrator come first.
+	*/
+	COMM_FUNC inline int MM_MaterialRank(unsigned materialIndex)
+	{
+		//fluid 0, rigid 1, elastic 2, plastic 3 -> fluid, elastic, plastic, rigid
+		return materialIndex == 1 ? Attribute::MATERIAL_NUM - 1 : (materialIndex == 0 ? 0 : materialIndex - 1);
+	}
+
+	__global__ void MM_ComputeSortKey(
+		DeviceArray<int> keys,
+		DeviceArray<Attribute> attArr)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= attArr.size()) return;
+
+		Attribute att = attArr[pId];
+		keys[pId] = MM_MaterialRank(att.GetMaterialIndex());
+	}
+
+	template<typename TDataType>
+	MultiMaterialParticleSystem<TDataType>::MultiMaterialParticleSystem(std::string name)
+		: ParticleSystem<TDataType>(name)
+		, m_sortedNum(-1)
+	{
+		this->attachField(&m_attribute, "attribute", "Storing the particle attributes!", false);
+
+		for (int i = 0; i <= Attribute::MATERIAL_NUM; i++)
+		{
+			m_materialStart[i] = 0;
+		}
+
+		m_horizon.setValue(0.0125);
+
+		m_integrator = this->template setNumericalIntegrator<ParticleIntegrator<TDataType>>("integrator");
+		this->m_position.connect(m_integrator->m_position);
+		this->m_velocity.connect(m_integrator->m_velocity);
+		this->m_force.connect(m_integrator->m_forceDensity);
+
+		m_nbrQuery = this->template addComputeModule<NeighborQuery<TDataType>>("neighborhood");
+		m_horizon.connect(m_nbrQuery->m_radius);
+		this->m_position.connect(m_nbrQuery->m_position);
+	}
+
+	template<typename TDataType>
+	MultiMaterialParticleSystem<TDataType>::~MultiMaterialParticleSystem()
+	{
+		m_keys.release();
+		m_order.release();
+	}
+
+	template<typename TDataType>
+	void MultiMaterialParticleSystem<TDataType>::addParticles(std::vector<Coord>& pos, Attribute attribute)
+	{
+		if (attribute.IsElastic() || attribute.IsPlastic())
+		{
+			Log::sendMessage(Log::Error, "MultiMaterialParticleSystem only holds fluid and rigid particles!");
+			return;
+		}
+
+		m_hostPosition.insert(m_hostPosition.end(), pos.begin(), pos.end());
+		m_hostAttribute.insert(m_hostAttribute.end(), pos.size(), attribute);
+
+		this->m_pSet->setPoints(m_hostPosition);
+	}
+
+	template<typename TDataType>
+	void MultiMaterialParticleSystem<TDataType>::setMaterialSolver(Attribute::MaterialType material, std::shared_ptr<ConstraintModule> solver)
+	{
+		if (material != Attribute::MATERIAL_FLUID)
+		{
+			Log::sendMessage(Log::Error, "MultiMaterialParticleSystem only solves fluid particles, rigid ones are static!");
+			return;
+		}
+
+		if (!solver->supportsParticleRange())
+		{
+			Log::sendMessage(Log::Error, std::string("Solver ") + solver->getName() + std::string(" can not be restricted to one material!"));
+			return;
+		}
+
+		Attribute att;
+		att.SetMaterialType(material);
+		int rank = MM_MaterialRank(att.GetMaterialIndex());
+
+		if (m_solvers[rank] != nullptr)
+		{
+			this->deleteConstraintModule(m_solvers[rank]);
+		}
+		m_solvers[rank] = solver;
+		this->addConstraintModule(solver);
+
+		auto smoothingLength = solver->getField<VarField<Real>>("smoothing_length");
+		if (smoothingLength != nullptr)
+			m_horizon.connect(*smoothingLength);
+
+		auto position = solver->getField<DeviceArrayField<Coord>>("position");
+		if (position != nullptr)
+			this->m_position.connect(*position);
+
+		auto velocity = solver->getField<DeviceArrayField<Coord>>("velocity");
+		if (velocity != nullptr)
+			this->m_velocity.connect(*velocity);
+
+		auto neighborhood = solver->getField<NeighborField<int>>("neighborhood");
+		if (neighborhood != nullptr)
+			m_nbrQuery->m_neighborhood.connect(*neighborhood);
+
+		solver->initialize();
+	}
+
+	template<typename TDataType>
+	void MultiMaterialParticleSystem<TDataType>::getMaterialRange(Attribute::MaterialType material, int& start, int& count)
+	{
+		Attribute att;
+		att.SetMaterialType(material);
+		int rank = MM_MaterialRank(att.GetMaterialIndex());
+
+		start = m_materialStart[rank];
+		count = m_materialStart[rank + 1] - m_materialStart[rank];
+	}
+
+	template<typename TDataType>
+	void MultiMaterialParticleSystem<TDataType>::sortByMaterial()
+	{
+		int num = this->m_position.getElementCount();
+		m_sortedNum = num;
+		if (num <= 0)
+		{
+			for (int i = 0; i <= Attribute::MATERIAL_NUM; i++)
+			{
+				m_materialStart[i] = 0;
+			}
+			return;
+		}
+
+		if (m_keys.size() != num)
+		{
+			m_keys.setSize(num);
+			m_order.setSize(num);
+		}
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+		MM_ComputeSortKey << <pDims, BLOCK_SIZE >> > (m_keys, m_attribute.getValue());
+		cuSynchronize();
+
+		//The sort is stable, particles of the same material keep their relative order
+		thrust::sequence(thrust::device, m_order.getDataPtr(), m_order.getDataPtr() + num);
+		thrust::stable_sort_by_key(thrust::device, m_keys.getDataPtr(), m_keys.getDataPtr() + num, m_order.getDataPtr());
+
+		//Keeping all particles in the sorted order also reorders module fields such as the multipliers of DensityPBD
+		this->removeParticles(m_order.getDataPtr(), num);
+
+		DeviceArray<int> start(Attribute::MATERIAL_NUM + 1);
+		thrust::lower_bound(thrust::device,
+			m_keys.getDataPtr(), m_keys.getDataPtr() + num,
+			thrust::counting_iterator<int>(0), thrust::counting_iterator<int>(Attribute::MATERIAL_NUM + 1),
+			start.getDataPtr());
+
+		cudaMemcpy(m_materialStart, start.getDataPtr(), (Attribute::MATERIAL_NUM + 1) * sizeof(int), cudaMemcpyDeviceToHost);
+		start.release();
+	}
+
+	template<typename TDataType>
+	bool MultiMaterialParticleSystem<TDataType>::resetStatus()
+	{
+		bool ret = ParticleSystem<TDataType>::resetStatus();
+
+		m_attribute.setElementCount(m_hostAttribute.size());
+		if (m_hostAttribute.size() > 0)
+		{
+			Function1Pt::copy(m_attribute.getValue(), m_hostAttribute);
+		}
+
+		sortByMaterial();
+
+		return ret;
+	}
+
+	template<typename TDataType>
+	bool MultiMaterialParticleSystem<TDataType>::initialize()
+	{
+		m_nbrQuery->initialize();
+		m_nbrQuery->compute();
+
+		return ParticleSystem<TDataType>::initialize();
+	}
+
+	template<typename TDataType>
+	void MultiMaterialParticleSystem<TDataType>::advance(Real dt)
+	{
+		//Emitted particles carry a zero attribute, i.e., they are fluid, and are appended at the end.
+		//Removing k particles and emitting k others keeps the count, so any change triggers a sort
+		bool changed = this->updateParticleNumber(this->getDt());
+		if (this->m_position.getElementCount() == 0)
+			return;
+
+		if (changed || this->m_position.getElementCount() != m_sortedNum)
+		{
+			sortByMaterial();
+		}
+
+		int rigidStart = m_materialStart[Attribute::MATERIAL_NUM - 1];
+		m_integrator->setParticleRange(0, rigidStart);
+
+		m_integrator->begin();
+		m_integrator->integrate();
+
+		m_nbrQuery->compute();
+
+		for (int i = 0; i < Attribute::MATERIAL_NUM; i++)
+		{
+			int count = m_materialStart[i + 1] - m_materialStart[i];
+			if (m_solvers[i] == nullptr || count <= 0)
+				continue;
+
+			m_solvers[i]->setParticleRange(m_materialStart[i], count);
+			m_solvers[i]->constrain();
+		}
+
+		m_integrator->end();
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "ParticleSystem.h"
+#include "Attribute.h"
+
+namespace Physika
+{
+	template<typename> class NeighborQuery;
+	template<typename> class ParticleIntegrator;
+	/*!
+	*	\class	MultiMaterialParticleSystem
+	*	\brief	A single particle container holding several materials, tagged by their Attribute.
+	*
+	*	Particles are kept sorted by material so that each material occupies a contiguous range, fluid particles first,
+	*	then rigid ones. One neighbor query is shared by all materials, and the fluid solver only corrects the fluid range
+	*	while seeing all neighbors, so the fluid couples with the rigid particles through the shared neighborhood.
+	*
+	*	Scope: only fluid particles are solved. Rigid particles are neither advanced nor solved and act as a static boundary.
+	*	Elastic and plastic particles are rejected, since ElasticityModule and ElastoplasticityModule can not be restricted
+	*	to a particle range and their rest shapes refer to particle slots that change whenever the container is sorted.
+	*	Solving them here requires range support in those modules with rest shapes keyed by particle_id.
+	*/
+	template<typename TDataType>
+	class MultiMaterialParticleSystem : public ParticleSystem<TDataType>
+	{
+		DECLARE_CLASS_1(MultiMaterialParticleSystem, TDataType)
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+
+		MultiMaterialParticleSystem(std::string name = "default");
+		virtual ~MultiMaterialParticleSystem();
+
+		/*!
+		*	\brief	Add particles sharing the same attribute, must be called before the scene graph is initialized.
+		*/
+		void addParticles(std::vector<Coord>& pos, Attribute attribute);
+
+		/*!
+		*	\brief	Set the solver correcting the fluid particles, it must support particle ranges, e.g., DensityPBD.
+		*			Other materials are rejected, see the scope above.
+		*/
+		void setMaterialSolver(Attribute::MaterialType material, std::shared_ptr<ConstraintModule> solver);
+
+		/// Range of the particles of one material after the last sort
+		void getMaterialRange(Attribute::MaterialType material, int& start, int& count);
+
+		DeviceArrayField<Attribute>* getAttribute()
+		{
+			return &m_attribute;
+		}
+
+		void advance(Real dt) override;
+		bool resetStatus() override;
+		bool initialize() override;
+
+	public:
+		VarField<Real> m_horizon;
+
+	protected:
+		/*!
+		*	\brief	Reorder all array fields of the node by material and update the material ranges.
+		*/
+		void sortByMaterial();
+
+		DeviceArrayField<Attribute> m_attribute;
+
+	private:
+		std::shared_ptr<ParticleIntegrator<TDataType>> m_integrator;
+		std::shared_ptr<NeighborQuery<TDataType>> m_nbrQuery;
+		std::shared_ptr<ConstraintModule> m_solvers[Attribute::MATERIAL_NUM];
+
+		/// First particle of each material in sorted order, the last entry is the particle number
+		int m_materialStart[Attribute::MATERIAL_NUM + 1];
+		int m_sortedNum;
+
+		std::vector<Coord> m_hostPosition;
+		std::vector<Attribute> m_hostAttribute;
+
+		DeviceArray<int> m_keys;
+		DeviceArray<int> m_order;
+	};
+
+#ifdef PRECISION_FLOAT
+	template class MultiMaterialParticleSystem<DataType3f>;
+#else
+	template class MultiMaterialParticleSystem<DataType3d>;
+#endif
+}
@@ -0,0 +1,503 @@
+#include <cuda_runtime.h>
+#include <thrust/fill.h>
+#include <thrust/reduce.h>
+#include <thrust/scan.h>
+#include <thrust/execution_policy.h>
+#include "ParticleAdaptivity.h"
+#include "SurfaceDetection.h"
+#include "BoundaryParticles.h"
+#include "Core/Utility.h"
+#include "Framework/Topology/FieldNeighbor.h"
+
+namespace Physika
+{
+	IMPLEMENT_CLASS_1(ParticleAdaptivity, TDataType)
+
+#define PA_KEEP 0
+#define PA_SPLIT 1
+#define PA_MERGE 2
+
+	COMM_FUNC inline unsigned PA_Hash(unsigned x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352dU;
+		x ^= x >> 15;
+		x *= 0x846ca68bU;
+		x ^= x >> 16;
+		return x;
+	}
+
+	template<typename Real>
+	COMM_FUNC inline int PA_Level(Real mass)
+	{
+		return (int)floor(log2(mass) + Real(0.5));
+	}
+
+	template<typename Real>
+	__global__ void PA_ResetSize(
+		DeviceArray<Real> massArr,
+		DeviceArray<Real> radiusArr,
+		Real h)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= massArr.size()) return;
+
+		if (massArr[pId] <= Real(0))
+		{
+			massArr[pId] = Real(1);
+			radiusArr[pId] = h;
+		}
+	}
+
+	__global__ void PA_MarkSurface(
+		DeviceArray<int> depth,
+		DeviceArray<int> surfaceIndex,
+		int surfaceNum)
+	{
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (tId >= surfaceNum) return;
+
+		depth[surfaceIndex[tId]] = 0;
+	}
+
+	__global__ void PA_MarkBoundary(
+		DeviceArray<int> depth,
+		NeighborList<int> boundaryNeighbors)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= depth.size()) return;
+
+		if (boundaryNeighbors.getNeighborSize(pId) > 0)
+			depth[pId] = 0;
+	}
+
+	/*!
+	*	\brief	One hop of the distance to the nearest seed, read from the last hop so that the result does not depend on thread order.
+	*/
+	__global__ void PA_PropagateDepth(
+		DeviceArray<int> depth,
+		DeviceArray<int> depthOld,
+		NeighborList<int> neighbors)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= depth.size()) return;
+
+		int d = depthOld[pId];
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			d = min(d, depthOld[j] + 1);
+		}
+		depth[pId] = d;
+	}
+
+	template<typename Real>
+	__global__ void PA_Classify(
+		DeviceArray<int> state,
+		DeviceArray<int> depth,
+		DeviceArray<Real> massArr,
+		int fineBand,
+		int bandWidth,
+		int maxLevel)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= state.size()) return;
+
+		int d = depth[pId];
+		int target = d < fineBand ? 0 : min(maxLevel, (d - fineBand) / bandWidth + 1);
+		int level = PA_Level(massArr[pId]);
+
+		state[pId] = level > target ? PA_SPLIT : (level < target ? PA_MERGE : PA_KEEP);
+	}
+
+	/*!
+	*	\brief	Nearest neighbor of the same level that wants to merge as well, ties go to the lower id.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void PA_FindPartner(
+		DeviceArray<int> partner,
+		DeviceArray<int> state,
+		DeviceArray<Coord> posArr,
+		DeviceArray<Real> massArr,
+		NeighborList<int> neighbors)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		int p = -1;
+		if (state[pId] == PA_MERGE)
+		{
+			Coord pos_i = posArr[pId];
+			int level = PA_Level(massArr[pId]);
+
+			Real minDist = Real(0);
+			int nbSize = neighbors.getNeighborSize(pId);
+			for (int ne = 0; ne < nbSize; ne++)
+			{
+				int j = neighbors.getElement(pId, ne);
+				if (j == pId || state[j] != PA_MERGE || PA_Level(massArr[j]) != level)
+					continue;
+
+				Real r = (pos_i - posArr[j]).norm();
+				if (p < 0 || r < minDist || (r == minDist && j < p))
+				{
+					p = j;
+					minDist = r;
+				}
+			}
+		}
+		partner[pId] = p;
+	}
+
+	/*!
+	*	\brief	Mutual partners merge into the lower id, which only reads the other one, the higher id is dropped.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void PA_Merge(
+		DeviceArray<int> keep,
+		DeviceArray<int> partner,
+		DeviceArray<Coord> posArr,
+		DeviceArray<Coord> velArr,
+		DeviceArray<Real> massArr,
+		DeviceArray<Real> radiusArr,
+		Real h,
+		Real invDims)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		int j = partner[pId];
+		if (j < 0 || partner[j] != pId)
+		{
+			keep[pId] = 1;
+			return;
+		}
+
+		if (pId > j)
+		{
+			keep[pId] = 0;
+			return;
+		}
+
+		Real m_i = massArr[pId];
+		Real m_j = massArr[j];
+		Real m = m_i + m_j;
+
+		posArr[pId] = (m_i*posArr[pId] + m_j*posArr[j]) / m;
+		velArr[pId] = (m_i*velArr[pId] + m_j*velArr[j]) / m;
+		massArr[pId] = m;
+		radiusArr[pId] = h*pow(m, invDims);
+		keep[pId] = 1;
+	}
+
+	__global__ void PA_FlagSplit(
+		DeviceArray<int> flag,
+		DeviceArray<int> state)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= state.size()) return;
+
+		flag[pId] = state[pId] == PA_SPLIT ? 1 : 0;
+	}
+
+	__global__ void PA_CompactIndex(
+		DeviceArray<int> index,
+		DeviceArray<int> flag,
+		DeviceArray<int> offset)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= flag.size()) return;
+
+		if (flag[pId] == 1)
+		{
+			index[offset[pId]] = pId;
+		}
+	}
+
+	/*!
+	*	\brief	Halve the parents before they are copied, and pick a direction along which parent and child are separated.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void PA_SplitParents(
+		DeviceArray<Coord> splitOffset,
+		DeviceArray<int> splitIndex,
+		DeviceArray<Real> massArr,
+		DeviceArray<Real> radiusArr,
+		Real h,
+		Real invDims,
+		unsigned seed,
+		int splitNum)
+	{
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (tId >= splitNum) return;
+
+		int pId = splitIndex[tId];
+
+		Real m = Real(0.5)*massArr[pId];
+		Real radius = h*pow(m, invDims);
+		massArr[pId] = m;
+		radiusArr[pId] = radius;
+
+		Coord dir(0);
+		for (int d = 0; d < Coord::dims(); d++)
+		{
+			unsigned x = PA_Hash(seed ^ PA_Hash((unsigned)pId * Coord::dims() + d));
+			dir[d] = Real(2)*Real(x & 0xffff) / Real(0xffff) - Real(1);
+		}
+		Real len = dir.norm();
+		if (len < EPSILON)
+		{
+			dir = Coord(0);
+			dir[0] = Real(1);
+			len = Real(1);
+		}
+
+		//Both halves end up a quarter of their support radius away from where the parent was
+		splitOffset[tId] = Real(0.25)*radius*dir / len;
+	}
+
+	template<typename Coord>
+	__global__ void PA_PlaceChildren(
+		DeviceArray<Coord> posArr,
+		DeviceArray<int> splitIndex,
+		DeviceArray<Coord> splitOffset,
+		int start,
+		int splitNum)
+	{
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (tId >= splitNum) return;
+
+		Coord offset = splitOffset[tId];
+		posArr[splitIndex[tId]] -= offset;
+		posArr[start + tId] += offset;
+	}
+
+	template<typename TDataType>
+	ParticleAdaptivity<TDataType>::ParticleAdaptivity()
+		: ComputeModule()
+		, m_maxLevel(2)
+		, m_fineBand(3)
+		, m_bandWidth(3)
+		, m_interval(10)
+		, m_step(0)
+		, m_planned(false)
+		, m_splitNum(0)
+		, m_remainingNum(0)
+	{
+		m_smoothingLength.setValue(Real(0.011));
+
+		attachField(&m_smoothingLength, "smoothing_length", "The smoothing length of the reference particle!", false);
+		attachField(&m_position, "position", "Storing the particle positions!", false);
+		attachField(&m_velocity, "velocity", "Storing the particle velocities!", false);
+		attachField(&m_particleMass, "particle_mass", "Storing the particle masses relative to the reference particle!", false);
+		attachField(&m_particleRadius, "particle_radius", "Storing the particle support radii!", false);
+		attachField(&m_neighborhood, "neighborhood", "Storing neighboring particles' ids!", false);
+	}
+
+	template<typename TDataType>
+	ParticleAdaptivity<TDataType>::~ParticleAdaptivity()
+	{
+		m_depth.release();
+		m_depthOld.release();
+		m_state.release();
+		m_partner.release();
+		m_keep.release();
+		m_flag.release();
+		m_offset.release();
+		m_splitIndex.release();
+		m_splitOffset.release();
+		m_remainingIndex.release();
+	}
+
+	template<typename TDataType>
+	bool ParticleAdaptivity<TDataType>::initializeImpl()
+	{
+		if (!isAllFieldsReady())
+		{
+			std::cout << "Exception: " << std::string("ParticleAdaptivity's fields are not fully initialized!") << "\n";
+			return false;
+		}
+
+		m_surfaceDetection = std::make_shared<SurfaceDetection<TDataType>>();
+		m_smoothingLength.connect(m_surfaceDetection->m_smoothingLength);
+		m_position.connect(m_surfaceDetection->m_position);
+		m_neighborhood.connect(m_surfaceDetection->m_neighborhood);
+
+		return m_surfaceDetection->initialize();
+	}
+
+	template<typename TDataType>
+	void ParticleAdaptivity<TDataType>::computeDepth(int num)
+	{
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+		int maxDepth = m_fineBand + m_maxLevel*m_bandWidth;
+
+		m_depth.setSize(num);
+		m_depthOld.setSize(num);
+		thrust::fill(thrust::device, m_depth.getDataPtr(), m_depth.getDataPtr() + num, maxDepth);
+
+		m_surfaceDetection->compute();
+		int surfaceNum = m_surfaceDetection->getSurfaceNumber();
+		if (surfaceNum > 0)
+		{
+			cuint sDims = cudaGridSize(surfaceNum, BLOCK_SIZE);
+			PA_MarkSurface << <sDims, BLOCK_SIZE >> > (
+				m_depth,
+				m_surfaceDetection->getSurfaceIndex(),
+				surfaceNum);
+		}
+
+		if (m_boundary != nullptr)
+		{
+			m_boundary->queryNeighbors(m_position.getValue());
+			if (m_boundary->getNeighbors().size() == num)
+			{
+				PA_MarkBoundary << <pDims, BLOCK_SIZE >> > (m_depth, m_boundary->getNeighbors());
+			}
+		}
+
+		for (int it = 0; it < maxDepth; it++)
+		{
+			std::swap(m_depth, m_depthOld);
+			PA_PropagateDepth << <pDims, BLOCK_SIZE >> > (
+				m_depth,
+				m_depthOld,
+				m_neighborhood.getValue());
+		}
+		cuSynchronize();
+	}
+
+	template<typename TDataType>
+	void ParticleAdaptivity<TDataType>::compute()
+	{
+		m_planned = false;
+		m_splitNum = 0;
+
+		int num = m_position.getElementCount();
+		if (num <= 0 || m_particleMass.getElementCount() != num || m_particleRadius.getElementCount() != num)
+			return;
+
+		Real h = m_smoothingLength.getValue();
+		Real invDims = Real(1) / Coord::dims();
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+		PA_ResetSize << <pDims, BLOCK_SIZE >> > (
+			m_particleMass.getValue(),
+			m_particleRadius.getValue(),
+			h);
+
+		bool due = isDue();
+		m_step++;
+		if (!due)
+		{
+			cuSynchronize();
+			return;
+		}
+
+		computeDepth(num);
+
+		m_state.setSize(num);
+		m_partner.setSize(num);
+		m_keep.setSize(num);
+		m_flag.setSize(num);
+		m_offset.setSize(num);
+
+		PA_Classify << <pDims, BLOCK_SIZE >> > (
+			m_state,
+			m_depth,
+			m_particleMass.getValue(),
+			m_fineBand,
+			m_bandWidth,
+			m_maxLevel);
+
+		PA_FindPartner << <pDims, BLOCK_SIZE >> > (
+			m_partner,
+			m_state,
+			m_position.getValue(),
+			m_particleMass.getValue(),
+			m_neighborhood.getValue());
+
+		PA_Merge << <pDims, BLOCK_SIZE >> > (
+			m_keep,
+			m_partner,
+			m_position.getValue(),
+			m_velocity.getValue(),
+			m_particleMass.getValue(),
+			m_particleRadius.getValue(),
+			h,
+			invDims);
+
+		PA_FlagSplit << <pDims, BLOCK_SIZE >> > (m_flag, m_state);
+		cuSynchronize();
+
+		m_splitNum = thrust::reduce(thrust::device, m_flag.getDataPtr(), m_flag.getDataPtr() + num, (int)0, thrust::plus<int>());
+		thrust::exclusive_scan(thrust::device, m_flag.getDataPtr(), m_flag.getDataPtr() + num, m_offset.getDataPtr());
+
+		if (m_splitNum > 0)
+		{
+			m_splitIndex.setSize(num);
+			m_splitOffset.setSize(m_splitNum);
+
+			PA_CompactIndex << <pDims, BLOCK_SIZE >> > (m_splitIndex, m_flag, m_offset);
+
+			cuint sDims = cudaGridSize(m_splitNum, BLOCK_SIZE);
+			PA_SplitParents << <sDims, BLOCK_SIZE >> > (
+				m_splitOffset,
+				m_splitIndex,
+				m_particleMass.getValue(),
+				m_particleRadius.getValue(),
+				h,
+				invDims,
+				(unsigned)m_step,
+				m_splitNum);
+			cuSynchronize();
+		}
+
+		m_planned = true;
+	}
+
+	template<typename TDataType>
+	void ParticleAdaptivity<TDataType>::placeChildren(int start)
+	{
+		if (m_splitNum <= 0 || start + m_splitNum != m_position.getElementCount())
+			return;
+
+		cuint sDims = cudaGridSize(m_splitNum, BLOCK_SIZE);
+		PA_PlaceChildren << <sDims, BLOCK_SIZE >> > (
+			m_position.getValue(),
+			m_splitIndex,
+			m_splitOffset,
+			start,
+			m_splitNum);
+		cuSynchronize();
+	}
+
+	template<typename TDataType>
+	int ParticleAdaptivity<TDataType>::findRemaining(int num)
+	{
+		m_remainingNum = num;
+		if (!m_planned || num <= 0 || num < m_keep.size())
+			return m_remainingNum;
+
+		//The appended children are always kept
+		int oldNum = m_keep.size();
+		m_keep.setSize(num);
+		thrust::fill(thrust::device, m_keep.getDataPtr() + oldNum, m_keep.getDataPtr() + num, 1);
+
+		m_offset.setSize(num);
+		m_remainingIndex.setSize(num);
+
+		m_remainingNum = thrust::reduce(thrust::device, m_keep.getDataPtr(), m_keep.getDataPtr() + num, (int)0, thrust::plus<int>());
+		thrust::exclusive_scan(thrust::device, m_keep.getDataPtr(), m_keep.getDataPtr() + num, m_offset.getDataPtr());
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+		PA_CompactIndex << <pDims, BLOCK_SIZE >> > (m_remainingIndex, m_keep, m_offset);
+		cuSynchronize();
+
+		m_planned = false;
+
+		return m_remainingNum;
+	}
+}
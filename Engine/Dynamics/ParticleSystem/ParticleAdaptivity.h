@@ -0,0 +1,119 @@
+#pragma once
+#include "Framework/Framework/ModuleCompute.h"
+#include "Framework/Framework/FieldVar.h"
+#include "Framework/Framework/FieldArray.h"
+#include "Framework/Topology/FieldNeighbor.h"
+
+namespace Physika {
+
+	template<typename TDataType> class SurfaceDetection;
+	template<typename TDataType> class BoundaryParticles;
+
+	/*!
+	*	\class	ParticleAdaptivity
+	*	\brief	Plans splitting and merging of fluid particles, fine near the free surface and obstacles, coarse in the interior.
+	*
+	*	Particle masses are relative to the reference particle and restricted to powers of two, mass 2^l being level l.
+	*	The support radius of a particle scales with the cube root of its mass. The depth of a particle is its distance in
+	*	neighbor hops to the nearest surface particle or particle next to a boundary sample, it is mapped to a target level
+	*	that grows by one every few hops. Particles above their target level split into two halves, pairs of mutually nearest
+	*	particles of the same level below their target merge into one, conserving mass and momentum.
+	*
+	*	compute() changes masses, radii, positions and velocities in place, the owning node then appends the children
+	*	listed by getSplitIndex() and calls placeChildren(), and finally keeps the particles listed by findRemaining().
+	*	Neighbors must be up to date when compute() plans, see isDue().
+	*/
+	template<typename TDataType>
+	class ParticleAdaptivity : public ComputeModule
+	{
+		DECLARE_CLASS_1(ParticleAdaptivity, TDataType)
+
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+
+		ParticleAdaptivity();
+		~ParticleAdaptivity() override;
+
+		/*!
+		*	\brief	Give particles without a mass, e.g., emitted ones, the reference size, and plan splits and merges if due.
+		*/
+		void compute() override;
+
+		/// Levels range from 0, the reference particle, to maxLevel, a particle of mass 2^maxLevel
+		void setMaxLevel(int level) { m_maxLevel = level > 0 ? level : 0; }
+		/// Hops from the surface kept at the finest level, and hops covered by each coarser level
+		void setBandWidth(int fine, int perLevel) { m_fineBand = fine; m_bandWidth = perLevel > 1 ? perLevel : 1; }
+		/// Plan splits and merges every interval steps
+		void setInterval(int steps) { m_interval = steps > 1 ? steps : 1; }
+
+		/*!
+		*	\brief	Particles next to the boundary samples are kept at the finest level.
+		*/
+		void setBoundaryParticles(std::shared_ptr<BoundaryParticles<TDataType>> boundary) { m_boundary = boundary; }
+
+		/// Whether the next compute() plans, the neighbors should be queried for the current particles before
+		bool isDue() { return m_step % m_interval == 0; }
+
+		/// Parents of the particles to append, only the first getSplitNumber() entries are valid
+		DeviceArray<int>& getSplitIndex() { return m_splitIndex; }
+		int getSplitNumber() { return m_splitNum; }
+
+		/*!
+		*	\brief	Move the parents and their children, appended from start on in the order of getSplitIndex(), apart.
+		*/
+		void placeChildren(int start);
+
+		/*!
+		*	\brief	Compact the ids of the particles surviving the merges among num particles, the appended children included.
+		*/
+		int findRemaining(int num);
+		DeviceArray<int>& getRemainingIndex() { return m_remainingIndex; }
+
+	protected:
+		bool initializeImpl() override;
+
+	public:
+		VarField<Real> m_smoothingLength;
+
+		DeviceArrayField<Coord> m_position;
+		DeviceArrayField<Coord> m_velocity;
+		DeviceArrayField<Real> m_particleMass;
+		DeviceArrayField<Real> m_particleRadius;
+
+		NeighborField<int> m_neighborhood;
+
+	private:
+		void computeDepth(int num);
+
+		int m_maxLevel;
+		int m_fineBand;
+		int m_bandWidth;
+		int m_interval;
+		int m_step;
+
+		bool m_planned;
+		int m_splitNum;
+		int m_remainingNum;
+
+		DeviceArray<int> m_depth;
+		DeviceArray<int> m_depthOld;
+		DeviceArray<int> m_state;
+		DeviceArray<int> m_partner;
+		DeviceArray<int> m_keep;
+		DeviceArray<int> m_flag;
+		DeviceArray<int> m_offset;
+		DeviceArray<int> m_splitIndex;
+		DeviceArray<Coord> m_splitOffset;
+		DeviceArray<int> m_remainingIndex;
+
+		std::shared_ptr<SurfaceDetection<TDataType>> m_surfaceDetection;
+		std::shared_ptr<BoundaryParticles<TDataType>> m_boundary;
+	};
+
+#ifdef PRECISION_FLOAT
+	template class ParticleAdaptivity<DataType3f>;
+#else
+	template class ParticleAdaptivity<DataType3d>;
+#endif
+}
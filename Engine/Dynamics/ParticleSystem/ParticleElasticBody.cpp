@@ -95,6 +95,12 @@ namespace Physika
 		integrator->end();
 	}
 
+	template<typename TDataType>
+	typename TDataType::Real ParticleElasticBody<TDataType>::getStableTimeStep()
+	{
+		return this->computeStableTimeStep(m_horizon.getValue(), Real(0.4), this->getUnscheduledDt());
+	}
+
 	template<typename TDataType>
 	void ParticleElasticBody<TDataType>::updateTopology()
 	{
@@ -24,6 +24,9 @@ namespace Physika
 		void advance(Real dt) override;
 		void updateTopology() override;
 
+		/// The CFL step over the horizon, at most the time step set with setDt()
+		Real getStableTimeStep() override;
+
 		bool translate(Coord t) override;
 		bool scale(Real s) override;
 
@@ -14,6 +14,7 @@
 
 #include "DensityPBD.h"
 #include "ImplicitViscosity.h"
+#include "ParticleSleeping.h"
 
 namespace Physika
 {
@@ -78,6 +79,11 @@ namespace Physika
 	{
 		auto module = this->template getModule<ElastoplasticityModule<TDataType>>("elastoplasticity");
 
+		if (m_sleeping != nullptr)
+		{
+			m_sleeping->compute();
+		}
+
 		m_integrator->begin();
 
 		m_integrator->integrate();
@@ -93,6 +99,12 @@ namespace Physika
 		m_integrator->end();
 	}
 
+	template<typename TDataType>
+	typename TDataType::Real ParticleElastoplasticBody<TDataType>::getStableTimeStep()
+	{
+		return this->computeStableTimeStep(m_horizon.getValue(), Real(0.4), this->getUnscheduledDt());
+	}
+
 	template<typename TDataType>
 	void ParticleElastoplasticBody<TDataType>::updateTopology()
 	{
@@ -153,5 +165,36 @@ namespace Physika
 
 		solver->setName("elastoplasticity");
 		this->addConstraintModule(solver);
+
+		solver->setSleeping(m_sleeping);
+	}
+
+	template<typename TDataType>
+	void ParticleElastoplasticBody<TDataType>::enableSleeping(Real velocity, int steps)
+	{
+		if (m_sleeping == nullptr)
+		{
+			m_sleeping = this->template addComputeModule<ParticleSleeping<TDataType>>("sleeping");
+			this->m_position.connect(m_sleeping->m_position);
+			this->m_velocity.connect(m_sleeping->m_velocity);
+			m_nbrQuery->m_neighborhood.connect(m_sleeping->m_neighborhood);
+		}
+		m_sleeping->setSleepThreshold(velocity, steps);
+
+		m_integrator->setSleeping(m_sleeping);
+		this->template getModule<ElastoplasticityModule<TDataType>>("elastoplasticity")->setSleeping(m_sleeping);
+	}
+
+	template<typename TDataType>
+	void ParticleElastoplasticBody<TDataType>::disableSleeping()
+	{
+		if (m_sleeping == nullptr)
+			return;
+
+		m_integrator->setSleeping(nullptr);
+		this->template getModule<ElastoplasticityModule<TDataType>>("elastoplasticity")->setSleeping(nullptr);
+
+		this->deleteModule(m_sleeping);
+		m_sleeping = nullptr;
 	}
 }
\ No newline at end of file
@@ -10,6 +10,7 @@ namespace Physika
 	template<typename> class ElastoplasticityModule;
 	template<typename> class DensityPBD;
 	template<typename TDataType> class ImplicitViscosity;
+	template<typename TDataType> class ParticleSleeping;
 	/*!
 	*	\class	ParticleElastoplasticBody
 	*	\brief	Peridynamics-based elastoplastic object.
@@ -29,6 +30,9 @@ namespace Physika
 
 		void updateTopology() override;
 
+		/// The CFL step over the horizon, at most the time step set with setDt()
+		Real getStableTimeStep() override;
+
 		bool initialize() override;
 
 		bool translate(Coord t) override;
@@ -38,6 +42,13 @@ namespace Physika
 
 		void setElastoplasticitySolver(std::shared_ptr<ElastoplasticityModule<TDataType>> solver);
 
+		/*!
+		*	\brief	Let particles slower than the given velocity for the given number of steps sleep,
+		*			the integrator and the elasticity solver then skip them until they are disturbed.
+		*/
+		void enableSleeping(Real velocity, int steps);
+		void disableSleeping();
+
 	public:
 		VarField<Real> m_horizon;
 
@@ -50,6 +61,7 @@ namespace Physika
 		std::shared_ptr<ElastoplasticityModule<TDataType>> m_plasticity;
 		std::shared_ptr<DensityPBD<TDataType>> m_pbdModule;
 		std::shared_ptr<ImplicitViscosity<TDataType>> m_visModule;
+		std::shared_ptr<ParticleSleeping<TDataType>> m_sleeping;
 	};
 
 
@@ -0,0 +1,82 @@
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "ParticleEmitter.h"
+#include "Core/Utility.h"
+
+namespace Physika
+{
+	IMPLEMENT_CLASS_1(ParticleEmitter, TDataType)
+
+	template<typename TDataType>
+	ParticleEmitter<TDataType>::ParticleEmitter(std::string name)
+		: Module(name)
+		, m_center(Coord(0))
+		, m_velocity(Coord(0, -1, 0))
+		, m_width(Real(0.05))
+		, m_height(Real(0.05))
+		, m_samplingDistance(Real(0.005))
+		, m_active(true)
+		, m_traveled(Real(0))
+		, m_emittedNum(0)
+	{
+	}
+
+	template<typename TDataType>
+	ParticleEmitter<TDataType>::~ParticleEmitter()
+	{
+		m_positions.release();
+		m_velocities.release();
+	}
+
+	template<typename TDataType>
+	void ParticleEmitter<TDataType>::generateParticles(Real dt)
+	{
+		m_emittedNum = 0;
+
+		Real speed = m_velocity.norm();
+		if (!m_active || speed < EPSILON || m_samplingDistance <= Real(0))
+			return;
+
+		//Orthonormal frame of the nozzle
+		Coord dir = m_velocity / speed;
+		Coord axis = std::abs(dir[1]) < Real(0.9) ? Coord(0, 1, 0) : Coord(1, 0, 0);
+		Coord t1 = dir.cross(axis);
+		t1.normalize();
+		Coord t2 = dir.cross(t1);
+
+		int nu = std::max(1, (int)(m_width / m_samplingDistance));
+		int nv = std::max(1, (int)(m_height / m_samplingDistance));
+		Real u0 = -Real(0.5)*(nu - 1)*m_samplingDistance;
+		Real v0 = -Real(0.5)*(nv - 1)*m_samplingDistance;
+
+		std::vector<Coord> hPos;
+		std::vector<Coord> hVel;
+
+		m_traveled += speed*dt;
+		while (m_traveled >= m_samplingDistance)
+		{
+			m_traveled -= m_samplingDistance;
+
+			//The layer has already moved on since it crossed the nozzle
+			Coord layer = m_center + m_traveled*dir;
+			for (int i = 0; i < nu; i++)
+			{
+				for (int j = 0; j < nv; j++)
+				{
+					hPos.push_back(layer + (u0 + i*m_samplingDistance)*t1 + (v0 + j*m_samplingDistance)*t2);
+					hVel.push_back(m_velocity);
+				}
+			}
+		}
+
+		m_emittedNum = hPos.size();
+		if (m_emittedNum == 0)
+			return;
+
+		m_positions.setSize(m_emittedNum);
+		m_velocities.setSize(m_emittedNum);
+		Function1Pt::copy(m_positions, hPos);
+		Function1Pt::copy(m_velocities, hVel);
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "Framework/Framework/Module.h"
+#include "Core/Array/Array.h"
+
+namespace Physika
+{
+	/*!
+	*	\class	ParticleEmitter
+	*	\brief	Injects particles through a rectangular nozzle, perpendicular to the emission velocity.
+	*
+	*	A new layer of particles, sampled with the given distance, is released each time the previous layer has moved
+	*	one sampling distance away from the nozzle, so the emitted stream stays evenly spaced for any time step.
+	*	The owning ParticleSystem appends the generated particles to its fields between steps.
+	*/
+	template<typename TDataType>
+	class ParticleEmitter : public Module
+	{
+		DECLARE_CLASS_1(ParticleEmitter, TDataType)
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+
+		ParticleEmitter(std::string name = "emitter");
+		~ParticleEmitter() override;
+
+		void setLocation(Coord center) { m_center = center; }
+		void setVelocity(Coord vel) { m_velocity = vel; }
+		void setNozzleSize(Real width, Real height) { m_width = width; m_height = height; }
+		void setSamplingDistance(Real d) { m_samplingDistance = d; }
+
+		void setActive(bool active) { m_active = active; }
+		bool isActive() { return m_active; }
+
+		/*!
+		*	\brief	Generate the particles released over the elapsed time dt, the result is read with
+		*			getPositions() and getVelocities(), of which the first getEmittedNumber() entries are valid.
+		*/
+		virtual void generateParticles(Real dt);
+
+		DeviceArray<Coord>& getPositions() { return m_positions; }
+		DeviceArray<Coord>& getVelocities() { return m_velocities; }
+		int getEmittedNumber() { return m_emittedNum; }
+
+	protected:
+		Coord m_center;
+		Coord m_velocity;
+
+		Real m_width;
+		Real m_height;
+		Real m_samplingDistance;
+
+		bool m_active;
+
+		/// Distance the last released layer has traveled beyond the nozzle
+		Real m_traveled;
+
+		int m_emittedNum;
+		DeviceArray<Coord> m_positions;
+		DeviceArray<Coord> m_velocities;
+	};
+
+#ifdef PRECISION_FLOAT
+	template class ParticleEmitter<DataType3f>;
+#else
+	template class ParticleEmitter<DataType3d>;
+#endif
+}
@@ -1,9 +1,15 @@
+#include <algorithm>
 #include "ParticleFluid.h"
 #include "PositionBasedFluidModel.h"
+#include "ParticleIntegrator.h"
+#include "ParticleAdaptivity.h"
+#include "DensityPBD.h"
 
 #include "Framework/Topology/PointSet.h"
 #include "Rendering/PointRenderModule.h"
 #include "Core/Utility.h"
+#include "Framework/Framework/SceneGraph.h"
+#include "Framework/Topology/NeighborQuery.h"
 
 
 namespace Physika
@@ -13,6 +19,10 @@ namespace Physika
 	template<typename TDataType>
 	ParticleFluid<TDataType>::ParticleFluid(std::string name)
 		: ParticleSystem<TDataType>(name)
+		, m_adaptiveTimeStep(false)
+		, m_cfl(Real(0.4))
+		, m_minTimeStep(Real(0.00001))
+		, m_maxTimeStep(Real(0.005))
 	{
 		auto pbf = std::make_shared<PositionBasedFluidModel<TDataType>>();
 		this->setNumericalModel(pbf);
@@ -21,6 +31,11 @@ namespace Physika
 		this->getVelocity()->connect(pbf->m_velocity);
 		this->getForce()->connect(pbf->m_forceDensity);
 
+		this->attachField(&m_particleMass, "particle_mass", "Storing the particle masses relative to the initial particles!", false);
+		this->attachField(&m_particleRadius, "particle_radius", "Storing the particle support radii!", false);
+		m_particleMass.connect(pbf->m_particleMass);
+		m_particleRadius.connect(pbf->m_particleRadius);
+
 //		this->getVelocity()->connect(this->getRenderModule()->m_vecIndex);
 		
 				//auto fluid = std::make_shared<PositionBasedFluidModel<TDataType>>();
@@ -42,6 +57,152 @@ namespace Physika
 	void ParticleFluid<TDataType>::advance(Real dt)
 	{
 		auto nModel = this->getNumericalModel();
-		nModel->step(this->getDt());
+
+		//Emitted and drained particles enter and leave between steps. The scene graph does not distinguish
+		//whether a substep is the first of a frame, so the emitters are fed the time covered by this call
+		SceneGraph& scene = SceneGraph::getInstance();
+		bool coversFrame = m_adaptiveTimeStep && !scene.isMultiRate();
+		this->updateParticleNumber(coversFrame ? scene.getFrameInterval() : this->getDt());
+
+		//The sinks may have drained all particles, nothing is solved until emitters release new ones
+		if (this->m_position.getElementCount() == 0)
+			return;
+
+		adaptResolution();
+
+		auto pbf = std::dynamic_pointer_cast<PositionBasedFluidModel<TDataType>>(nModel);
+		auto integrator = std::dynamic_pointer_cast<ParticleIntegrator<TDataType>>(this->getNumericalIntegrator());
+		if (!m_adaptiveTimeStep || pbf == nullptr || integrator == nullptr)
+		{
+			nModel->step(this->getDt());
+			return;
+		}
+
+		//Modules read the time step from the node, so each substep sets it before stepping.
+		//In multi-rate mode the node covers the time step scheduled by the scene graph instead of the whole frame
+		Real interval = scene.isMultiRate() ? this->getDt() : scene.getFrameInterval();
+		Real length = pbf->m_smoothingLength.getValue();
+		Real fixedDt = this->getDt();
+
+		Real t = 0;
+		bool finished = false;
+		while (!finished)
+		{
+			Real remaining = interval - t;
+
+			Real subDt = integrator->computeStableTimeStep(length, m_cfl, m_maxTimeStep);
+			subDt = std::max(subDt, m_minTimeStep);
+
+			//Split the rest of the frame evenly rather than leaving a tiny last substep
+			if (subDt >= remaining)
+			{
+				subDt = remaining;
+				finished = true;
+			}
+			else if (2 * subDt > remaining)
+			{
+				subDt = remaining / 2;
+			}
+
+			this->setDt(subDt);
+			nModel->step(subDt);
+
+			//The parent applies its obstacles once before its children, substeps have to be kept inside them as well
+			if (this->getParent() != nullptr)
+			{
+				this->getParent()->constrainChild(this, subDt);
+			}
+
+			t += subDt;
+		}
+
+		this->setDt(fixedDt);
+	}
+
+	template<typename TDataType>
+	typename TDataType::Real ParticleFluid<TDataType>::getStableTimeStep()
+	{
+		auto pbf = std::dynamic_pointer_cast<PositionBasedFluidModel<TDataType>>(this->getNumericalModel());
+		if (pbf == nullptr)
+			return Node::getStableTimeStep();
+
+		Real dt = this->computeStableTimeStep(pbf->m_smoothingLength.getValue(), m_cfl, m_maxTimeStep);
+		return dt > 0 ? std::max(dt, m_minTimeStep) : dt;
+	}
+
+	template<typename TDataType>
+	void ParticleFluid<TDataType>::enableAdaptiveResolution(int maxLevel, int interval)
+	{
+		if (m_adaptivity == nullptr)
+		{
+			m_adaptivity = std::make_shared<ParticleAdaptivity<TDataType>>();
+			this->getPosition()->connect(m_adaptivity->m_position);
+			this->getVelocity()->connect(m_adaptivity->m_velocity);
+			m_particleMass.connect(m_adaptivity->m_particleMass);
+			m_particleRadius.connect(m_adaptivity->m_particleRadius);
+		}
+
+		m_adaptivity->setMaxLevel(maxLevel);
+		m_adaptivity->setInterval(interval);
+	}
+
+	template<typename TDataType>
+	void ParticleFluid<TDataType>::adaptResolution()
+	{
+		auto pbf = std::dynamic_pointer_cast<PositionBasedFluidModel<TDataType>>(this->getNumericalModel());
+		auto nbrQuery = this->template getModule<NeighborQuery<TDataType>>("neighborhood");
+		if (m_adaptivity == nullptr || pbf == nullptr || nbrQuery == nullptr)
+			return;
+
+		//Sizes are zero until the first call, afterwards they follow the particles like all other fields
+		int num = this->m_position.getElementCount();
+		if (m_particleMass.getElementCount() != num)
+		{
+			m_particleMass.setElementCount(num);
+			m_particleMass.getValue().reset();
+			m_particleRadius.setElementCount(num);
+			m_particleRadius.getValue().reset();
+		}
+
+		if (!m_adaptivity->isInitialized())
+		{
+			pbf->m_smoothingLength.connect(m_adaptivity->m_smoothingLength);
+			nbrQuery->m_neighborhood.connect(m_adaptivity->m_neighborhood);
+			if (!m_adaptivity->initialize())
+				return;
+		}
+
+		//Particles next to the walls sampled for the density solver are kept at the finest level
+		auto boundary = pbf->getBoundaryParticles();
+		if (boundary != nullptr && !boundary->isInitialized())
+			boundary->setSmoothingLength(pbf->m_smoothingLength.getValue());
+		m_adaptivity->setBoundaryParticles(boundary);
+
+		//Emitted and drained particles invalidate the neighbor lists of the last step
+		if (m_adaptivity->isDue())
+			nbrQuery->compute();
+
+		m_adaptivity->compute();
+
+		int splitNum = m_adaptivity->getSplitNumber();
+		if (splitNum > 0)
+		{
+			this->duplicateParticles(m_adaptivity->getSplitIndex().getDataPtr(), splitNum);
+			m_adaptivity->placeChildren(num);
+		}
+
+		int total = this->m_position.getElementCount();
+		int remaining = m_adaptivity->findRemaining(total);
+		if (remaining != total)
+		{
+			this->removeParticles(m_adaptivity->getRemainingIndex().getDataPtr(), remaining);
+		}
+
+		//Multipliers carried over from particles of a different mass are no useful initial guess
+		auto pbd = this->template getModule<DensityPBD<TDataType>>("density_constraint");
+		if (pbd != nullptr && (splitNum > 0 || remaining != total))
+		{
+			pbd->resetWarmStart();
+		}
 	}
 }
\ No newline at end of file
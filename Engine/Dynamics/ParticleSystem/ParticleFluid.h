@@ -3,6 +3,7 @@
 
 namespace Physika
 {
+	template<typename TDataType> class ParticleAdaptivity;
 	/*!
 	*	\class	ParticleFluid
 	*	\brief	Position-based fluids.
@@ -23,7 +24,39 @@ namespace Physika
 		virtual ~ParticleFluid();
 
 		void advance(Real dt) override;
+
+		/// The CFL step within the time step bounds, see setCFL() and setTimeStepBounds()
+		Real getStableTimeStep() override;
+
+		/*!
+		*	\brief	Cover the frame interval of the scene graph with substeps chosen by the CFL condition,
+		*			instead of taking one step of the node's fixed time step per frame.
+		*/
+		void setAdaptiveTimeStep(bool adaptive) { m_adaptiveTimeStep = adaptive; }
+		void setCFL(Real cfl) { m_cfl = cfl; }
+		void setTimeStepBounds(Real minDt, Real maxDt) { m_minTimeStep = minDt; m_maxTimeStep = maxDt; }
+
+		/*!
+		*	\brief	Split particles near the free surface and obstacles, and merge them in the interior up to particles of
+		*			2^maxLevel times the initial mass. Splits and merges are planned every interval steps.
+		*/
+		void enableAdaptiveResolution(int maxLevel, int interval = 10);
+		std::shared_ptr<ParticleAdaptivity<TDataType>> getAdaptivity() { return m_adaptivity; }
+
+	public:
+		/// Relative mass and support radius of each particle, empty unless adaptive resolution is enabled
+		DeviceArrayField<Real> m_particleMass;
+		DeviceArrayField<Real> m_particleRadius;
+
 	private:
+		void adaptResolution();
+
+		std::shared_ptr<ParticleAdaptivity<TDataType>> m_adaptivity;
+
+		bool m_adaptiveTimeStep;
+		Real m_cfl;
+		Real m_minTimeStep;
+		Real m_maxTimeStep;
 	};
 
 #ifdef PRECISION_FLOAT
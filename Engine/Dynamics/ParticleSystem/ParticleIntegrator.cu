@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cuda_runtime.h>
 #include "ParticleIntegrator.h"
 #include "Framework/Framework/FieldArray.h"
@@ -5,12 +6,16 @@
 #include "Framework/Framework/Node.h"
 #include "Core/Utility.h"
 #include "Framework/Framework/SceneGraph.h"
+#include "Core/Utility/ResidualMax.h"
+#include "ParticleSleeping.h"
 
 namespace Physika
 {
 	template<typename TDataType>
 	ParticleIntegrator<TDataType>::ParticleIntegrator()
 		: NumericalIntegrator()
+		, m_rangeStart(0)
+		, m_rangeCount(-1)
 	{
 		attachField(&m_position, "position", "Storing the particle positions!", false);
 		attachField(&m_velocity, "velocity", "Storing the particle velocities!", false);
@@ -20,6 +25,14 @@ namespace Physika
 	template<typename TDataType>
 	void ParticleIntegrator<TDataType>::begin()
 	{
+		//Particles were emitted or removed since the last step
+		int num = m_position.getElementCount();
+		if (m_prePosition.size() != num)
+		{
+			m_prePosition.setSize(num);
+			m_preVelocity.setSize(num);
+		}
+
 		Function1Pt::copy(m_prePosition, m_position.getValue());
 		Function1Pt::copy(m_preVelocity, m_velocity.getValue());
 		
@@ -32,6 +45,29 @@ namespace Physika
 
 	}
 
+	template<typename TDataType>
+	bool ParticleIntegrator<TDataType>::getActiveSet(int*& activeIndex, int& offset, int& activeNum)
+	{
+		activeIndex = nullptr;
+		offset = 0;
+		activeNum = m_position.getElementCount();
+
+		if (m_sleeping != nullptr)
+		{
+			activeIndex = m_sleeping->getActiveIndex().getDataPtr();
+			activeNum = m_sleeping->getActiveNumber();
+			return true;
+		}
+		else if (m_rangeCount >= 0)
+		{
+			offset = m_rangeStart;
+			activeNum = m_rangeCount;
+			return true;
+		}
+
+		return false;
+	}
+
 	template<typename TDataType>
 	bool ParticleIntegrator<TDataType>::initializeImpl()
 	{
@@ -45,6 +81,7 @@ namespace Physika
 
 		m_prePosition.resize(num);
 		m_preVelocity.resize(num);
+		m_maxima.resize(2);
 
 		return true;
 	}
@@ -59,7 +96,10 @@ namespace Physika
 		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
 		if (pId >= forceDensity.size()) return;
 
-		vel[pId] += dt * (forceDensity[pId] + Coord(0, gravity, 0));
+		Coord g(0);
+		g[1] = gravity;
+
+		vel[pId] += dt * (forceDensity[pId] + g);
 	}
 
 
@@ -76,11 +116,56 @@ namespace Physika
 		vel[pId] += dt * force[pId] / mass[pId];
 	}
 
+	/*!
+	*	\brief	Threads map to the first activeNum entries of activeIndex, or to a contiguous range from offset if it is null.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void K_UpdateActiveVelocity(
+		DeviceArray<Coord> vel,
+		DeviceArray<Coord> forceDensity,
+		int* activeIndex,
+		int offset,
+		int activeNum,
+		Real gravity,
+		Real dt)
+	{
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (tId >= activeNum) return;
+
+		int pId = activeIndex == nullptr ? offset + tId : activeIndex[tId];
+
+		Coord g(0);
+		g[1] = gravity;
+
+		vel[pId] += dt * (forceDensity[pId] + g);
+	}
+
 	template<typename TDataType>
 	bool ParticleIntegrator<TDataType>::updateVelocity()
 	{
 		Real dt = getParent()->getDt();
 		Real gravity = SceneGraph::getInstance().getGravity();
+
+		int* activeIndex = nullptr;
+		int offset, activeNum;
+		if (getActiveSet(activeIndex, offset, activeNum))
+		{
+			if (activeNum > 0)
+			{
+				cuint pDims = cudaGridSize(activeNum, BLOCK_SIZE);
+				K_UpdateActiveVelocity << <pDims, BLOCK_SIZE >> > (
+					m_velocity.getValue(),
+					m_forceDensity.getValue(),
+					activeIndex,
+					offset,
+					activeNum,
+					gravity,
+					dt);
+			}
+
+			return true;
+		}
+
 		cuint pDims = cudaGridSize(m_position.getReference()->size(), BLOCK_SIZE);
 
 		K_UpdateVelocity << <pDims, BLOCK_SIZE >> > (
@@ -104,10 +189,47 @@ namespace Physika
 		pos[pId] += dt * vel[pId];
 	}
 
+	template<typename Real, typename Coord>
+	__global__ void K_UpdateActivePosition(
+		DeviceArray<Coord> pos,
+		DeviceArray<Coord> vel,
+		int* activeIndex,
+		int offset,
+		int activeNum,
+		Real dt)
+	{
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (tId >= activeNum) return;
+
+		int pId = activeIndex == nullptr ? offset + tId : activeIndex[tId];
+
+		pos[pId] += dt * vel[pId];
+	}
+
 	template<typename TDataType>
 	bool ParticleIntegrator<TDataType>::updatePosition()
 	{
 		Real dt = getParent()->getDt();
+
+		int* activeIndex = nullptr;
+		int offset, activeNum;
+		if (getActiveSet(activeIndex, offset, activeNum))
+		{
+			if (activeNum > 0)
+			{
+				cuint pDims = cudaGridSize(activeNum, BLOCK_SIZE);
+				K_UpdateActivePosition << <pDims, BLOCK_SIZE >> > (
+					m_position.getValue(),
+					m_velocity.getValue(),
+					activeIndex,
+					offset,
+					activeNum,
+					dt);
+			}
+
+			return true;
+		}
+
 		cuint pDims = cudaGridSize(m_position.getReference()->size(), BLOCK_SIZE);
 
 		K_UpdatePosition << <pDims, BLOCK_SIZE >> > (
@@ -126,4 +248,60 @@ namespace Physika
 
 		return true;
 	}
+
+	/*!
+	*	\brief	Maximum speed and maximum acceleration (force density plus gravity) in a single pass.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void K_ComputeMaxMagnitude(
+		Real* maxima,
+		DeviceArray<Coord> vel,
+		DeviceArray<Coord> forceDensity,
+		Real gravity)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+
+		Real v_i = Real(0);
+		Real a_i = Real(0);
+		if (pId < vel.size())
+		{
+			Coord g(0);
+			g[1] = gravity;
+
+			v_i = vel[pId].norm();
+			a_i = (forceDensity[pId] + g).norm();
+		}
+
+		RS_WarpMax(maxima, v_i);
+		RS_WarpMax(maxima + 1, a_i);
+	}
+
+	template<typename TDataType>
+	typename TDataType::Real ParticleIntegrator<TDataType>::computeStableTimeStep(Real length, Real cfl, Real maxDt)
+	{
+		Real gravity = SceneGraph::getInstance().getGravity();
+		cuint pDims = cudaGridSize(m_position.getReference()->size(), BLOCK_SIZE);
+
+		m_maxima.reset();
+		K_ComputeMaxMagnitude << <pDims, BLOCK_SIZE >> > (
+			m_maxima.getDataPtr(),
+			m_velocity.getValue(),
+			m_forceDensity.getValue(),
+			gravity);
+
+		Real maxima[2];
+		cudaMemcpy(maxima, m_maxima.getDataPtr(), 2 * sizeof(Real), cudaMemcpyDeviceToHost);
+
+		Real dt = maxDt;
+		if (maxima[0] > EPSILON)
+		{
+			dt = std::min(dt, cfl*length / maxima[0]);
+		}
+		if (maxima[1] > EPSILON)
+		{
+			dt = std::min(dt, cfl*std::sqrt(length / maxima[1]));
+		}
+
+		return dt;
+	}
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "Framework/Framework/FieldArray.h"
 
 namespace Physika {
+	template<typename TDataType> class ParticleSleeping;
+
 	template<typename TDataType>
 	class ParticleIntegrator : public NumericalIntegrator
 	{
@@ -22,9 +24,29 @@ namespace Physika {
 		bool updateVelocity();
 		bool updatePosition();
 
+		/*!
+		*	\brief	Largest time step, up to maxDt, for which no particle moves more than cfl*length,
+		*			and for which the change of velocity is bounded by the current maximum acceleration.
+		*/
+		Real computeStableTimeStep(Real length, Real cfl, Real maxDt);
+
+		/*!
+		*	\brief	Only advance the particles in the active set of the given module, the sleeping ones stay in place.
+		*			The owner calls its compute() before begin().
+		*/
+		void setSleeping(std::shared_ptr<ParticleSleeping<TDataType>> sleeping) { m_sleeping = sleeping; }
+
+		/*!
+		*	\brief	Only advance the particles [start, start + count), a negative count means all particles.
+		*/
+		void setParticleRange(int start, int count) { m_rangeStart = start; m_rangeCount = count; }
+
 	protected:
 		bool initializeImpl() override;
 
+		/// Whether only part of the particles is advanced, either the awake ones or a range
+		bool getActiveSet(int*& activeIndex, int& offset, int& activeNum);
+
 	public:
 		DeviceArrayField<Coord> m_position;
 		DeviceArrayField<Coord> m_velocity;
@@ -33,6 +55,13 @@ namespace Physika {
 	private:
 		DeviceArray<Coord> m_prePosition;
 		DeviceArray<Coord> m_preVelocity;
+
+		DeviceArray<Real> m_maxima;
+
+		std::shared_ptr<ParticleSleeping<TDataType>> m_sleeping;
+
+		int m_rangeStart;
+		int m_rangeCount;
 	};
 
 #ifdef PRECISION_FLOAT
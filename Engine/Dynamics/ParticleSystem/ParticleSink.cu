@@ -0,0 +1,94 @@
+#include <cuda_runtime.h>
+#include <thrust/reduce.h>
+#include <thrust/scan.h>
+#include <thrust/execution_policy.h>
+#include "ParticleSink.h"
+#include "Core/Utility.h"
+
+namespace Physika
+{
+	IMPLEMENT_CLASS_1(ParticleSink, TDataType)
+
+	template<typename Coord>
+	__global__ void SK_FlagRemaining(
+		DeviceArray<int> flag,
+		DeviceArray<Coord> posArr,
+		Coord lo,
+		Coord hi)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		Coord pos_i = posArr[pId];
+
+		bool bInside = true;
+		for (int d = 0; d < Coord::dims(); d++)
+		{
+			bInside = bInside && pos_i[d] >= lo[d] && pos_i[d] <= hi[d];
+		}
+
+		flag[pId] = bInside ? 0 : 1;
+	}
+
+	__global__ void SK_CompactRemaining(
+		DeviceArray<int> remainingIndex,
+		DeviceArray<int> flag,
+		DeviceArray<int> offset)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= flag.size()) return;
+
+		if (flag[pId] == 1)
+		{
+			remainingIndex[offset[pId]] = pId;
+		}
+	}
+
+	template<typename TDataType>
+	ParticleSink<TDataType>::ParticleSink(std::string name)
+		: Module(name)
+		, m_lowBound(Coord(0))
+		, m_highBound(Coord(0))
+		, m_active(true)
+		, m_remainingNum(0)
+	{
+	}
+
+	template<typename TDataType>
+	ParticleSink<TDataType>::~ParticleSink()
+	{
+		m_flag.release();
+		m_offset.release();
+		m_remainingIndex.release();
+	}
+
+	template<typename TDataType>
+	int ParticleSink<TDataType>::findRemaining(DeviceArray<Coord>& pos)
+	{
+		int num = pos.size();
+		m_remainingNum = num;
+		if (!m_active || num <= 0)
+			return m_remainingNum;
+
+		m_flag.setSize(num);
+		m_offset.setSize(num);
+		m_remainingIndex.setSize(num);
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+		SK_FlagRemaining << <pDims, BLOCK_SIZE >> > (
+			m_flag,
+			pos,
+			m_lowBound,
+			m_highBound);
+		cuSynchronize();
+
+		m_remainingNum = thrust::reduce(thrust::device, m_flag.getDataPtr(), m_flag.getDataPtr() + num, (int)0, thrust::plus<int>());
+		thrust::exclusive_scan(thrust::device, m_flag.getDataPtr(), m_flag.getDataPtr() + num, m_offset.getDataPtr());
+
+		SK_CompactRemaining << <pDims, BLOCK_SIZE >> > (m_remainingIndex, m_flag, m_offset);
+		cuSynchronize();
+
+		return m_remainingNum;
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "Framework/Framework/Module.h"
+#include "Core/Array/Array.h"
+
+namespace Physika
+{
+	/*!
+	*	\class	ParticleSink
+	*	\brief	Removes the particles entering an axis-aligned box, e.g., a drain.
+	*
+	*	The sink only lists the ids of the particles to keep, the owning ParticleSystem then compacts all of its
+	*	array fields with this list between steps, preserving the order of the remaining particles.
+	*/
+	template<typename TDataType>
+	class ParticleSink : public Module
+	{
+		DECLARE_CLASS_1(ParticleSink, TDataType)
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+
+		ParticleSink(std::string name = "sink");
+		~ParticleSink() override;
+
+		void setBox(Coord lo, Coord hi) { m_lowBound = lo; m_highBound = hi; }
+
+		void setActive(bool active) { m_active = active; }
+		bool isActive() { return m_active; }
+
+		/*!
+		*	\brief	Collect the ids of the particles outside the box, returns the number of particles to keep.
+		*/
+		virtual int findRemaining(DeviceArray<Coord>& pos);
+
+		/// Ids of the remaining particles, only the first getRemainingNumber() entries are valid
+		DeviceArray<int>& getRemainingIndex() { return m_remainingIndex; }
+		int getRemainingNumber() { return m_remainingNum; }
+
+	protected:
+		Coord m_lowBound;
+		Coord m_highBound;
+
+		bool m_active;
+
+		int m_remainingNum;
+
+		DeviceArray<int> m_flag;
+		DeviceArray<int> m_offset;
+		DeviceArray<int> m_remainingIndex;
+	};
+
+#ifdef PRECISION_FLOAT
+	template class ParticleSink<DataType3f>;
+#else
+	template class ParticleSink<DataType3d>;
+#endif
+}
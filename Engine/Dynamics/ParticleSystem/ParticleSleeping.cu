@@ -0,0 +1,175 @@
+#include <cuda_runtime.h>
+#include <thrust/reduce.h>
+#include <thrust/scan.h>
+#include <thrust/execution_policy.h>
+#include "ParticleSleeping.h"
+#include "Core/Utility.h"
+#include "Framework/Topology/FieldNeighbor.h"
+
+namespace Physika
+{
+	IMPLEMENT_CLASS_1(ParticleSleeping, TDataType)
+
+	template<typename Real, typename Coord>
+	__global__ void SL_UpdateCounter(
+		DeviceArray<int> counter,
+		DeviceArray<Coord> velArr,
+		Real threshold,
+		int steps)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= velArr.size()) return;
+
+		int c = counter[pId];
+		counter[pId] = velArr[pId].norm() < threshold ? (c < steps ? c + 1 : steps) : 0;
+	}
+
+	/*!
+	*	\brief	A particle sleeps if it has been slow for the given number of steps and none of its neighbors is moving.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void SL_UpdateState(
+		DeviceArray<int> awake,
+		DeviceArray<int> counter,
+		DeviceArray<Coord> velArr,
+		NeighborList<int> neighbors,
+		Real threshold,
+		int steps)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= velArr.size()) return;
+
+		bool bSleep = counter[pId] >= steps;
+
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize && bSleep; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			if (velArr[j].norm() >= threshold)
+				bSleep = false;
+		}
+
+		awake[pId] = bSleep ? 0 : 1;
+	}
+
+	/*!
+	*	\brief	Zero the velocities of the sleeping particles and restart the counter of those woken up by a neighbor.
+	*/
+	template<typename Coord>
+	__global__ void SL_ApplyState(
+		DeviceArray<Coord> velArr,
+		DeviceArray<int> counter,
+		DeviceArray<int> awake,
+		int steps)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= velArr.size()) return;
+
+		if (awake[pId] == 0)
+		{
+			velArr[pId] = Coord(0);
+		}
+		else if (counter[pId] >= steps)
+		{
+			counter[pId] = 0;
+		}
+	}
+
+	__global__ void SL_CompactActive(
+		DeviceArray<int> activeIndex,
+		DeviceArray<int> awake,
+		DeviceArray<int> offset)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= awake.size()) return;
+
+		if (awake[pId] == 1)
+		{
+			activeIndex[offset[pId]] = pId;
+		}
+	}
+
+	template<typename TDataType>
+	ParticleSleeping<TDataType>::ParticleSleeping()
+		: ComputeModule()
+		, m_threshold(Real(0.01))
+		, m_steps(30)
+		, m_activeNum(0)
+	{
+		attachField(&m_position, "position", "Storing the particle positions!", false);
+		attachField(&m_velocity, "velocity", "Storing the particle velocities!", false);
+		attachField(&m_neighborhood, "neighborhood", "Storing neighboring particles' ids!", false);
+	}
+
+	template<typename TDataType>
+	ParticleSleeping<TDataType>::~ParticleSleeping()
+	{
+		m_counter.release();
+		m_awake.release();
+		m_offset.release();
+		m_activeIndex.release();
+	}
+
+	template<typename TDataType>
+	bool ParticleSleeping<TDataType>::initializeImpl()
+	{
+		if (!isAllFieldsReady())
+		{
+			std::cout << "Exception: " << std::string("ParticleSleeping's fields are not fully initialized!") << "\n";
+			return false;
+		}
+
+		return true;
+	}
+
+	template<typename TDataType>
+	void ParticleSleeping<TDataType>::compute()
+	{
+		int num = m_position.getElementCount();
+		if (num <= 0)
+		{
+			m_activeNum = 0;
+			return;
+		}
+
+		//Particles added or removed, start over with everyone awake
+		if (m_counter.size() != num)
+		{
+			m_counter.resize(num);
+			m_awake.resize(num);
+			m_offset.resize(num);
+			m_activeIndex.resize(num);
+
+			m_counter.reset();
+		}
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+		SL_UpdateCounter << <pDims, BLOCK_SIZE >> > (
+			m_counter,
+			m_velocity.getValue(),
+			m_threshold,
+			m_steps);
+
+		SL_UpdateState << <pDims, BLOCK_SIZE >> > (
+			m_awake,
+			m_counter,
+			m_velocity.getValue(),
+			m_neighborhood.getValue(),
+			m_threshold,
+			m_steps);
+
+		SL_ApplyState << <pDims, BLOCK_SIZE >> > (
+			m_velocity.getValue(),
+			m_counter,
+			m_awake,
+			m_steps);
+		cuSynchronize();
+
+		m_activeNum = thrust::reduce(thrust::device, m_awake.getDataPtr(), m_awake.getDataPtr() + num, (int)0, thrust::plus<int>());
+		thrust::exclusive_scan(thrust::device, m_awake.getDataPtr(), m_awake.getDataPtr() + num, m_offset.getDataPtr());
+
+		SL_CompactActive << <pDims, BLOCK_SIZE >> > (m_activeIndex, m_awake, m_offset);
+		cuSynchronize();
+	}
+}
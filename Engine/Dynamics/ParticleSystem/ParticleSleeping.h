@@ -0,0 +1,63 @@
+#pragma once
+#include "Framework/Framework/ModuleCompute.h"
+#include "Framework/Framework/FieldArray.h"
+#include "Framework/Topology/FieldNeighbor.h"
+
+namespace Physika {
+
+	/*!
+	*	\class	ParticleSleeping
+	*	\brief	Puts particles to sleep once they have stayed slower than a threshold for a number of steps,
+	*			and compacts the ids of the awake ones into an active set.
+	*
+	*	A sleeping particle has its velocity zeroed and is skipped by the modules consuming the active set, e.g.,
+	*	ParticleIntegrator and ElasticityModule, so settled regions cost nothing but this pass. It wakes up as soon as
+	*	its own velocity exceeds the threshold, e.g., after a collision, or one of its neighbors moves faster than that.
+	*	Call compute() once at the beginning of a step, before the consumers run.
+	*/
+	template<typename TDataType>
+	class ParticleSleeping : public ComputeModule
+	{
+		DECLARE_CLASS_1(ParticleSleeping, TDataType)
+
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+
+		ParticleSleeping();
+		~ParticleSleeping() override;
+
+		void compute() override;
+
+		void setSleepThreshold(Real velocity, int steps) { m_threshold = velocity; m_steps = steps > 1 ? steps : 1; }
+
+		/// Ids of the awake particles, only the first getActiveNumber() entries are valid
+		DeviceArray<int>& getActiveIndex() { return m_activeIndex; }
+		int getActiveNumber() { return m_activeNum; }
+
+	protected:
+		bool initializeImpl() override;
+
+	public:
+		DeviceArrayField<Coord> m_position;
+		DeviceArrayField<Coord> m_velocity;
+
+		NeighborField<int> m_neighborhood;
+
+	private:
+		Real m_threshold;
+		int m_steps;
+		int m_activeNum;
+
+		DeviceArray<int> m_counter;
+		DeviceArray<int> m_awake;
+		DeviceArray<int> m_offset;
+		DeviceArray<int> m_activeIndex;
+	};
+
+#ifdef PRECISION_FLOAT
+	template class ParticleSleeping<DataType3f>;
+#else
+	template class ParticleSleeping<DataType3d>;
+#endif
+}
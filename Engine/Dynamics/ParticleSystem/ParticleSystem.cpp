@@ -1,5 +1,8 @@
 #include "ParticleSystem.h"
 #include "PositionBasedFluidModel.h"
+#include "ParticleEmitter.h"
+#include "ParticleSink.h"
+#include "ParticleIntegrator.h"
 
 #include "Framework/Topology/PointSet.h"
 #include "Core/Utility.h"
@@ -12,10 +15,12 @@ namespace Physika
 	template<typename TDataType>
 	ParticleSystem<TDataType>::ParticleSystem(std::string name)
 		: Node(name)
+		, m_nextId(0)
 	{
 		attachField(&m_position, MechanicalState::position(), "Storing the particle positions!", false);
 		attachField(&m_velocity, MechanicalState::velocity(), "Storing the particle velocities!", false);
 		attachField(&m_force, MechanicalState::force(), "Storing the force densities!", false);
+		attachField(&m_id, "particle_id", "Storing the persistent particle ids!", false);
 
 		m_pSet = std::make_shared<PointSet<TDataType>>();
 		this->setTopologyModule(m_pSet);
@@ -64,13 +69,152 @@ namespace Physika
 		return Node::initialize();
 	}
 
+	template<typename TDataType>
+	typename TDataType::Real ParticleSystem<TDataType>::computeStableTimeStep(Real length, Real cfl, Real maxDt)
+	{
+		Real declared = Node::getStableTimeStep();
+		if (declared > 0)
+			return declared;
+
+		auto integrator = std::dynamic_pointer_cast<ParticleIntegrator<TDataType>>(this->getNumericalIntegrator());
+		if (integrator == nullptr || !integrator->isInitialized())
+			return declared;
+
+		if (m_position.getElementCount() == 0)
+			return maxDt;
+
+		return integrator->computeStableTimeStep(length, cfl, maxDt);
+	}
+
 	template<typename TDataType>
 	void ParticleSystem<TDataType>::updateTopology()
 	{
-		auto pts = m_pSet->getPoints();
+		auto& pts = m_pSet->getPoints();
+		if (pts.size() != m_position.getElementCount())
+		{
+			pts.setSize(m_position.getElementCount());
+		}
 		Function1Pt::copy(pts, getPosition()->getValue());
 	}
 
+	template<typename TDataType>
+	void ParticleSystem<TDataType>::addEmitter(std::shared_ptr<ParticleEmitter<TDataType>> emitter)
+	{
+		m_emitters.push_back(emitter);
+	}
+
+	template<typename TDataType>
+	void ParticleSystem<TDataType>::addSink(std::shared_ptr<ParticleSink<TDataType>> sink)
+	{
+		m_sinks.push_back(sink);
+	}
+
+	template<typename TDataType>
+	bool ParticleSystem<TDataType>::updateParticleNumber(Real dt)
+	{
+		bool changed = false;
+		for (auto sink : m_sinks)
+		{
+			int num = m_position.getElementCount();
+			if (num == 0)
+				break;
+
+			int remaining = sink->findRemaining(m_position.getValue());
+			if (remaining == num)
+				continue;
+
+			removeParticles(sink->getRemainingIndex().getDataPtr(), remaining);
+			changed = true;
+		}
+
+		for (auto emitter : m_emitters)
+		{
+			emitter->generateParticles(dt);
+
+			int emitted = emitter->getEmittedNumber();
+			if (emitted <= 0)
+				continue;
+
+			int num = m_position.getElementCount();
+			auto fields = getParticleFields();
+			for (auto field : fields)
+			{
+				field->appendElements(emitted);
+			}
+
+			cudaMemcpy(m_position.getValue().getDataPtr() + num, emitter->getPositions().getDataPtr(), emitted * sizeof(Coord), cudaMemcpyDeviceToDevice);
+			cudaMemcpy(m_velocity.getValue().getDataPtr() + num, emitter->getVelocities().getDataPtr(), emitted * sizeof(Coord), cudaMemcpyDeviceToDevice);
+
+			std::vector<int> ids(emitted);
+			for (int i = 0; i < emitted; i++)
+			{
+				ids[i] = m_nextId++;
+			}
+			cudaMemcpy(m_id.getValue().getDataPtr() + num, &ids[0], emitted * sizeof(int), cudaMemcpyHostToDevice);
+			changed = true;
+		}
+
+		return changed;
+	}
+
+
+	template<typename TDataType>
+	void ParticleSystem<TDataType>::removeParticles(int* index, int num)
+	{
+		auto fields = getParticleFields();
+		for (auto field : fields)
+		{
+			field->compactElements(index, num);
+		}
+	}
+
+	template<typename TDataType>
+	void ParticleSystem<TDataType>::duplicateParticles(int* index, int num)
+	{
+		if (num <= 0)
+			return;
+
+		int oldNum = m_position.getElementCount();
+
+		auto fields = getParticleFields();
+		for (auto field : fields)
+		{
+			field->duplicateElements(index, num);
+		}
+
+		std::vector<int> ids(num);
+		for (int i = 0; i < num; i++)
+		{
+			ids[i] = m_nextId++;
+		}
+		cudaMemcpy(m_id.getValue().getDataPtr() + oldNum, &ids[0], num * sizeof(int), cudaMemcpyHostToDevice);
+	}
+
+	template<typename TDataType>
+	std::vector<Field*> ParticleSystem<TDataType>::getParticleFields()
+	{
+		size_t num = m_position.getElementCount();
+
+		std::vector<Field*> fields;
+		for (auto field : this->getAllFields())
+		{
+			if (!field->isEmpty() && field->getElementCount() == num)
+				fields.push_back(field);
+		}
+		fields.push_back(&m_color);
+
+		//Derived fields follow their source and are skipped by the field operations anyway
+		for (auto module : this->getModuleList())
+		{
+			for (auto field : module->getAllFields())
+			{
+				if (!field->isDerived() && !field->isEmpty() && field->getElementCount() == num)
+					fields.push_back(field);
+			}
+		}
+
+		return fields;
+	}
 
 	template<typename TDataType>
 	bool ParticleSystem<TDataType>::resetStatus()
@@ -81,10 +225,19 @@ namespace Physika
 		m_velocity.setElementCount(pts.size());
 		m_force.setElementCount(pts.size());
 		m_color.setElementCount(pts.size());
+		m_id.setElementCount(pts.size());
 
 		Function1Pt::copy(m_position.getValue(), pts);
 		m_velocity.getReference()->reset();
 
+		std::vector<int> ids(pts.size());
+		for (int i = 0; i < ids.size(); i++)
+		{
+			ids[i] = i;
+		}
+		Function1Pt::copy(m_id.getValue(), ids);
+		m_nextId = ids.size();
+
 		return Node::resetStatus();
 	}
 
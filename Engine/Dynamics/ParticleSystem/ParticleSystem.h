@@ -5,6 +5,8 @@
 namespace Physika
 {
 	template <typename TDataType> class PointSet;
+	template <typename TDataType> class ParticleEmitter;
+	template <typename TDataType> class ParticleSink;
 	/*!
 	*	\class	ParticleSystem
 	*	\brief	Position-based fluids.
@@ -49,6 +51,15 @@ namespace Physika
 			return &m_color;
 		}
 
+		/// Persistent ids, kept by each particle from its creation on regardless of emission and removal of others
+		DeviceArrayField<int>* getParticleId()
+		{
+			return &m_id;
+		}
+
+		void addEmitter(std::shared_ptr<ParticleEmitter<TDataType>> emitter);
+		void addSink(std::shared_ptr<ParticleSink<TDataType>> sink);
+
 		void updateTopology() override;
 		bool resetStatus() override;
 
@@ -57,13 +68,47 @@ namespace Physika
 		bool initialize() override;
 
 	protected:
+		/*!
+		*	\brief	Remove the particles caught by the sinks and append those released by the emitters over dt.
+		*			Must be called between steps, all particle fields are compacted or grown accordingly, see getParticleFields().
+		*			Steps should be skipped while no particle is left. Returns whether any particle was removed or appended.
+		*/
+		bool updateParticleNumber(Real dt);
+
+		/*!
+		*	\brief	Stable time step of the "integrator" by the CFL condition, at most maxDt. A step declared with
+		*			setStableTimeStep() takes precedence, and none is declared before the integrator is initialized.
+		*/
+		Real computeStableTimeStep(Real length, Real cfl, Real maxDt);
+
+		/// Keep the num particles listed in index, a device array, in that order
+		void removeParticles(int* index, int num);
+
+		/*!
+		*	\brief	Append copies of the num particles listed in index, a device array. The copies get new persistent ids.
+		*/
+		void duplicateParticles(int* index, int num);
+
 		DeviceArrayField<Coord> m_position;
 		DeviceArrayField<Coord> m_velocity;
 		DeviceArrayField<Vector3f> m_color;
 		DeviceArrayField<Coord> m_force;
+		DeviceArrayField<int> m_id;
 
 		std::shared_ptr<PointSet<TDataType>> m_pSet;
 		std::shared_ptr<PointRenderModule> m_pointsRender;
+
+	private:
+		/*!
+		*	\brief	Array fields holding one element per particle, i.e., those of the node and of its modules that own
+		*			getElementCount() elements, e.g., the multipliers DensityPBD keeps over time steps.
+		*/
+		std::vector<Field*> getParticleFields();
+
+		int m_nextId;
+
+		std::vector<std::shared_ptr<ParticleEmitter<TDataType>>> m_emitters;
+		std::vector<std::shared_ptr<ParticleSink<TDataType>>> m_sinks;
 	};
 
 
@@ -5,6 +5,10 @@
 #include "ParticleIntegrator.h"
 #include "DensitySummation.h"
 #include "ImplicitViscosity.h"
+#include "DivergenceFreeSPH.h"
+#include "SurfaceDetection.h"
+#include "SurfaceTension.h"
+#include "BoundaryParticles.h"
 #include "Framework/Framework/MechanicalState.h"
 #include "Framework/Mapping/PointSetToPointSet.h"
 #include "Framework/Topology/FieldNeighbor.h"
@@ -20,12 +24,16 @@ namespace Physika
 	template<typename TDataType>
 	PositionBasedFluidModel<TDataType>::PositionBasedFluidModel()
 		: NumericalModel()
-		, m_restRho(Real(1000))
 		, m_pNum(0)
+		, m_cellBlocked(false)
 	{
 		m_smoothingLength.setValue(Real(0.0075));
+		m_restDensity.setValue(Real(1000));
+		m_mass.setValue(Real(1));
 
 		attachField(&m_smoothingLength, "smoothingLength", "Smoothing length", false);
+		attachField(&m_restDensity, "rest_density", "Reference density", false);
+		attachField(&m_mass, "mass", "particle mass", false);
 
 		attachField(&m_position, "position", "Storing the particle positions!", false);
 		attachField(&m_velocity, "velocity", "Storing the particle velocities!", false);
@@ -44,14 +52,26 @@ namespace Physika
 		m_nbrQuery = this->getParent()->addComputeModule<NeighborQuery<TDataType>>("neighborhood");
 		m_smoothingLength.connect(m_nbrQuery->m_radius);
 		m_position.connect(m_nbrQuery->m_position);
+		m_particleRadius.connect(m_nbrQuery->m_particleRadius);
 		m_nbrQuery->initialize();
 
-		m_pbdModule = this->getParent()->addConstraintModule<DensityPBD<TDataType>>("density_constraint");
-		m_smoothingLength.connect(m_pbdModule->m_smoothingLength);
-		m_position.connect(m_pbdModule->m_position);
-		m_velocity.connect(m_pbdModule->m_velocity);
-		m_nbrQuery->m_neighborhood.connect(m_pbdModule->m_neighborhood);
-		m_pbdModule->initialize();
+		if (m_incompressibilitySolver == nullptr)
+		{
+			m_pbdModule = this->getParent()->addConstraintModule<DensityPBD<TDataType>>("density_constraint");
+			m_smoothingLength.connect(m_pbdModule->m_smoothingLength);
+			m_restDensity.connect(m_pbdModule->m_restDensity);
+			m_mass.connect(m_pbdModule->m_mass);
+			m_position.connect(m_pbdModule->m_position);
+			m_velocity.connect(m_pbdModule->m_velocity);
+			m_nbrQuery->m_neighborhood.connect(m_pbdModule->m_neighborhood);
+			m_particleMass.connect(m_pbdModule->m_particleMass);
+			m_particleRadius.connect(m_pbdModule->m_particleRadius);
+			m_pbdModule->initialize();
+		}
+		else
+		{
+			connectSolver(m_incompressibilitySolver);
+		}
 
 		m_integrator = this->getParent()->setNumericalIntegrator<ParticleIntegrator<TDataType>>("integrator");
 		m_position.connect(m_integrator->m_position);
@@ -59,17 +79,88 @@ namespace Physika
 		m_forceDensity.connect(m_integrator->m_forceDensity);
 		m_integrator->initialize();
 
-		m_visModule = this->getParent()->addConstraintModule<ImplicitViscosity<TDataType>>("viscosity");
-		m_visModule->setViscosity(Real(1));
-		m_smoothingLength.connect(m_visModule->m_smoothingLength);
-		m_position.connect(m_visModule->m_position);
-		m_velocity.connect(m_visModule->m_velocity);
-		m_nbrQuery->m_neighborhood.connect(m_visModule->m_neighborhood);
-		m_visModule->initialize();
+		if (m_viscositySolver == nullptr)
+		{
+			m_visModule = this->getParent()->addConstraintModule<ImplicitViscosity<TDataType>>("viscosity");
+			m_visModule->setViscosity(Real(1));
+			m_smoothingLength.connect(m_visModule->m_smoothingLength);
+			m_position.connect(m_visModule->m_position);
+			m_velocity.connect(m_visModule->m_velocity);
+			m_nbrQuery->m_neighborhood.connect(m_visModule->m_neighborhood);
+			m_visModule->initialize();
+		}
+		else
+		{
+			connectSolver(m_viscositySolver);
+		}
+
+		if (m_surfaceTensionSolver != nullptr)
+		{
+			connectSurfaceTensionSolver();
+		}
+
+		connectBoundaryParticles();
+		connectCellBlockedDensity();
 
 		return true;
 	}
 
+	template<typename TDataType>
+	void PositionBasedFluidModel<TDataType>::setBoundaryParticles(std::shared_ptr<BoundaryParticles<TDataType>> boundary)
+	{
+		m_boundary = boundary;
+
+		if (this->isInitialized())
+		{
+			connectBoundaryParticles();
+		}
+	}
+
+	template<typename TDataType>
+	void PositionBasedFluidModel<TDataType>::connectBoundaryParticles()
+	{
+		auto pbd = m_incompressibilitySolver != nullptr ? std::dynamic_pointer_cast<DensityPBD<TDataType>>(m_incompressibilitySolver) : m_pbdModule;
+		if (pbd != nullptr)
+		{
+			pbd->setBoundaryParticles(m_boundary);
+		}
+
+		auto dfsph = std::dynamic_pointer_cast<DivergenceFreeSPH<TDataType>>(m_incompressibilitySolver);
+		if (dfsph != nullptr)
+		{
+			dfsph->setBoundaryParticles(m_boundary);
+		}
+	}
+
+	template<typename TDataType>
+	void PositionBasedFluidModel<TDataType>::setCellBlockedDensity(bool cellBlocked)
+	{
+		m_cellBlocked = cellBlocked;
+
+		if (this->isInitialized())
+		{
+			connectCellBlockedDensity();
+		}
+	}
+
+	template<typename TDataType>
+	void PositionBasedFluidModel<TDataType>::connectCellBlockedDensity()
+	{
+		auto pbd = m_incompressibilitySolver != nullptr ? std::dynamic_pointer_cast<DensityPBD<TDataType>>(m_incompressibilitySolver) : m_pbdModule;
+		if (pbd == nullptr)
+			return;
+
+		if (m_cellBlocked)
+		{
+			pbd->setFusedDensity(false);
+			pbd->setGridHash(&m_nbrQuery->getHash());
+		}
+		else
+		{
+			pbd->setGridHash(nullptr);
+		}
+	}
+
 	template<typename TDataType>
 	void PositionBasedFluidModel<TDataType>::step(Real dt)
 	{
@@ -84,9 +175,23 @@ namespace Physika
 		m_nbrQuery->compute();
 		m_integrator->integrate();
 		
-		m_pbdModule->constrain();
+		if (m_incompressibilitySolver != nullptr)
+			m_incompressibilitySolver->constrain();
+		else
+			m_pbdModule->constrain();
+
+		if (m_viscositySolver != nullptr)
+			m_viscositySolver->constrain();
+		else
+			m_visModule->constrain();
 
-		m_visModule->constrain();
+		if (m_surfaceTensionSolver != nullptr)
+		{
+			if (m_surfaceDetection != nullptr)
+				m_surfaceDetection->compute();
+
+			m_surfaceTensionSolver->applyForce();
+		}
 		
 		m_integrator->end();
 	}
@@ -94,24 +199,73 @@ namespace Physika
 	template<typename TDataType>
 	void PositionBasedFluidModel<TDataType>::setIncompressibilitySolver(std::shared_ptr<ConstraintModule> solver)
 	{
-		if (!m_incompressibilitySolver)
+		if (m_incompressibilitySolver)
 		{
 			getParent()->deleteConstraintModule(m_incompressibilitySolver);
 		}
 		m_incompressibilitySolver = solver;
 		getParent()->addConstraintModule(solver);
+
+		if (this->isInitialized())
+		{
+			connectSolver(m_incompressibilitySolver);
+			connectBoundaryParticles();
+			connectCellBlockedDensity();
+		}
+	}
+
+	template<typename TDataType>
+	void PositionBasedFluidModel<TDataType>::connectSolver(std::shared_ptr<Module> solver)
+	{
+		auto smoothingLength = solver->getField<VarField<Real>>("smoothing_length");
+		if (smoothingLength != nullptr)
+			m_smoothingLength.connect(*smoothingLength);
+
+		auto restDensity = solver->getField<VarField<Real>>("rest_density");
+		if (restDensity != nullptr)
+			m_restDensity.connect(*restDensity);
+
+		auto mass = solver->getField<VarField<Real>>("mass");
+		if (mass != nullptr)
+			m_mass.connect(*mass);
+
+		auto position = solver->getField<DeviceArrayField<Coord>>("position");
+		if (position != nullptr)
+			m_position.connect(*position);
+
+		auto velocity = solver->getField<DeviceArrayField<Coord>>("velocity");
+		if (velocity != nullptr)
+			m_velocity.connect(*velocity);
+
+		auto neighborhood = solver->getField<NeighborField<int>>("neighborhood");
+		if (neighborhood != nullptr)
+			m_nbrQuery->m_neighborhood.connect(*neighborhood);
+
+		auto pbd = std::dynamic_pointer_cast<DensityPBD<TDataType>>(solver);
+		if (pbd != nullptr)
+		{
+			m_particleMass.connect(pbd->m_particleMass);
+			m_particleRadius.connect(pbd->m_particleRadius);
+		}
+
+		solver->initialize();
 	}
 
 
 	template<typename TDataType>
 	void PositionBasedFluidModel<TDataType>::setViscositySolver(std::shared_ptr<ConstraintModule> solver)
 	{
-		if (!m_viscositySolver)
+		if (m_viscositySolver)
 		{
 			getParent()->deleteConstraintModule(m_viscositySolver);
 		}
 		m_viscositySolver = solver;
 		getParent()->addConstraintModule(solver);
+
+		if (this->isInitialized())
+		{
+			connectSolver(m_viscositySolver);
+		}
 	}
 
 
@@ -119,12 +273,37 @@ namespace Physika
 	template<typename TDataType>
 	void PositionBasedFluidModel<TDataType>::setSurfaceTensionSolver(std::shared_ptr<ForceModule> solver)
 	{
-		if (!m_surfaceTensionSolver)
+		if (m_surfaceTensionSolver)
 		{
 			getParent()->deleteForceModule(m_surfaceTensionSolver);
 		}
 		m_surfaceTensionSolver = solver;
 		getParent()->addForceModule(m_surfaceTensionSolver);
+
+		if (this->isInitialized())
+		{
+			connectSurfaceTensionSolver();
+		}
+	}
+
+	template<typename TDataType>
+	void PositionBasedFluidModel<TDataType>::connectSurfaceTensionSolver()
+	{
+		auto surfaceTension = std::dynamic_pointer_cast<SurfaceTension<TDataType>>(m_surfaceTensionSolver);
+		if (surfaceTension != nullptr)
+		{
+			if (m_surfaceDetection == nullptr)
+			{
+				m_surfaceDetection = std::make_shared<SurfaceDetection<TDataType>>();
+				m_smoothingLength.connect(m_surfaceDetection->m_smoothingLength);
+				m_position.connect(m_surfaceDetection->m_position);
+				m_nbrQuery->m_neighborhood.connect(m_surfaceDetection->m_neighborhood);
+				m_surfaceDetection->initialize();
+			}
+			surfaceTension->setSurfaceDetection(m_surfaceDetection);
+		}
+
+		connectSolver(m_surfaceTensionSolver);
 	}
 
 }
\ No newline at end of file
@@ -10,6 +10,8 @@ namespace Physika
 	template<typename TDataType> class NeighborQuery;
 	template<typename TDataType> class DensityPBD;
 	template<typename TDataType> class ImplicitViscosity;
+	template<typename TDataType> class SurfaceDetection;
+	template<typename TDataType> class BoundaryParticles;
 	class ForceModule;
 	class ConstraintModule;
 	/*!
@@ -34,29 +36,71 @@ namespace Physika
 		void step(Real dt) override;
 
 		void setSmoothingLength(Real len) { m_smoothingLength.setValue(len); }
-		void setRestDensity(Real rho) { m_restRho = rho; }
+		void setRestDensity(Real rho) { m_restDensity.setValue(rho); }
 
+		/*!
+		*	\brief	Replace the default DensityPBD, e.g., with DivergenceFreeSPH. Fields of the solver named
+		*			"smoothing_length", "position", "velocity" and "neighborhood" are connected to the model.
+		*/
 		void setIncompressibilitySolver(std::shared_ptr<ConstraintModule> solver);
+		/// Replace the default ImplicitViscosity, the solver is connected like the incompressibility solver
 		void setViscositySolver(std::shared_ptr<ConstraintModule> solver);
+		/*!
+		*	\brief	The solver is connected like the incompressibility solver and applied after viscosity. A SurfaceTension
+		*			shares the surface detection of the model, which is computed once per step.
+		*/
 		void setSurfaceTensionSolver(std::shared_ptr<ForceModule> solver);
 
+		/*!
+		*	\brief	Boundary particles read by the density solver, only used if it is a DensityPBD or a DivergenceFreeSPH.
+		*/
+		void setBoundaryParticles(std::shared_ptr<BoundaryParticles<TDataType>> boundary);
+		std::shared_ptr<BoundaryParticles<TDataType>> getBoundaryParticles() { return m_boundary; }
+
+		/*!
+		*	\brief	Let a DensityPBD sum densities cell-blocked over the hash of the neighbor query. Enabling it turns off
+		*			fusing densities with the multipliers, see DensityPBD::setFusedDensity().
+		*/
+		void setCellBlockedDensity(bool cellBlocked);
+
 	public:
 		VarField<Real> m_smoothingLength;
 
+		/*!
+		*	\brief	Rest density and mass of the reference particle, shared with the fields "rest_density" and "mass" of the
+		*			density solver and the surface tension solver.
+		*/
+		VarField<Real> m_restDensity;
+		VarField<Real> m_mass;
+
 		DeviceArrayField<Coord> m_position;
 		DeviceArrayField<Coord> m_velocity;
 		DeviceArrayField<Coord> m_forceDensity;
 
+		/*!
+		*	\brief	Optional relative mass and support radius of each particle, read by the neighbor query and a DensityPBD
+		*			once they are set for all particles, see ParticleAdaptivity.
+		*/
+		DeviceArrayField<Real> m_particleMass;
+		DeviceArrayField<Real> m_particleRadius;
+
 	protected:
 		bool initializeImpl() override;
 
 	private:
+		void connectSolver(std::shared_ptr<Module> solver);
+		void connectSurfaceTensionSolver();
+		void connectBoundaryParticles();
+		void connectCellBlockedDensity();
+
 		int m_pNum;
-		Real m_restRho;
+		bool m_cellBlocked;
 
 		std::shared_ptr<ForceModule> m_surfaceTensionSolver;
+		std::shared_ptr<SurfaceDetection<TDataType>> m_surfaceDetection;
 		std::shared_ptr<ConstraintModule> m_viscositySolver;
 		std::shared_ptr<ConstraintModule> m_incompressibilitySolver;
+		std::shared_ptr<BoundaryParticles<TDataType>> m_boundary;
 
 		std::shared_ptr<DensityPBD<TDataType>> m_pbdModule;
 		std::shared_ptr<ImplicitViscosity<TDataType>> m_visModule;
@@ -6,7 +6,10 @@
 #include "Core/Utility.h"
 #include "ParticleSystem.h"
 #include "Framework/Topology/NeighborQuery.h"
+#include "Framework/Topology/NeighborScatter.h"
+#include "Framework/Framework/SceneGraph.h"
 #include "Kernel.h"
+#include "Core/Utility/ResidualMax.h"
 
 namespace Physika
 {
@@ -16,6 +19,7 @@ namespace Physika
 	template<typename TDataType>
 	Physika::SolidFluidInteraction<TDataType>::SolidFluidInteraction(std::string name)
 		:Node(name)
+		, m_iterationPolicy(5)
 	{
 		
 	}
@@ -28,6 +32,41 @@ namespace Physika
 
 	template<typename TDataType>
 	bool SolidFluidInteraction<TDataType>::initialize()
+	{
+		couple();
+
+		m_nbrQuery = std::make_shared<NeighborQuery<TDataType>>();
+		m_position.connect(m_nbrQuery->m_position);
+		m_nbrQuery->initialize();
+		
+		return true;
+	}
+
+	template<typename TDataType>
+	bool SolidFluidInteraction<TDataType>::isCoupled()
+	{
+		if (m_position.getElementCount() <= 0)
+			return false;
+
+		Coord* allPos = m_position.getValue().getDataPtr();
+		Coord* allVel = m_vels.getDataPtr();
+
+		int start = 0;
+		for (int i = 0; i < m_particleSystems.size(); i++)
+		{
+			DeviceArray<Coord>& points = m_particleSystems[i]->getPosition()->getValue();
+			DeviceArray<Coord>& vels = m_particleSystems[i]->getVelocity()->getValue();
+			if (points.getDataPtr() != allPos + start || vels.getDataPtr() != allVel + start || vels.size() != points.size())
+				return false;
+
+			start += points.size();
+		}
+
+		return start == m_position.getElementCount();
+	}
+
+	template<typename TDataType>
+	void SolidFluidInteraction<TDataType>::couple()
 	{
 		int total_num = 0;
 		std::vector<int> ids;
@@ -44,6 +83,23 @@ namespace Physika
 			}
 		}
 
+		if (total_num <= 0)
+			return;
+
+		//Gather the current states first, the children may still refer to the previous coupled buffer
+		DeviceArray<Coord> pos(total_num);
+		DeviceArray<Coord> vel(total_num);
+		int start = 0;
+		for (int i = 0; i < m_particleSystems.size(); i++)
+		{
+			DeviceArray<Coord>& points = m_particleSystems[i]->getPosition()->getValue();
+			DeviceArray<Coord>& vels = m_particleSystems[i]->getVelocity()->getValue();
+			int num = points.size();
+			cudaMemcpy(pos.getDataPtr() + start, points.getDataPtr(), num * sizeof(Coord), cudaMemcpyDeviceToDevice);
+			cudaMemcpy(vel.getDataPtr() + start, vels.getDataPtr(), num * sizeof(Coord), cudaMemcpyDeviceToDevice);
+			start += num;
+		}
+
 		m_objId.resize(total_num);
 		m_position.setElementCount(total_num);
 		m_vels.resize(total_num);
@@ -53,16 +109,27 @@ namespace Physika
 		weights.resize(total_num);
 		init_pos.resize(total_num);
 
+		Function1Pt::copy(m_position.getValue(), pos);
+		Function1Pt::copy(m_vels, vel);
+		pos.release();
+		vel.release();
+
 		Function1Pt::copy(m_objId, ids);
 		Function1Pt::copy(m_mass, mass);
 		ids.clear();
 		mass.clear();
 
-		m_nbrQuery = std::make_shared<NeighborQuery<TDataType>>();
-		m_position.connect(m_nbrQuery->m_position);
-		m_nbrQuery->initialize();
-		
-		return true;
+		//From now on the children read and write their sub-ranges of the coupled buffers directly
+		start = 0;
+		for (int i = 0; i < m_particleSystems.size(); i++)
+		{
+			DeviceArray<Coord>& points = m_particleSystems[i]->getPosition()->getValue();
+			DeviceArray<Coord>& vels = m_particleSystems[i]->getVelocity()->getValue();
+			int num = points.size();
+			points.setExternalData(m_position.getValue().getDataPtr() + start, num);
+			vels.setExternalData(m_vels.getDataPtr() + start, num);
+			start += num;
+		}
 	}
 
 	template<typename TDataType>
@@ -155,21 +222,97 @@ namespace Physika
 		//		newPoints[pId] = pos_num;
 	}
 
+	/*!
+	*	\brief	Deterministic variant of K_Collide, the targets of neighbor j are stored in the entry of j and added by a NeighborScatter.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void K_CollideOrdered(
+		DeviceArray<int> objIds,
+		DeviceArray<Real> mass,
+		DeviceArray<Coord> points,
+		DeviceArray<Coord> newPoints,
+		DeviceArray<Real> weights,
+		DeviceArray<Coord> entryPoints,
+		DeviceArray<Real> entryWeights,
+		NeighborList<int> neighbors,
+		Real radius
+	)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= points.size()) return;
+
+		SpikyKernel<Real> kernel;
+
+		Coord pos_i = points[pId];
+		int id_i = objIds[pId];
+		Real mass_i = mass[pId];
+
+		Coord point_i(0);
+		Real weight_i = Real(0);
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			int entry = neighbors.getElementIndex(pId, ne);
+			Coord pos_j = points[j];
+
+			Real r = (pos_i - pos_j).norm();
+			if (r < radius && objIds[j] != id_i)
+			{
+				Real mass_j = mass[j];
+				Coord n = pos_i - pos_j;
+				n = n.norm() < EPSILON ? Coord(0, 0, 0) : n.normalize();
+
+				Real a = mass_i / (mass_i + mass_j);
+
+				Real d = radius - r;
+
+				Coord target_i = pos_i + (1 - a)*d*n;
+				Coord target_j = pos_j - a*d*n;
+
+				Real weight = kernel.Weight(r, 2 * radius);
+
+				point_i += weight*target_i;
+				weight_i += weight;
+
+				entryPoints[entry] = weight*target_j;
+				entryWeights[entry] = weight;
+			}
+			else
+			{
+				entryPoints[entry] = Coord(0);
+				entryWeights[entry] = Real(0);
+			}
+		}
+
+		newPoints[pId] = point_i;
+		weights[pId] = weight_i;
+	}
+
 	template<typename Real, typename Coord>
 	__global__ void K_ComputeTarget(
 		DeviceArray<Coord> oldPoints,
 		DeviceArray<Coord> newPoints,
-		DeviceArray<Real> weights)
+		DeviceArray<Real> weights,
+		Real* residual)
 	{
 		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= oldPoints.size()) return;
 
-		if (weights[pId] > EPSILON)
+		Real err_i = Real(0);
+		if (pId < oldPoints.size())
 		{
-			newPoints[pId] /= weights[pId];
+			if (weights[pId] > EPSILON)
+			{
+				newPoints[pId] /= weights[pId];
+			}
+			else
+				newPoints[pId] = oldPoints[pId];
+
+			err_i = (newPoints[pId] - oldPoints[pId]).norm();
 		}
-		else
-			newPoints[pId] = oldPoints[pId];
+
+		if (residual != nullptr)
+			RS_WarpMax(residual, err_i);
 	}
 
 	template<typename Real, typename Coord>
@@ -188,59 +331,99 @@ namespace Physika
 	template<typename TDataType>
 	void SolidFluidInteraction<TDataType>::advance(Real dt)
 	{
-		int start = 0;
-		DeviceArray<Coord>& allpoints = m_position.getValue();
-		for (int i = 0; i < m_particleSystems.size(); i++)
+		//A child was reset or changed its particle number since the last step
+		if (!isCoupled())
 		{
-			DeviceArray<Coord>& points = m_particleSystems[i]->getPosition()->getValue();
-			DeviceArray<Coord>& vels = m_particleSystems[i]->getVelocity()->getValue();
-			int num = points.size();
-			cudaMemcpy(allpoints.getDataPtr() + start, points.getDataPtr(), num * sizeof(Coord), cudaMemcpyDeviceToDevice);
-			cudaMemcpy(m_vels.getDataPtr() + start, vels.getDataPtr(), num * sizeof(Coord), cudaMemcpyDeviceToDevice);
-			start += num;
+			couple();
+			if (!isCoupled())
+				return;
 		}
 
+		DeviceArray<Coord>& allpoints = m_position.getValue();
+
 		m_nbrQuery->compute();
 
+		bool ordered = SceneGraph::getInstance().isDeterministic();
+		if (ordered)
+		{
+			if (m_scatter == nullptr)
+			{
+				m_scatter = std::make_shared<NeighborScatter>();
+			}
+			m_scatter->update(m_nbrQuery->getNeighborList());
+			m_entryPoints.setSize(m_scatter->getEntryNum());
+			m_entryWeights.setSize(m_scatter->getEntryNum());
+		}
+
 		Function1Pt::copy(init_pos, allpoints);
 
 		Real radius = 0.005;
 
+		if (m_residual == nullptr)
+		{
+			m_residual = std::make_shared<ResidualMax<Real>>();
+		}
+		bool hasTarget = m_iterationPolicy.hasTarget();
+
+		//Shallow handles, the source and target of each iteration are swapped rather than copied
+		DeviceArray<Coord> curPos = allpoints;
+		DeviceArray<Coord> newPos = posBuf;
+
 		uint pDims = cudaGridSize(allpoints.size(), BLOCK_SIZE);
-		for (size_t it = 0; it < 5; it++)
+		int it = 0;
+		float residual = std::numeric_limits<float>::max();
+		while (m_iterationPolicy.proceed(it, residual))
 		{
+			if (hasTarget)
+				m_residual->reset();
+
 			weights.reset();
-			posBuf.reset();
-			K_Collide << <pDims, BLOCK_SIZE >> > (
-				m_objId, 
-				m_mass,
-				allpoints,
-				posBuf, 
-				weights, 
-				m_nbrQuery->getNeighborList(),
-				radius);
+			newPos.reset();
+			if (ordered)
+			{
+				K_CollideOrdered << <pDims, BLOCK_SIZE >> > (
+					m_objId,
+					m_mass,
+					curPos,
+					newPos,
+					weights,
+					m_entryPoints,
+					m_entryWeights,
+					m_nbrQuery->getNeighborList(),
+					radius);
+				m_scatter->add(newPos, m_entryPoints);
+				m_scatter->add(weights, m_entryWeights);
+			}
+			else
+			{
+				K_Collide << <pDims, BLOCK_SIZE >> > (
+					m_objId,
+					m_mass,
+					curPos,
+					newPos,
+					weights,
+					m_nbrQuery->getNeighborList(),
+					radius);
+			}
 
 			K_ComputeTarget << <pDims, BLOCK_SIZE >> > (
-				allpoints,
-				posBuf, 
-				weights);
+				curPos,
+				newPos, 
+				weights,
+				hasTarget ? m_residual->getDataPtr() : nullptr);
 
-			Function1Pt::copy(allpoints, posBuf);
-		}
+			std::swap(curPos, newPos);
 
-		K_ComputeVelocity << <pDims, BLOCK_SIZE >> > (init_pos, allpoints, m_vels, getParent()->getDt());
+			it++;
+			residual = hasTarget ? m_residual->getValue() : -1.0f;
+		}
 
-		start = 0;
-		for (int i = 0; i < m_particleSystems.size(); i++)
+		//The children only see the coupled buffer, after an odd number of iterations the result lies in posBuf
+		if (curPos.getDataPtr() != allpoints.getDataPtr())
 		{
-			DeviceArray<Coord>& points = m_particleSystems[i]->getPosition()->getValue();
-			DeviceArray<Coord>& vels = m_particleSystems[i]->getVelocity()->getValue();
-			int num = points.size();
-			cudaMemcpy(points.getDataPtr(), allpoints.getDataPtr() + start, num * sizeof(Coord), cudaMemcpyDeviceToDevice);
-			cudaMemcpy(vels.getDataPtr(), m_vels.getDataPtr() + start, num * sizeof(Coord), cudaMemcpyDeviceToDevice);
-
-			start += num;
+			Function1Pt::copy(allpoints, curPos);
 		}
 
+		K_ComputeVelocity << <pDims, BLOCK_SIZE >> > (init_pos, allpoints, m_vels, getParent()->getDt());
 	}
 }
\ No newline at end of file
@@ -1,11 +1,14 @@
 #pragma once
 #include "Framework/Framework/Node.h"
+#include "Framework/Framework/ModuleConstraint.h"
 
 namespace Physika
 {
 	template <typename T> class RigidBody;
 	template <typename T> class ParticleSystem;
 	template <typename T> class NeighborQuery;
+	template <typename Real> class ResidualMax;
+	class NeighborScatter;
 
 	/*!
 	*	\class	SolidFluidInteraction
@@ -35,12 +38,25 @@ namespace Physika
 
 
 		void advance(Real dt) override;
+
+		IterationPolicy& getIterationPolicy() { return m_iterationPolicy; }
 	private:
+		/*!
+		*	\brief	Move the positions and velocities of all child particle systems into one buffer each,
+		*			the children then refer to their sub-ranges so that no copies are needed between steps.
+		*/
+		void couple();
+		bool isCoupled();
+
+		IterationPolicy m_iterationPolicy;
+		std::shared_ptr<ResidualMax<Real>> m_residual;
+
+		/// Coupled positions and velocities, owned by this node and shared with the children
 		DeviceArrayField<Coord> m_position;
+		DeviceArray<Coord> m_vels;
 
 		DeviceArray<Real> m_mass;
 		DeviceArray<int> m_objId;
-		DeviceArray<Coord> m_vels;
 
 		DeviceArray<Coord> posBuf;
 		DeviceArray<Real> weights;
@@ -49,6 +65,11 @@ namespace Physika
 		std::shared_ptr<NeighborList<int>> m_nList;
 		std::shared_ptr<NeighborQuery<TDataType>> m_nbrQuery;
 
+		/// Orders the pair contributions in deterministic mode
+		std::shared_ptr<NeighborScatter> m_scatter;
+		DeviceArray<Coord> m_entryPoints;
+		DeviceArray<Real> m_entryWeights;
+
 		std::vector<std::shared_ptr<RigidBody<TDataType>>> m_rigids;
 		std::vector<std::shared_ptr<ParticleSystem<TDataType>>> m_particleSystems;
 	};
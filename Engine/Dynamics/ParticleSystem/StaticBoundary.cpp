@@ -54,6 +54,23 @@ namespace Physika
 		}
 	}
 
+	template<typename TDataType>
+	void StaticBoundary<TDataType>::constrainChild(Node* child, Real dt)
+	{
+		for (int i = 0; i < m_particleSystems.size(); i++)
+		{
+			if (m_particleSystems[i].get() != child)
+				continue;
+
+			DeviceArrayField<Coord>* posFd = m_particleSystems[i]->getPosition();
+			DeviceArrayField<Coord>* velFd = m_particleSystems[i]->getVelocity();
+			for (size_t t = 0; t < m_obstacles.size(); t++)
+			{
+				m_obstacles[t]->constrain(posFd->getValue(), velFd->getValue(), dt);
+			}
+		}
+	}
+
 	template<typename TDataType>
 	void StaticBoundary<TDataType>::loadSDF(std::string filename, bool bOutBoundary)
 	{
@@ -23,6 +23,7 @@ namespace Physika {
 		bool addParticleSystem(std::shared_ptr<ParticleSystem<TDataType>> child);
 
 		void advance(Real dt) override;
+		void constrainChild(Node* child, Real dt) override;
 
 		void loadSDF(std::string filename, bool bOutBoundary = false);
 		void loadCube(Coord lo, Coord hi, bool bOutBoundary = false);
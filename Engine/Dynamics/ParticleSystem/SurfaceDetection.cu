@@ -0,0 +1,134 @@
+#include <cuda_runtime.h>
+#include <thrust/reduce.h>
+#include <thrust/scan.h>
+#include <thrust/execution_policy.h>
+#include "SurfaceDetection.h"
+#include "Core/Utility.h"
+#include "Framework/Topology/FieldNeighbor.h"
+#include "Kernel.h"
+
+namespace Physika
+{
+	IMPLEMENT_CLASS_1(SurfaceDetection, TDataType)
+
+	template<typename Real, typename Coord, typename TKernel>
+	__global__ void SD_DetectSurface(
+		DeviceArray<int> flag,
+		DeviceArray<Coord> posArr,
+		NeighborList<int> neighbors,
+		TKernel kern,
+		Real threshold)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= posArr.size()) return;
+
+		Real total_weight = Real(0);
+		Coord dir_i(0);
+
+		Coord pos_i = posArr[pId];
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			Real r = (pos_i - posArr[j]).norm();
+
+			if (r > EPSILON)
+			{
+				Real weight = -kern.Gradient(r);
+				total_weight += weight;
+				dir_i += (posArr[j] - pos_i)*(weight / r);
+			}
+		}
+
+		bool bSurface = total_weight < EPSILON || dir_i.norm() / total_weight > threshold;
+
+		flag[pId] = bSurface ? 1 : 0;
+	}
+
+	__global__ void SD_CompactSurface(
+		DeviceArray<int> surfaceIndex,
+		DeviceArray<int> flag,
+		DeviceArray<int> offset)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= flag.size()) return;
+
+		if (flag[pId] == 1)
+		{
+			surfaceIndex[offset[pId]] = pId;
+		}
+	}
+
+	template<typename TDataType>
+	SurfaceDetection<TDataType>::SurfaceDetection()
+		: ComputeModule()
+		, m_threshold(Real(0.2))
+		, m_surfaceNum(0)
+	{
+		m_smoothingLength.setValue(Real(0.011));
+
+		attachField(&m_smoothingLength, "smoothing_length", "The smoothing length in SPH!", false);
+		attachField(&m_position, "position", "Storing the particle positions!", false);
+		attachField(&m_neighborhood, "neighborhood", "Storing neighboring particles' ids!", false);
+	}
+
+	template<typename TDataType>
+	SurfaceDetection<TDataType>::~SurfaceDetection()
+	{
+		m_flag.release();
+		m_offset.release();
+		m_surfaceIndex.release();
+	}
+
+	template<typename TDataType>
+	bool SurfaceDetection<TDataType>::initializeImpl()
+	{
+		if (!isAllFieldsReady())
+		{
+			std::cout << "Exception: " << std::string("SurfaceDetection's fields are not fully initialized!") << "\n";
+			return false;
+		}
+
+		return true;
+	}
+
+	template<typename TDataType>
+	void SurfaceDetection<TDataType>::compute()
+	{
+		int num = m_position.getElementCount();
+		if (num <= 0)
+		{
+			m_surfaceNum = 0;
+			return;
+		}
+
+		if (m_flag.size() != num)
+		{
+			m_flag.resize(num);
+			m_offset.resize(num);
+			m_surfaceIndex.resize(num);
+		}
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+		SD_DetectSurface <Real, Coord> << <pDims, BLOCK_SIZE >> > (
+			m_flag,
+			m_position.getValue(),
+			m_neighborhood.getValue(),
+			SmoothKernel<Real>(m_smoothingLength.getValue()),
+			m_threshold);
+		cuSynchronize();
+
+		m_surfaceNum = thrust::reduce(thrust::device, m_flag.getDataPtr(), m_flag.getDataPtr() + num, (int)0, thrust::plus<int>());
+		thrust::exclusive_scan(thrust::device, m_flag.getDataPtr(), m_flag.getDataPtr() + num, m_offset.getDataPtr());
+
+		SD_CompactSurface << <pDims, BLOCK_SIZE >> > (m_surfaceIndex, m_flag, m_offset);
+		cuSynchronize();
+	}
+
+#ifdef PRECISION_FLOAT
+	template class SurfaceDetection<DataType3f>;
+#else
+	template class SurfaceDetection<DataType3d>;
+#endif
+}
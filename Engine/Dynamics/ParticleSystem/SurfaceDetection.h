@@ -0,0 +1,55 @@
+#pragma once
+#include "Framework/Framework/ModuleCompute.h"
+#include "Framework/Framework/FieldVar.h"
+#include "Framework/Framework/FieldArray.h"
+#include "Framework/Topology/FieldNeighbor.h"
+
+namespace Physika {
+
+	/*!
+	*	\class	SurfaceDetection
+	*	\brief	Flags particles near the free surface and compacts their ids into a list.
+	*
+	*	A particle is on the surface if the normalized sum of the directions to its neighbors exceeds the threshold,
+	*	i.e., its neighborhood is one-sided, or if it has no neighbors at all. Surface-only modules such as SurfaceTension
+	*	share one detection per step and launch over getSurfaceNumber() threads instead of all particles.
+	*/
+	template<typename TDataType>
+	class SurfaceDetection : public ComputeModule
+	{
+		DECLARE_CLASS_1(SurfaceDetection, TDataType)
+
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+
+		SurfaceDetection();
+		~SurfaceDetection() override;
+
+		void compute() override;
+
+		void setThreshold(Real threshold) { m_threshold = threshold; }
+
+		/// Ids of the surface particles, only the first getSurfaceNumber() entries are valid
+		DeviceArray<int>& getSurfaceIndex() { return m_surfaceIndex; }
+		int getSurfaceNumber() { return m_surfaceNum; }
+
+	protected:
+		bool initializeImpl() override;
+
+	public:
+		VarField<Real> m_smoothingLength;
+
+		DeviceArrayField<Coord> m_position;
+
+		NeighborField<int> m_neighborhood;
+
+	private:
+		Real m_threshold;
+		int m_surfaceNum;
+
+		DeviceArray<int> m_flag;
+		DeviceArray<int> m_offset;
+		DeviceArray<int> m_surfaceIndex;
+	};
+}
@@ -1,29 +1,37 @@
 #include <cuda_runtime.h>
 #include "Core/Utility.h"
 #include "SurfaceTension.h"
-#include "Framework/Framework/MechanicalState.h"
-#include "Framework/Topology/NeighborList.h"
+#include "SurfaceDetection.h"
+#include "Framework/Framework/Node.h"
+#include "Framework/Topology/FieldNeighbor.h"
 #include "Kernel.h"
 
 namespace Physika
 {
-	template<typename Real, typename Coord>
+	IMPLEMENT_CLASS_1(SurfaceTension, TDataType)
+
+	/*!
+	*	\brief	One thread per surface particle, surfaceIndex holds surfaceNum valid ids.
+	*/
+	template<typename Real, typename Coord, typename TKernel>
 	__global__ void ST_ComputeSurfaceEnergy
 	(
 		DeviceArray<Real> energyArr,
+		DeviceArray<int> surfaceIndex,
+		int surfaceNum,
 		DeviceArray<Coord> posArr,
 		NeighborList<int> neighbors,
-		Real smoothingLength
+		TKernel kern
 	)
 	{
-		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= posArr.size()) return;
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (tId >= surfaceNum) return;
+
+		int pId = surfaceIndex[tId];
 
 		Real total_weight = Real(0);
 		Coord dir_i(0);
 
-		SmoothKernel<Real> kern;
-
 		Coord pos_i = posArr[pId];
 		int nbSize = neighbors.getNeighborSize(pId);
 		for (int ne = 0; ne < nbSize; ne++)
@@ -33,7 +41,7 @@ namespace Physika
 
 			if (r > EPSILON)
 			{
-				Real weight = -kern.Gradient(r, smoothingLength);
+				Real weight = -kern.Gradient(r);
 				total_weight += weight;
 				dir_i += (posArr[j] - pos_i)*(weight / r);
 			}
@@ -45,31 +53,34 @@ namespace Physika
 		energyArr[pId] = absDir*absDir;
 	}
 
-	template<typename Real, typename Coord>
+	template<typename Real, typename Coord, typename TKernel>
 	__global__ void ST_ComputeSurfaceTension
 	(
 		DeviceArray<Coord> velArr, 
 		DeviceArray<Real> energyArr, 
+		DeviceArray<int> surfaceIndex,
+		int surfaceNum,
 		DeviceArray<Coord> posArr, 
 		NeighborList<int> neighbors,
+		TKernel kern,
 		Real smoothingLength,
 		Real mass,
 		Real restDensity,
+		Real intensity,
 		float dt
 	)
 	{
-		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId >= posArr.size()) return;
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (tId >= surfaceNum) return;
+
+		int pId = surfaceIndex[tId];
 
 		Real Vref = mass / restDensity;
 
 		float alpha = (float) 945.0f / (32.0f * (float)M_PI * smoothingLength * smoothingLength * smoothingLength);
-		float ceof = 16000.0f * alpha;
-
-		SmoothKernel<Real> kern;
+		float ceof = 16000.0f * alpha * intensity;
 
 		Coord F_i(0);
-		Coord dv_pi(0);
 		Coord pos_i = posArr[pId];
 		int nbSize = neighbors.getNeighborSize(pId);
 		for (int ne = 0; ne < nbSize; ne++)
@@ -79,62 +90,118 @@ namespace Physika
 
 			if (r > EPSILON)
 			{
-				Coord temp = Vref*Vref*kern.Gradient(r, smoothingLength)*(posArr[j] - pos_i) * (1.0f / r);
+				Coord temp = Vref*Vref*kern.Gradient(r)*(posArr[j] - pos_i) * (1.0f / r);
 				Coord dv_ij = dt * ceof*1.0f*(energyArr[pId])*temp / mass;
 				F_i += dv_ij;
-
-// 				atomicAdd(&velArr[j].x, dv_ij.x);
-// 				atomicAdd(&velArr[j].y, dv_ij.y);
-// 				atomicAdd(&velArr[j].z, dv_ij.z);
 			}
 		}
 		velArr[pId] -= F_i;
-
-// 		atomicAdd(&velArr[pId].x, -F_i.x);
-// 		atomicAdd(&velArr[pId].y, -F_i.y);
-// 		atomicAdd(&velArr[pId].z, -F_i.z);
 	}
 
 	template<typename TDataType>
 	SurfaceTension<TDataType>::SurfaceTension()
 		: ForceModule()
-		, m_posID(MechanicalState::position())
-		, m_velID(MechanicalState::velocity())
-		, m_neighborhoodID(MechanicalState::particle_neighbors())
 		, m_intensity(Real(1))
-		, m_soothingLength(Real(0.0125))
+		, m_sharedDetection(false)
+	{
+		m_mass.setValue(Real(1));
+		m_restDensity.setValue(Real(1000));
+		m_smoothingLength.setValue(Real(0.0125));
+
+		attachField(&m_mass, "mass", "particle mass", false);
+		attachField(&m_restDensity, "rest_density", "Reference density", false);
+		attachField(&m_smoothingLength, "smoothing_length", "The smoothing length in SPH!", false);
+		attachField(&m_position, "position", "Storing the particle positions!", false);
+		attachField(&m_velocity, "velocity", "Storing the particle velocities!", false);
+		attachField(&m_neighborhood, "neighborhood", "Storing neighboring particles' ids!", false);
+	}
+
+	template<typename TDataType>
+	SurfaceTension<TDataType>::~SurfaceTension()
 	{
+		m_energy.release();
+	}
 
+	template<typename TDataType>
+	void SurfaceTension<TDataType>::setSurfaceDetection(std::shared_ptr<SurfaceDetection<TDataType>> detection)
+	{
+		m_surfaceDetection = detection;
+		m_sharedDetection = detection != nullptr;
 	}
 
 	template<typename TDataType>
-	bool SurfaceTension<TDataType>::execute()
+	bool SurfaceTension<TDataType>::initializeImpl()
 	{
-// 		m_energy = DeviceBuffer<Real>::create(num);
-// 
-// 		DeviceArray<Coord>* posArr = m_parent->GetNewPositionBuffer()->getDataPtr();
-// 		DeviceArray<Coord>* velArr = m_parent->GetNewVelocityBuffer()->getDataPtr();
-// 		DeviceArray<Attribute>* attArr = m_parent->GetAttributeBuffer()->getDataPtr();
-// 		float dt = m_parent->getDt();
-// 
-// 		DeviceArray<SPHNeighborList>* neighborArr = m_parent->GetNeighborBuffer()->getDataPtr();
-// 
-// 		DeviceArray<Real>* energy = m_energy->getDataPtr();
-// 
-// 		Real mass = m_parent->GetParticleMass();
-// 		Real smoothingLength = m_parent->GetSmoothingLength();
-// 		Real restDensity = m_parent->GetRestDensity();
-// 
-// 		uint pDims = cudaGridSize(posArr->size(), BLOCK_SIZE);
-// 		ST_ComputeSurfaceEnergy <Real, Coord> << < pDims, BLOCK_SIZE >> > (*energy, *posArr, *neighborArr, smoothingLength);
-// 		ST_ComputeSurfaceTension <Real, Coord> << < pDims, BLOCK_SIZE >> > (*velArr, *energy, *posArr, *attArr, *neighborArr, smoothingLength, mass, restDensity, dt);
+		if (!isAllFieldsReady())
+		{
+			std::cout << "Exception: " << std::string("SurfaceTension's fields are not fully initialized!") << "\n";
+			return false;
+		}
+
+		if (m_surfaceDetection == nullptr)
+		{
+			m_surfaceDetection = std::make_shared<SurfaceDetection<TDataType>>();
+			m_smoothingLength.connect(m_surfaceDetection->m_smoothingLength);
+			m_position.connect(m_surfaceDetection->m_position);
+			m_neighborhood.connect(m_surfaceDetection->m_neighborhood);
+			m_surfaceDetection->initialize();
+		}
 
 		return true;
 	}
 
+	template<typename TDataType>
+	bool SurfaceTension<TDataType>::execute()
+	{
+		return applyForce();
+	}
+
 	template<typename TDataType>
 	bool SurfaceTension<TDataType>::applyForce()
 	{
+		int num = m_position.getElementCount();
+		if (m_energy.size() != num)
+		{
+			m_energy.resize(num);
+		}
+
+		if (!m_sharedDetection)
+		{
+			m_surfaceDetection->compute();
+		}
+
+		int surfaceNum = m_surfaceDetection->getSurfaceNumber();
+		if (surfaceNum <= 0)
+			return true;
+
+		uint pDims = cudaGridSize(surfaceNum, BLOCK_SIZE);
+
+		Real h = m_smoothingLength.getValue();
+		DeviceArray<int>& surfaceIndex = m_surfaceDetection->getSurfaceIndex();
+
+		ST_ComputeSurfaceEnergy <Real, Coord> << < pDims, BLOCK_SIZE >> > (
+			m_energy,
+			surfaceIndex,
+			surfaceNum,
+			m_position.getValue(),
+			m_neighborhood.getValue(),
+			SmoothKernel<Real>(h));
+
+		ST_ComputeSurfaceTension <Real, Coord> << < pDims, BLOCK_SIZE >> > (
+			m_velocity.getValue(),
+			m_energy,
+			surfaceIndex,
+			surfaceNum,
+			m_position.getValue(),
+			m_neighborhood.getValue(),
+			SmoothKernel<Real>(h),
+			h,
+			m_mass.getValue(),
+			m_restDensity.getValue(),
+			m_intensity,
+			this->getParent()->getDt());
+		cuSynchronize();
+
 		return true;
 	}
 
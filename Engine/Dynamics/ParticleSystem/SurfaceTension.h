@@ -1,40 +1,59 @@
 #pragma once
 #include "Framework/Framework/ModuleForce.h"
+#include "Framework/Framework/FieldVar.h"
 #include "Framework/Framework/FieldArray.h"
+#include "Framework/Topology/FieldNeighbor.h"
 
 namespace Physika {
+	template<typename TDataType> class SurfaceDetection;
 
+	/*!
+	*	\class	SurfaceTension
+	*	\brief	Surface tension on the velocities, evaluated only on the surface particles listed by a SurfaceDetection.
+	*
+	*	The detection is either shared with other surface-only modules through setSurfaceDetection(),
+	*	in which case its owner computes it once per step, or created and computed by the module itself.
+	*/
 	template<typename TDataType>
 	class SurfaceTension : public ForceModule
 	{
+		DECLARE_CLASS_1(SurfaceTension, TDataType)
 	public:
 		typedef typename TDataType::Real Real;
 		typedef typename TDataType::Coord Coord;
 
 		SurfaceTension();
-		~SurfaceTension() override {};
-		
+		~SurfaceTension() override;
+
 		bool execute() override;
 
 		bool applyForce() override;
 
-		void setPositionID(FieldID id) { m_posID = id; }
-		void setVelocityID(FieldID id) { m_velID = id; }
-		void setNeighborhoodID(FieldID id) { m_neighborhoodID = id; }
-
 		void setIntensity(Real intensity) { m_intensity = intensity; }
-		void setSmoothingLength(Real len) { m_soothingLength = len; }
+		void setSmoothingLength(Real len) { m_smoothingLength.setValue(len); }
+
+		void setSurfaceDetection(std::shared_ptr<SurfaceDetection<TDataType>> detection);
 
 	protected:
-		FieldID m_posID;
-		FieldID m_velID;
-		FieldID m_neighborhoodID;
+		bool initializeImpl() override;
+
+	public:
+		VarField<Real> m_mass;
+		VarField<Real> m_restDensity;
+		VarField<Real> m_smoothingLength;
+
+		DeviceArrayField<Coord> m_position;
+		DeviceArrayField<Coord> m_velocity;
+
+		NeighborField<int> m_neighborhood;
 
 	private:
 		Real m_intensity;
-		Real m_soothingLength;
 
-		DeviceArrayField<Real>* m_energy;
+		bool m_sharedDetection;
+		std::shared_ptr<SurfaceDetection<TDataType>> m_surfaceDetection;
+
+		DeviceArray<Real> m_energy;
 	};
 
 #ifdef PRECISION_FLOAT
@@ -42,4 +61,4 @@ namespace Physika {
 #else
 	template class SurfaceTension<DataType3d>;
 #endif
-}
\ No newline at end of file
+}
@@ -5,6 +5,8 @@
 #include "DensitySummation.h"
 #include "Attribute.h"
 #include "Kernel.h"
+#include "Core/Utility/ResidualMax.h"
+#include "Framework/Framework/SceneGraph.h"
 
 namespace Physika
 {
@@ -530,13 +532,223 @@ namespace Physika
 		}
 	}
 
+	//Number of consecutive particles per diagonal block of the block Jacobi preconditioner
+	#define VC_PRECOND_BLOCK 4
+
+	//Slots of the device scalars used by the conjugate gradient solver, r.z alternates between slots 0 and 1
+	#define VC_SCALAR_PY 2
+	#define VC_SCALAR_RR 3
+	#define VC_SCALAR_NUM 4
+
+	template <typename Real>
+	__global__ void VC_Dot(
+		Real* sum,
+		DeviceArray<Real> terms,
+		DeviceArray<Real> xArr,
+		DeviceArray<Real> yArr)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+
+		Real xy = pId < xArr.size() ? xArr[pId] * yArr[pId] : Real(0);
+		RS_WarpSum(sum, terms, pId, xy);
+	}
+
+	/*!
+	*	\brief	Build and invert the diagonal blocks of VC_PRECOND_BLOCK consecutive particles, one thread per block.
+	*			Rows of static particles and particles without a diagonal entry are excluded from the solve.
+	*/
+	template <typename Real, typename Coord>
+	__global__ void VC_ComputeBlockInverse(
+		DeviceArray<Real> blockInv,
+		DeviceArray<Real> Aii,
+		DeviceArray<Real> alpha,
+		DeviceArray<Coord> position,
+		DeviceArray<Attribute> attribute,
+		NeighborList<int> neighbor,
+		Real smoothingLength)
+	{
+		int bId = threadIdx.x + (blockIdx.x * blockDim.x);
+		int num = position.size();
+		int start = bId * VC_PRECOND_BLOCK;
+		if (start >= num) return;
+
+		Real M[VC_PRECOND_BLOCK][VC_PRECOND_BLOCK];
+		Real inv[VC_PRECOND_BLOCK][VC_PRECOND_BLOCK];
+		bool valid[VC_PRECOND_BLOCK];
+		for (int li = 0; li < VC_PRECOND_BLOCK; li++)
+		{
+			int i = start + li;
+			valid[li] = i < num && attribute[i].IsDynamic() && Aii[i] > EPSILON;
+			for (int lj = 0; lj < VC_PRECOND_BLOCK; lj++)
+			{
+				M[li][lj] = Real(0);
+				inv[li][lj] = li == lj ? Real(1) : Real(0);
+			}
+			M[li][li] = valid[li] ? Aii[i] : Real(1);
+		}
+
+		for (int li = 0; li < VC_PRECOND_BLOCK; li++)
+		{
+			if (!valid[li]) continue;
+
+			int i = start + li;
+			Coord pos_i = position[i];
+			Real invAlpha_i = 1.0f / alpha[i];
+
+			int nbSize = neighbor.getNeighborSize(i);
+			for (int ne = 0; ne < nbSize; ne++)
+			{
+				int j = neighbor.getElement(i, ne);
+				int lj = j - start;
+				if (lj < 0 || lj >= VC_PRECOND_BLOCK || lj == li || !valid[lj]) continue;
+
+				Real r = (pos_i - position[j]).norm();
+				if (r > EPSILON)
+				{
+					Real a_ij = -invAlpha_i*kernWRR(r, smoothingLength);
+					M[li][lj] += a_ij;
+					M[lj][li] += a_ij;
+				}
+			}
+		}
+
+		//Gauss-Jordan elimination, the blocks are symmetric positive definite in practice, fall back to Jacobi otherwise
+		bool singular = false;
+		for (int k = 0; k < VC_PRECOND_BLOCK && !singular; k++)
+		{
+			Real pivot = M[k][k];
+			if (abs(pivot) < EPSILON)
+			{
+				singular = true;
+				break;
+			}
+
+			Real invPivot = Real(1) / pivot;
+			for (int c = 0; c < VC_PRECOND_BLOCK; c++)
+			{
+				M[k][c] *= invPivot;
+				inv[k][c] *= invPivot;
+			}
+
+			for (int row = 0; row < VC_PRECOND_BLOCK; row++)
+			{
+				if (row == k) continue;
+				Real f = M[row][k];
+				for (int c = 0; c < VC_PRECOND_BLOCK; c++)
+				{
+					M[row][c] -= f*M[k][c];
+					inv[row][c] -= f*inv[k][c];
+				}
+			}
+		}
+
+		for (int li = 0; li < VC_PRECOND_BLOCK; li++)
+		{
+			for (int lj = 0; lj < VC_PRECOND_BLOCK; lj++)
+			{
+				//Aii is only read for valid rows, the rows past the last particle are not
+				Real v = Real(0);
+				if (valid[li] && valid[lj])
+				{
+					v = singular ? (li == lj ? Real(1) / Aii[start + li] : Real(0)) : inv[li][lj];
+				}
+				blockInv[(bId * VC_PRECOND_BLOCK + li) * VC_PRECOND_BLOCK + lj] = v;
+			}
+		}
+	}
+
+	/*!
+	*	\brief	z = M^-1 r, also accumulating r.z and r.r into the device scalars, or storing them in the terms in order.
+	*/
+	template <typename Real>
+	__global__ void VC_Precondition(
+		DeviceArray<Real> z,
+		DeviceArray<Real> r,
+		DeviceArray<Real> Aii,
+		DeviceArray<Real> blockInv,
+		int preconditioner,
+		Real* rz,
+		Real* rr,
+		DeviceArray<Real> rzTerms,
+		DeviceArray<Real> rrTerms)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+
+		Real r_i = Real(0);
+		Real z_i = Real(0);
+		if (pId < r.size())
+		{
+			r_i = r[pId];
+			if (preconditioner == 1)
+			{
+				z_i = Aii[pId] > EPSILON ? r_i / Aii[pId] : Real(0);
+			}
+			else if (preconditioner == 2)
+			{
+				int start = pId - pId % VC_PRECOND_BLOCK;
+				int row = pId * VC_PRECOND_BLOCK;
+				for (int k = 0; k < VC_PRECOND_BLOCK && start + k < r.size(); k++)
+				{
+					z_i += blockInv[row + k] * r[start + k];
+				}
+			}
+			else
+			{
+				z_i = r_i;
+			}
+			z[pId] = z_i;
+		}
+
+		RS_WarpSum(rz, rzTerms, pId, r_i*z_i);
+		RS_WarpSum(rr, rrTerms, pId, r_i*r_i);
+	}
+
+	template <typename Real>
+	__global__ void VC_UpdatePressure(
+		DeviceArray<Real> pressure,
+		DeviceArray<Real> r,
+		DeviceArray<Real> p,
+		DeviceArray<Real> y,
+		Real* scalars,
+		int rzSlot)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= pressure.size()) return;
+
+		Real py = scalars[VC_SCALAR_PY];
+		Real alpha = abs(py) > EPSILON ? scalars[rzSlot] / py : Real(0);
+
+		pressure[pId] += alpha*p[pId];
+		r[pId] -= alpha*y[pId];
+	}
+
+	template <typename Real>
+	__global__ void VC_UpdateDirection(
+		DeviceArray<Real> p,
+		DeviceArray<Real> z,
+		Real* scalars,
+		int rzSlot,
+		int rzNewSlot)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= p.size()) return;
+
+		Real rz = scalars[rzSlot];
+		Real beta = abs(rz) > EPSILON ? scalars[rzNewSlot] / rz : Real(0);
+
+		p[pId] = z[pId] + beta*p[pId];
+	}
+
 	template<typename TDataType>
 	VelocityConstraint<TDataType>::VelocityConstraint()
 		: ConstraintModule()
 		, m_airPressure(Real(0))
 		, m_reduce(NULL)
-		, m_arithmetic(NULL)
+		, m_preconditioner(Jacobi)
 	{
+		m_iterationPolicy.setIterationBounds(0, 1000);
+		m_iterationPolicy.setTargetResidual(1.0f);
+
 		m_smoothingLength.setValue(Real(0.011));
 
 		attachField(&m_smoothingLength, "smoothing_length", "The smoothing length in SPH!", false);
@@ -562,6 +774,11 @@ namespace Physika
 		m_y.release();
 		m_r.release();
 		m_p.release();
+		m_z.release();
+		m_blockInv.release();
+		m_scalars.release();
+		m_dotTerms.release();
+		m_normTerms.release();
 
 		m_pressure.release();
 
@@ -569,10 +786,6 @@ namespace Physika
 		{
 			delete m_reduce;
 		}
-		if (m_arithmetic)
-		{
-			delete m_arithmetic;
-		}
 	}
 
 	template<typename TDataType>
@@ -580,7 +793,32 @@ namespace Physika
 	{
 		Real dt = getParent()->getDt();
 
-		uint pDims = cudaGridSize(m_position.getElementCount(), BLOCK_SIZE);
+		int num = m_position.getElementCount();
+		uint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+		//Particles were emitted or removed since the last step, the pressures of the last step no longer match their slots
+		if (m_alpha.size() != num)
+		{
+			m_alpha.setSize(num);
+			m_Aii.setSize(num);
+			m_AiiFluid.setSize(num);
+			m_AiiTotal.setSize(num);
+			m_divergence.setSize(num);
+			m_bSurface.setSize(num);
+			m_density.setSize(num);
+
+			m_y.setSize(num);
+			m_r.setSize(num);
+			m_p.setSize(num);
+			m_z.setSize(num);
+			m_blockInv.setSize(((num + VC_PRECOND_BLOCK - 1) / VC_PRECOND_BLOCK) * VC_PRECOND_BLOCK * VC_PRECOND_BLOCK);
+
+			m_pressure.setSize(num);
+			m_pressure.reset();
+
+			delete m_reduce;
+			m_reduce = Reduction<Real>::Create(num);
+		}
 
 		//compute alpha_i = sigma w_j and A_i = sigma w_ij / r_ij / r_ij
 		m_alpha.reset();
@@ -619,8 +857,6 @@ namespace Physika
 			m_smoothingLength.getValue(),
 			m_maxA);
 
-		int itor = 0;
-
 		//compute the source term
 		m_densitySum->compute(m_density);
 		m_divergence.reset();
@@ -647,7 +883,59 @@ namespace Physika
 			m_restDensity, 
 			dt);
 		
-		//solve the linear system of equations with a conjugate gradient method.
+		//solve the linear system of equations with a preconditioned conjugate gradient method.
+		solvePressure();
+
+		//update the each particle's velocity
+		VC_UpdateVelocityBoundaryCorrected << <pDims, BLOCK_SIZE >> > (
+			m_pressure,
+			m_alpha,
+			m_bSurface, 
+			m_position.getValue(), 
+			m_velocity.getValue(), 
+			m_normal.getValue(), 
+			m_attribute.getValue(), 
+			m_neighborhood.getValue(),
+			m_restDensity,
+			m_airPressure,
+			m_tangential,
+			m_separation,
+			m_smoothingLength.getValue(),
+			dt);
+
+		return true;
+	}
+
+	template<typename TDataType>
+	void VelocityConstraint<TDataType>::solvePressure()
+	{
+		int num = m_position.getElementCount();
+		uint pDims = cudaGridSize(num, BLOCK_SIZE);
+		Real* scalars = m_scalars.getDataPtr();
+
+		//In the deterministic mode the dot products are stored per particle and summed along the fixed tree of m_reduce
+		bool ordered = SceneGraph::getInstance().isDeterministic();
+		if (ordered && m_dotTerms.size() != num)
+		{
+			m_dotTerms.resize(num);
+			m_normTerms.resize(num);
+		}
+		DeviceArray<Real> dotTerms = ordered ? m_dotTerms : DeviceArray<Real>();
+		DeviceArray<Real> normTerms = ordered ? m_normTerms : DeviceArray<Real>();
+
+		if (m_preconditioner == BlockJacobi)
+		{
+			int blockNum = (num + VC_PRECOND_BLOCK - 1) / VC_PRECOND_BLOCK;
+			VC_ComputeBlockInverse << <cudaGridSize(blockNum, BLOCK_SIZE), BLOCK_SIZE >> > (
+				m_blockInv,
+				m_Aii,
+				m_alpha,
+				m_position.getValue(),
+				m_attribute.getValue(),
+				m_neighborhood.getValue(),
+				m_smoothingLength.getValue());
+		}
+
 		m_y.reset();
 		VC_ComputeAx << <pDims, BLOCK_SIZE >> > (
 			m_y, 
@@ -659,16 +947,40 @@ namespace Physika
 			m_neighborhood.getValue(),
 			m_smoothingLength.getValue());
 
-		m_r.reset();
 		Function2Pt::subtract(m_r, m_divergence, m_y);
-		Function1Pt::copy(m_p, m_r);
-		Real rr = m_arithmetic->Dot(m_r, m_r);
-		Real err = sqrt(rr / m_r.size());
 
-		while (itor < 1000 && err > 1.0f)
+		int rzSlot = 0;
+		m_scalars.reset();
+		VC_Precondition << <pDims, BLOCK_SIZE >> > (
+			m_z,
+			m_r,
+			m_Aii,
+			m_blockInv,
+			(int)m_preconditioner,
+			scalars + rzSlot,
+			scalars + VC_SCALAR_RR,
+			dotTerms,
+			normTerms);
+		Function1Pt::copy(m_p, m_z);
+		if (ordered)
 		{
+			RS_SumTerms(scalars + rzSlot, m_dotTerms, m_reduce);
+			RS_SumTerms(scalars + VC_SCALAR_RR, m_normTerms, m_reduce);
+		}
+
+		Real rr;
+		cudaMemcpy(&rr, scalars + VC_SCALAR_RR, sizeof(Real), cudaMemcpyDeviceToHost);
+		float err = sqrt(rr / num);
+
+		//All scalars stay on the device, the residual norm is the only value read back per iteration
+		int itor = 0;
+		while (m_iterationPolicy.proceed(itor, err))
+		{
+			int rzNewSlot = 1 - rzSlot;
+			cudaMemset(scalars + rzNewSlot, 0, sizeof(Real));
+			cudaMemset(scalars + VC_SCALAR_PY, 0, 2 * sizeof(Real));
+
 			m_y.reset();
-			//VC_ComputeAx << <pDims, BLOCK_SIZE >> > (*yArr, *pArr, *aiiArr, *alphaArr, *posArr, *attArr, *neighborArr);
 			VC_ComputeAx << <pDims, BLOCK_SIZE >> > (
 				m_y, 
 				m_p, 
@@ -678,41 +990,35 @@ namespace Physika
 				m_attribute.getValue(),
 				m_neighborhood.getValue(),
 				m_smoothingLength.getValue());
+			VC_Dot << <pDims, BLOCK_SIZE >> > (scalars + VC_SCALAR_PY, dotTerms, m_p, m_y);
+			if (ordered) RS_SumTerms(scalars + VC_SCALAR_PY, m_dotTerms, m_reduce);
+
+			VC_UpdatePressure << <pDims, BLOCK_SIZE >> > (m_pressure, m_r, m_p, m_y, scalars, rzSlot);
+
+			VC_Precondition << <pDims, BLOCK_SIZE >> > (
+				m_z,
+				m_r,
+				m_Aii,
+				m_blockInv,
+				(int)m_preconditioner,
+				scalars + rzNewSlot,
+				scalars + VC_SCALAR_RR,
+				dotTerms,
+				normTerms);
+			if (ordered)
+			{
+				RS_SumTerms(scalars + rzNewSlot, m_dotTerms, m_reduce);
+				RS_SumTerms(scalars + VC_SCALAR_RR, m_normTerms, m_reduce);
+			}
 
-			float alpha = rr / m_arithmetic->Dot(m_p, m_y);
-			Function2Pt::saxpy(m_pressure, m_p, m_pressure, alpha);
-			Function2Pt::saxpy(m_r, m_y, m_r, -alpha);
-
-			Real rr_old = rr;
-
-			rr = m_arithmetic->Dot(m_r, m_r);
-
-			Real beta = rr / rr_old;
-			Function2Pt::saxpy(m_p, m_p, m_r, beta);
+			VC_UpdateDirection << <pDims, BLOCK_SIZE >> > (m_p, m_z, scalars, rzSlot, rzNewSlot);
 
-			err = sqrt(rr / m_r.size());
+			cudaMemcpy(&rr, scalars + VC_SCALAR_RR, sizeof(Real), cudaMemcpyDeviceToHost);
+			err = sqrt(rr / num);
 
+			rzSlot = rzNewSlot;
 			itor++;
 		}
-
-		//update the each particle's velocity
-		VC_UpdateVelocityBoundaryCorrected << <pDims, BLOCK_SIZE >> > (
-			m_pressure,
-			m_alpha,
-			m_bSurface, 
-			m_position.getValue(), 
-			m_velocity.getValue(), 
-			m_normal.getValue(), 
-			m_attribute.getValue(), 
-			m_neighborhood.getValue(),
-			m_restDensity,
-			m_airPressure,
-			m_tangential,
-			m_separation,
-			m_smoothingLength.getValue(),
-			dt);
-
-		return true;
 	}
 
 	template<typename TDataType>
@@ -743,11 +1049,13 @@ namespace Physika
 		m_y.resize(num);
 		m_r.resize(num);
 		m_p.resize(num);
+		m_z.resize(num);
+		m_blockInv.resize(((num + VC_PRECOND_BLOCK - 1) / VC_PRECOND_BLOCK) * VC_PRECOND_BLOCK * VC_PRECOND_BLOCK);
+		m_scalars.resize(VC_SCALAR_NUM);
 
 		m_pressure.resize(num);
 
-		m_reduce = Reduction<float>::Create(num);
-		m_arithmetic = Arithmetic<float>::Create(num);
+		m_reduce = Reduction<Real>::Create(num);
 
 
 		uint pDims = cudaGridSize(num, BLOCK_SIZE);
@@ -22,6 +22,19 @@ namespace Physika {
 		
 		bool constrain() override;
 
+		enum PreconditionerType
+		{
+			NoPreconditioner,
+			Jacobi,
+			BlockJacobi
+		};
+
+		/*!
+		*	\brief	Jacobi scales the residual by the diagonal of the pressure matrix, BlockJacobi inverts the diagonal blocks
+		*			of four consecutive particles, which pays off when particles are sorted spatially.
+		*/
+		void setPreconditioner(PreconditionerType type) { m_preconditioner = type; }
+
 	public:
 		VarField<Real> m_smoothingLength;
 
@@ -35,6 +48,8 @@ namespace Physika {
 		bool initializeImpl() override;
 
 	private:
+		void solvePressure();
+
 		bool m_bConfigured = false;
 		Real m_maxAlpha;
 		Real m_maxA;
@@ -62,9 +77,15 @@ namespace Physika {
 		DeviceArray<Real> m_y;
 		DeviceArray<Real> m_r;
 		DeviceArray<Real> m_p;
+		DeviceArray<Real> m_z;
+		DeviceArray<Real> m_blockInv;
+		DeviceArray<Real> m_scalars;
+		DeviceArray<Real> m_dotTerms;
+		DeviceArray<Real> m_normTerms;
+
+		PreconditionerType m_preconditioner;
 
 		Reduction<Real>* m_reduce;
-		Arithmetic<Real>* m_arithmetic;
 
 		std::shared_ptr<DensitySummation<TDataType>> m_densitySum;
 	};
@@ -28,7 +28,18 @@ namespace Physika
 		}
 		if (node->isActive())
 		{
-			node->advance(node->getDt());
+			//Substeps are scheduled by the scene graph in multi-rate mode, otherwise the node is advanced once
+			int substeps = node->getSubstepNumber();
+			for (int i = 0; i < substeps; i++)
+			{
+				node->advance(node->getDt());
+
+				//The parent only constrains its children once per scene step, before they advance
+				if (substeps > 1 && node->getParent() != NULL)
+				{
+					node->getParent()->constrainChild(node, node->getDt());
+				}
+			}
 			node->updateTopology();
 
 			/*if (node->getAnimationController() != nullptr)
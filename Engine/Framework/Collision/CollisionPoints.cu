@@ -4,6 +4,8 @@
 #include "Framework/Framework/CollidableObject.h"
 #include "Framework/Collision/CollidablePoints.h"
 #include "Framework/Topology/NeighborQuery.h"
+#include "Framework/Topology/NeighborScatter.h"
+#include "Framework/Framework/SceneGraph.h"
 
 namespace Physika
 {
@@ -109,6 +111,64 @@ namespace Physika
 //		newPoints[pId] = pos_num;
 	}
 
+	/*!
+	*	\brief	Deterministic variant of K_Collide, the targets of neighbor j are stored in the entry of j and added by a NeighborScatter.
+	*/
+	template<typename Real, typename Coord>
+	__global__ void K_CollideOrdered(
+		DeviceArray<int> objIds,
+		DeviceArray<Coord> points,
+		DeviceArray<Coord> newPoints,
+		DeviceArray<Real> weights,
+		DeviceArray<Coord> entryPoints,
+		DeviceArray<Real> entryWeights,
+		NeighborList<int> neighbors,
+		Real radius
+	)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= points.size()) return;
+
+		Coord pos_i = points[pId];
+		int id_i = objIds[pId];
+
+		Coord point_i(0);
+		Real weight_i = Real(0);
+		int nbSize = neighbors.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = neighbors.getElement(pId, ne);
+			int entry = neighbors.getElementIndex(pId, ne);
+
+			Real r = (pos_i - points[j]).norm();
+			if (r < radius && objIds[j] != id_i)
+			{
+				Coord center = (pos_i + points[j]) / 2;
+				Coord n = pos_i - center;
+				if (n.norm() < EPSILON)
+					n = Coord(1, 0, 0);
+				else
+				{
+					n = n.normalize();
+				}
+
+				point_i += center + 0.5*radius*n;
+				weight_i += Real(1);
+
+				entryPoints[entry] = center - 0.5*radius*n;
+				entryWeights[entry] = Real(1);
+			}
+			else
+			{
+				entryPoints[entry] = Coord(0);
+				entryWeights[entry] = Real(0);
+			}
+		}
+
+		newPoints[pId] = point_i;
+		weights[pId] = weight_i;
+	}
+
 	template<typename Real, typename Coord>
 	__global__ void K_ComputeTarget(
 		DeviceArray<Coord> oldPoints,
@@ -168,6 +228,18 @@ namespace Physika
 		Real radius = 0.005;
 		m_nbrQuery->queryParticleNeighbors(*m_nList, m_points, radius);
 
+		bool ordered = SceneGraph::getInstance().isDeterministic();
+		if (ordered)
+		{
+			if (m_scatter == nullptr)
+			{
+				m_scatter = std::make_shared<NeighborScatter>();
+			}
+			m_scatter->update(*m_nList);
+			m_entryPoints.setSize(m_scatter->getEntryNum());
+			m_entryWeights.setSize(m_scatter->getEntryNum());
+		}
+
 		DeviceArray<Coord> posBuf;
 		posBuf.resize(m_points.size());
 
@@ -184,7 +256,16 @@ namespace Physika
 		{
 			weights.reset();
 			posBuf.reset();
-			K_Collide << <pDims, BLOCK_SIZE >> > (m_objId, m_points, posBuf, weights, *m_nList, radius);
+			if (ordered)
+			{
+				K_CollideOrdered << <pDims, BLOCK_SIZE >> > (m_objId, m_points, posBuf, weights, m_entryPoints, m_entryWeights, *m_nList, radius);
+				m_scatter->add(posBuf, m_entryPoints);
+				m_scatter->add(weights, m_entryWeights);
+			}
+			else
+			{
+				K_Collide << <pDims, BLOCK_SIZE >> > (m_objId, m_points, posBuf, weights, *m_nList, radius);
+			}
 			K_ComputeTarget << <pDims, BLOCK_SIZE >> > (m_points, posBuf, weights);
 			Function1Pt::copy(m_points, posBuf);
 		}
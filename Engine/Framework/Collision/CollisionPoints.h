@@ -8,6 +8,7 @@ template <typename> class CollidablePoints;
 template <typename> class NeighborQuery;
 template <typename> class NeighborList;
 template <typename> class GridHash;
+class NeighborScatter;
 
 template<typename TDataType>
 class CollisionPoints : public CollisionModel
@@ -36,6 +37,11 @@ protected:
 	std::shared_ptr<NeighborQuery<TDataType>> m_nbrQuery;
 	std::shared_ptr<NeighborList<int>> m_nList;
 
+	/// Orders the pair contributions in deterministic mode
+	std::shared_ptr<NeighborScatter> m_scatter;
+	DeviceArray<Coord> m_entryPoints;
+	DeviceArray<Real> m_entryWeights;
+
 	std::vector<std::shared_ptr<CollidablePoints<TDataType>>> m_collidableObjects;
 };
 
@@ -37,6 +37,7 @@ public:
 	bool removeFieldAlias(const FieldID name, FieldMap& fieldAlias);
 
 	Field*	getField(const FieldID name);
+	FieldVector& getAllFields() { return m_field; }
 
 	bool attachField(Field* field, std::string name, std::string desc, bool autoDestroy = true);
 
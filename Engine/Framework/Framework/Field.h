@@ -37,6 +37,22 @@ public:
 
 	virtual bool isEmpty() = 0;
 
+	/*!
+	*	\brief	Append num zero-initialized elements and keep the existing ones, used when particles are emitted.
+	*			Only array fields owning their data respond, derived fields follow their source.
+	*/
+	virtual void appendElements(size_t num) {};
+
+	/*!
+	*	\brief	Keep the num elements listed in index, a device array, in that order, used when particles are removed.
+	*/
+	virtual void compactElements(int* index, size_t num) {};
+
+	/*!
+	*	\brief	Append copies of the num elements listed in index, a device array, used when particles are split.
+	*/
+	virtual void duplicateElements(int* index, size_t num) {};
+
 	void setAutoDestroy(bool autoDestroy);
 	void setDerived(bool derived);
 
@@ -41,8 +41,15 @@ public:
 
 	bool connect(ArrayField<T, deviceType>& field2);
 
+	void appendElements(size_t num) override;
+	void compactElements(int* index, size_t num) override;
+	void duplicateElements(int* index, size_t num) override;
+
 private:
 	std::shared_ptr<Array<T, deviceType>> m_data = nullptr;
+
+	/// Target of compactElements(), swapped with the data afterwards so that both keep their capacity
+	Array<T, deviceType> m_buffer;
 };
 
 template<typename T, DeviceType deviceType>
@@ -102,6 +109,7 @@ ArrayField<T, deviceType>::~ArrayField()
 	{
 		m_data->release();
 	}
+	m_buffer.release();
 }
 
 template<typename T, DeviceType deviceType>
@@ -137,6 +145,41 @@ bool ArrayField<T, deviceType>::connect(ArrayField<T, deviceType>& field2)
 	return true;
 }
 
+template<typename T, DeviceType deviceType>
+void ArrayField<T, deviceType>::appendElements(size_t num)
+{
+	if (getSource() != nullptr || m_data == nullptr)
+		return;
+
+	m_data->setSize(m_data->size() + num);
+}
+
+template<typename T, DeviceType deviceType>
+void ArrayField<T, deviceType>::compactElements(int* index, size_t num)
+{
+	if (getSource() != nullptr || m_data == nullptr || deviceType != DeviceType::GPU)
+		return;
+
+	m_buffer.setSize(num);
+	Function1Pt::gather((void*)m_buffer.getDataPtr(), (void*)m_data->getDataPtr(), index, num, sizeof(T));
+	std::swap(*m_data, m_buffer);
+
+	//Do not keep referring to memory owned elsewhere
+	if (m_buffer.isExternal())
+		m_buffer.release();
+}
+
+template<typename T, DeviceType deviceType>
+void ArrayField<T, deviceType>::duplicateElements(int* index, size_t num)
+{
+	if (getSource() != nullptr || m_data == nullptr || deviceType != DeviceType::GPU)
+		return;
+
+	int oldNum = m_data->size();
+	m_data->setSize(oldNum + num);
+	Function1Pt::gather((void*)(m_data->getDataPtr() + oldNum), (void*)m_data->getDataPtr(), index, num, sizeof(T));
+}
+
 template<typename T, DeviceType deviceType>
 void ArrayField<T, deviceType>::setValue(std::vector<T>& vals)
 {
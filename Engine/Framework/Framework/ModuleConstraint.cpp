@@ -7,6 +7,8 @@ ConstraintModule::ConstraintModule()
 	: Module()
 	, m_posID(MechanicalState::position())
 	, m_velID(MechanicalState::velocity())
+	, m_rangeStart(0)
+	, m_rangeCount(-1)
 {
 }
 
@@ -1,10 +1,67 @@
 #pragma once
+#include <limits>
 #include "Framework/Framework/Module.h"
 
 namespace Physika
 {
 class Field;
 
+/*!
+*	\class	IterationPolicy
+*	\brief	Convergence control for iterative solvers.
+*
+*	A solver keeps iterating while proceed() returns true. Iteration stops once the residual reported by the solver drops to
+*	the target, but never before the minimum and never after the maximum number of iterations.
+*	Without a target (the default), exactly the maximum number of iterations is taken.
+*	A negative residual means the solver did not report one, in which case iteration continues up to the maximum.
+*/
+class IterationPolicy
+{
+public:
+	IterationPolicy(int maxIter = 1)
+		: m_minIteration(1)
+		, m_maxIteration(maxIter)
+		, m_targetResidual(0.0f)
+		, m_lastIteration(0)
+		, m_lastResidual(-1.0f)
+	{
+	}
+
+	void setIterationBounds(int minIter, int maxIter) { m_minIteration = minIter; m_maxIteration = maxIter; }
+	void setMaxIteration(int maxIter) { m_maxIteration = maxIter; }
+	int getMaxIteration() { return m_maxIteration; }
+	int getMinIteration() { return m_minIteration; }
+
+	void setTargetResidual(float residual) { m_targetResidual = residual; }
+	float getTargetResidual() { return m_targetResidual; }
+	bool hasTarget() { return m_targetResidual > 0.0f; }
+
+	/*!
+	*	\brief	Decide whether to take another iteration after iter iterations have been completed.
+	*/
+	bool proceed(int iter, float residual = std::numeric_limits<float>::max())
+	{
+		m_lastIteration = iter;
+		m_lastResidual = residual;
+
+		if (iter >= m_maxIteration) return false;
+		if (iter < m_minIteration || !hasTarget() || residual < 0.0f) return true;
+
+		return residual > m_targetResidual;
+	}
+
+	int getLastIterationNumber() { return m_lastIteration; }
+	float getLastResidual() { return m_lastResidual; }
+
+private:
+	int m_minIteration;
+	int m_maxIteration;
+	float m_targetResidual;
+
+	int m_lastIteration;
+	float m_lastResidual;
+};
+
 class ConstraintModule : public Module
 {
 public:
@@ -21,9 +78,33 @@ public:
 
 	virtual bool constrain() { return true; }
 
+	/*!
+	*	\brief	Iteration bounds and target residual of iterative constraints, see IterationPolicy.
+	*/
+	IterationPolicy& getIterationPolicy() { return m_iterationPolicy; }
+
+	/*!
+	*	\brief	Only correct the particles [start, start + count), e.g., one material of a container sorted by material.
+	*			Neighbors outside the range still contribute, but are left unchanged. A negative count means all particles.
+	*/
+	void setParticleRange(int start, int count) { m_rangeStart = start; m_rangeCount = count; }
+	virtual bool supportsParticleRange() { return false; }
+
 	std::string getModuleType() override { return "ConstraintModule"; }
 protected:
+	/// The range set by setParticleRange(), or all of the total particles
+	void getParticleRange(int total, int& start, int& count)
+	{
+		start = m_rangeCount < 0 ? 0 : m_rangeStart;
+		count = m_rangeCount < 0 ? total : m_rangeCount;
+	}
+
 	FieldID m_posID;
 	FieldID m_velID;
+
+	IterationPolicy m_iterationPolicy;
+
+	int m_rangeStart;
+	int m_rangeCount;
 };
 }
@@ -25,6 +25,10 @@ Node::Node(std::string name)
 
 	m_mass.setValue(1.0);
 	m_dt = 0.001f;
+	m_stableDt = 0.0f;
+	m_substeps = 1;
+	m_scheduled = false;
+	m_unscheduledDt = m_dt;
 }
 
 
@@ -103,6 +107,54 @@ void Node::setDt(Real dt)
 	m_dt = dt;
 }
 
+Real Node::getStableTimeStep()
+{
+	return m_stableDt;
+}
+
+void Node::setStableTimeStep(Real dt)
+{
+	m_stableDt = dt;
+}
+
+int Node::getSubstepNumber()
+{
+	return m_substeps;
+}
+
+void Node::setSubstepNumber(int num)
+{
+	m_substeps = num < 1 ? 1 : num;
+}
+
+void Node::setSchedule(int substeps, Real dt)
+{
+	if (!m_scheduled)
+	{
+		m_unscheduledDt = m_dt;
+		m_scheduled = true;
+	}
+
+	setSubstepNumber(substeps);
+	m_dt = dt;
+}
+
+void Node::resetSchedule()
+{
+	if (m_scheduled)
+	{
+		m_dt = m_unscheduledDt;
+		m_scheduled = false;
+	}
+
+	m_substeps = 1;
+}
+
+Real Node::getUnscheduledDt()
+{
+	return m_scheduled ? m_unscheduledDt : m_dt;
+}
+
 void Node::setMass(Real mass)
 {
 	m_mass.setValue(mass);
@@ -69,6 +69,23 @@ public:
 
 	void setDt(Real dt);
 
+	/// Largest time step the node can be advanced with stably, a non-positive value means the node declares none
+	virtual Real getStableTimeStep();
+
+	void setStableTimeStep(Real dt);
+
+	/// Number of times the node is advanced per scene step, each with getDt()
+	int getSubstepNumber();
+
+	void setSubstepNumber(int num);
+
+	/// Substeps and time step assigned by the scene graph in multi-rate mode, resetSchedule() restores the time step set before
+	void setSchedule(int substeps, Real dt);
+	void resetSchedule();
+
+	/// Time step given to the node with setDt(), rather than the one assigned by the scene graph
+	Real getUnscheduledDt();
+
 	void setMass(Real mass);
 	Real getMass();
 
@@ -282,6 +299,8 @@ public:
 	virtual bool initialize() { return true; }
 	virtual void draw() {};
 	virtual void advance(Real dt);
+	/// Called for a child that advanced one substep of dt within its own advance(), e.g., to keep it inside obstacles
+	virtual void constrainChild(Node* child, Real dt) {};
 	virtual void takeOneFrame() {};
 	virtual void updateModules() {};
 	virtual void updateTopology() {};
@@ -340,6 +359,15 @@ private:
 	Real m_dt;
 	bool m_initalized;
 
+	/**
+	 * @brief Declared stable time step and the number of substeps scheduled by the scene graph
+	 * 
+	 */
+	Real m_stableDt;
+	int m_substeps;
+	bool m_scheduled;
+	Real m_unscheduledDt;
+
 	VarField<Real> m_mass;
 	/**
 	 * @brief Dynamics indicator
@@ -1,8 +1,11 @@
 #include "SceneGraph.h"
+#include <algorithm>
+#include <cmath>
 #include "Framework/Action/ActAnimate.h"
 #include "Framework/Action/ActDraw.h"
 #include "Framework/Action/ActInit.h"
 #include "Framework/Framework/SceneLoaderFactory.h"
+#include "Core/Utility/GTimer.h"
 
 namespace Physika
 {
@@ -48,7 +51,111 @@ void SceneGraph::advance(float dt)
 
 void SceneGraph::takeOneFrame()
 {
-	m_root->traverseTopDown<AnimateAct>();
+	if (m_frameTiming)
+	{
+		GTimer timer;
+		timer.start();
+		animateFrame();
+		timer.stop();
+		m_frameCost = timer.getEclipsedTime();
+	}
+	else
+	{
+		animateFrame();
+	}
+
+	m_frameNumber++;
+}
+
+void SceneGraph::animateFrame()
+{
+	if (!m_multiRate)
+	{
+		m_root->traverseTopDown<AnimateAct>();
+	}
+	else
+	{
+		takeMultiRateFrame();
+	}
+}
+
+void SceneGraph::takeMultiRateFrame()
+{
+	float interval = getFrameInterval();
+	float coarseDt = computeCoarseStep(m_root.get());
+	if (coarseDt <= 0.0f || coarseDt > interval)
+	{
+		coarseDt = interval;
+	}
+
+	//Split the frame evenly into coarse steps
+	int steps = (int)std::ceil(interval / coarseDt - 1e-4f);
+	steps = steps < 1 ? 1 : steps;
+	coarseDt = interval / steps;
+
+	scheduleSubsteps(m_root.get(), coarseDt);
+
+	for (int i = 0; i < steps; i++)
+	{
+		m_root->traverseTopDown<AnimateAct>();
+	}
+}
+
+float SceneGraph::computeCoarseStep(Node* node)
+{
+	float dt = node->isActive() ? node->getStableTimeStep() : 0.0f;
+
+	ListPtr<Node> children = node->getChildren();
+	for (auto iter = children.begin(); iter != children.end(); iter++)
+	{
+		dt = std::max(dt, computeCoarseStep((*iter).get()));
+	}
+
+	return dt;
+}
+
+void SceneGraph::scheduleSubsteps(Node* node, float coarseDt)
+{
+	float stableDt = node->getStableTimeStep();
+
+	if (stableDt > 0.0f)
+	{
+		int substeps = (int)std::ceil(coarseDt / stableDt - 1e-4f);
+		substeps = substeps < 1 ? 1 : substeps;
+		node->setSchedule(substeps, coarseDt / substeps);
+	}
+	else
+	{
+		//Nodes that declare no step keep their own time step rather than taking the coarse one
+		node->resetSchedule();
+	}
+
+	ListPtr<Node> children = node->getChildren();
+	for (auto iter = children.begin(); iter != children.end(); iter++)
+	{
+		scheduleSubsteps((*iter).get(), coarseDt);
+	}
+}
+
+void SceneGraph::setMultiRate(bool enabled)
+{
+	if (m_multiRate && !enabled && m_root != nullptr)
+	{
+		resetSubsteps(m_root.get());
+	}
+
+	m_multiRate = enabled;
+}
+
+void SceneGraph::resetSubsteps(Node* node)
+{
+	node->resetSchedule();
+
+	ListPtr<Node> children = node->getChildren();
+	for (auto iter = children.begin(); iter != children.end(); iter++)
+	{
+		resetSubsteps((*iter).get());
+	}
 }
 
 void SceneGraph::run()
@@ -37,10 +37,42 @@ public:
 
 	inline void setFrameRate(float frameRate) { m_frameRate = frameRate; }
 	inline float getFrameRate() { return m_frameRate; }
+	/// Device time in milliseconds taken by the last takeOneFrame(), only measured while frame timing is enabled
 	inline float getTimeCostPerFrame() { return m_frameCost; }
+	/// Timing a frame waits for the device at its end, so it is off by default
+	inline void setFrameTiming(bool enabled) { m_frameTiming = enabled; }
 	inline float getFrameInterval() { return 1.0f / m_frameRate; }
 	inline int getFrameNumber() { return m_frameNumber; }
 
+	/**
+	 * @brief Advance nodes at different rates within a frame
+	 * 
+	 * Each node declares its stable step with Node::setStableTimeStep() or by overriding Node::getStableTimeStep(),
+	 * as ParticleFluid and the elastic bodies do from the CFL condition. The coarse step is the largest declared step,
+	 * capped by the frame interval, and a node is advanced with the smallest integer number of substeps that keeps it stable.
+	 * Nodes without a declaration, e.g., coupling nodes such as SolidFluidInteraction, are advanced once per coarse step
+	 * with their own time step, so coupled data is exchanged at the coarse step. The time steps of the declaring nodes are
+	 * overwritten by the scheduler, and restored together with a single substep per node when the mode is turned off.
+	 * Parents constrain their children after each substep, see Node::constrainChild().
+	 */
+	void setMultiRate(bool enabled);
+	inline bool isMultiRate() { return m_multiRate; }
+
+	/**
+	 * @brief Make runs bit-reproducible on the same device
+	 * 
+	 * Grid hashes sort the particle ids of each cell. DensityPBD, SolidFluidInteraction and CollisionPoints gather their
+	 * neighbor sums in a fixed order instead of scattering them with atomics, see NeighborScatter. The conjugate gradient
+	 * dot products of VelocityConstraint and ImplicitViscosity are summed along the fixed tree of Reduction instead of
+	 * with atomics, see RS_SumTerms(). Reductions always use a fixed tree, and residual maxima do not depend on the order.
+	 *
+	 * Not covered yet: the atomic scatters of VelocityConstraint's pressure and velocity updates, ElasticityModule,
+	 * HyperelasticityModule and Helmholtz, so scenes using them are not reproducible.
+	 * The overhead of the mode has not been measured yet, App_PBDBenchmark reports the frame time with the mode on and off.
+	 */
+	inline void setDeterministic(bool enabled) { m_deterministic = enabled; }
+	inline bool isDeterministic() { return m_deterministic; }
+
 	void setGravity(float g);
 	float getGravity();
 
@@ -58,6 +90,9 @@ private:
 		, m_frameNumber(0)
 		, m_frameCost(0)
 		, m_initialized(false)
+		, m_multiRate(false)
+		, m_deterministic(false)
+		, m_frameTiming(false)
 		, m_lowerBound(0, 0, 0)
 		, m_upperBound(1, 1, 1)
 	{};
@@ -70,8 +105,17 @@ private:
 
 	~SceneGraph() {};
 
+	void animateFrame();
+	void takeMultiRateFrame();
+	float computeCoarseStep(Node* node);
+	void scheduleSubsteps(Node* node, float coarseDt);
+	void resetSubsteps(Node* node);
+
 private:
 	bool m_initialized;
+	bool m_multiRate;
+	bool m_deterministic;
+	bool m_frameTiming;
 
 	float m_elapsedTime;
 	float m_maxTime;
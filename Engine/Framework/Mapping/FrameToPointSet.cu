@@ -96,6 +96,9 @@ namespace Physika
 			m_initFrom->getCenter(), 
 			m_initFrom->getOrientation());
 
+		//Lets the target refit structures built over its points, e.g., the BVH of a TriangleSet
+		m_to->updateTopology();
+
 		return true;
 	}
 
@@ -1,7 +1,7 @@
 #pragma once
 #include "PointSetToPointSet.h"
 #include "Core/Utility.h"
-#include "Framework/Topology/NeighborQuery.h"
+#include "Framework/Topology/StaticKdTree.h"
 
 namespace Physika
 {
@@ -93,6 +93,9 @@ namespace Physika
 			m_neighborhood,
 			m_radius);
 
+		//Lets the target refit structures built over its points, e.g., the BVH of a TriangleSet
+		m_to->updateTopology();
+
 		return true;
 	}
 
@@ -105,11 +108,9 @@ namespace Physika
 		m_initFrom->copyFrom(*from);
 		m_initTo->copyFrom(*to);
 
-		NeighborQuery<TDataType>* nbQuery = new NeighborQuery<TDataType>(m_initFrom->getPoints());
-
-		m_neighborhood.resize(m_initTo->getPoints().size());
-		nbQuery->queryParticleNeighbors(m_neighborhood, m_initTo->getPoints(), m_radius);
-
-		delete nbQuery;
+		//The initial configuration never changes, a static kd-tree avoids hashing it through a grid
+		StaticKdTree<TDataType> kdTree;
+		kdTree.construct(m_initFrom->getPoints());
+		kdTree.queryRadius(m_neighborhood, m_initTo->getPoints(), m_radius);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#pragma once
+#include <thrust/copy.h>
+#include <thrust/execution_policy.h>
+#include <thrust/device_ptr.h>
+#include <thrust/iterator/counting_iterator.h>
+#include "Core/DataTypes.h"
+#include "Core/Utility.h"
+#include "Core/Array/Array.h"
+#include "Framework/Topology/GridHash.h"
+
+namespace Physika {
+
+	#define CELL_BLOCK_TILE 256
+
+	/*!
+	*	\class	CellBlock
+	*	\brief	Cell-blocked scheduling for gather kernels over a GridHash.
+	*
+	*	Each thread block takes one non-empty cell, loads the particles of the surrounding stencil into a shared-memory tile
+	*	once and evaluates every particle of the cell against the tile. Positions of a neighboring cell are therefore fetched
+	*	once per cell rather than once per particle. Stencils holding more than CELL_BLOCK_TILE particles are processed in chunks.
+	*
+	*	A gather functor provides
+	*		typedef ... AccType;
+	*		COMM_FUNC AccType init(int i);
+	*		COMM_FUNC void accumulate(AccType& acc, int i, int j, Coord x_ij, Real r);
+	*		COMM_FUNC void write(int i, AccType& acc);
+	*	where accumulate() is called for all pairs with r < h, including i == j.
+	*
+	*	This header contains kernels and should only be included from .cu files.
+	*/
+	template<typename TDataType>
+	class CellBlock
+	{
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+
+		CellBlock() {};
+		~CellBlock() { release(); };
+
+		/*!
+		*	\brief	Collect non-empty cells of a hash, must be called whenever the hash is reconstructed.
+		*/
+		void update(GridHash<TDataType>& hash);
+
+		template<typename Function>
+		void gather(GridHash<TDataType>& hash, DeviceArray<Coord>& pos, Function func, Real h);
+
+		int getCellNum() { return m_cellNum; }
+
+		void release() { m_cells.release(); m_cellNum = 0; }
+
+	private:
+		DeviceArray<int> m_cells;
+		int m_cellNum = 0;
+	};
+
+	template<typename TDataType>
+	struct CB_NonEmptyCell
+	{
+		GridHash<TDataType> hash;
+
+		GPU_FUNC bool operator()(const int gId)
+		{
+			return hash.getCounter(gId) > 0;
+		}
+	};
+
+	template<typename Real, typename Coord, typename TDataType, typename Function>
+	__global__ void K_CellBlockGather(
+		DeviceArray<int> cells,
+		GridHash<TDataType> hash,
+		DeviceArray<Coord> posArr,
+		Function func,
+		Real h)
+	{
+		__shared__ int nbrCell[27];
+		__shared__ int nbrStart[28];
+		__shared__ int tileId[CELL_BLOCK_TILE];
+		__shared__ Real tilePos[CELL_BLOCK_TILE][3];
+
+		int cId = cells[blockIdx.x];
+		int tId = threadIdx.x;
+
+		if (tId == 0)
+		{
+			int i = cId % hash.nx;
+			int j = (cId / hash.nx) % hash.ny;
+			int k = cId / (hash.nx*hash.ny);
+
+			nbrStart[0] = 0;
+			for (int c = 0; c < 27; c++)
+			{
+				int gId = hash.getIndex(i + c % 3 - 1, j + (c / 3) % 3 - 1, k + c / 9 - 1);
+				nbrCell[c] = gId;
+				nbrStart[c + 1] = nbrStart[c] + (gId == INVALID ? 0 : hash.getCounter(gId));
+			}
+		}
+		__syncthreads();
+
+		int nbrTotal = nbrStart[27];
+		int nCenter = hash.getCounter(cId);
+
+		for (int base = 0; base < nCenter; base += blockDim.x)
+		{
+			bool active = base + tId < nCenter;
+			int pId = active ? hash.getParticleId(cId, base + tId) : 0;
+			Coord pos_i = active ? posArr[pId] : Coord(0);
+			typename Function::AccType acc = func.init(pId);
+
+			for (int chunk = 0; chunk < nbrTotal; chunk += CELL_BLOCK_TILE)
+			{
+				int chunkSize = min(CELL_BLOCK_TILE, nbrTotal - chunk);
+				for (int t = tId; t < chunkSize; t += blockDim.x)
+				{
+					int flat = chunk + t;
+					int c = 0;
+					while (nbrStart[c + 1] <= flat) c++;
+
+					int j = hash.getParticleId(nbrCell[c], flat - nbrStart[c]);
+					Coord pos_j = posArr[j];
+					tileId[t] = j;
+					for (int d = 0; d < Coord::dims(); d++)
+					{
+						tilePos[t][d] = pos_j[d];
+					}
+				}
+				__syncthreads();
+
+				if (active)
+				{
+					for (int t = 0; t < chunkSize; t++)
+					{
+						Coord pos_j(0);
+						for (int d = 0; d < Coord::dims(); d++)
+						{
+							pos_j[d] = tilePos[t][d];
+						}
+
+						Coord x_ij = pos_i - pos_j;
+						Real r = x_ij.norm();
+						if (r < h)
+						{
+							func.accumulate(acc, pId, tileId[t], x_ij, r);
+						}
+					}
+				}
+				__syncthreads();
+			}
+
+			if (active)
+			{
+				func.write(pId, acc);
+			}
+		}
+	}
+
+	template<typename TDataType>
+	void CellBlock<TDataType>::update(GridHash<TDataType>& hash)
+	{
+		if (m_cells.size() != hash.num)
+		{
+			m_cells.resize(hash.num);
+		}
+
+		CB_NonEmptyCell<TDataType> pred;
+		pred.hash = hash;
+
+		thrust::device_ptr<int> cellPtr(m_cells.getDataPtr());
+		thrust::device_ptr<int> cellEnd = thrust::copy_if(
+			thrust::device,
+			thrust::counting_iterator<int>(0),
+			thrust::counting_iterator<int>(hash.num),
+			cellPtr,
+			pred);
+
+		m_cellNum = cellEnd - cellPtr;
+	}
+
+	template<typename TDataType>
+	template<typename Function>
+	void CellBlock<TDataType>::gather(GridHash<TDataType>& hash, DeviceArray<Coord>& pos, Function func, Real h)
+	{
+		if (m_cellNum <= 0) return;
+
+		K_CellBlockGather <Real, Coord> << <m_cellNum, BLOCK_SIZE >> > (m_cells, hash, pos, func, h);
+		cuSynchronize();
+	}
+}
@@ -0,0 +1,296 @@
+#include <thrust/reduce.h>
+#include <thrust/scan.h>
+#include <thrust/count.h>
+#include <thrust/sort.h>
+#include <thrust/sequence.h>
+#include <thrust/binary_search.h>
+#include <thrust/execution_policy.h>
+#include <thrust/iterator/counting_iterator.h>
+#include "GraphColoring.h"
+#include "Core/Utility.h"
+
+namespace Physika
+{
+	#define UNCOLORED -1
+
+	/*!
+	*	\brief	Pseudo-random vertex priority, ties are broken by vertex index.
+	*/
+	__device__ inline bool GC_Prior(int i, int j)
+	{
+		unsigned int hi = (unsigned int)i;
+		unsigned int hj = (unsigned int)j;
+		hi = (hi ^ 61) ^ (hi >> 16); hi *= 9; hi = hi ^ (hi >> 4); hi *= 0x27d4eb2d; hi = hi ^ (hi >> 15);
+		hj = (hj ^ 61) ^ (hj >> 16); hj *= 9; hj = hj ^ (hj >> 4); hj *= 0x27d4eb2d; hj = hj ^ (hj >> 15);
+
+		return hi > hj || (hi == hj && i < j);
+	}
+
+	__global__ void GC_InitColors(DeviceArray<int> colors)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= colors.size()) return;
+
+		colors[pId] = UNCOLORED;
+	}
+
+	/*!
+	*	\brief	Jones-Plassmann round, an uncolored vertex takes the smallest free color
+	*			if it has the highest priority among its uncolored neighbors.
+	*/
+	__global__ void GC_AssignColors(
+		DeviceArray<int> newColors,
+		DeviceArray<int> colors,
+		NeighborList<int> graph)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= colors.size()) return;
+
+		int c_i = colors[pId];
+		newColors[pId] = c_i;
+		if (c_i != UNCOLORED) return;
+
+		int nbSize = graph.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = graph.getElement(pId, ne);
+			if (j != pId && colors[j] == UNCOLORED && GC_Prior(j, pId))
+				return;
+		}
+
+		for (int base = 0; ; base += 32)
+		{
+			unsigned int mask = 0;
+			for (int ne = 0; ne < nbSize; ne++)
+			{
+				int j = graph.getElement(pId, ne);
+				int c_j = colors[j];
+				if (j != pId && c_j >= base && c_j < base + 32)
+					mask |= 1u << (c_j - base);
+			}
+
+			if (mask != 0xffffffff)
+			{
+				newColors[pId] = base + __ffs(~mask) - 1;
+				return;
+			}
+		}
+	}
+
+	/*!
+	*	\brief	Uncolor the lower priority end of each conflicting pair.
+	*/
+	__global__ void GC_DetectConflicts(
+		DeviceArray<int> newColors,
+		DeviceArray<int> colors,
+		NeighborList<int> graph)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= colors.size()) return;
+
+		int c_i = colors[pId];
+		newColors[pId] = c_i;
+		if (c_i == UNCOLORED) return;
+
+		int nbSize = graph.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			int j = graph.getElement(pId, ne);
+			if (j != pId && colors[j] == c_i && GC_Prior(j, pId))
+			{
+				newColors[pId] = UNCOLORED;
+				return;
+			}
+		}
+	}
+
+	__global__ void GC_CountDegree(
+		DeviceArray<int> degree,
+		DeviceArray<TopologyModule::Edge> edges)
+	{
+		int eId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (eId >= edges.size()) return;
+
+		atomicAdd(&degree[edges[eId][0]], 1);
+		atomicAdd(&degree[edges[eId][1]], 1);
+	}
+
+	__global__ void GC_FillAdjacency(
+		NeighborList<int> graph,
+		DeviceArray<int> counter,
+		DeviceArray<TopologyModule::Edge> edges)
+	{
+		int eId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (eId >= edges.size()) return;
+
+		int v0 = edges[eId][0];
+		int v1 = edges[eId][1];
+
+		graph.setElement(v0, atomicAdd(&counter[v0], 1), v1);
+		graph.setElement(v1, atomicAdd(&counter[v1], 1), v0);
+	}
+
+	GraphColoring::GraphColoring()
+	{
+	}
+
+	GraphColoring::~GraphColoring()
+	{
+		release();
+	}
+
+	void GraphColoring::color(NeighborList<int>& graph)
+	{
+		int num = graph.size();
+		if (num <= 0) return;
+
+		if (m_colors.size() != num)
+		{
+			m_colors.resize(num);
+			m_colorsBuf.resize(num);
+		}
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+		GC_InitColors << <pDims, BLOCK_SIZE >> > (m_colors);
+		cuSynchronize();
+
+		m_roundNum = 0;
+		resolve(graph);
+		buildClasses();
+	}
+
+	void GraphColoring::color(DeviceArray<Edge>& edges, int vertexNum)
+	{
+		buildGraph(edges, vertexNum);
+		color(m_edgeGraph);
+	}
+
+	void GraphColoring::recolor(NeighborList<int>& graph)
+	{
+		int num = graph.size();
+		if (num <= 0) return;
+
+		if (m_colors.size() != num)
+		{
+			color(graph);
+			return;
+		}
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+		GC_DetectConflicts << <pDims, BLOCK_SIZE >> > (m_colorsBuf, m_colors, graph);
+		cuSynchronize();
+		m_colors.Swap(m_colorsBuf);
+
+		m_roundNum = 0;
+		resolve(graph);
+		buildClasses();
+	}
+
+	void GraphColoring::recolor(DeviceArray<Edge>& edges, int vertexNum)
+	{
+		buildGraph(edges, vertexNum);
+		recolor(m_edgeGraph);
+	}
+
+	void GraphColoring::resolve(NeighborList<int>& graph)
+	{
+		int num = m_colors.size();
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+
+		int uncolored = thrust::count(thrust::device, m_colors.getDataPtr(), m_colors.getDataPtr() + num, UNCOLORED);
+		while (uncolored > 0)
+		{
+			GC_AssignColors << <pDims, BLOCK_SIZE >> > (m_colorsBuf, m_colors, graph);
+			cuSynchronize();
+			m_colors.Swap(m_colorsBuf);
+
+			uncolored = thrust::count(thrust::device, m_colors.getDataPtr(), m_colors.getDataPtr() + num, UNCOLORED);
+			m_roundNum++;
+		}
+	}
+
+	void GraphColoring::buildGraph(DeviceArray<Edge>& edges, int vertexNum)
+	{
+		if (m_edgeGraph.size() != vertexNum)
+		{
+			m_edgeGraph.resize(vertexNum);
+			m_counter.resize(vertexNum);
+		}
+
+		DeviceArray<int>& index = m_edgeGraph.getIndex();
+		index.reset();
+
+		if (edges.size() <= 0)
+		{
+			m_edgeGraph.getElements().release();
+			return;
+		}
+
+		cuint eDims = cudaGridSize(edges.size(), BLOCK_SIZE);
+		GC_CountDegree << <eDims, BLOCK_SIZE >> > (index, edges);
+		cuSynchronize();
+
+		int total = thrust::reduce(thrust::device, index.getDataPtr(), index.getDataPtr() + index.size(), (int)0, thrust::plus<int>());
+		thrust::exclusive_scan(thrust::device, index.getDataPtr(), index.getDataPtr() + index.size(), index.getDataPtr());
+
+		DeviceArray<int>& elements = m_edgeGraph.getElements();
+		if (elements.size() != total)
+		{
+			elements.resize(total);
+		}
+
+		m_counter.reset();
+		GC_FillAdjacency << <eDims, BLOCK_SIZE >> > (m_edgeGraph, m_counter, edges);
+		cuSynchronize();
+	}
+
+	void GraphColoring::buildClasses()
+	{
+		int num = m_colors.size();
+
+		m_colorNum = thrust::reduce(thrust::device, m_colors.getDataPtr(), m_colors.getDataPtr() + num, (int)UNCOLORED, thrust::maximum<int>()) + 1;
+
+		if (m_order.size() != num)
+		{
+			m_order.resize(num);
+		}
+
+		thrust::sequence(thrust::device, m_order.getDataPtr(), m_order.getDataPtr() + num);
+		Function1Pt::copy(m_colorsBuf, m_colors);
+		thrust::stable_sort_by_key(thrust::device, m_colorsBuf.getDataPtr(), m_colorsBuf.getDataPtr() + num, m_order.getDataPtr());
+
+		DeviceArray<int> offset(m_colorNum + 1);
+		thrust::lower_bound(thrust::device,
+			m_colorsBuf.getDataPtr(), m_colorsBuf.getDataPtr() + num,
+			thrust::counting_iterator<int>(0), thrust::counting_iterator<int>(m_colorNum + 1),
+			offset.getDataPtr());
+
+		m_offset.resize(m_colorNum + 1);
+		cudaMemcpy(m_offset.data(), offset.getDataPtr(), (m_colorNum + 1) * sizeof(int), cudaMemcpyDeviceToHost);
+		offset.release();
+	}
+
+	float GraphColoring::getBalance()
+	{
+		if (m_colorNum <= 0) return 1.0f;
+
+		int maxSize = 0;
+		for (int c = 0; c < m_colorNum; c++)
+		{
+			maxSize = getColorSize(c) > maxSize ? getColorSize(c) : maxSize;
+		}
+
+		return maxSize * m_colorNum / (float)m_colors.size();
+	}
+
+	void GraphColoring::release()
+	{
+		m_colors.release();
+		m_colorsBuf.release();
+		m_order.release();
+		m_counter.release();
+		m_edgeGraph.release();
+		m_offset.clear();
+		m_colorNum = 0;
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include "Core/Platform.h"
+#include "Core/Array/Array.h"
+#include "Framework/Topology/NeighborList.h"
+#include "Framework/Framework/ModuleTopology.h"
+
+namespace Physika {
+
+	/*!
+	*	\class	GraphColoring
+	*	\brief	Partition the vertices of a graph into independent sets, i.e., no two adjacent vertices share a color.
+	*
+	*	Vertices of the same color can be processed in parallel without write conflicts, which allows Gauss-Seidel style sweeps
+	*	instead of Jacobi iterations with atomic scatters. Colors are assigned greedily and speculatively on the GPU,
+	*	conflicts are resolved in favor of the vertex with the higher priority, a fixed hash of its index with ties going
+	*	to the smaller index, so the result is deterministic.
+	*
+	*	Self references in a neighbor list are ignored.
+	*/
+	class GraphColoring
+	{
+	public:
+		typedef TopologyModule::Edge Edge;
+
+		GraphColoring();
+		~GraphColoring();
+
+		/*!
+		*	\brief	Color a graph from scratch.
+		*/
+		void color(NeighborList<int>& graph);
+		void color(DeviceArray<Edge>& edges, int vertexNum);
+
+		/*!
+		*	\brief	Keep valid colors from the last call and only recolor conflicting vertices,
+		*			falls back to a full coloring if the number of vertices changes.
+		*/
+		void recolor(NeighborList<int>& graph);
+		void recolor(DeviceArray<Edge>& edges, int vertexNum);
+
+		/*!
+		*	\brief	Colors of all vertices
+		*/
+		DeviceArray<int>& getColors() { return m_colors; }
+
+		/*!
+		*	\brief	Vertex ids sorted by color, vertices of color c are stored in [getColorOffset(c), getColorOffset(c) + getColorSize(c))
+		*/
+		DeviceArray<int>& getOrder() { return m_order; }
+
+		int getColorNum() { return m_colorNum; }
+		int getColorOffset(int c) { return m_offset[c]; }
+		int getColorSize(int c) { return m_offset[c + 1] - m_offset[c]; }
+
+		/*!
+		*	\brief	Ratio between the largest color class and the average class size, 1 means perfectly balanced.
+		*/
+		float getBalance();
+
+		/*!
+		*	\brief	Number of speculative rounds taken by the last call
+		*/
+		int getRoundNum() { return m_roundNum; }
+
+		void release();
+
+	private:
+		void buildGraph(DeviceArray<Edge>& edges, int vertexNum);
+		void resolve(NeighborList<int>& graph);
+		void buildClasses();
+
+		int m_colorNum = 0;
+		int m_roundNum = 0;
+
+		std::vector<int> m_offset;
+
+		DeviceArray<int> m_colors;
+		DeviceArray<int> m_colorsBuf;
+		DeviceArray<int> m_order;
+		DeviceArray<int> m_counter;
+
+		NeighborList<int> m_edgeGraph;
+	};
+}
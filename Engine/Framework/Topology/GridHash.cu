@@ -1,5 +1,6 @@
 #include "GridHash.h"
 #include "Core/Utility.h"
+#include "Framework/Framework/SceneGraph.h"
 
 namespace Physika{
 
@@ -94,6 +95,30 @@ namespace Physika{
 		hash.ids[hash.index[gId] + index] = pId;
 	}
 
+	/*!
+	*	\brief	Sort the ids of each cell, their order otherwise depends on the order in which threads have been scheduled.
+	*/
+	template<typename TDataType>
+	__global__ void K_SortCellIds(GridHash<TDataType> hash)
+	{
+		int gId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (gId >= hash.num) return;
+
+		int* cellIds = hash.ids + hash.index[gId];
+		int n = hash.getCounter(gId);
+		for (int i = 1; i < n; i++)
+		{
+			int id = cellIds[i];
+			int j = i - 1;
+			while (j >= 0 && cellIds[j] > id)
+			{
+				cellIds[j + 1] = cellIds[j];
+				j--;
+			}
+			cellIds[j + 1] = id;
+		}
+	}
+
 	template<typename TDataType>
 	void GridHash<TDataType>::construct(DeviceArray<Coord>& pos)
 	{
@@ -114,6 +139,12 @@ namespace Physika{
 //		std::cout << "Particle number: " << particle_num << std::endl;
 
 		K_ConstructHashTable << <pDims, BLOCK_SIZE >> > (*this, pos);
+
+		if (SceneGraph::getInstance().isDeterministic())
+		{
+			uint cDims = cudaGridSize(num, BLOCK_SIZE);
+			K_SortCellIds << <cDims, BLOCK_SIZE >> > (*this);
+		}
 		cuSynchronize();
 	}
 
@@ -129,11 +160,14 @@ namespace Physika{
 	{
 		if (counter != nullptr)
 			cuSafeCall(cudaFree(counter));
+		counter = nullptr;
 		
 		if (ids != nullptr)
 			cuSafeCall(cudaFree(ids));
+		ids = nullptr;
 
 		if (index != nullptr)
 			cuSafeCall(cudaFree(index));
+		index = nullptr;
 	}
 }
\ No newline at end of file
@@ -22,6 +22,9 @@ namespace Physika{
 
 		void setSpace(Real _h, Coord _lo, Coord _hi);
 
+		/*!
+		*	\brief	Ids within a cell are sorted in deterministic mode, see SceneGraph::setDeterministic().
+		*/
 		void construct(DeviceArray<Coord>& pos);
 
 		void clear();
@@ -59,6 +59,13 @@ namespace Physika
 				return m_elements[m_maxNum*i + j];
 		};
 
+		/*!
+		*	\brief	Position of the j-th neighbor of i in getElements()
+		*/
+		GPU_FUNC int getElementIndex(int i, int j) {
+			return isLimited() ? m_maxNum*i + j : m_index[i] + j;
+		}
+
 		GPU_FUNC void setElement(int i, int j, ElementType elem) {
 			if (!isLimited())
 				m_elements[m_index[i] + j] = elem;
@@ -37,6 +37,15 @@ namespace Physika
 		-1, -1, -1
 	};
 
+	/*!
+	*	\brief	With per-particle radii two particles are neighbors within the larger one, keeping the lists symmetric.
+	*/
+	template<typename Real>
+	__device__ inline Real NQ_SupportRadius(Real h, DeviceArray<Real>& radius, bool hasRadius, int i, int j)
+	{
+		return hasRadius ? max(radius[i], radius[j]) : h;
+	}
+
 	template<typename TDataType>
 	NeighborQuery<TDataType>::NeighborQuery()
 		: ComputeModule()
@@ -120,16 +129,42 @@ namespace Physika
 	template<typename TDataType>
 	void NeighborQuery<TDataType>::compute()
 	{
+		//No particles are left, the lists keep their last size until particles are emitted again
+		if (m_position.getElementCount() == 0)
+			return;
+
+		//Particles were emitted or removed, the lists are rebuilt below anyway
+		NeighborList<int>& nbr = m_neighborhood.getValue();
+		if (nbr.size() != m_position.getElementCount())
+		{
+			nbr.resize(m_position.getElementCount(), nbr.getNeighborLimit());
+		}
+
+		//Cells must cover the largest support radius, they are only ever enlarged
+		bool useRadius = !m_particleRadius.isEmpty() && m_particleRadius.getElementCount() == m_position.getElementCount();
+		if (useRadius)
+		{
+			DeviceArray<Real>& radius = m_particleRadius.getValue();
+			Reduction<Real>* pReduce = Reduction<Real>::Create(radius.size());
+			Real maxRadius = pReduce->Maximum(radius.getDataPtr(), radius.size());
+			delete pReduce;
+
+			if (maxRadius > m_hash.ds)
+			{
+				m_hash.setSpace(maxRadius, m_lowBound, m_highBound);
+			}
+		}
+
 		m_hash.clear();
 		m_hash.construct(m_position.getValue());
 
 		if (!m_neighborhood.getValue().isLimited())
 		{
-			queryNeighborDynamic(m_neighborhood.getValue(), m_position.getValue(), m_radius.getValue());
+			queryNeighborDynamic(m_neighborhood.getValue(), m_position.getValue(), m_radius.getValue(), useRadius);
 		}
 		else
 		{
-			queryNeighborFixed(m_neighborhood.getValue(), m_position.getValue(), m_radius.getValue());
+			queryNeighborFixed(m_neighborhood.getValue(), m_position.getValue(), m_radius.getValue(), useRadius);
 		}
 	}
 
@@ -157,16 +192,39 @@ namespace Physika
 		}
 	}
 
+	template<typename TDataType>
+	void NeighborQuery<TDataType>::queryNeighbors(NeighborList<int>& nbr, DeviceArray<Coord>& pos)
+	{
+		if (pos.size() <= 0)
+			return;
+
+		if (nbr.size() != pos.size())
+		{
+			nbr.resize(pos.size(), nbr.getNeighborLimit());
+		}
+
+		if (!nbr.isLimited())
+		{
+			queryNeighborDynamic(nbr, pos, m_radius.getValue());
+		}
+		else
+		{
+			queryNeighborFixed(nbr, pos, m_radius.getValue());
+		}
+	}
+
 	template<typename Real, typename Coord, typename TDataType>
 	__global__ void K_CalNeighborSize(
 		DeviceArray<int> count,
 		DeviceArray<Coord> position_new,
 		DeviceArray<Coord> position, 
 		GridHash<TDataType> hash, 
-		Real h)
+		Real h,
+		DeviceArray<Real> radius,
+		bool hasRadius)
 	{
 		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId > position_new.size()) return;
+		if (pId >= position_new.size()) return;
 
 		Coord pos_ijk = position_new[pId];
 		int3 gId3 = hash.getIndex3(pos_ijk);
@@ -180,7 +238,7 @@ namespace Physika
 				for (int i = 0; i < totalNum; i++) {
 					int nbId = hash.getParticleId(cId, i);
 					Real d_ij = (pos_ijk - position[nbId]).norm();
-					if (d_ij < h)
+					if (d_ij < NQ_SupportRadius(h, radius, hasRadius, pId, nbId))
 					{
 						counter++;
 					}
@@ -197,10 +255,12 @@ namespace Physika
 		DeviceArray<Coord> position_new,
 		DeviceArray<Coord> position, 
 		GridHash<TDataType> hash, 
-		Real h)
+		Real h,
+		DeviceArray<Real> radius,
+		bool hasRadius)
 	{
 		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId > position_new.size()) return;
+		if (pId >= position_new.size()) return;
 
 		Coord pos_ijk = position_new[pId];
 		int3 gId3 = hash.getIndex3(pos_ijk);
@@ -214,7 +274,7 @@ namespace Physika
 				for (int i = 0; i < totalNum; i++) {
 					int nbId = hash.getParticleId(cId, i);
 					Real d_ij = (pos_ijk - position[nbId]).norm();
-					if (d_ij < h)
+					if (d_ij < NQ_SupportRadius(h, radius, hasRadius, pId, nbId))
 					{
 						nbr.setElement(pId, j, nbId);
 						j++;
@@ -225,19 +285,23 @@ namespace Physika
 	}
 
 	template<typename TDataType>
-	void NeighborQuery<TDataType>::queryNeighborSize(DeviceArray<int>& num, DeviceArray<Coord>& pos, Real h)
+	void NeighborQuery<TDataType>::queryNeighborSize(DeviceArray<int>& num, DeviceArray<Coord>& pos, Real h, bool useRadius)
 	{
+		DeviceArray<Real> radius;
+		if (useRadius)
+			radius = m_particleRadius.getValue();
+
 		uint pDims = cudaGridSize(num.size(), BLOCK_SIZE);
-		K_CalNeighborSize << <pDims, BLOCK_SIZE >> > (num, pos, m_position.getValue(), m_hash, h);
+		K_CalNeighborSize << <pDims, BLOCK_SIZE >> > (num, pos, m_position.getValue(), m_hash, h, radius, useRadius);
 		cuSynchronize();
 	}
 
 	template<typename TDataType>
-	void NeighborQuery<TDataType>::queryNeighborDynamic(NeighborList<int>& nbrList, DeviceArray<Coord>& pos, Real h)
+	void NeighborQuery<TDataType>::queryNeighborDynamic(NeighborList<int>& nbrList, DeviceArray<Coord>& pos, Real h, bool useRadius)
 	{
 		DeviceArray<int>& nbrNum = nbrList.getIndex();
 
-		queryNeighborSize(nbrNum, pos, h);
+		queryNeighborSize(nbrNum, pos, h, useRadius);
 
 		int sum = thrust::reduce(thrust::device, nbrNum.getDataPtr(), nbrNum.getDataPtr()+ nbrNum.size(), (int)0, thrust::plus<int>());
 		thrust::exclusive_scan(thrust::device, nbrNum.getDataPtr(), nbrNum.getDataPtr() + nbrNum.size(), nbrNum.getDataPtr());
@@ -247,10 +311,19 @@ namespace Physika
 			DeviceArray<int>& elements = nbrList.getElements();
 			elements.resize(sum);
 
+			DeviceArray<Real> radius;
+			if (useRadius)
+				radius = m_particleRadius.getValue();
+
 			uint pDims = cudaGridSize(pos.size(), BLOCK_SIZE);
-			K_GetNeighborElements << <pDims, BLOCK_SIZE >> > (nbrList, pos, m_position.getValue(), m_hash, h);
+			K_GetNeighborElements << <pDims, BLOCK_SIZE >> > (nbrList, pos, m_position.getValue(), m_hash, h, radius, useRadius);
 			cuSynchronize();
 		}
+		else
+		{
+			//No stale elements may be left, the size of the last list is derived from the element count
+			nbrList.getElements().release();
+		}
 	}
 
 	template<typename Real, typename Coord, typename TDataType>
@@ -260,11 +333,13 @@ namespace Physika
 		DeviceArray<Coord> position, 
 		GridHash<TDataType> hash, 
 		Real h,
+		DeviceArray<Real> radius,
+		bool hasRadius,
 		int* heapIDs,
 		Real* heapDistance)
 	{
 		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
-		if (pId > position_new.size()) return;
+		if (pId >= position_new.size()) return;
 
 		int nbrLimit = neighbors.getNeighborLimit();
 
@@ -283,7 +358,7 @@ namespace Physika
 				for (int i = 0; i < totalNum; i++) {
 					int nbId = hash.getParticleId(cId, i);
 					float d_ij = (pos_ijk - position[nbId]).norm();
-					if (d_ij < h)
+					if (d_ij < NQ_SupportRadius(h, radius, hasRadius, pId, nbId))
 					{
 						if (counter < nbrLimit)
 						{
@@ -324,8 +399,12 @@ namespace Physika
 	}
 
 	template<typename TDataType>
-	void NeighborQuery<TDataType>::queryNeighborFixed(NeighborList<int>& nbrList, DeviceArray<Coord>& pos, Real h)
+	void NeighborQuery<TDataType>::queryNeighborFixed(NeighborList<int>& nbrList, DeviceArray<Coord>& pos, Real h, bool useRadius)
 	{
+		DeviceArray<Real> radius;
+		if (useRadius)
+			radius = m_particleRadius.getValue();
+
 		int num = pos.size();
 		int* ids;
 		Real* distance;
@@ -339,6 +418,8 @@ namespace Physika
 			m_position.getValue(), 
 			m_hash, 
 			h, 
+			radius,
+			useRadius,
 			ids, 
 			distance);
 		cuSynchronize();
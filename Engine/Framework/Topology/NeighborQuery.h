@@ -27,18 +27,29 @@ namespace Physika {
 
 		void queryParticleNeighbors(NeighborList<int>& nbr, DeviceArray<Coord>& pos, Real radius);
 
+		/*!
+		*	\brief	Neighbors of other points among the particles hashed by the last compute(), the hash is not rebuilt.
+		*			Used to query moving particles against a static set, e.g., boundary particles.
+		*/
+		void queryNeighbors(NeighborList<int>& nbr, DeviceArray<Coord>& pos);
+
 		void setNeighborSizeLimit(int num) { m_maxNum = num; }
 
 		NeighborList<int>& getNeighborList() { return m_neighborhood.getValue(); }
 
+		/*!
+		*	\brief	The spatial hash built by the last compute(), can be used for cell-blocked gather kernels.
+		*/
+		GridHash<TDataType>& getHash() { return m_hash; }
+
 	protected:
 		bool initializeImpl() override;
 
 	private:
-		void queryNeighborSize(DeviceArray<int>& num, DeviceArray<Coord>& pos, Real h);
-		void queryNeighborDynamic(NeighborList<int>& nbrList, DeviceArray<Coord>& pos, Real h);
+		void queryNeighborSize(DeviceArray<int>& num, DeviceArray<Coord>& pos, Real h, bool useRadius = false);
+		void queryNeighborDynamic(NeighborList<int>& nbrList, DeviceArray<Coord>& pos, Real h, bool useRadius = false);
 
-		void queryNeighborFixed(NeighborList<int>& nbrList, DeviceArray<Coord>& pos, Real h);
+		void queryNeighborFixed(NeighborList<int>& nbrList, DeviceArray<Coord>& pos, Real h, bool useRadius = false);
 
 	public:
 		VarField<Real> m_radius;
@@ -46,6 +57,12 @@ namespace Physika {
 		DeviceArrayField<Coord> m_position;
 		NeighborField<int> m_neighborhood;
 
+		/*!
+		*	\brief	Optional per-particle support radii replacing m_radius in compute(), two particles are neighbors
+		*			if they are closer than the larger of their radii.
+		*/
+		DeviceArrayField<Real> m_particleRadius;
+
 	private:
 		int m_maxNum;
 
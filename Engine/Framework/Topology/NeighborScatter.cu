@@ -0,0 +1,59 @@
+#include <thrust/fill.h>
+#include <thrust/sort.h>
+#include <thrust/sequence.h>
+#include <thrust/binary_search.h>
+#include <thrust/execution_policy.h>
+#include <thrust/iterator/counting_iterator.h>
+#include "NeighborScatter.h"
+
+namespace Physika
+{
+	__global__ void NS_ComputeKeys(
+		DeviceArray<int> keys,
+		NeighborList<int> nbr)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= nbr.size()) return;
+
+		int nbSize = nbr.getNeighborSize(pId);
+		for (int ne = 0; ne < nbSize; ne++)
+		{
+			keys[nbr.getElementIndex(pId, ne)] = nbr.getElement(pId, ne);
+		}
+	}
+
+	void NeighborScatter::update(NeighborList<int>& nbr)
+	{
+		int num = nbr.size();
+		int entryNum = nbr.getElements().size();
+
+		m_keys.setSize(entryNum);
+		m_order.setSize(entryNum);
+		m_start.setSize(num + 1);
+
+		if (entryNum > 0)
+		{
+			//Unused entries of a limited list sort behind all particles
+			thrust::fill(thrust::device, m_keys.getDataPtr(), m_keys.getDataPtr() + entryNum, num);
+
+			uint pDims = cudaGridSize(num, BLOCK_SIZE);
+			NS_ComputeKeys << <pDims, BLOCK_SIZE >> > (m_keys, nbr);
+			cuSynchronize();
+
+			thrust::sequence(thrust::device, m_order.getDataPtr(), m_order.getDataPtr() + entryNum);
+			thrust::stable_sort_by_key(thrust::device, m_keys.getDataPtr(), m_keys.getDataPtr() + entryNum, m_order.getDataPtr());
+		}
+
+		thrust::lower_bound(thrust::device,
+			m_keys.getDataPtr(), m_keys.getDataPtr() + entryNum,
+			thrust::counting_iterator<int>(0), thrust::counting_iterator<int>(num + 1),
+			m_start.getDataPtr());
+	}
+
+	void NeighborScatter::release()
+	{
+		m_keys.release();
+		m_order.release();
+		m_start.release();
+	}
+}
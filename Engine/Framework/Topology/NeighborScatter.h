@@ -0,0 +1,77 @@
+#pragma once
+#include "Core/Platform.h"
+#include "Core/Utility.h"
+#include "Core/Array/Array.h"
+#include "Framework/Topology/NeighborList.h"
+
+namespace Physika {
+
+	/*!
+	*	\class	NeighborScatter
+	*	\brief	Ordered replacement for atomic scatters over a neighbor list, giving the same result on every run.
+	*
+	*	Instead of adding a value to neighbor j with atomics, a kernel stores it in the entry of j in the neighbor list,
+	*	see NeighborList::getElementIndex(). update() sorts the entries by the particle they refer to, keeping the order of
+	*	the entries referring to the same particle, and add() then sums the stored values of each particle in that order.
+	*	Floating-point sums are therefore always evaluated in the same order, at the cost of a sort per neighbor list
+	*	and a buffer of one value per entry.
+	*
+	*	This header contains kernels and should only be included from .cu files.
+	*/
+	class NeighborScatter
+	{
+	public:
+		NeighborScatter() {};
+		~NeighborScatter() { release(); };
+
+		/*!
+		*	\brief	Must be called whenever the neighbor list changes, unused entries of a limited list are skipped.
+		*/
+		void update(NeighborList<int>& nbr);
+
+		/*!
+		*	\brief	Add the values stored per entry to the particles the entries refer to, dst is not cleared.
+		*/
+		template<typename T>
+		void add(DeviceArray<T>& dst, DeviceArray<T>& entries);
+
+		/// Number of values a kernel has to store, i.e., the size of the element array of the neighbor list
+		int getEntryNum() { return m_keys.size(); }
+
+		void release();
+
+	private:
+		DeviceArray<int> m_keys;
+		DeviceArray<int> m_order;
+		DeviceArray<int> m_start;
+	};
+
+	template<typename T>
+	__global__ void NS_AddEntries(
+		DeviceArray<T> dst,
+		DeviceArray<T> entries,
+		DeviceArray<int> order,
+		DeviceArray<int> start)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= dst.size()) return;
+
+		T val = dst[pId];
+		for (int s = start[pId]; s < start[pId + 1]; s++)
+		{
+			val += entries[order[s]];
+		}
+		dst[pId] = val;
+	}
+
+	template<typename T>
+	void NeighborScatter::add(DeviceArray<T>& dst, DeviceArray<T>& entries)
+	{
+		if (m_start.size() != dst.size() + 1 || entries.size() != m_keys.size())
+			return;
+
+		uint pDims = cudaGridSize(dst.size(), BLOCK_SIZE);
+		NS_AddEntries << <pDims, BLOCK_SIZE >> > (dst, entries, m_order, m_start);
+		cuSynchronize();
+	}
+}
@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <thrust/reduce.h>
+#include <thrust/scan.h>
+#include <thrust/execution_policy.h>
+#include "StaticKdTree.h"
+#include "Core/Utility.h"
+
+namespace Physika
+{
+	#define KDTREE_STACK_SIZE 64
+	#define KDTREE_MAGIC 0x4b44544d
+
+	template<typename Real, typename Coord>
+	__global__ void KD_QueryRadius(
+		NeighborList<int> nbr,
+		DeviceArray<int> count,
+		DeviceArray<Coord> queries,
+		DeviceArray<Coord> points,
+		DeviceArray<int> ids,
+		DeviceArray<int> dims,
+		Real radius,
+		bool countOnly)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= queries.size()) return;
+
+		int n = points.size();
+		Coord q = queries[pId];
+		int num = 0;
+
+		int stack[KDTREE_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			int node = stack[--top];
+
+			Coord p = points[node];
+			if ((q - p).norm() < radius)
+			{
+				if (!countOnly)
+					nbr.setElement(pId, num, ids[node]);
+				num++;
+			}
+
+			Real diff = q[dims[node]] - p[dims[node]];
+			int nearChild = diff < Real(0) ? 2 * node + 1 : 2 * node + 2;
+			int farChild = diff < Real(0) ? 2 * node + 2 : 2 * node + 1;
+
+			if (farChild < n && abs(diff) < radius && top < KDTREE_STACK_SIZE) stack[top++] = farChild;
+			if (nearChild < n && top < KDTREE_STACK_SIZE) stack[top++] = nearChild;
+		}
+
+		if (countOnly)
+			count[pId] = num;
+	}
+
+	template<typename Real, typename Coord>
+	__global__ void KD_QueryKNN(
+		NeighborList<int> nbr,
+		DeviceArray<Coord> queries,
+		DeviceArray<Coord> points,
+		DeviceArray<int> ids,
+		DeviceArray<int> dims,
+		int k)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= queries.size()) return;
+
+		int n = points.size();
+		Coord q = queries[pId];
+
+		Real bestDist[KDTREE_MAX_K];
+		int bestId[KDTREE_MAX_K];
+		int num = 0;
+
+		int stack[KDTREE_STACK_SIZE];
+		Real bound[KDTREE_STACK_SIZE];
+		int top = 0;
+		stack[top] = 0;
+		bound[top++] = Real(0);
+		while (top > 0)
+		{
+			top--;
+			int node = stack[top];
+			if (num == k && bound[top] >= bestDist[k - 1]) continue;
+
+			Coord p = points[node];
+			Real d2 = (q - p).normSquared();
+			if (num < k || d2 < bestDist[k - 1])
+			{
+				int slot = num < k ? num++ : k - 1;
+				while (slot > 0 && bestDist[slot - 1] > d2)
+				{
+					bestDist[slot] = bestDist[slot - 1];
+					bestId[slot] = bestId[slot - 1];
+					slot--;
+				}
+				bestDist[slot] = d2;
+				bestId[slot] = ids[node];
+			}
+
+			Real diff = q[dims[node]] - p[dims[node]];
+			int nearChild = diff < Real(0) ? 2 * node + 1 : 2 * node + 2;
+			int farChild = diff < Real(0) ? 2 * node + 2 : 2 * node + 1;
+
+			if (farChild < n && top < KDTREE_STACK_SIZE)
+			{
+				stack[top] = farChild;
+				bound[top++] = diff*diff;
+			}
+			if (nearChild < n && top < KDTREE_STACK_SIZE)
+			{
+				stack[top] = nearChild;
+				bound[top++] = Real(0);
+			}
+		}
+
+		nbr.setNeighborSize(pId, num);
+		for (int i = 0; i < num; i++)
+		{
+			nbr.setElement(pId, i, bestId[i]);
+		}
+	}
+
+	/*!
+	*	\brief	Size of the left subtree of a left-balanced tree with m nodes.
+	*/
+	inline int KD_LeftSubtreeSize(int m)
+	{
+		if (m <= 1) return 0;
+
+		int h = 0;
+		while ((2 << h) <= m) h++;
+
+		int lastLevel = m - ((1 << h) - 1);
+		int halfLast = 1 << (h - 1);
+
+		return (halfLast - 1) + (lastLevel < halfLast ? lastLevel : halfLast);
+	}
+
+	template<typename Real, typename Coord>
+	void KD_Build(
+		std::vector<Coord>& treePoints,
+		std::vector<int>& treeIds,
+		std::vector<int>& treeDims,
+		std::vector<Coord>& points,
+		std::vector<int>& perm,
+		int node, int begin, int end)
+	{
+		if (begin >= end) return;
+
+		Coord lo = points[perm[begin]];
+		Coord hi = lo;
+		for (int i = begin + 1; i < end; i++)
+		{
+			Coord p = points[perm[i]];
+			for (int d = 0; d < Coord::dims(); d++)
+			{
+				lo[d] = std::min(lo[d], p[d]);
+				hi[d] = std::max(hi[d], p[d]);
+			}
+		}
+
+		int dim = 0;
+		for (int d = 1; d < Coord::dims(); d++)
+		{
+			if (hi[d] - lo[d] > hi[dim] - lo[dim]) dim = d;
+		}
+
+		int mid = begin + KD_LeftSubtreeSize(end - begin);
+		std::nth_element(perm.begin() + begin, perm.begin() + mid, perm.begin() + end,
+			[&](int a, int b) { return points[a][dim] < points[b][dim]; });
+
+		treePoints[node] = points[perm[mid]];
+		treeIds[node] = perm[mid];
+		treeDims[node] = dim;
+
+		KD_Build<Real, Coord>(treePoints, treeIds, treeDims, points, perm, 2 * node + 1, begin, mid);
+		KD_Build<Real, Coord>(treePoints, treeIds, treeDims, points, perm, 2 * node + 2, mid + 1, end);
+	}
+
+	template<typename TDataType>
+	StaticKdTree<TDataType>::StaticKdTree()
+	{
+	}
+
+	template<typename TDataType>
+	StaticKdTree<TDataType>::~StaticKdTree()
+	{
+		release();
+	}
+
+	template<typename TDataType>
+	void StaticKdTree<TDataType>::construct(DeviceArray<Coord>& points)
+	{
+		std::vector<Coord> hPoints(points.size());
+		cudaMemcpy(hPoints.data(), points.getDataPtr(), points.size() * sizeof(Coord), cudaMemcpyDeviceToHost);
+
+		construct(hPoints);
+	}
+
+	template<typename TDataType>
+	void StaticKdTree<TDataType>::construct(std::vector<Coord>& points)
+	{
+		m_nodeNum = points.size();
+
+		m_hPoints.resize(m_nodeNum);
+		m_hIds.resize(m_nodeNum);
+		m_hDims.resize(m_nodeNum);
+
+		std::vector<int> perm(m_nodeNum);
+		for (int i = 0; i < m_nodeNum; i++)
+		{
+			perm[i] = i;
+		}
+
+		KD_Build<Real, Coord>(m_hPoints, m_hIds, m_hDims, points, perm, 0, 0, m_nodeNum);
+
+		upload();
+	}
+
+	template<typename TDataType>
+	void StaticKdTree<TDataType>::upload()
+	{
+		if (m_nodeNum <= 0) return;
+
+		if (m_points.size() != m_nodeNum)
+		{
+			m_points.resize(m_nodeNum);
+			m_ids.resize(m_nodeNum);
+			m_dims.resize(m_nodeNum);
+		}
+
+		Function1Pt::copy(m_points, m_hPoints);
+		Function1Pt::copy(m_ids, m_hIds);
+		Function1Pt::copy(m_dims, m_hDims);
+	}
+
+	template<typename TDataType>
+	void StaticKdTree<TDataType>::queryRadius(NeighborList<int>& nbr, DeviceArray<Coord>& queries, Real radius)
+	{
+		int num = queries.size();
+		if (num <= 0) return;
+
+		if (nbr.size() != num)
+		{
+			nbr.resize(num);
+		}
+		nbr.setDynamic();
+
+		DeviceArray<int>& index = nbr.getIndex();
+		if (m_nodeNum <= 0)
+		{
+			index.reset();
+			nbr.getElements().release();
+			return;
+		}
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+		KD_QueryRadius << <pDims, BLOCK_SIZE >> > (nbr, index, queries, m_points, m_ids, m_dims, radius, true);
+		cuSynchronize();
+
+		int sum = thrust::reduce(thrust::device, index.getDataPtr(), index.getDataPtr() + index.size(), (int)0, thrust::plus<int>());
+		thrust::exclusive_scan(thrust::device, index.getDataPtr(), index.getDataPtr() + index.size(), index.getDataPtr());
+
+		if (sum > 0)
+		{
+			DeviceArray<int>& elements = nbr.getElements();
+			if (elements.size() != sum)
+			{
+				elements.resize(sum);
+			}
+
+			KD_QueryRadius << <pDims, BLOCK_SIZE >> > (nbr, index, queries, m_points, m_ids, m_dims, radius, false);
+			cuSynchronize();
+		}
+		else
+		{
+			nbr.getElements().release();
+		}
+	}
+
+	template<typename TDataType>
+	void StaticKdTree<TDataType>::queryKNN(NeighborList<int>& nbr, DeviceArray<Coord>& queries, int k)
+	{
+		int num = queries.size();
+		if (num <= 0) return;
+
+		k = k < KDTREE_MAX_K ? k : KDTREE_MAX_K;
+		k = k < m_nodeNum ? k : m_nodeNum;
+		if (k <= 0) return;
+
+		if (nbr.size() != num || nbr.getNeighborLimit() != k)
+		{
+			nbr.resize(num, k);
+		}
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+		KD_QueryKNN << <pDims, BLOCK_SIZE >> > (nbr, queries, m_points, m_ids, m_dims, k);
+		cuSynchronize();
+	}
+
+	template<typename TDataType>
+	bool StaticKdTree<TDataType>::write(std::ostream& out)
+	{
+		int header[4] = { KDTREE_MAGIC, Coord::dims(), (int)sizeof(Real), m_nodeNum };
+		out.write((const char*)header, sizeof(header));
+		out.write((const char*)m_hPoints.data(), m_nodeNum * sizeof(Coord));
+		out.write((const char*)m_hIds.data(), m_nodeNum * sizeof(int));
+		out.write((const char*)m_hDims.data(), m_nodeNum * sizeof(int));
+
+		return out.good();
+	}
+
+	template<typename TDataType>
+	bool StaticKdTree<TDataType>::read(std::istream& in)
+	{
+		int header[4];
+		in.read((char*)header, sizeof(header));
+		if (!in.good() || header[0] != KDTREE_MAGIC || header[1] != Coord::dims() || header[2] != (int)sizeof(Real))
+		{
+			std::cout << "Exception: " << std::string("StaticKdTree: incompatible kd-tree data!") << "\n";
+			return false;
+		}
+
+		m_nodeNum = header[3];
+		m_hPoints.resize(m_nodeNum);
+		m_hIds.resize(m_nodeNum);
+		m_hDims.resize(m_nodeNum);
+
+		in.read((char*)m_hPoints.data(), m_nodeNum * sizeof(Coord));
+		in.read((char*)m_hIds.data(), m_nodeNum * sizeof(int));
+		in.read((char*)m_hDims.data(), m_nodeNum * sizeof(int));
+		if (!in.good())
+		{
+			std::cout << "Exception: " << std::string("StaticKdTree: truncated kd-tree data!") << "\n";
+			m_nodeNum = 0;
+			return false;
+		}
+
+		upload();
+		return true;
+	}
+
+	template<typename TDataType>
+	void StaticKdTree<TDataType>::release()
+	{
+		m_points.release();
+		m_ids.release();
+		m_dims.release();
+
+		m_hPoints.clear();
+		m_hIds.clear();
+		m_hDims.clear();
+		m_nodeNum = 0;
+	}
+}
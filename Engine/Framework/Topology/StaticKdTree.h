@@ -0,0 +1,73 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include "Core/DataTypes.h"
+#include "Core/Platform.h"
+#include "Core/Array/Array.h"
+#include "Framework/Topology/NeighborList.h"
+
+namespace Physika
+{
+	#define KDTREE_MAX_K 32
+
+	/*!
+	*	\class	StaticKdTree
+	*	\brief	A kd-tree for point sets that do not move, e.g., boundary samples and rest configurations.
+	*
+	*	The tree is built once on the host and stored implicitly in left-balanced order, node i has its children at 2i + 1 and 2i + 2,
+	*	so no child pointers are stored and nodes of the upper levels are contiguous in memory.
+	*	Each node keeps its point, the original point id and the split dimension.
+	*/
+	template<typename TDataType>
+	class StaticKdTree
+	{
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+
+		StaticKdTree();
+		~StaticKdTree();
+
+		void construct(DeviceArray<Coord>& points);
+		void construct(std::vector<Coord>& points);
+
+		/*!
+		*	\brief	Collect ids of all points within radius of each query point.
+		*/
+		void queryRadius(NeighborList<int>& nbr, DeviceArray<Coord>& queries, Real radius);
+
+		/*!
+		*	\brief	Collect ids of the k nearest points for each query point, sorted by distance, k is clamped to KDTREE_MAX_K.
+		*/
+		void queryKNN(NeighborList<int>& nbr, DeviceArray<Coord>& queries, int k);
+
+		int size() { return m_nodeNum; }
+
+		/*!
+		*	\brief	Binary serialization of the built tree, a loaded tree can be queried without rebuilding.
+		*/
+		bool write(std::ostream& out);
+		bool read(std::istream& in);
+
+		void release();
+
+	private:
+		void upload();
+
+		int m_nodeNum = 0;
+
+		std::vector<Coord> m_hPoints;
+		std::vector<int> m_hIds;
+		std::vector<int> m_hDims;
+
+		DeviceArray<Coord> m_points;
+		DeviceArray<int> m_ids;
+		DeviceArray<int> m_dims;
+	};
+
+#ifdef PRECISION_FLOAT
+	template class StaticKdTree<DataType3f>;
+#else
+	template class StaticKdTree<DataType3d>;
+#endif
+}
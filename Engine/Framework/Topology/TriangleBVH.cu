@@ -0,0 +1,646 @@
+#include <limits>
+#include <thrust/sort.h>
+#include <thrust/reduce.h>
+#include <thrust/scan.h>
+#include <thrust/execution_policy.h>
+#include "TriangleBVH.h"
+#include "Core/Utility.h"
+#include "Framework/Framework/Log.h"
+
+namespace Physika
+{
+	#define BVH_STACK_SIZE 64
+
+	template<typename Coord>
+	struct BVH_MergeBox
+	{
+		COMM_FUNC BVHBox<Coord> operator()(const BVHBox<Coord>& a, const BVHBox<Coord>& b) const
+		{
+			return a.merge(b);
+		}
+	};
+
+	template<typename Real, typename Coord>
+	COMM_FUNC Real BVH_BoxDistanceSquared(const BVHBox<Coord>& box, const Coord& p)
+	{
+		Real d2 = Real(0);
+		for (int d = 0; d < 3; d++)
+		{
+			Real v = p[d] < box.lo[d] ? box.lo[d] - p[d] : (p[d] > box.hi[d] ? p[d] - box.hi[d] : Real(0));
+			d2 += v*v;
+		}
+		return d2;
+	}
+
+	/*!
+	*	\brief	Closest point on a triangle, see Ericson, "Real-Time Collision Detection", section 5.1.5.
+	*/
+	template<typename Real, typename Coord>
+	COMM_FUNC Coord BVH_ClosestPointOnTriangle(const Coord& p, const Coord& a, const Coord& b, const Coord& c)
+	{
+		Coord ab = b - a;
+		Coord ac = c - a;
+		Coord ap = p - a;
+		Real d1 = ab.dot(ap);
+		Real d2 = ac.dot(ap);
+		if (d1 <= Real(0) && d2 <= Real(0)) return a;
+
+		Coord bp = p - b;
+		Real d3 = ab.dot(bp);
+		Real d4 = ac.dot(bp);
+		if (d3 >= Real(0) && d4 <= d3) return b;
+
+		Real vc = d1*d4 - d3*d2;
+		if (vc <= Real(0) && d1 >= Real(0) && d3 <= Real(0))
+			return a + ab*(d1 / (d1 - d3));
+
+		Coord cp = p - c;
+		Real d5 = ab.dot(cp);
+		Real d6 = ac.dot(cp);
+		if (d6 >= Real(0) && d5 <= d6) return c;
+
+		Real vb = d5*d2 - d1*d6;
+		if (vb <= Real(0) && d2 >= Real(0) && d6 <= Real(0))
+			return a + ac*(d2 / (d2 - d6));
+
+		Real va = d3*d6 - d5*d4;
+		if (va <= Real(0) && (d4 - d3) >= Real(0) && (d5 - d6) >= Real(0))
+			return b + (c - b)*((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+		Real denom = Real(1) / (va + vb + vc);
+		return a + ab*(vb*denom) + ac*(vc*denom);
+	}
+
+	/*!
+	*	\brief	Moller-Trumbore ray triangle intersection, returns a negative value on miss.
+	*/
+	template<typename Real, typename Coord>
+	COMM_FUNC Real BVH_RayTriangle(const Coord& o, const Coord& dir, const Coord& a, const Coord& b, const Coord& c)
+	{
+		Coord e1 = b - a;
+		Coord e2 = c - a;
+		Coord p = dir.cross(e2);
+		Real det = e1.dot(p);
+		if (abs(det) < EPSILON) return Real(-1);
+
+		Real invDet = Real(1) / det;
+		Coord s = o - a;
+		Real u = s.dot(p)*invDet;
+		if (u < Real(0) || u > Real(1)) return Real(-1);
+
+		Coord q = s.cross(e1);
+		Real v = dir.dot(q)*invDet;
+		if (v < Real(0) || u + v > Real(1)) return Real(-1);
+
+		return e2.dot(q)*invDet;
+	}
+
+	template<typename Real, typename Coord>
+	COMM_FUNC bool BVH_RayBox(const BVHBox<Coord>& box, const Coord& o, const Coord& invDir, Real maxT)
+	{
+		Real t0 = Real(0);
+		Real t1 = maxT;
+		for (int d = 0; d < 3; d++)
+		{
+			Real tNear = (box.lo[d] - o[d])*invDir[d];
+			Real tFar = (box.hi[d] - o[d])*invDir[d];
+			if (tNear > tFar) { Real tmp = tNear; tNear = tFar; tFar = tmp; }
+			t0 = tNear > t0 ? tNear : t0;
+			t1 = tFar < t1 ? tFar : t1;
+			if (t0 > t1) return false;
+		}
+		return true;
+	}
+
+	COMM_FUNC inline unsigned int BVH_ExpandBits(unsigned int v)
+	{
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	template<typename Real, typename Coord>
+	COMM_FUNC inline unsigned int BVH_Morton(Coord p)
+	{
+		unsigned int code[3];
+		for (int d = 0; d < 3; d++)
+		{
+			Real v = p[d] * Real(1024);
+			v = v < Real(0) ? Real(0) : (v > Real(1023) ? Real(1023) : v);
+			code[d] = BVH_ExpandBits((unsigned int)v);
+		}
+		return code[0] * 4 + code[1] * 2 + code[2];
+	}
+
+	template<typename Coord, typename Triangle>
+	__global__ void BVH_ComputeTriangleBoxes(
+		DeviceArray<BVHBox<Coord>> boxes,
+		DeviceArray<Coord> points,
+		DeviceArray<Triangle> triangles)
+	{
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (tId >= triangles.size()) return;
+
+		Triangle t = triangles[tId];
+		BVHBox<Coord> box(points[t[0]], points[t[0]]);
+		box = box.merge(BVHBox<Coord>(points[t[1]], points[t[1]]));
+		box = box.merge(BVHBox<Coord>(points[t[2]], points[t[2]]));
+
+		boxes[tId] = box;
+	}
+
+	template<typename Real, typename Coord>
+	__global__ void BVH_ComputeMortonCodes(
+		DeviceArray<unsigned int> codes,
+		DeviceArray<int> ids,
+		DeviceArray<BVHBox<Coord>> boxes,
+		BVHBox<Coord> bound)
+	{
+		int tId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (tId >= codes.size()) return;
+
+		Coord center = (boxes[tId].lo + boxes[tId].hi)*Real(0.5);
+		Coord extent = bound.hi - bound.lo;
+		Coord p;
+		for (int d = 0; d < 3; d++)
+		{
+			p[d] = extent[d] > EPSILON ? (center[d] - bound.lo[d]) / extent[d] : Real(0.5);
+		}
+
+		codes[tId] = BVH_Morton<Real, Coord>(p);
+		ids[tId] = tId;
+	}
+
+	/*!
+	*	\brief	Length of the common prefix of two sorted keys, duplicated codes are distinguished by their indices.
+	*/
+	__device__ inline int BVH_Delta(DeviceArray<unsigned int>& codes, int n, int i, int j)
+	{
+		if (j < 0 || j >= n) return -1;
+
+		unsigned int a = codes[i];
+		unsigned int b = codes[j];
+		if (a == b) return 32 + __clz(i ^ j);
+
+		return __clz(a ^ b);
+	}
+
+	__global__ void BVH_BuildInternalNodes(
+		DeviceArray<int> left,
+		DeviceArray<int> right,
+		DeviceArray<int> parent,
+		DeviceArray<unsigned int> codes)
+	{
+		int i = threadIdx.x + (blockIdx.x * blockDim.x);
+		int n = codes.size();
+		if (i >= n - 1) return;
+
+		int d = BVH_Delta(codes, n, i, i + 1) - BVH_Delta(codes, n, i, i - 1) > 0 ? 1 : -1;
+
+		int dMin = BVH_Delta(codes, n, i, i - d);
+		int lMax = 2;
+		while (BVH_Delta(codes, n, i, i + lMax*d) > dMin) lMax *= 2;
+
+		int l = 0;
+		for (int t = lMax / 2; t >= 1; t /= 2)
+		{
+			if (BVH_Delta(codes, n, i, i + (l + t)*d) > dMin) l += t;
+		}
+		int j = i + l*d;
+
+		int dNode = BVH_Delta(codes, n, i, j);
+		int s = 0;
+		int div = 2;
+		int t = (l + div - 1) / div;
+		while (t >= 1)
+		{
+			if (BVH_Delta(codes, n, i, i + (s + t)*d) > dNode) s += t;
+			if (t == 1) break;
+			div *= 2;
+			t = (l + div - 1) / div;
+		}
+		int gamma = i + s*d + (d < 0 ? d : 0);
+
+		int first = i < j ? i : j;
+		int last = i < j ? j : i;
+
+		int lc = first == gamma ? n - 1 + gamma : gamma;
+		int rc = last == gamma + 1 ? n - 1 + gamma + 1 : gamma + 1;
+
+		left[i] = lc;
+		right[i] = rc;
+		parent[lc] = i;
+		parent[rc] = i;
+	}
+
+	/*!
+	*	\brief	Bottom-up box update, the second thread arriving at an internal node merges both children.
+	*/
+	template<typename Coord, typename Triangle>
+	__global__ void BVH_Refit(
+		DeviceArray<BVHBox<Coord>> boxes,
+		DeviceArray<int> flags,
+		DeviceArray<int> left,
+		DeviceArray<int> right,
+		DeviceArray<int> parent,
+		DeviceArray<int> leafTri,
+		DeviceArray<Coord> points,
+		DeviceArray<Triangle> triangles)
+	{
+		int lId = threadIdx.x + (blockIdx.x * blockDim.x);
+		int n = leafTri.size();
+		if (lId >= n) return;
+
+		Triangle t = triangles[leafTri[lId]];
+		BVHBox<Coord> box(points[t[0]], points[t[0]]);
+		box = box.merge(BVHBox<Coord>(points[t[1]], points[t[1]]));
+		box = box.merge(BVHBox<Coord>(points[t[2]], points[t[2]]));
+
+		int node = n - 1 + lId;
+		boxes[node] = box;
+
+		while (node != 0)
+		{
+			__threadfence();
+			node = parent[node];
+			if (atomicAdd(&flags[node], 1) == 0) return;
+
+			boxes[node] = boxes[left[node]].merge(boxes[right[node]]);
+		}
+	}
+
+	template<typename Real, typename Coord, typename Triangle>
+	__global__ void BVH_QueryClosestPoint(
+		DeviceArray<int> triIds,
+		DeviceArray<Coord> closest,
+		DeviceArray<Coord> queries,
+		DeviceArray<BVHBox<Coord>> boxes,
+		DeviceArray<int> left,
+		DeviceArray<int> right,
+		DeviceArray<int> leafTri,
+		DeviceArray<int> overflow,
+		DeviceArray<Coord> points,
+		DeviceArray<Triangle> triangles,
+		Real maxDist)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= queries.size()) return;
+
+		int n = leafTri.size();
+		Coord p = queries[pId];
+		Real best = maxDist*maxDist;
+		int bestTri = -1;
+		Coord bestPoint = p;
+
+		int stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			int node = stack[--top];
+			if (BVH_BoxDistanceSquared<Real, Coord>(boxes[node], p) > best) continue;
+
+			if (node >= n - 1)
+			{
+				int tri = leafTri[node - n + 1];
+				Triangle t = triangles[tri];
+				Coord q = BVH_ClosestPointOnTriangle<Real, Coord>(p, points[t[0]], points[t[1]], points[t[2]]);
+				Real d2 = (q - p).normSquared();
+				if (d2 <= best)
+				{
+					best = d2;
+					bestTri = tri;
+					bestPoint = q;
+				}
+			}
+			else if (top < BVH_STACK_SIZE - 1)
+			{
+				int lc = left[node];
+				int rc = right[node];
+				bool lFirst = BVH_BoxDistanceSquared<Real, Coord>(boxes[lc], p) < BVH_BoxDistanceSquared<Real, Coord>(boxes[rc], p);
+				stack[top++] = lFirst ? rc : lc;
+				stack[top++] = lFirst ? lc : rc;
+			}
+			else
+			{
+				overflow[0] = 1;
+			}
+		}
+
+		triIds[pId] = bestTri;
+		closest[pId] = bestPoint;
+	}
+
+	template<typename Coord>
+	__global__ void BVH_QueryOverlap(
+		NeighborList<int> triIds,
+		DeviceArray<int> count,
+		DeviceArray<BVHBox<Coord>> queries,
+		DeviceArray<BVHBox<Coord>> boxes,
+		DeviceArray<int> left,
+		DeviceArray<int> right,
+		DeviceArray<int> leafTri,
+		DeviceArray<int> overflow,
+		bool countOnly)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= queries.size()) return;
+
+		int n = leafTri.size();
+		BVHBox<Coord> q = queries[pId];
+		int num = 0;
+
+		int stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			int node = stack[--top];
+			if (!boxes[node].overlaps(q)) continue;
+
+			if (node >= n - 1)
+			{
+				if (!countOnly)
+					triIds.setElement(pId, num, leafTri[node - n + 1]);
+				num++;
+			}
+			else if (top < BVH_STACK_SIZE - 1)
+			{
+				stack[top++] = right[node];
+				stack[top++] = left[node];
+			}
+			else
+			{
+				overflow[0] = 1;
+			}
+		}
+
+		if (countOnly)
+			count[pId] = num;
+	}
+
+	template<typename Real, typename Coord, typename Triangle>
+	__global__ void BVH_QueryRay(
+		DeviceArray<int> triIds,
+		DeviceArray<Real> hitT,
+		DeviceArray<Coord> origins,
+		DeviceArray<Coord> directions,
+		DeviceArray<BVHBox<Coord>> boxes,
+		DeviceArray<int> left,
+		DeviceArray<int> right,
+		DeviceArray<int> leafTri,
+		DeviceArray<int> overflow,
+		DeviceArray<Coord> points,
+		DeviceArray<Triangle> triangles,
+		Real maxT)
+	{
+		int pId = threadIdx.x + (blockIdx.x * blockDim.x);
+		if (pId >= origins.size()) return;
+
+		int n = leafTri.size();
+		Coord o = origins[pId];
+		Coord dir = directions[pId];
+		Coord invDir;
+		for (int d = 0; d < 3; d++)
+		{
+			invDir[d] = abs(dir[d]) > EPSILON ? Real(1) / dir[d] : (dir[d] < Real(0) ? Real(-1) : Real(1)) / EPSILON;
+		}
+
+		Real best = maxT;
+		int bestTri = -1;
+
+		int stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			int node = stack[--top];
+			if (!BVH_RayBox<Real, Coord>(boxes[node], o, invDir, best)) continue;
+
+			if (node >= n - 1)
+			{
+				int tri = leafTri[node - n + 1];
+				Triangle t = triangles[tri];
+				Real tHit = BVH_RayTriangle<Real, Coord>(o, dir, points[t[0]], points[t[1]], points[t[2]]);
+				if (tHit >= Real(0) && tHit <= best)
+				{
+					best = tHit;
+					bestTri = tri;
+				}
+			}
+			else if (top < BVH_STACK_SIZE - 1)
+			{
+				stack[top++] = right[node];
+				stack[top++] = left[node];
+			}
+			else
+			{
+				overflow[0] = 1;
+			}
+		}
+
+		triIds[pId] = bestTri;
+		hitT[pId] = bestTri >= 0 ? best : maxT;
+	}
+
+	template<typename TDataType>
+	TriangleBVH<TDataType>::TriangleBVH()
+	{
+	}
+
+	template<typename TDataType>
+	TriangleBVH<TDataType>::~TriangleBVH()
+	{
+		release();
+	}
+
+	template<typename TDataType>
+	void TriangleBVH<TDataType>::construct(DeviceArray<Coord>& points, DeviceArray<Triangle>& triangles)
+	{
+		int n = triangles.size();
+		if (n <= 0) return;
+
+		if (m_triNum != n)
+		{
+			m_triNum = n;
+			m_boxes.resize(2 * n - 1);
+			m_left.resize(2 * n - 1);
+			m_right.resize(2 * n - 1);
+			m_parent.resize(2 * n - 1);
+			m_flags.resize(2 * n - 1);
+			m_leafTri.resize(n);
+			m_codes.resize(n);
+		}
+
+		if (m_overflow.size() != 1)
+		{
+			m_overflow.resize(1);
+		}
+
+		cuint pDims = cudaGridSize(n, BLOCK_SIZE);
+
+		BVH_ComputeTriangleBoxes << <pDims, BLOCK_SIZE >> > (m_boxes, points, triangles);
+		cuSynchronize();
+
+		Box bound = thrust::reduce(thrust::device, m_boxes.getDataPtr(), m_boxes.getDataPtr() + n, Box(Coord(std::numeric_limits<Real>::max()), Coord(-std::numeric_limits<Real>::max())), BVH_MergeBox<Coord>());
+
+		BVH_ComputeMortonCodes<Real, Coord> << <pDims, BLOCK_SIZE >> > (m_codes, m_leafTri, m_boxes, bound);
+		cuSynchronize();
+
+		thrust::sort_by_key(thrust::device, m_codes.getDataPtr(), m_codes.getDataPtr() + n, m_leafTri.getDataPtr());
+
+		if (n > 1)
+		{
+			BVH_BuildInternalNodes << <cudaGridSize(n - 1, BLOCK_SIZE), BLOCK_SIZE >> > (m_left, m_right, m_parent, m_codes);
+			cuSynchronize();
+		}
+
+		refit(points, triangles);
+	}
+
+	template<typename TDataType>
+	void TriangleBVH<TDataType>::refit(DeviceArray<Coord>& points, DeviceArray<Triangle>& triangles)
+	{
+		if (m_triNum <= 0) return;
+
+		m_flags.reset();
+
+		cuint pDims = cudaGridSize(m_triNum, BLOCK_SIZE);
+		BVH_Refit << <pDims, BLOCK_SIZE >> > (m_boxes, m_flags, m_left, m_right, m_parent, m_leafTri, points, triangles);
+		cuSynchronize();
+	}
+
+	template<typename TDataType>
+	void TriangleBVH<TDataType>::queryClosestPoint(
+		DeviceArray<int>& triIds,
+		DeviceArray<Coord>& closest,
+		DeviceArray<Coord>& queries,
+		DeviceArray<Coord>& points,
+		DeviceArray<Triangle>& triangles,
+		Real maxDist)
+	{
+		if (m_triNum <= 0) return;
+
+		m_overflow.reset();
+
+		cuint pDims = cudaGridSize(queries.size(), BLOCK_SIZE);
+		BVH_QueryClosestPoint << <pDims, BLOCK_SIZE >> > (
+			triIds,
+			closest,
+			queries,
+			m_boxes,
+			m_left,
+			m_right,
+			m_leafTri,
+			m_overflow,
+			points,
+			triangles,
+			maxDist);
+		cuSynchronize();
+
+		checkOverflow("queryClosestPoint");
+	}
+
+	template<typename TDataType>
+	void TriangleBVH<TDataType>::queryOverlap(NeighborList<int>& triIds, DeviceArray<Box>& queries)
+	{
+		int num = queries.size();
+		if (m_triNum <= 0 || num <= 0) return;
+
+		m_overflow.reset();
+
+		if (triIds.size() != num)
+		{
+			triIds.resize(num);
+		}
+
+		DeviceArray<int>& index = triIds.getIndex();
+
+		cuint pDims = cudaGridSize(num, BLOCK_SIZE);
+		BVH_QueryOverlap << <pDims, BLOCK_SIZE >> > (triIds, index, queries, m_boxes, m_left, m_right, m_leafTri, m_overflow, true);
+		cuSynchronize();
+
+		int sum = thrust::reduce(thrust::device, index.getDataPtr(), index.getDataPtr() + index.size(), (int)0, thrust::plus<int>());
+		thrust::exclusive_scan(thrust::device, index.getDataPtr(), index.getDataPtr() + index.size(), index.getDataPtr());
+
+		if (sum > 0)
+		{
+			DeviceArray<int>& elements = triIds.getElements();
+			if (elements.size() != sum)
+			{
+				elements.resize(sum);
+			}
+
+			BVH_QueryOverlap << <pDims, BLOCK_SIZE >> > (triIds, index, queries, m_boxes, m_left, m_right, m_leafTri, m_overflow, false);
+			cuSynchronize();
+		}
+		else
+		{
+			triIds.getElements().release();
+		}
+
+		checkOverflow("queryOverlap");
+	}
+
+	template<typename TDataType>
+	void TriangleBVH<TDataType>::queryRay(
+		DeviceArray<int>& triIds,
+		DeviceArray<Real>& hitT,
+		DeviceArray<Coord>& origins,
+		DeviceArray<Coord>& directions,
+		DeviceArray<Coord>& points,
+		DeviceArray<Triangle>& triangles,
+		Real maxT)
+	{
+		if (m_triNum <= 0) return;
+
+		m_overflow.reset();
+
+		cuint pDims = cudaGridSize(origins.size(), BLOCK_SIZE);
+		BVH_QueryRay << <pDims, BLOCK_SIZE >> > (
+			triIds,
+			hitT,
+			origins,
+			directions,
+			m_boxes,
+			m_left,
+			m_right,
+			m_leafTri,
+			m_overflow,
+			points,
+			triangles,
+			maxT);
+		cuSynchronize();
+
+		checkOverflow("queryRay");
+	}
+
+	template<typename TDataType>
+	void TriangleBVH<TDataType>::release()
+	{
+		m_boxes.release();
+		m_left.release();
+		m_right.release();
+		m_parent.release();
+		m_leafTri.release();
+		m_flags.release();
+		m_codes.release();
+		m_overflow.release();
+		m_triNum = 0;
+	}
+
+	template<typename TDataType>
+	bool TriangleBVH<TDataType>::checkOverflow(std::string query)
+	{
+		int overflow = 0;
+		cudaMemcpy(&overflow, m_overflow.getDataPtr(), sizeof(int), cudaMemcpyDeviceToHost);
+		if (overflow != 0)
+		{
+			Log::sendMessage(Log::Error, std::string("TriangleBVH::") + query + std::string(": traversal stack overflow, subtrees were skipped and results are incomplete!"));
+			return false;
+		}
+		return true;
+	}
+}
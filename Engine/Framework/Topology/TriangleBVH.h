@@ -0,0 +1,128 @@
+#pragma once
+#include "Core/DataTypes.h"
+#include "Core/Platform.h"
+#include "Core/Array/Array.h"
+#include "Framework/Framework/ModuleTopology.h"
+#include "Framework/Topology/NeighborList.h"
+
+namespace Physika
+{
+	template<typename Coord>
+	class BVHBox
+	{
+	public:
+		COMM_FUNC BVHBox() {};
+		COMM_FUNC BVHBox(Coord l, Coord u) : lo(l), hi(u) {};
+
+		COMM_FUNC BVHBox merge(const BVHBox& box) const
+		{
+			BVHBox ret;
+			for (int d = 0; d < 3; d++)
+			{
+				ret.lo[d] = lo[d] < box.lo[d] ? lo[d] : box.lo[d];
+				ret.hi[d] = hi[d] > box.hi[d] ? hi[d] : box.hi[d];
+			}
+			return ret;
+		}
+
+		COMM_FUNC bool overlaps(const BVHBox& box) const
+		{
+			for (int d = 0; d < 3; d++)
+			{
+				if (hi[d] < box.lo[d] || lo[d] > box.hi[d])
+					return false;
+			}
+			return true;
+		}
+
+		Coord lo;
+		Coord hi;
+	};
+
+	/*!
+	*	\class	TriangleBVH
+	*	\brief	A linear bounding volume hierarchy over a triangle mesh.
+	*
+	*	The hierarchy is built in parallel from Morton codes of triangle centroids, see
+	*	Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees", HPG 2012.
+	*	Node 0 is always the root, nodes [0, n - 1) are internal nodes and nodes [n - 1, 2n - 1) are leaves.
+	*
+	*	For deforming meshes with a fixed connectivity, refit() updates all bounding boxes bottom-up in O(n)
+	*	without touching the tree topology.
+	*/
+	template<typename TDataType>
+	class TriangleBVH
+	{
+	public:
+		typedef typename TDataType::Real Real;
+		typedef typename TDataType::Coord Coord;
+		typedef typename TopologyModule::Triangle Triangle;
+		typedef BVHBox<Coord> Box;
+
+		TriangleBVH();
+		~TriangleBVH();
+
+		void construct(DeviceArray<Coord>& points, DeviceArray<Triangle>& triangles);
+
+		/*!
+		*	\brief	Recompute bounding boxes for the current vertex positions, the triangles must be the ones passed to construct().
+		*/
+		void refit(DeviceArray<Coord>& points, DeviceArray<Triangle>& triangles);
+
+		/*!
+		*	\brief	For each query point, find the closest point on the mesh within maxDist.
+		*			triIds is set to -1 if no triangle is found.
+		*/
+		void queryClosestPoint(
+			DeviceArray<int>& triIds,
+			DeviceArray<Coord>& closest,
+			DeviceArray<Coord>& queries,
+			DeviceArray<Coord>& points,
+			DeviceArray<Triangle>& triangles,
+			Real maxDist);
+
+		/*!
+		*	\brief	For each query box, collect ids of triangles whose bounding boxes overlap it.
+		*/
+		void queryOverlap(NeighborList<int>& triIds, DeviceArray<Box>& queries);
+
+		/*!
+		*	\brief	For each ray, find the nearest hit with a parameter in [0, maxT].
+		*			triIds is set to -1 for rays that miss the mesh.
+		*/
+		void queryRay(
+			DeviceArray<int>& triIds,
+			DeviceArray<Real>& hitT,
+			DeviceArray<Coord>& origins,
+			DeviceArray<Coord>& directions,
+			DeviceArray<Coord>& points,
+			DeviceArray<Triangle>& triangles,
+			Real maxT);
+
+		int getTriangleNum() { return m_triNum; }
+
+		void release();
+
+	private:
+		/// Report queries whose traversal ran out of stack, which only happens for degenerate, very deep trees
+		bool checkOverflow(std::string query);
+
+		int m_triNum = 0;
+
+		DeviceArray<Box> m_boxes;
+		DeviceArray<int> m_left;
+		DeviceArray<int> m_right;
+		DeviceArray<int> m_parent;
+		DeviceArray<int> m_leafTri;
+		DeviceArray<int> m_flags;
+		DeviceArray<unsigned int> m_codes;
+		/// Set by a query kernel that had to skip a subtree
+		DeviceArray<int> m_overflow;
+	};
+
+#ifdef PRECISION_FLOAT
+	template class TriangleBVH<DataType3f>;
+#else
+	template class TriangleBVH<DataType3d>;
+#endif
+}
@@ -2,6 +2,7 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <set>
 #include "Core/Utility.h"
 
 namespace Physika
@@ -43,9 +44,90 @@ namespace Physika
 	template<typename TDataType>
 	void TriangleSet<TDataType>::updatePointNeighbors()
 	{
+		int num = this->m_coords.size();
+		if (num <= 0 || m_triangls.size() <= 0)
+			return;
 
+		//The connectivity rarely changes, so the one-ring of each vertex is collected on the host
+		HostArray<Triangle> triangles(m_triangls.size());
+		Function1Pt::copy(triangles, m_triangls);
+
+		std::vector<std::set<int>> rings(num);
+		for (int t = 0; t < triangles.size(); t++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					if (i != j)
+						rings[triangles[t][i]].insert(triangles[t][j]);
+				}
+			}
+		}
+		triangles.release();
+
+		std::vector<int> index(num);
+		std::vector<int> elements;
+		for (int i = 0; i < num; i++)
+		{
+			index[i] = elements.size();
+			elements.insert(elements.end(), rings[i].begin(), rings[i].end());
+		}
+
+		this->m_pointNeighbors.resize(num);
+		Function1Pt::copy(this->m_pointNeighbors.getIndex(), index);
+
+		DeviceArray<int>& nbrs = this->m_pointNeighbors.getElements();
+		if (elements.size() > 0)
+		{
+			nbrs.resize(elements.size());
+			Function1Pt::copy(nbrs, elements);
+		}
+		else
+		{
+			nbrs.release();
+		}
 	}
 
+	template<typename TDataType>
+	bool TriangleSet<TDataType>::updateTopology()
+	{
+		if (m_bvh != nullptr)
+		{
+			updateBVH();
+		}
+		return true;
+	}
+
+	template<typename TDataType>
+	TriangleBVH<TDataType>* TriangleSet<TDataType>::getBVH()
+	{
+		if (m_bvh == nullptr || m_bvh->getTriangleNum() != m_triangls.size())
+		{
+			updateBVH(true);
+		}
+		return m_bvh.get();
+	}
+
+
+	template<typename TDataType>
+	void TriangleSet<TDataType>::updateBVH(bool rebuild)
+	{
+		if (m_bvh == nullptr)
+		{
+			m_bvh = std::make_shared<TriangleBVH<TDataType>>();
+			rebuild = true;
+		}
+
+		if (rebuild || m_bvh->getTriangleNum() != m_triangls.size())
+		{
+			m_bvh->construct(this->m_coords, m_triangls);
+		}
+		else
+		{
+			m_bvh->refit(this->m_coords, m_triangls);
+		}
+	}
 
 	template<typename TDataType>
 	bool TriangleSet<TDataType>::initializeImpl()
@@ -60,6 +142,14 @@ namespace Physika
 	{
 		m_triangls.resize(triangles.size());
 		Function1Pt::copy(m_triangls, triangles);
+
+		//The tree is rebuilt for the new connectivity on the next request
+		if (m_bvh != nullptr)
+		{
+			m_bvh->release();
+		}
+
+		this->tagAsChanged();
 	}
 
 	template<typename TDataType>
@@ -1,5 +1,6 @@
 #pragma once
 #include "EdgeSet.h"
+#include "TriangleBVH.h"
 #include "Framework/ModuleTopology.h"
 
 
@@ -21,8 +22,27 @@ namespace Physika
 
 		NeighborList<int>* getTriangleNeighbors() { return &m_triangleNeighbors; }
 
+		/*!
+		*	\brief	Neighbors of a vertex are the vertices sharing a triangle with it.
+		*/
 		void updatePointNeighbors() override;
 
+		/*!
+		*	\brief	Refit the BVH to the current points, called by the mappings that move the points.
+		*			Nothing is done until the BVH has been requested by getBVH().
+		*/
+		bool updateTopology() override;
+
+		/*!
+		*	\brief	Build the BVH on the first call or when the triangles change, otherwise refit it to the current points.
+		*/
+		void updateBVH(bool rebuild = false);
+
+		/*!
+		*	\brief	The BVH is built on the first request and kept up to date afterwards, see updateTopology().
+		*/
+		TriangleBVH<TDataType>* getBVH();
+
 		void loadObjFile(std::string filename);
 
 	protected:
@@ -31,6 +51,8 @@ namespace Physika
 	protected:
 		DeviceArray<Triangle> m_triangls;
 		NeighborList<int> m_triangleNeighbors;
+
+		std::shared_ptr<TriangleBVH<TDataType>> m_bvh;
 	};
 
 #ifdef PRECISION_FLOAT
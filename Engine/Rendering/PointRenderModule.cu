@@ -172,6 +172,13 @@ namespace Physika
 
 		DeviceArray<float3>* xyz = (DeviceArray<float3>*)&(pSet->getPoints());
 
+		//The particle number changes with emitters and sinks
+		if (m_colorArray.size() != xyz->size())
+		{
+			m_pointRender->resize(xyz->size());
+			m_colorArray.resize(xyz->size());
+		}
+
 		if (!m_vecIndex.isEmpty())
 		{
 			uint pDims = cudaGridSize(xyz->size(), BLOCK_SIZE);
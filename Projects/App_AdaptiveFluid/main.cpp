@@ -0,0 +1,83 @@
+#include <iostream>
+#include <memory>
+#include <cuda.h>
+#include <cuda_runtime_api.h>
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+#include "GUI/GlutGUI/GLApp.h"
+
+#include "Framework/Framework/SceneGraph.h"
+#include "Framework/Framework/Log.h"
+
+#include "Dynamics/ParticleSystem/ParticleFluid.h"
+#include "Dynamics/ParticleSystem/StaticBoundary.h"
+#include "Dynamics/ParticleSystem/PositionBasedFluidModel.h"
+#include "Dynamics/ParticleSystem/BoundaryParticles.h"
+
+using namespace std;
+using namespace Physika;
+
+
+void RecieveLogMessage(const Log::Message& m)
+{
+	switch (m.type)
+	{
+	case Log::Info:
+		cout << ">>>: " << m.text << endl; break;
+	case Log::Warning:
+		cout << "???: " << m.text << endl; break;
+	case Log::Error:
+		cout << "!!!: " << m.text << endl; break;
+	case Log::User:
+		cout << ">>>: " << m.text << endl; break;
+	default: break;
+	}
+}
+
+/*
+*	Fluid in a box with adaptive resolution: particles near the free surface and the walls stay at the finest level,
+*	particles in the interior merge up to four times the initial mass.
+*/
+void CreateScene()
+{
+	SceneGraph& scene = SceneGraph::getInstance();
+
+	std::shared_ptr<StaticBoundary<DataType3f>> root = scene.createNewScene<StaticBoundary<DataType3f>>();
+	root->loadCube(Vector3f(0), Vector3f(1), true);
+
+	std::shared_ptr<ParticleFluid<DataType3f>> child1 = std::make_shared<ParticleFluid<DataType3f>>();
+	root->addParticleSystem(child1);
+	child1->getRenderModule()->setColor(Vector3f(1, 0, 0));
+	child1->loadParticles("../Media/fluid/fluid_point.obj");
+	child1->setMass(100);
+	child1->getRenderModule()->setColorRange(0, 2);
+
+	//The walls are sampled for the density solver, the adaptivity keeps particles next to the samples fine
+	std::shared_ptr<BoundaryParticles<DataType3f>> walls = std::make_shared<BoundaryParticles<DataType3f>>();
+	walls->sampleBox(Vector3f(0), Vector3f(1));
+
+	auto pbf = std::dynamic_pointer_cast<PositionBasedFluidModel<DataType3f>>(child1->getNumericalModel());
+	pbf->setBoundaryParticles(walls);
+
+	child1->enableAdaptiveResolution(2);
+	child1->setAdaptiveTimeStep(true);
+}
+
+int main()
+{
+	CreateScene();
+
+	Log::setOutput("console_log.txt");
+	Log::setLevel(Log::Info);
+	Log::setUserReceiver(&RecieveLogMessage);
+	Log::sendMessage(Log::Info, "Simulation begin");
+
+	GLApp window;
+	window.createWindow(1024, 768);
+
+	window.mainLoop();
+
+	Log::sendMessage(Log::Info, "Simulation end!");
+	return 0;
+}
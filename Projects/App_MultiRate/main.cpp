@@ -0,0 +1,84 @@
+#include <iostream>
+#include <memory>
+#include <cuda.h>
+#include <cuda_runtime_api.h>
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+#include "GUI/GlutGUI/GLApp.h"
+
+#include "Framework/Framework/SceneGraph.h"
+#include "Framework/Framework/Log.h"
+
+#include "Dynamics/ParticleSystem/ParticleFluid.h"
+#include "Dynamics/ParticleSystem/ParticleElasticBody.h"
+#include "Dynamics/ParticleSystem/StaticBoundary.h"
+
+using namespace std;
+using namespace Physika;
+
+
+void RecieveLogMessage(const Log::Message& m)
+{
+	switch (m.type)
+	{
+	case Log::Info:
+		cout << ">>>: " << m.text << endl; break;
+	case Log::Warning:
+		cout << "???: " << m.text << endl; break;
+	case Log::Error:
+		cout << "!!!: " << m.text << endl; break;
+	case Log::User:
+		cout << ">>>: " << m.text << endl; break;
+	default: break;
+	}
+}
+
+/*
+*	A fluid and an elastic bunny advanced at different rates: the fluid takes CFL steps of up to 0.005,
+*	the bunny keeps substeps of at most its own time step of 0.001 within each of them.
+*/
+void CreateScene()
+{
+	SceneGraph& scene = SceneGraph::getInstance();
+	scene.setMultiRate(true);
+
+	std::shared_ptr<StaticBoundary<DataType3f>> root = scene.createNewScene<StaticBoundary<DataType3f>>();
+	root->loadCube(Vector3f(0), Vector3f(1), true);
+
+	std::shared_ptr<ParticleFluid<DataType3f>> fluid = std::make_shared<ParticleFluid<DataType3f>>();
+	root->addParticleSystem(fluid);
+	fluid->getRenderModule()->setColor(Vector3f(1, 0, 0));
+	fluid->loadParticles("../Media/fluid/fluid_point.obj");
+	fluid->setMass(100);
+	fluid->getRenderModule()->setColorRange(0, 2);
+	fluid->setTimeStepBounds(0.0001f, 0.005f);
+
+	std::shared_ptr<ParticleElasticBody<DataType3f>> bunny = std::make_shared<ParticleElasticBody<DataType3f>>();
+	root->addParticleSystem(bunny);
+	bunny->getRenderModule()->setColor(Vector3f(0, 1, 1));
+	bunny->setMass(1.0);
+	bunny->loadParticles("../Media/bunny/bunny_points.obj");
+	bunny->loadSurface("../Media/bunny/bunny_mesh.obj");
+	bunny->translate(Vector3f(0.5, 0.2, 0.5));
+	bunny->setVisible(false);
+	bunny->setDt(0.001f);
+}
+
+int main()
+{
+	CreateScene();
+
+	Log::setOutput("console_log.txt");
+	Log::setLevel(Log::Info);
+	Log::setUserReceiver(&RecieveLogMessage);
+	Log::sendMessage(Log::Info, "Simulation begin");
+
+	GLApp window;
+	window.createWindow(1024, 768);
+
+	window.mainLoop();
+
+	Log::sendMessage(Log::Info, "Simulation end!");
+	return 0;
+}
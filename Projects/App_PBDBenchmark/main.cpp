@@ -0,0 +1,164 @@
+#include <iostream>
+#include <memory>
+#include <cuda.h>
+#include <cuda_runtime_api.h>
+
+#include "Framework/Framework/SceneGraph.h"
+#include "Framework/Framework/Log.h"
+#include "Framework/Topology/NeighborQuery.h"
+#include "Core/Utility.h"
+
+#include "Dynamics/ParticleSystem/ParticleFluid.h"
+#include "Dynamics/ParticleSystem/StaticBoundary.h"
+#include "Dynamics/ParticleSystem/DensityPBD.h"
+
+using namespace std;
+using namespace Physika;
+
+/*
+*	Compares iterations-to-tolerance and wall-clock time of the Jacobi and the colored Gauss-Seidel modes of DensityPBD.
+*	The fluid is compressed uniformly and the density constraint is solved with an increasing number of iterations
+*	until the maximum relative compression falls below the tolerance.
+*	Afterwards the same frames are simulated with and without deterministic mode to report its overhead per frame.
+*/
+
+#ifdef PRECISION_FLOAT
+typedef DataType3f TDataType;
+#else
+typedef DataType3d TDataType;
+#endif
+typedef TDataType::Coord Coord;
+
+const Real TOLERANCE = Real(0.01);
+const int MAX_ITERATION = 50;
+const Real COMPRESSION = Real(0.95);
+const int FRAME_NUMBER = 20;
+
+void RunSolver(std::shared_ptr<ParticleFluid<TDataType>> fluid, bool gaussSeidel)
+{
+	auto pbd = fluid->getModule<DensityPBD<TDataType>>("density_constraint");
+	auto nbrQuery = fluid->getModule<NeighborQuery<TDataType>>("neighborhood");
+
+	DeviceArray<Coord>& pos = fluid->getPosition()->getValue();
+	DeviceArray<Coord>& vel = fluid->getVelocity()->getValue();
+
+	DeviceArray<Coord> pos0(pos.size());
+	DeviceArray<Coord> vel0(vel.size());
+	Function1Pt::copy(pos0, pos);
+	Function1Pt::copy(vel0, vel);
+
+	pbd->setGaussSeidel(gaussSeidel);
+
+	cout << (gaussSeidel ? "Colored Gauss-Seidel" : "Jacobi") << endl;
+	cout << "iterations\terror\ttime(s)" << endl;
+
+	for (int n = 1; n <= MAX_ITERATION; n++)
+	{
+		Function1Pt::copy(pos, pos0);
+		Function1Pt::copy(vel, vel0);
+		nbrQuery->compute();
+
+		pbd->setIterationNumber(n);
+
+		CTimer timer;
+		timer.start();
+		pbd->constrain();
+		cudaDeviceSynchronize();
+		timer.stop();
+
+		Real err = pbd->computeDensityError();
+		cout << n << "\t" << err << "\t" << timer.getElapsedTime() << endl;
+
+		if (err < TOLERANCE)
+		{
+			cout << "Reached tolerance " << TOLERANCE << " after " << n << " iterations" << endl;
+			break;
+		}
+	}
+
+	Function1Pt::copy(pos, pos0);
+	Function1Pt::copy(vel, vel0);
+	pos0.release();
+	vel0.release();
+}
+
+void RunFrames(std::shared_ptr<ParticleFluid<TDataType>> fluid, bool deterministic)
+{
+	SceneGraph& scene = SceneGraph::getInstance();
+
+	DeviceArray<Coord>& pos = fluid->getPosition()->getValue();
+	DeviceArray<Coord>& vel = fluid->getVelocity()->getValue();
+
+	DeviceArray<Coord> pos0(pos.size());
+	DeviceArray<Coord> vel0(vel.size());
+	Function1Pt::copy(pos0, pos);
+	Function1Pt::copy(vel0, vel);
+
+	scene.setDeterministic(deterministic);
+	scene.setFrameTiming(true);
+
+	float total = 0.0f;
+	for (int i = 0; i < FRAME_NUMBER; i++)
+	{
+		scene.takeOneFrame();
+		total += scene.getTimeCostPerFrame();
+	}
+
+	scene.setFrameTiming(false);
+	scene.setDeterministic(false);
+
+	cout << (deterministic ? "Deterministic" : "Default") << " mode: " << total / FRAME_NUMBER << " ms per frame" << endl;
+
+	Function1Pt::copy(pos, pos0);
+	Function1Pt::copy(vel, vel0);
+	pos0.release();
+	vel0.release();
+}
+
+int main()
+{
+	SceneGraph& scene = SceneGraph::getInstance();
+
+	std::shared_ptr<StaticBoundary<TDataType>> root = scene.createNewScene<StaticBoundary<TDataType>>();
+	root->loadCube(Coord(0), Coord(1), true);
+
+	std::shared_ptr<ParticleFluid<TDataType>> fluid = std::make_shared<ParticleFluid<TDataType>>();
+	root->addParticleSystem(fluid);
+	fluid->loadParticles("../Media/fluid/fluid_point.obj");
+	fluid->setMass(100);
+
+	scene.initialize();
+
+	Log::sendMessage(Log::Info, "Settling the fluid");
+	for (int i = 0; i < 10; i++)
+	{
+		scene.takeOneFrame();
+	}
+
+	//Compress the fluid towards its lowest corner
+	DeviceArray<Coord>& pos = fluid->getPosition()->getValue();
+	HostArray<Coord> hPos(pos.size());
+	Function1Pt::copy(hPos, pos);
+
+	Coord lo = hPos[0];
+	for (int i = 1; i < hPos.size(); i++)
+	{
+		for (int d = 0; d < 3; d++)
+			lo[d] = min(lo[d], hPos[i][d]);
+	}
+	for (int i = 0; i < hPos.size(); i++)
+	{
+		hPos[i] = lo + (hPos[i] - lo)*COMPRESSION;
+	}
+
+	Function1Pt::copy(pos, hPos);
+	hPos.release();
+
+	RunSolver(fluid, false);
+	RunSolver(fluid, true);
+
+	RunFrames(fluid, false);
+	RunFrames(fluid, true);
+
+	return 0;
+}